@@ -0,0 +1,231 @@
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "address.h"
+
+/*
+ * function is_unix_address(): whether an address names a Unix socket path
+ * input:     address string.
+ * output:    true if it starts with UNIX_ADDRESS_PREFIX.
+ */
+bool is_unix_address(char *address) {
+    return strncmp(address, UNIX_ADDRESS_PREFIX,
+                   strlen(UNIX_ADDRESS_PREFIX)) == 0;
+}
+
+/*
+ * function unix_socket_address(): fill in the address of a Unix socket path
+ * input:     address with UNIX_ADDRESS_PREFIX, structure to fill in.
+ * output:    1 on success, 0 if the path is empty or too long.
+ */
+int unix_socket_address(char *address, struct sockaddr_un *unix_addr) {
+    char *path = address + strlen(UNIX_ADDRESS_PREFIX);
+    memset(unix_addr, 0, sizeof(*unix_addr));
+    unix_addr->sun_family = AF_UNIX;
+    if (path[0] == '\0' || strlen(path) >= sizeof(unix_addr->sun_path)) {
+        fprintf(stderr, "Invalid socket path: %s\n", address);
+        return 0;
+    }
+    strcpy(unix_addr->sun_path, path);
+    return 1;
+}
+
+/*
+ * function connect_to_address(): connect a stream socket to a server
+ * algorithm: a unix: address connects to that socket path and ignores the
+ *   port. Otherwise resolve the host and port with getaddrinfo and try each
+ *   IPv6 or IPv4 result in turn until one connects.
+ * input:     host name, address literal or unix: path, and port.
+ * output:    socket file descriptor, -1 if no connection could be made.
+ */
+int connect_to_address(char *host, char *port) {
+    if (is_unix_address(host)) {
+        struct sockaddr_un unix_addr;
+        if (!unix_socket_address(host, &unix_addr)) {
+            return -1;
+        }
+        int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (sockfd == -1 || connect(sockfd, (struct sockaddr *)&unix_addr,
+                                    sizeof(unix_addr)) == -1) {
+            perror("connect");
+            if (sockfd != -1) {
+                close(sockfd);
+            }
+            return -1;
+        }
+        return sockfd;
+    }
+
+    struct addrinfo hints, *results;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int error = getaddrinfo(host, port, &hints, &results);
+    if (error != 0) {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(error));
+        return -1;
+    }
+
+    int sockfd = -1;
+    for (struct addrinfo *result = results; result != NULL;
+         result = result->ai_next) {
+        sockfd = socket(result->ai_family, result->ai_socktype,
+                        result->ai_protocol);
+        if (sockfd == -1) {
+            continue;
+        }
+        if (connect(sockfd, result->ai_addr, result->ai_addrlen) == 0) {
+            break;
+        }
+        close(sockfd);
+        sockfd = -1;
+    }
+    if (sockfd == -1) {
+        perror("connect");
+    }
+    freeaddrinfo(results);
+    return sockfd;
+}
+
+/*
+ * function listen_on_unix_path(): open a listening Unix domain socket
+ * algorithm: remove a socket left at the path by a server that did not
+ *   shut down cleanly, then bind and listen. Other files are left alone and
+ *   make the bind fail.
+ * input:     unix: address, listen backlog.
+ * output:    socket file descriptor, -1 on failure.
+ */
+int listen_on_unix_path(char *address, int backlog) {
+    struct sockaddr_un unix_addr;
+    if (!unix_socket_address(address, &unix_addr)) {
+        return -1;
+    }
+    struct stat info;
+    if (stat(unix_addr.sun_path, &info) == 0 && S_ISSOCK(info.st_mode)) {
+        unlink(unix_addr.sun_path);
+    }
+
+    int sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sockfd == -1 ||
+        bind(sockfd, (struct sockaddr *)&unix_addr, sizeof(unix_addr)) == -1 ||
+        listen(sockfd, backlog) == -1) {
+        perror(address);
+        if (sockfd != -1) {
+            close(sockfd);
+        }
+        return -1;
+    }
+    return sockfd;
+}
+
+/*
+ * function listen_on_address(): open a listening stream socket
+ * algorithm: addresses are unix:path, host, host:port, [ipv6] or
+ *   [ipv6]:port, where a missing port is the default one. The host is
+ *   resolved with getaddrinfo for binding and the first result is used. IPv6
+ *   listeners only take IPv6 connections, so one can share a port with an
+ *   IPv4 listener. With reuse_port several sockets may listen on the same
+ *   address and the kernel balances connections between them.
+ * input:     address, default port, whether to set SO_REUSEPORT, listen
+ *   backlog.
+ * output:    socket file descriptor, -1 on failure.
+ */
+int listen_on_address(char *address, int default_port, bool reuse_port,
+                      int backlog) {
+    if (is_unix_address(address)) {
+        return listen_on_unix_path(address, backlog);
+    }
+
+    // Split the host from the port, an IPv6 literal is bracketed as its
+    // address contains colons itself
+    char host[NI_MAXHOST];
+    char port[NI_MAXSERV];
+    snprintf(port, sizeof(port), "%d", default_port);
+    char *port_start = NULL;
+    if (address[0] == '[') {
+        char *end = strchr(address, ']');
+        if (end == NULL || (end[1] != '\0' && end[1] != ':') ||
+            end - address - 1 >= (long)sizeof(host)) {
+            fprintf(stderr, "Invalid address: %s\n", address);
+            return -1;
+        }
+        snprintf(host, end - address, "%s", address + 1);
+        port_start = end[1] == ':' ? end + 2 : NULL;
+    } else {
+        port_start = strchr(address, ':');
+        size_t host_len = port_start != NULL ? (size_t)(port_start - address)
+                                             : strlen(address);
+        if (host_len >= sizeof(host)) {
+            fprintf(stderr, "Invalid address: %s\n", address);
+            return -1;
+        }
+        snprintf(host, host_len + 1, "%s", address);
+        port_start = port_start != NULL ? port_start + 1 : NULL;
+    }
+    if (port_start != NULL) {
+        snprintf(port, sizeof(port), "%s", port_start);
+    }
+
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    int error = getaddrinfo(host[0] != '\0' ? host : NULL, port, &hints,
+                            &result);
+    if (error != 0) {
+        fprintf(stderr, "%s: %s\n", address, gai_strerror(error));
+        return -1;
+    }
+
+    int yes = 1;
+    int sockfd =
+        socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    bool ok =
+        sockfd != -1 &&
+        setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) == 0 &&
+        (!reuse_port ||
+         setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) ==
+             0) &&
+        (result->ai_family != AF_INET6 ||
+         setsockopt(sockfd, IPPROTO_IPV6, IPV6_V6ONLY, &yes, sizeof(yes)) ==
+             0) &&
+        bind(sockfd, result->ai_addr, result->ai_addrlen) == 0 &&
+        listen(sockfd, backlog) == 0;
+    if (!ok) {
+        perror(address);
+        if (sockfd != -1) {
+            close(sockfd);
+        }
+        sockfd = -1;
+    }
+    freeaddrinfo(result);
+    return sockfd;
+}
+
+/*
+ * function close_listener(): close a listening socket for good
+ * algorithm: a Unix domain socket's path is removed as well, so the next
+ *   server can bind it. Listeners handed to another server are not closed
+ *   this way.
+ * input:     listening socket file descriptor.
+ * output:    none.
+ */
+void close_listener(int sockfd) {
+    struct sockaddr_un unix_addr;
+    socklen_t len = sizeof(unix_addr);
+    if (getsockname(sockfd, (struct sockaddr *)&unix_addr, &len) == 0 &&
+        unix_addr.sun_family == AF_UNIX && unix_addr.sun_path[0] != '\0') {
+        unlink(unix_addr.sun_path);
+    }
+    close(sockfd);
+}
@@ -0,0 +1,12 @@
+// Addresses starting with this name the path of a Unix domain socket
+#define UNIX_ADDRESS_PREFIX "unix:"
+// Address listened on when none is configured
+#define DEFAULT_LISTEN_ADDRESS "0.0.0.0"
+// Most addresses a server can listen on
+#define MAX_LISTENERS 8
+
+bool is_unix_address(char *address);
+int connect_to_address(char *host, char *port);
+int listen_on_address(char *address, int default_port, bool reuse_port,
+                      int backlog);
+void close_listener(int sockfd);
@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "logger.h"
+#include "arena.h"
+
+// Totals across every arena, for the statistics printed at shutdown
+long arena_allocations = 0;
+long arena_blocks = 0;
+long arena_bytes = 0;
+
+/*
+ * function arena_alloc(): allocate memory from an arena
+ * algorithm: bump the offset of the newest block, taking a new block from
+ *   malloc (at least ARENA_BLOCK_BYTES) when it has no room left.
+ * input:     pointer to arena, number of bytes.
+ * output:    memory aligned to ARENA_ALIGNMENT, NULL if malloc failed.
+ */
+void *arena_alloc(Arena *arena, size_t bytes) {
+    bytes = (bytes + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    ArenaBlock *block = arena->blocks;
+    if (block == NULL || block->capacity - block->used < bytes) {
+        size_t capacity = bytes > ARENA_BLOCK_BYTES ? bytes : ARENA_BLOCK_BYTES;
+        block = malloc(sizeof(ArenaBlock) + capacity);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->used = 0;
+        block->capacity = capacity;
+        block->next = arena->blocks;
+        arena->blocks = block;
+        __atomic_fetch_add(&arena_blocks, 1, __ATOMIC_RELAXED);
+    }
+
+    void *memory = &block->data[block->used];
+    block->used += bytes;
+    __atomic_fetch_add(&arena_allocations, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&arena_bytes, bytes, __ATOMIC_RELAXED);
+    return memory;
+}
+
+/*
+ * function arena_release(): free everything allocated from an arena
+ * algorithm: free the block list, leaving the arena empty and reusable.
+ * input:     pointer to arena.
+ * output:    none.
+ */
+void arena_release(Arena *arena) {
+    while (arena->blocks != NULL) {
+        ArenaBlock *block = arena->blocks;
+        arena->blocks = block->next;
+        free(block);
+    }
+}
+
+/*
+ * function arena_footprint(): memory an arena holds from malloc
+ * input:     pointer to arena.
+ * output:    bytes of every block, headers included.
+ */
+size_t arena_footprint(Arena *arena) {
+    size_t bytes = 0;
+    for (ArenaBlock *block = arena->blocks; block != NULL;
+         block = block->next) {
+        bytes += sizeof(ArenaBlock) + block->capacity;
+    }
+    return bytes;
+}
+
+/*
+ * function print_arena_stats(): print the totals across every arena
+ * input:     none.
+ * output:    none.
+ */
+void print_arena_stats() {
+    log_message(LOG_LEVEL_INFO,
+                "Arenas: %ld allocations, %ld bytes, %ld blocks",
+                __atomic_load_n(&arena_allocations, __ATOMIC_RELAXED),
+                __atomic_load_n(&arena_bytes, __ATOMIC_RELAXED),
+                __atomic_load_n(&arena_blocks, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,23 @@
+// Smallest block an arena takes from malloc
+#define ARENA_BLOCK_BYTES 4096
+// Alignment of every allocation from an arena
+#define ARENA_ALIGNMENT 16
+
+// A block of memory handed out front to back
+typedef struct arena_block_t {
+    struct arena_block_t *next;
+    size_t used;
+    size_t capacity;
+    _Alignas(ARENA_ALIGNMENT) unsigned char data[];
+} ArenaBlock;
+
+// Bump allocator whose allocations are all released together, an arena with
+// no blocks is empty
+typedef struct arena_t {
+    ArenaBlock *blocks;
+} Arena;
+
+void *arena_alloc(Arena *arena, size_t bytes);
+void arena_release(Arena *arena);
+size_t arena_footprint(Arena *arena);
+void print_arena_stats();
@@ -0,0 +1,433 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common_constants.h"
+#include "minesweeper_logic.h"
+#include "probability.h"
+#include "server_io.h"
+#include "solver.h"
+#include "worker_pool.h"
+
+#define RANDOM_NUMBER_SEED 42
+#define DEFAULT_SAMPLES 200
+#define DEFAULT_WARMUP 20
+#define DEFAULT_BUDGET_MS 2000
+#define MIN_SAMPLES 10
+
+// A board configuration to run every benchmark against
+typedef struct bench_board_t {
+    int width;
+    int height;
+    double density;
+} BenchBoard;
+
+// State shared by the prepare and run steps of a benchmark
+typedef struct bench_case_t {
+    GameState game;
+    int row;
+    int column;
+    int sock;
+    Solver solver;
+    double *probabilities;
+} BenchCase;
+
+// A single benchmark: prepare runs untimed before each sample, run performs
+// the timed work and returns the number of operations it did
+typedef struct bench_op_t {
+    const char *name;
+    int batch;
+    void (*prepare)(BenchCase *bench);
+    int (*run)(BenchCase *bench, int batch);
+} BenchOp;
+
+// Summary of all samples collected for one benchmark
+typedef struct bench_result_t {
+    int samples;
+    double median_ns;
+    double p90_ns;
+    double p99_ns;
+    double median_cycles;
+} BenchResult;
+
+// Beginner, intermediate and expert boards plus a large board for flood fills
+BenchBoard boards[] = {
+    {9, 9, 0.05},    {9, 9, 0.12},     {9, 9, 0.20},    {16, 16, 0.05},
+    {16, 16, 0.156}, {16, 16, 0.25},   {30, 16, 0.05},  {30, 16, 0.206},
+    {30, 16, 0.25},  {100, 100, 0.02}, {100, 100, 0.1}, {100, 100, 0.2},
+};
+
+int perf_fd = -1;
+
+/*
+ * function now_ns(): read the monotonic clock
+ * algorithm: convert the timespec from clock_gettime to nanoseconds.
+ * input:     none.
+ * output:    current time in nanoseconds.
+ */
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * function open_cycle_counter(): open a hardware cycle counter for this thread
+ * algorithm: ask perf_event_open for CPU cycles including kernel time, and
+ *   retry user space only if the kernel ones are not permitted.
+ * input:     none.
+ * output:    none (perf_fd stays -1 when counters are unavailable).
+ */
+void open_cycle_counter() {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_hv = 1;
+
+    perf_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (perf_fd == -1) {
+        attr.exclude_kernel = 1;
+        perf_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    if (perf_fd == -1) {
+        fprintf(stderr, "perf_event_open unavailable (%s), cycles omitted\n",
+                strerror(errno));
+    }
+}
+
+/*
+ * function read_cycles(): read the current value of the cycle counter
+ * algorithm: read the 64 bit counter value from the perf file descriptor.
+ * input:     none.
+ * output:    cycle count, or 0 if counters are unavailable.
+ */
+uint64_t read_cycles() {
+    uint64_t count = 0;
+    if (perf_fd != -1 &&
+        read(perf_fd, &count, sizeof(count)) != sizeof(count)) {
+        count = 0;
+    }
+    return count;
+}
+
+/*
+ * function find_zero_tile(): find a tile that starts a flood fill
+ * algorithm: scan outwards from the centre for a tile with no adjacent mines
+ *   and no mine of its own, falling back to any safe tile.
+ * input:     benchmark case with a freshly generated board.
+ * output:    none (row and column of the case are set).
+ */
+void find_zero_tile(BenchCase *bench) {
+    GameState *game = &bench->game;
+    int fallback = -1;
+    int tiles = game->width * game->height;
+    int centre = (game->height / 2) * game->width + game->width / 2;
+
+    for (int i = 0; i < tiles; i++) {
+        int index = (centre + i) % tiles;
+        Tile *tile = &game->tiles[index];
+        if (tile->is_mine) {
+            continue;
+        }
+        if (tile->adjacent_mines == 0) {
+            fallback = index;
+            break;
+        }
+        if (fallback == -1) {
+            fallback = index;
+        }
+    }
+    bench->row = fallback / game->width;
+    bench->column = fallback % game->width;
+}
+
+// Starts a new game and places its mines as a first reveal in the centre would
+void generate_board(GameState *game) {
+    initialise_game(game);
+    place_first_click_mines(game, game->height / 2, game->width / 2);
+}
+
+void prepare_new_board(BenchCase *bench) { generate_board(&bench->game); }
+
+void prepare_flood(BenchCase *bench) {
+    generate_board(&bench->game);
+    find_zero_tile(bench);
+}
+
+void prepare_opened_board(BenchCase *bench) {
+    prepare_flood(bench);
+    search_tiles(&bench->game, bench->row, bench->column);
+}
+
+int run_generate(BenchCase *bench, int batch) {
+    for (int i = 0; i < batch; i++) {
+        generate_board(&bench->game);
+    }
+    return batch;
+}
+
+int run_search(BenchCase *bench, int batch) {
+    (void)batch;
+    search_tiles(&bench->game, bench->row, bench->column);
+    return 1;
+}
+
+int run_place_flag(BenchCase *bench, int batch) {
+    (void)batch;
+    GameState *game = &bench->game;
+    int tiles = game->width * game->height;
+    int ops = 0;
+
+    // Flag every mine but the last so the game is never won mid sample
+    for (int i = 0; i < tiles && game->mines_left > 1; i++) {
+        if (game->tiles[i].is_mine) {
+            place_flag(game, i / game->width, i % game->width);
+            ops++;
+        }
+    }
+    return ops;
+}
+
+int run_end_board(BenchCase *bench, int batch) {
+    for (int i = 0; i < batch; i++) {
+        update_end_board(&bench->game, i % 2 ? GAME_WON : GAME_LOST);
+    }
+    return batch;
+}
+
+int run_serialize(BenchCase *bench, int batch) {
+    for (int i = 0; i < batch; i++) {
+        send_revealed_game(&bench->game, bench->sock);
+    }
+    return batch;
+}
+
+int run_solve(BenchCase *bench, int batch) {
+    for (int i = 0; i < batch; i++) {
+        solve_board(&bench->solver, &bench->game);
+    }
+    return batch;
+}
+
+int run_probabilities(BenchCase *bench, int batch) {
+    for (int i = 0; i < batch; i++) {
+        mine_probabilities(&bench->game, bench->probabilities, 1000000);
+    }
+    return batch;
+}
+
+BenchOp ops[] = {
+    {"initialise_and_place", 8, prepare_new_board, run_generate},
+    {"search_tiles_flood", 1, prepare_flood, run_search},
+    {"place_flag", 1, prepare_new_board, run_place_flag},
+    {"update_end_board", 8, prepare_opened_board, run_end_board},
+    {"send_revealed_game", 2, prepare_opened_board, run_serialize},
+    {"solve_board", 4, prepare_opened_board, run_solve},
+    {"mine_probabilities", 1, prepare_opened_board, run_probabilities},
+};
+
+/*
+ * function drain_socket(): discard everything written to the bench socket
+ * algorithm: read from the peer end of the socket pair until it is closed,
+ *   so serialization never blocks on a full socket buffer.
+ * input:     pointer to the socket file descriptor.
+ * output:    none.
+ */
+void *drain_socket(void *data) {
+    int fd = *((int *)data);
+    char buffer[65536];
+    while (read(fd, buffer, sizeof(buffer)) > 0) {
+    }
+    return NULL;
+}
+
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+double percentile(double *sorted, int count, double fraction) {
+    int index = (int)(fraction * (count - 1) + 0.5);
+    return sorted[index];
+}
+
+/*
+ * function run_benchmark(): collect timing samples for one operation
+ * algorithm: run warmup samples that are discarded, then time samples until
+ *   the sample count or time budget is reached. Each sample is prepared
+ *   untimed, and its time and cycles are divided by the operations it did.
+ * input:     operation, benchmark case, sample/warmup counts and budget.
+ * output:    summary of the collected samples.
+ */
+BenchResult run_benchmark(BenchOp *op, BenchCase *bench, int samples,
+                          int warmup, uint64_t budget_ns) {
+    double *ns = malloc(sizeof(double) * samples);
+    double *cycles = malloc(sizeof(double) * samples);
+    int count = 0;
+    uint64_t deadline = now_ns() + budget_ns;
+
+    for (int i = 0; i < warmup + samples; i++) {
+        if (i >= warmup + MIN_SAMPLES && now_ns() > deadline) {
+            break;
+        }
+
+        op->prepare(bench);
+        uint64_t start_cycles = read_cycles();
+        uint64_t start = now_ns();
+        int done = op->run(bench, op->batch);
+        uint64_t end = now_ns();
+        uint64_t end_cycles = read_cycles();
+
+        if (i < warmup || done == 0) {
+            continue;
+        }
+        ns[count] = (double)(end - start) / done;
+        cycles[count] = (double)(end_cycles - start_cycles) / done;
+        count++;
+    }
+
+    BenchResult result;
+    memset(&result, 0, sizeof(result));
+    result.samples = count;
+    if (count > 0) {
+        qsort(ns, count, sizeof(double), compare_doubles);
+        qsort(cycles, count, sizeof(double), compare_doubles);
+        result.median_ns = percentile(ns, count, 0.5);
+        result.p90_ns = percentile(ns, count, 0.9);
+        result.p99_ns = percentile(ns, count, 0.99);
+        result.median_cycles = perf_fd != -1 ? percentile(cycles, count, 0.5)
+                                             : -1;
+    }
+
+    free(ns);
+    free(cycles);
+    return result;
+}
+
+/*
+ * function main(): entry point for the microbenchmarks
+ * algorithm: parse options, then run every operation on every board size and
+ *   density. Results are printed as a table and written as CSV.
+ * input:     command line arguments.
+ * output:    exit status.
+ */
+int main(int argc, char *argv[]) {
+    int samples = DEFAULT_SAMPLES;
+    int warmup = DEFAULT_WARMUP;
+    int budget_ms = DEFAULT_BUDGET_MS;
+    char *output_path = "bench_results.csv";
+    char *filter = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:w:t:o:f:")) != -1) {
+        if (opt == 's') {
+            samples = atoi(optarg);
+        } else if (opt == 'w') {
+            warmup = atoi(optarg);
+        } else if (opt == 't') {
+            budget_ms = atoi(optarg);
+        } else if (opt == 'o') {
+            output_path = optarg;
+        } else if (opt == 'f') {
+            filter = optarg;
+        } else {
+            fprintf(stderr,
+                    "usage: bench [-s samples] [-w warmup] [-t budget_ms] "
+                    "[-o output.csv] [-f name_filter]\n");
+            exit(1);
+        }
+    }
+    if (samples < MIN_SAMPLES) {
+        samples = MIN_SAMPLES;
+    }
+
+    FILE *output = fopen(output_path, "w");
+    if (!output) {
+        perror("bench output");
+        exit(1);
+    }
+    fprintf(output,
+            "op,width,height,mines,samples,median_ns,p90_ns,p99_ns,"
+            "median_cycles\n");
+
+    // Serialized boards are written to a socket pair drained by a thread
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == -1) {
+        perror("socketpair");
+        exit(1);
+    }
+    pthread_t drain_thread;
+    pthread_create(&drain_thread, NULL, drain_socket, &pair[1]);
+
+    srand(RANDOM_NUMBER_SEED);
+    open_cycle_counter();
+    worker_pool_start(sysconf(_SC_NPROCESSORS_ONLN));
+
+    printf("%-20s %9s %6s %10s %10s %10s %12s\n", "op", "board", "mines",
+           "median_ns", "p90_ns", "p99_ns", "cycles/op");
+
+    int num_boards = sizeof(boards) / sizeof(boards[0]);
+    int num_ops = sizeof(ops) / sizeof(ops[0]);
+    for (int b = 0; b < num_boards; b++) {
+        BenchBoard *board = &boards[b];
+        int mines = (int)(board->width * board->height * board->density + 0.5);
+        if (mines < 1) {
+            mines = 1;
+        }
+
+        BenchCase bench;
+        bench.sock = pair[0];
+        if (!create_game(&bench.game, board->width, board->height, mines)) {
+            fprintf(stderr, "invalid board %dx%d\n", board->width,
+                    board->height);
+            continue;
+        }
+        solver_init(&bench.solver);
+        bench.probabilities =
+            malloc(sizeof(double) * board->width * board->height);
+
+        for (int o = 0; o < num_ops; o++) {
+            if (filter && !strstr(ops[o].name, filter)) {
+                continue;
+            }
+            BenchResult result =
+                run_benchmark(&ops[o], &bench, samples, warmup,
+                              (uint64_t)budget_ms * 1000000ull);
+
+            char size[16];
+            snprintf(size, sizeof(size), "%dx%d", board->width, board->height);
+            printf("%-20s %9s %6d %10.0f %10.0f %10.0f %12.0f\n", ops[o].name,
+                   size, mines, result.median_ns, result.p90_ns,
+                   result.p99_ns, result.median_cycles);
+            fprintf(output, "%s,%d,%d,%d,%d,%.1f,%.1f,%.1f,%.1f\n",
+                    ops[o].name, board->width, board->height, mines,
+                    result.samples, result.median_ns, result.p90_ns,
+                    result.p99_ns, result.median_cycles);
+        }
+        destroy_game(&bench.game);
+        solver_free(&bench.solver);
+        free(bench.probabilities);
+    }
+
+    worker_pool_stop();
+    fclose(output);
+    shutdown(pair[0], SHUT_RDWR);
+    close(pair[0]);
+    pthread_join(drain_thread, NULL);
+    close(pair[1]);
+
+    printf("\nResults written to %s\n", output_path);
+    return 0;
+}
@@ -0,0 +1,506 @@
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common_constants.h"
+#include "minesweeper_logic.h"
+#include "address.h"
+#include "multiplex.h"
+#include "shm_ring.h"
+#include "solver.h"
+
+#define DEFAULT_GAMES 1000
+#define DEFAULT_CONCURRENT 64
+// Pause before sending again once the server turned requests away as over
+// its rate limit
+#define RATE_LIMITED_PAUSE_MS 50
+
+// A game the bot is playing, whether the server has opened it yet, the
+// number of replies it still waits for and the number still to come for the
+// game played before under its id
+typedef struct bot_game_t {
+    GameState game;
+    bool opened;
+    int outstanding;
+    int stale;
+} BotGame;
+
+// Totals over every game played
+int games_total = DEFAULT_GAMES;
+int games_started = 0;
+int games_won = 0;
+int games_lost = 0;
+long moves_sent = 0;
+// Requests turned away as over the rate limit, and whether any were since
+// the last pause
+long requests_limited = 0;
+bool rate_limited = false;
+unsigned int bot_seed = 42;
+Solver solver;
+// Segment shared with the server, NULL when playing over the socket
+ShmSegment *segment = NULL;
+
+int connect_to_server(char *host_arg, char *port_arg);
+int login(int sockfd, char *username, char *password);
+ShmSegment *request_shared_memory(int sockfd);
+int flush_requests(int sockfd, MuxBuffer *output);
+void queue_request(MuxBuffer *output, int id, int option, int row, int column);
+void open_game(MuxTable *games, MuxBuffer *output, int id);
+void handle_reply(MuxTable *games, MuxBuffer *output, int id, int type,
+                  unsigned char *payload);
+void plan_moves(BotGame *bot_game, int id, MuxBuffer *output);
+int receive_replies(int sockfd, MuxBuffer *input, MuxTable *games,
+                    MuxBuffer *output);
+
+/*
+ * function main(): entry point for the bot
+ * algorithm: log in, switch the connection to multiplexed games and keep a
+ *   number of games running at once until the requested number of games
+ *   were played. Replies are matched to their game by id, and every move the
+ *   solver finds for a game is sent without waiting for the replies. With
+ *   -m requests and replies go through shared memory instead when the
+ *   server offers it.
+ * input:     command line arguments.
+ * output:    none.
+ */
+int main(int argc, char *argv[]) {
+    int concurrent = DEFAULT_CONCURRENT;
+    int opt;
+    bool shared_memory = false;
+    while ((opt = getopt(argc, argv, "mn:c:")) != -1) {
+        if (opt == 'm') {
+            shared_memory = true;
+        } else if (opt == 'n') {
+            games_total = atoi(optarg);
+        } else if (opt == 'c') {
+            concurrent = atoi(optarg);
+        } else {
+            argc = -1;
+            break;
+        }
+    }
+    // A Unix socket path has no port
+    bool unix_socket = optind < argc && is_unix_address(argv[optind]);
+    int login_arg = unix_socket ? optind + 1 : optind + 2;
+    if (argc - login_arg != 2 || games_total <= 0 || concurrent <= 0 ||
+        concurrent > MUX_MAX_GAMES) {
+        fprintf(stderr, "usage: bot [-m] [-n games] [-c concurrent] hostname "
+                        "port_number username password\n"
+                        "       bot [-m] [-n games] [-c concurrent] "
+                        "unix:socket_path username password\n");
+        exit(1);
+    }
+    if (concurrent > games_total) {
+        concurrent = games_total;
+    }
+
+    int sockfd = connect_to_server(
+        argv[optind], unix_socket ? NULL : argv[optind + 1]);
+    if (!login(sockfd, argv[login_arg], argv[login_arg + 1])) {
+        printf("Login failed.\n");
+        close(sockfd);
+        return 1;
+    }
+
+    if (shared_memory) {
+        segment = request_shared_memory(sockfd);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    solver_init(&solver);
+    MuxTable *games = mux_table_create();
+    MuxBuffer input = {NULL, 0, 0};
+    MuxBuffer output = {NULL, 0, 0};
+    // Over the socket the selection goes out with the first requests
+    char selection = '6';
+    if (segment == NULL) {
+        unsigned char *at = mux_append(&output, sizeof(selection));
+        if (at == NULL) {
+            perror("Couldn't queue request.");
+            exit(1);
+        }
+        *at = selection;
+    }
+    for (int id = 0; id < concurrent; id++) {
+        open_game(games, &output, id);
+    }
+
+    while (games_won + games_lost < games_total) {
+        if (rate_limited) {
+            struct timespec pause = {0, RATE_LIMITED_PAUSE_MS * 1000000L};
+            nanosleep(&pause, NULL);
+            rate_limited = false;
+        }
+        if (!flush_requests(sockfd, &output) ||
+            !receive_replies(sockfd, &input, games, &output)) {
+            printf("Connection to server lost.\n");
+            exit(1);
+        }
+    }
+
+    // Leave multiplexed mode, then quit
+    queue_request(&output, 0, 'X', 0, 0);
+    int type;
+    do {
+        flush_requests(sockfd, &output);
+        type = receive_replies(sockfd, &input, games, &output);
+    } while (type != MUX_EXIT && type != 0);
+    selection = '3';
+    send(sockfd, &selection, sizeof(selection), 0);
+    close(sockfd);
+    if (segment != NULL) {
+        shm_segment_close(segment);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds =
+        (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%d games (%d won, %d lost) with %d at once in %.2f s\n",
+           games_total, games_won, games_lost, concurrent, seconds);
+    printf("%ld moves, %.0f moves/s, %.0f games/s\n", moves_sent,
+           moves_sent / seconds, games_total / seconds);
+    if (requests_limited > 0) {
+        printf("%ld requests over the server's rate limit\n",
+               requests_limited);
+    }
+
+    solver_free(&solver);
+    free(games);
+    mux_buffer_free(&input);
+    mux_buffer_free(&output);
+    return 0;
+}
+
+/*
+ * function connect_to_server(): connect to the server
+ * input:     host name, IPv4 or IPv6 address, or unix: socket path, and port
+ *   number (unused for a socket path).
+ * output:    socket file descriptor.
+ */
+int connect_to_server(char *host_arg, char *port_arg) {
+    int sockfd = connect_to_address(host_arg, port_arg);
+    if (sockfd == -1) {
+        exit(1);
+    }
+    return sockfd;
+}
+
+/*
+ * function login(): wait for a server thread and log in
+ * algorithm: wait for the go ahead, skipping the updates sent while the
+ *   connection is queued, then send the fixed length username and password
+ *   and read the response, and on success the session token. Exits if the
+ *   server is too busy to queue the connection.
+ * input:     socket file descriptor, username and password.
+ * output:    whether the login succeeded.
+ */
+int login(int sockfd, char *username, char *password) {
+    int value;
+    char usr[MAX_READ_LENGTH] = {0};
+    char pwd[MAX_READ_LENGTH] = {0};
+    strncpy(usr, username, MAX_READ_LENGTH - 1);
+    strncpy(pwd, password, MAX_READ_LENGTH - 1);
+
+    int update[2];
+    do {
+        if (recv(sockfd, &value, sizeof(value), MSG_WAITALL) !=
+            sizeof(value)) {
+            return 0;
+        }
+        // A queue update carries the place in the queue and the wait
+        if (ntohl(value) == QUEUE_POSITION &&
+            recv(sockfd, update, sizeof(update), MSG_WAITALL) !=
+                sizeof(update)) {
+            return 0;
+        }
+    } while (ntohl(value) == QUEUE_POSITION);
+    if (ntohl(value) == SERVER_BUSY) {
+        printf("The server is too busy right now, try again later.\n");
+        close(sockfd);
+        exit(0);
+    }
+    send(sockfd, usr, MAX_READ_LENGTH, 0);
+    send(sockfd, pwd, MAX_READ_LENGTH, 0);
+    if (recv(sockfd, &value, sizeof(value), MSG_WAITALL) != sizeof(value) ||
+        ntohl(value) != 1) {
+        return 0;
+    }
+    char token[MAX_READ_LENGTH];
+    return recv(sockfd, token, MAX_READ_LENGTH, MSG_WAITALL) ==
+           MAX_READ_LENGTH;
+}
+
+/*
+ * function request_shared_memory(): switch to the shared memory transport
+ * algorithm: ask for a segment and map the one named in the answer. The
+ *   connection stays in the menu if the server could not create one.
+ * input:     socket file descriptor.
+ * output:    pointer to the segment, NULL to carry on over the socket.
+ */
+ShmSegment *request_shared_memory(int sockfd) {
+    char selection = '7';
+    int value;
+    char name[MAX_READ_LENGTH];
+    send(sockfd, &selection, sizeof(selection), 0);
+    if (recv(sockfd, &value, sizeof(value), MSG_WAITALL) != sizeof(value) ||
+        ntohl(value) != SHM_READY ||
+        recv(sockfd, name, MAX_READ_LENGTH, MSG_WAITALL) != MAX_READ_LENGTH) {
+        printf("Shared memory unavailable, playing over the socket.\n");
+        return NULL;
+    }
+    name[MAX_READ_LENGTH - 1] = '\0';
+    ShmSegment *shared = shm_segment_open(name);
+    if (shared == NULL) {
+        perror("Couldn't map the shared memory segment");
+        // The server waits for requests in the segment, leave it at once
+        exit(1);
+    }
+    return shared;
+}
+
+/*
+ * function flush_requests(): send the queued requests
+ * algorithm: over shared memory write what fits in the request ring and
+ *   keep the rest queued. Waiting for space could stall both sides with
+ *   full rings, so the caller reads replies before flushing again.
+ * input:     socket file descriptor, output buffer.
+ * output:    1 on success, 0 if the connection was lost.
+ */
+int flush_requests(int sockfd, MuxBuffer *output) {
+    if (segment == NULL) {
+        if (!mux_flush(sockfd, output)) {
+            perror("Couldn't send buffered messages");
+            return 0;
+        }
+        return 1;
+    }
+    size_t written =
+        shm_ring_write(&segment->requests, output->data, output->len);
+    memmove(output->data, output->data + written, output->len - written);
+    output->len -= written;
+    return 1;
+}
+
+/*
+ * function queue_request(): append a request to the output buffer
+ * input:     output buffer, game id, option, row and column.
+ * output:    none.
+ */
+void queue_request(MuxBuffer *output, int id, int option, int row,
+                   int column) {
+    unsigned char *at = mux_append(output, MUX_REQUEST_BYTES);
+    if (at == NULL) {
+        perror("Couldn't queue request.");
+        exit(1);
+    }
+    mux_put_int(at, id);
+    mux_put_int(at + sizeof(int), option);
+    mux_put_int(at + 2 * sizeof(int), row);
+    mux_put_int(at + 3 * sizeof(int), column);
+}
+
+/*
+ * function open_game(): start a new game under an id
+ * algorithm: create the bot's record of the game on first use of the id and
+ *   ask the server to open a game for it.
+ * input:     table of games, output buffer, game id.
+ * output:    none.
+ */
+void open_game(MuxTable *games, MuxBuffer *output, int id) {
+    BotGame *bot_game = mux_find(games, id);
+    if (bot_game == NULL) {
+        bot_game = malloc(sizeof(BotGame));
+        bot_game->game.tiles = NULL;
+        bot_game->stale = 0;
+        mux_insert(games, id, bot_game);
+    }
+    bot_game->opened = false;
+    bot_game->outstanding = 1;
+    games_started++;
+    queue_request(output, id, 'O', 0, 0);
+}
+
+/*
+ * function handle_reply(): apply a reply to the game it belongs to
+ * algorithm: update the board from the packed tiles, which are read from
+ *   the game's board in the segment over shared memory. A board a later move
+ *   already replaced there is skipped, as that move's reply brings it. Once
+ *   a game ends count the result and reuse its id for the next game, if more
+ *   are wanted. Once every reply the game was waiting for arrived, plan its
+ *   next moves. Errors, and requests turned away as over the server's rate
+ *   limit, are counted off first as answers to moves that were already on
+ *   their way when the game played before under the id ended. Otherwise a
+ *   request turned away was not played: the open is sent again, and moves
+ *   are planned again from the board once the game's other replies are in,
+ *   after a pause.
+ * input:     table of games, output buffer, game id, reply type and payload.
+ * output:    none.
+ */
+void handle_reply(MuxTable *games, MuxBuffer *output, int id, int type,
+                  unsigned char *payload) {
+    BotGame *bot_game = mux_find(games, id);
+    if (bot_game != NULL && bot_game->stale > 0 &&
+        (type == MUX_ERROR || type == RATE_LIMITED)) {
+        bot_game->stale--;
+        return;
+    }
+    if (bot_game != NULL && type == RATE_LIMITED) {
+        requests_limited++;
+        rate_limited = true;
+        if (!bot_game->opened) {
+            queue_request(output, id, 'O', 0, 0);
+        } else if (--bot_game->outstanding == 0) {
+            plan_moves(bot_game, id, output);
+        }
+        return;
+    }
+    if (bot_game == NULL || type != MUX_BOARD) {
+        return;
+    }
+    bot_game->opened = true;
+
+    int response = mux_get_int(payload);
+    int width = mux_get_int(payload + 2 * sizeof(int));
+    int height = mux_get_int(payload + 3 * sizeof(int));
+    GameState *game = &bot_game->game;
+    if (game->tiles == NULL &&
+        !create_game(game, width, height, 0)) {
+        perror("Couldn't allocate board.");
+        exit(1);
+    }
+    unsigned char *bytes = payload + 5 * sizeof(int);
+    unsigned char shared[SHM_BOARD_BYTES];
+    bool current = true;
+    if (segment != NULL) {
+        unsigned int sequence = mux_get_int(payload + 5 * sizeof(int));
+        current = width * height <= SHM_BOARD_BYTES &&
+                  shm_board_read(&segment->boards[id], sequence, shared,
+                                 width * height);
+        bytes = shared;
+    }
+    for (int index = 0; current && index < width * height; index++) {
+        unpack_tile(&game->tiles[index], bytes[index]);
+    }
+    game->mines_left = mux_get_int(payload + sizeof(int));
+    bot_game->outstanding--;
+
+    if (response == GAME_WON || response == GAME_LOST) {
+        if (response == GAME_WON) {
+            games_won++;
+        } else {
+            games_lost++;
+        }
+        if (games_started < games_total) {
+            bot_game->stale += bot_game->outstanding;
+            open_game(games, output, id);
+        } else {
+            mux_remove(games, id);
+            destroy_game(game);
+            free(bot_game);
+        }
+    } else if (bot_game->outstanding == 0) {
+        plan_moves(bot_game, id, output);
+    }
+}
+
+/*
+ * function plan_moves(): queue the next moves of a game
+ * algorithm: flag every mine and reveal every safe tile the solver can
+ *   deduce, all at once. If nothing can be deduced reveal a random unknown
+ *   tile.
+ * input:     the game, its id and the output buffer.
+ * output:    none.
+ */
+void plan_moves(BotGame *bot_game, int id, MuxBuffer *output) {
+    GameState *game = &bot_game->game;
+    int queued = 0;
+    if (solve_board(&solver, game) > 0) {
+        for (int i = 0; i < solver.num_mines; i++) {
+            int index = solver.mine_tiles[i];
+            queue_request(output, id, 'P', index / game->width,
+                          index % game->width);
+            queued++;
+        }
+        for (int i = 0; i < solver.num_safe; i++) {
+            int index = solver.safe_tiles[i];
+            queue_request(output, id, 'R', index / game->width,
+                          index % game->width);
+            queued++;
+        }
+    }
+
+    if (queued == 0) {
+        int tiles = game->width * game->height;
+        int index;
+        do {
+            index = rand_r(&bot_seed) % tiles;
+        } while (game->tiles[index].revealed || game->tiles[index].flagged);
+        queue_request(output, id, 'R', index / game->width,
+                      index % game->width);
+        queued = 1;
+    }
+    bot_game->outstanding += queued;
+    moves_sent += queued;
+}
+
+/*
+ * function receive_replies(): read replies and hand each to its game
+ * algorithm: read whatever is available into the input buffer, from the
+ *   socket or the reply ring, then handle every complete reply and keep a
+ *   partial one for the next read. The ring is waited on for a while, then
+ *   the socket is checked in case the server went away.
+ * input:     socket file descriptor, input buffer, table of games and output
+ *   buffer.
+ * output:    type of the last reply handled, -1 if none was complete, 0 if
+ *   the connection was lost.
+ */
+int receive_replies(int sockfd, MuxBuffer *input, MuxTable *games,
+                    MuxBuffer *output) {
+    size_t used = input->len;
+    if (mux_append(input, MUX_FLUSH_BYTES) == NULL) {
+        return 0;
+    }
+    ssize_t received;
+    if (segment != NULL) {
+        received = shm_ring_read(&segment->replies, input->data + used,
+                                 input->capacity - used);
+        if (received == 0) {
+            input->len = used;
+            if (!shm_ring_wait_readable(&segment->replies, MUX_POLL_MS) &&
+                !shm_peer_connected(sockfd)) {
+                return 0;
+            }
+            return -1;
+        }
+    } else {
+        received = recv(sockfd, input->data + used, input->capacity - used, 0);
+    }
+    if (received <= 0) {
+        return 0;
+    }
+    input->len = used + received;
+
+    int last_type = -1;
+    size_t offset = 0;
+    while (input->len - offset >= MUX_HEADER_BYTES) {
+        unsigned char *message = input->data + offset;
+        int length = mux_get_int(message + 2 * sizeof(int));
+        if (input->len - offset < MUX_HEADER_BYTES + (size_t)length) {
+            break;
+        }
+        last_type = mux_get_int(message + sizeof(int));
+        handle_reply(games, output, mux_get_int(message), last_type,
+                     message + MUX_HEADER_BYTES);
+        offset += MUX_HEADER_BYTES + length;
+    }
+    memmove(input->data, input->data + offset, input->len - offset);
+    input->len -= offset;
+    return last_type;
+}
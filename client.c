@@ -1,19 +1,27 @@
 #include <errno.h>
-#include <netdb.h>
 #include <netinet/in.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include "minesweeper_logic.h"
+#include "address.h"
 
 #include "common_constants.h"
 
 #include "client.h"
 
+// Widest co-op board that is still printed in full
+#define COOP_PRINT_WIDTH 40
+
+// Token that lets this player pick their session up again after a disconnect
+char resume_token[MAX_READ_LENGTH] = "";
+
 /*
  * function main(): entry point for client
  * algorithm: checks whether sufficient command line arguments have
@@ -22,16 +30,31 @@
  * output:    none.
  */
 int main(int argc, char *argv[]) {
-    // Check if correct usage of program
-    if (argc != 3) {
-        fprintf(stderr, "usage: client_hostname port_number\n");
+    // Check if correct usage of program, a Unix socket path has no port
+    int token_arg = argc > 1 && is_unix_address(argv[1]) ? 2 : 3;
+    if (argc != token_arg && argc != token_arg + 1) {
+        fprintf(stderr, "usage: client hostname port_number [resume_token]\n"
+                        "       client unix:socket_path [resume_token]\n");
         exit(1);
     }
 
     // Create socket connection and wait for a free thread on server
-    int sockfd = setup_client_connection(argv[1], argv[2]);
+    int sockfd =
+        setup_client_connection(argv[1], token_arg == 3 ? argv[2] : NULL);
     wait_for_thread(sockfd);
 
+    // Pick up a previous session instead of logging in if a token was given
+    if (argc > token_arg) {
+        if (!resume(sockfd, argv[token_arg])) {
+            printf("That session has expired. Please log in again.\n");
+            close(sockfd);
+            return 0;
+        }
+        core_loop(sockfd);
+        close(sockfd);
+        return 0;
+    }
+
     // Send login details to server and exit if not authenticated
     int success = login(sockfd);
     if (!success) {
@@ -52,57 +75,44 @@ int main(int argc, char *argv[]) {
 
 /*
  * function setup_client_connection(): connect client to server
- * algorithm:
+ * algorithm: the host may be a name, an IPv4 or IPv6 address, or a unix:
+ *   socket path, in which case there is no port.
  * input: host name and port number (from command line).
  * output: socket file descriptor.
  */
 int setup_client_connection(char *host_arg, char *port_arg) {
-    // Variables to store connection information
-    int sockfd;
-    struct hostent *he;
-    struct sockaddr_in their_addr;
-    int port_no = atoi(port_arg);
-
-    // Get the host info
-    if ((he = gethostbyname(host_arg)) == NULL) {
-        herror("gethostbyname");
-        exit(1);
-    }
-
-    // Create endpoint for communication and refer to it with file descriptor
-    if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-        perror("socket");
-        exit(1);
-    }
-
-    // Set IPv4 addresses as type
-    their_addr.sin_family = AF_INET;
-    // Set host byte order from host short to network
-    their_addr.sin_port = htons(port_no);
-    their_addr.sin_addr = *((struct in_addr *)he->h_addr);
-    // Zero the rest of the struct
-    bzero(&(their_addr.sin_zero), 8);
-
-    // Connect socket file descriptor to address initialised then
-    if (connect(sockfd, (struct sockaddr *)&their_addr,
-                sizeof(struct sockaddr)) == -1) {
-        perror("connect");
+    int sockfd = connect_to_address(host_arg, port_arg);
+    if (sockfd == -1) {
         exit(1);
     }
-
     return sockfd;
 }
 
 /*
  * function wait_for_thread(): wait for free thread on server
- * algorithm: Block on recv call till a 'flag' is sent by server to proceed
+ * algorithm: Block on recv call till a 'flag' is sent by server to proceed.
+ *   While queued, print each update of the place in the queue. Exit if the
+ *   server is too busy to queue the connection.
  * input: socket file descriptor.
  * output: none.
  */
 void wait_for_thread(int sockfd) {
     printf("Waiting for open connection...\n");
     // Call that blocks processing till trigger sent by server
-    recv_int(sockfd);
+    int response;
+    while ((response = recv_int(sockfd)) == QUEUE_POSITION) {
+        int position = recv_int(sockfd);
+        int wait = recv_int(sockfd);
+        printf("Number %d in the queue", position);
+        if (wait >= 0) {
+            printf(", about %d seconds to go", wait);
+        }
+        printf(".\n");
+    }
+    if (response == SERVER_BUSY) {
+        printf("The server is too busy right now, try again later.\n");
+        exit(0);
+    }
     printf("Received connection.\n");
 }
 
@@ -130,11 +140,41 @@ int login(int sockfd) {
     send_string(sockfd, usr);
     send_string(sockfd, pwd);
 
-    // Receive authentication response from server
+    // Receive authentication response from server, followed by the token to
+    // resume the session with on success
     int val = recv_int(sockfd);
+    if (val) {
+        recv_string(sockfd, resume_token);
+        printf("\nIf you get disconnected, resume with session token %s\n\n",
+               resume_token);
+    }
     return val;
 }
 
+/*
+ * function resume(): pick up a session after a dropped connection
+ * algorithm: Send the resume marker and token in place of the login details.
+ *   The server answers with whether the session was found, whether a game is
+ *   in progress, and if so the board, which is shown before play continues.
+ * input: socket file descriptor, session token.
+ * output: whether the session was resumed.
+ */
+int resume(int sockfd, char *token) {
+    strncpy(resume_token, token, MAX_READ_LENGTH - 1);
+    char usr[MAX_READ_LENGTH] = RESUME_USERNAME;
+    send_string(sockfd, usr);
+    send_string(sockfd, resume_token);
+
+    if (recv_int(sockfd) != AUTH_RESUMED) {
+        return 0;
+    }
+    printf("Session resumed.\n");
+    if (recv_int(sockfd)) {
+        play_minesweeper(sockfd);
+    }
+    return 1;
+}
+
 /*
  * function print_login_page(): display client facing login page
  * algorithm: Print a number of strings to stdout with login instructions.
@@ -191,6 +231,10 @@ void core_loop(int sockfd) {
             play_minesweeper(sockfd);
         } else if (selection == '2') {
             show_leaderboard(sockfd);
+        } else if (selection == '4') {
+            watch_game(sockfd);
+        } else if (selection == '5') {
+            play_coop(sockfd);
         } else if (selection == '3') {
             // Leave the infinite loop and return to main on 'Quit'
             break;
@@ -213,16 +257,18 @@ int select_client_action(int sockfd) {
     printf("<1> Play Minesweeper\n");
     printf("<2> Show Leaderboard\n");
     printf("<3> Quit\n");
+    printf("<4> Watch a game\n");
+    printf("<5> Play together\n");
 
     // Ask client to select one of the provided options until correct input is
     // provided.
     char selection;
     do {
-        printf("\nSelection option (1-3): ");
+        printf("\nSelection option (1-5): ");
         scanf(" %c", &selection);
         // Remove remnants in input buffer to avoid incorrect processing
         clear_buffer();
-    } while (selection != '1' && selection != '2' && selection != '3');
+    } while (selection < '1' || selection > '5');
 
     // Send selected option to server
     if (send(sockfd, &selection, sizeof(selection), 0) == -1) {
@@ -243,23 +289,44 @@ int select_client_action(int sockfd) {
 void play_minesweeper(int sockfd) {
     // Create initial game and set up
     GameState game;
+    create_game(&game, NUM_TILES_X, NUM_TILES_Y, NUM_MINES);
     update_game_state(&game, sockfd);
 
     while (1) {
         // Get user selection for game and send to server
         char option = select_game_action();
-        send(sockfd, &option, sizeof(option), 0);
+
+        // Moves are sent together with their coordinates in one message
+        if (option == 'R' || option == 'P' || option == 'C') {
+            get_and_send_tile_coordinates(sockfd, option);
+        } else if (option == 'B') {
+            if (!get_and_send_batch(sockfd)) {
+                continue;
+            }
+        } else {
+            send(sockfd, &option, sizeof(option), 0);
+        }
 
         // Leave loop on quit game, returning back to main menu
         if (option == 'Q') {
             break;
         }
 
-        // Get tile coordinates from user on any other option
-        get_and_send_tile_coordinates(sockfd);
+        // Hints and probabilities are answered without a board update
+        if (option == 'H') {
+            print_hint(sockfd);
+            continue;
+        }
+        if (option == 'M') {
+            print_probabilities(&game, sockfd);
+            continue;
+        }
 
         // Get server response based on selected option and tile chosen
         int response = recv_int(sockfd);
+        if (option == 'B') {
+            printf("\n%d move(s) applied.\n", recv_int(sockfd));
+        }
 
         // Update the game board and show any text response provided by server
         update_game_state(&game, sockfd);
@@ -270,6 +337,261 @@ void play_minesweeper(int sockfd) {
             break;
         }
     };
+    destroy_game(&game);
+}
+
+/*
+ * function watch_game(): watch another player's game
+ * algorithm: Receive and list the games in progress, and send the user's pick
+ *   of one to watch ('0' to go back). Then print every board the server
+ *   sends until the game ends, while watching stdin so the user can press
+ *   Enter to stop watching.
+ * input: socket file descriptor.
+ * output: none.
+ */
+void watch_game(int sockfd) {
+    int count = recv_int(sockfd);
+    if (count == 0) {
+        printf("\nNobody is playing right now. Try again later.\n\n");
+        return;
+    }
+
+    printf("\nGames in progress:\n");
+    for (int i = 0; i < count; i++) {
+        char username[MAX_READ_LENGTH];
+        recv_string(sockfd, username);
+        int games_won = recv_int(sockfd);
+        printf("<%d> %s (%d games won)\n", i + 1, username, games_won);
+    }
+    printf("<0> Back\n");
+
+    char pick;
+    do {
+        printf("\nGame to watch (0-%d): ", count);
+        scanf(" %c", &pick);
+        clear_buffer();
+    } while (pick < '0' || pick > '0' + count);
+    send(sockfd, &pick, sizeof(pick), 0);
+    if (pick == '0') {
+        return;
+    }
+    printf("Press Enter to stop watching.\n");
+
+    GameState game;
+    create_game(&game, NUM_TILES_X, NUM_TILES_Y, NUM_MINES);
+    int stopping = 0;
+    while (1) {
+        fd_set ready;
+        FD_ZERO(&ready);
+        FD_SET(sockfd, &ready);
+        if (!stopping) {
+            FD_SET(STDIN_FILENO, &ready);
+        }
+        if (select(sockfd + 1, &ready, NULL, NULL, NULL) == -1) {
+            perror("select");
+            break;
+        }
+
+        // Ask the server to stop, boards already on their way still arrive
+        if (FD_ISSET(STDIN_FILENO, &ready)) {
+            clear_buffer();
+            char option = 'Q';
+            send(sockfd, &option, sizeof(option), 0);
+            stopping = 1;
+        }
+
+        if (FD_ISSET(sockfd, &ready)) {
+            int response = recv_int(sockfd);
+            if (response == SPECTATE_BOARD) {
+                update_game_state(&game, sockfd);
+            } else if (response == SPECTATE_UNAVAILABLE) {
+                printf("That game has already finished.\n\n");
+                break;
+            } else if (response == SPECTATE_END) {
+                int result = recv_int(sockfd);
+                if (result == GAME_WON) {
+                    printf("The player located all the mines!\n\n");
+                } else if (result == GAME_LOST) {
+                    printf("The player hit a mine!\n\n");
+                } else if (!stopping) {
+                    printf("The player left the game.\n\n");
+                }
+                break;
+            }
+        }
+    }
+    destroy_game(&game);
+}
+
+/*
+ * function play_coop(): play on a board shared with other players
+ * algorithm: Wait on both stdin and the server. Moves typed as an option and
+ *   a row and column number are sent straight away, 'Q' leaves. The server
+ *   answers with a snapshot of the whole board on joining and with the tiles
+ *   changed by each player's move afterwards, which are applied to the local
+ *   board. Leaves by itself once the game is over and stops after COOP_END.
+ * input: socket file descriptor.
+ * output: none.
+ */
+void play_coop(int sockfd) {
+    GameState game;
+    game.tiles = NULL;
+    int leaving = 0;
+    printf("\nEnter moves as R, P or C (chord) followed by a row and column "
+           "number,\ne.g. R 3 12 for row C. Enter Q to leave the game.\n");
+
+    while (1) {
+        fd_set ready;
+        FD_ZERO(&ready);
+        FD_SET(sockfd, &ready);
+        if (!leaving) {
+            FD_SET(STDIN_FILENO, &ready);
+        }
+        if (select(sockfd + 1, &ready, NULL, NULL, NULL) == -1) {
+            perror("select");
+            break;
+        }
+
+        if (FD_ISSET(STDIN_FILENO, &ready)) {
+            char line[MAX_READ_LENGTH * 2];
+            char option;
+            int row = 0, column = 0;
+            if (fgets(line, sizeof(line), stdin) == NULL ||
+                sscanf(line, " %c %d %d", &option, &row, &column) < 1) {
+                option = 'Q';
+            }
+            if (option == 'Q' || option == 'R' || option == 'P' ||
+                option == 'C') {
+                send_coop_command(sockfd, option, row - 1, column - 1);
+                leaving = option == 'Q';
+            } else {
+                printf("Unknown option, use R, P, C or Q.\n");
+            }
+        }
+
+        if (FD_ISSET(sockfd, &ready)) {
+            int type = recv_int(sockfd);
+            if (type == COOP_END) {
+                break;
+            } else if (type == COOP_UNAVAILABLE) {
+                printf("No co-op game could be started, try again later.\n");
+                break;
+            }
+            int response = recv_int(sockfd);
+            int mines_left = recv_int(sockfd);
+            int first = recv_int(sockfd);
+            int second = recv_int(sockfd);
+            char username[MAX_READ_LENGTH];
+            recv_string(sockfd, username);
+
+            if (type == COOP_SNAPSHOT) {
+                if (game.tiles == NULL || game.width != first ||
+                    game.height != second) {
+                    if (game.tiles != NULL) {
+                        destroy_game(&game);
+                    }
+                    if (!create_game(&game, first, second, 0)) {
+                        printf("Could not allocate the board. Exiting.\n");
+                        exit(0);
+                    }
+                }
+                recv_coop_tiles(sockfd, &game, NULL, first * second);
+            } else {
+                int *indices = malloc(sizeof(int) * (first > 0 ? first : 1));
+                for (int i = 0; i < first; i++) {
+                    indices[i] = recv_int(sockfd);
+                }
+                recv_coop_tiles(sockfd, &game, indices, first);
+                free(indices);
+            }
+            game.mines_left = mines_left;
+
+            if (game.width <= COOP_PRINT_WIDTH && game.height <= 26) {
+                print_game_state(&game);
+            } else {
+                printf("\nRemaining mines: %d\n", game.mines_left);
+            }
+            print_coop_event(username, response);
+
+            // Leave once the game is over, any moves still on their way
+            // are ignored by the server
+            if (!leaving && (response == GAME_WON || response == GAME_LOST)) {
+                send_coop_command(sockfd, 'Q', 0, 0);
+                leaving = 1;
+            }
+        }
+    }
+    if (game.tiles != NULL) {
+        destroy_game(&game);
+    }
+}
+
+/*
+ * function send_coop_command(): send a move on a shared board
+ * algorithm: pack the option and the zero based row and column as network
+ *   ints into one message.
+ * input: socket file descriptor, option, row and column.
+ * output: none.
+ */
+void send_coop_command(int sockfd, char option, int row, int column) {
+    char message[1 + 2 * sizeof(int)];
+    message[0] = option;
+    row = htonl(row);
+    column = htonl(column);
+    memcpy(&message[1], &row, sizeof(int));
+    memcpy(&message[1 + sizeof(int)], &column, sizeof(int));
+    if (send(sockfd, message, sizeof(message), 0) == -1) {
+        perror("Could not send move.");
+    }
+}
+
+/*
+ * function recv_coop_tiles(): receive tiles packed one byte each
+ * algorithm: read the bytes and unpack them into the given tiles, or into
+ *   the whole board in order if no indices are given.
+ * input: socket file descriptor, pointer to game, tile indices or NULL, and
+ *   number of tiles.
+ * output: none.
+ */
+void recv_coop_tiles(int sockfd, GameState *game, int *indices, int count) {
+    unsigned char *bytes = malloc(count > 0 ? count : 1);
+    if (count > 0 && recv(sockfd, bytes, count, MSG_WAITALL) != count) {
+        perror("Couldn't receive tiles.");
+        connection_lost();
+    }
+    int tiles = game->width * game->height;
+    for (int i = 0; i < count; i++) {
+        int index = indices == NULL ? i : indices[i];
+        if (index >= 0 && index < tiles) {
+            unpack_tile(&game->tiles[index], bytes[i]);
+        }
+    }
+    free(bytes);
+}
+
+/*
+ * function print_coop_event(): describe the move that changed the board
+ * input: name of the player who moved and the server response to the move.
+ * output: none.
+ */
+void print_coop_event(char *username, int response) {
+    if (response == GAME_WON) {
+        printf("%s flagged the last mine, you all won!\n", username);
+    } else if (response == GAME_LOST) {
+        printf("%s hit a mine, game over!\n", username);
+    } else if (response == NO_MINE_AT_FLAG) {
+        printf("There was no mine at flag!\n");
+    } else if (response == TILE_ALREADY_REVEALED) {
+        printf("The tile was already revealed!\n");
+    } else if (response == INVALID_COORDINATES) {
+        printf("The coordinates entered are invalid.\n");
+    } else if (response == CHORD_UNAVAILABLE) {
+        printf("Chord needs a revealed number with all its mines flagged.\n");
+    } else if (response == RATE_LIMITED) {
+        printf("Too many moves, slow down! The move was not played.\n");
+    } else {
+        printf("%s moved.\n", username);
+    }
 }
 
 /*
@@ -280,9 +602,9 @@ void play_minesweeper(int sockfd) {
  * output: none.
  */
 void update_game_state(GameState *game, int sockfd) {
-    for (int row = 0; row < NUM_TILES_Y; row++) {
-        for (int column = 0; column < NUM_TILES_X; column++) {
-            Tile *tile = &game->tiles[row][column];
+    for (int row = 0; row < game->height; row++) {
+        for (int column = 0; column < game->width; column++) {
+            Tile *tile = GAME_TILE(game, row, column);
             recv_tile(sockfd, tile);
         }
     }
@@ -301,36 +623,143 @@ char select_game_action() {
     printf("Select an option:\n");
     printf("<R> Reveal tile\n");
     printf("<P> Place flag\n");
+    printf("<C> Chord (reveal around a number whose mines are flagged)\n");
+    printf("<H> Hint (show a safe tile)\n");
+    printf("<M> Show mine probabilities\n");
+    printf("<B> Several moves at once\n");
     printf("<Q> Quit Game\n");
 
     // Ask client to select one of the provided options until correct input is
     // provided.
     char option;
     do {
-        printf("\nOption (R,P,Q): ");
+        printf("\nOption (R,P,C,H,M,B,Q): ");
         scanf(" %c", &option);
         // Remove remnants in input buffer to avoid incorrect processing
         clear_buffer();
-    } while (option != 'R' && option != 'P' && option != 'Q');
+    } while (option != 'R' && option != 'P' && option != 'C' &&
+             option != 'H' && option != 'M' && option != 'B' && option != 'Q');
     return option;
 }
 
 /*
  * function get_and_send_tile_coordinates(): as name suggests
- * algorithm: Get coordinates from user and send to server.
- * input: socket file descriptor.
+ * algorithm: Get coordinates from user and send them to the server together
+ *   with the selected option in one message.
+ * input: socket file descriptor, selected option.
  * output: none.
  */
-void get_and_send_tile_coordinates(int sockfd) {
+void get_and_send_tile_coordinates(int sockfd, char option) {
     // Get input from client
-    char row, column;
+    char move[3] = {option};
     printf("Please input a coordinate: ");
-    scanf(" %c%c", &row, &column);
+    scanf(" %c%c", &move[1], &move[2]);
     clear_buffer();
 
     // Send to server
-    send(sockfd, &row, sizeof(row), 0);
-    send(sockfd, &column, sizeof(column), 0);
+    send(sockfd, move, sizeof(move), 0);
+}
+
+/*
+ * function get_and_send_batch(): send several moves in one message
+ * algorithm: Read a line of moves such as "RA1 PB2", each an option followed
+ *   by a coordinate, and send them to the server as 'B', the number of moves
+ *   and then the moves.
+ * input: socket file descriptor.
+ * output: 1 if the batch was sent, 0 if no valid moves were entered.
+ */
+int get_and_send_batch(int sockfd) {
+    char line[MAX_BATCH_MOVES * 4 + 2];
+    char message[2 + MAX_BATCH_MOVES * 3] = {'B'};
+    int count = 0;
+
+    printf("Enter moves separated by spaces (e.g. RA1 PB2): ");
+    if (fgets(line, sizeof(line), stdin) == NULL) {
+        return 0;
+    }
+    if (strchr(line, '\n') == NULL) {
+        clear_buffer();
+    }
+
+    for (char *move = strtok(line, " \t\n"); move != NULL;
+         move = strtok(NULL, " \t\n")) {
+        if (strlen(move) != 3 ||
+            (move[0] != 'R' && move[0] != 'P' && move[0] != 'C')) {
+            printf("Skipping \"%s\", moves look like RA1, PB2 or CC3.\n",
+                   move);
+            continue;
+        }
+        if (count == MAX_BATCH_MOVES) {
+            printf("Only the first %d moves are sent.\n", MAX_BATCH_MOVES);
+            break;
+        }
+        memcpy(&message[2 + count * 3], move, 3);
+        count++;
+    }
+    if (count == 0) {
+        printf("No moves entered.\n\n");
+        return 0;
+    }
+
+    message[1] = count;
+    send(sockfd, message, 2 + count * 3, 0);
+    return 1;
+}
+
+/*
+ * function print_hint(): receive and display a hint from the server
+ * algorithm: Receive the hint response, and if a safe tile was found receive
+ *   its row and column and print them in the same form the user types them.
+ * input: socket file descriptor.
+ * output: none.
+ */
+void print_hint(int sockfd) {
+    int response = recv_int(sockfd);
+    if (response == HINT_SAFE_TILE) {
+        int row = recv_int(sockfd);
+        int column = recv_int(sockfd);
+        printf("Hint: tile %c%d is safe to reveal.\n\n", row + 'A',
+               column + 1);
+    } else {
+        printf("Hint: no tile can be proven safe, you will have to guess!\n\n");
+    }
+}
+
+/*
+ * function print_probabilities(): receive and display the mine probabilities
+ * algorithm: Receive whether the values are exact, then one value per tile in
+ *   tenths of a percent. Print them as a grid of whole percentages, showing
+ *   the number of revealed tiles and '+' for flags instead.
+ * input: pointer to game and socket file descriptor.
+ * output: none.
+ */
+void print_probabilities(GameState *game, int sockfd) {
+    int response = recv_int(sockfd);
+    if (response == PROBABILITIES_UNAVAILABLE) {
+        printf("Mine probabilities are not available right now.\n\n");
+        return;
+    }
+
+    printf("\nChance of a mine (%%)%s:\n\n    ",
+           response == PROBABILITIES_APPROXIMATE ? ", approximate" : "");
+    for (int column = 1; column <= game->width; column++) {
+        printf("%3d ", column);
+    }
+    for (int row = 0; row < game->height; row++) {
+        printf("\n%c | ", row + 'A');
+        for (int column = 0; column < game->width; column++) {
+            Tile *tile = GAME_TILE(game, row, column);
+            int value = recv_int(sockfd);
+            if (tile->revealed) {
+                printf("  %d ", tile->adjacent_mines);
+            } else if (tile->flagged) {
+                printf("  + ");
+            } else {
+                printf("%3d ", (value + 5) / 10);
+            }
+        }
+    }
+    printf("\n\n");
 }
 
 /*
@@ -359,6 +788,12 @@ void print_response_output(int response, int sockfd) {
         printf(
             "The coordinates entered are invalid. Ensure they are "
             "within the game bounds!\n");
+    } else if (response == CHORD_UNAVAILABLE) {
+        printf(
+            "Chording needs a revealed number with all of its mines "
+            "flagged!\n");
+    } else if (response == RATE_LIMITED) {
+        printf("Too many moves, slow down! The move was not played.\n");
     }
 }
 
@@ -401,7 +836,8 @@ void print_leaderboard_contents(int response, int sockfd) {
     } else {
         while (1) {
             // Receive required details from server
-            char *username = recv_string(sockfd);
+            char username[MAX_READ_LENGTH];
+            recv_string(sockfd, username);
             int duration = recv_int(sockfd);
             int games_won = recv_int(sockfd);
             int games_played = recv_int(sockfd);
@@ -410,9 +846,6 @@ void print_leaderboard_contents(int response, int sockfd) {
             printf("%s \t %d seconds \t %d games won, %d games played\n",
                    username, duration, games_won, games_played);
 
-            // Free memory from string after printing;
-            free(username);
-
             // Receive flag on whether more scores are to follow
             int entry_left = recv_int(sockfd);
             // If no entries remaining, exit loop and return to main menu
@@ -432,31 +865,42 @@ void print_leaderboard_contents(int response, int sockfd) {
  */
 int recv_int(int fd) {
     int val;
-    if (recv(fd, &val, sizeof(val), 0) == -1) {
+    if (recv(fd, &val, sizeof(val), MSG_WAITALL) != sizeof(val)) {
         perror("Couldn't receive int data.");
-        printf("Error receiving data from server. Exiting.\n");
-        exit(0);
+        connection_lost();
     }
     return ntohl(val);
 }
 
 /*
  * function recv_string(): helper function to read string from server
- * algorithm: read the data from file descriptor, read in to memory of specified
- *   length, and check for error
- * input: socket file descriptor.
- * output: received string.
+ * algorithm: read the data from file descriptor into the caller's buffer,
+ *   and check for error
+ * input: socket file descriptor, buffer of MAX_READ_LENGTH characters.
+ * output: none.
  */
-char *recv_string(int fd) {
-    char *str = malloc(MAX_READ_LENGTH);
-
-    if (recv(fd, str, MAX_READ_LENGTH, 0) == -1) {
+void recv_string(int fd, char *str) {
+    if (recv(fd, str, MAX_READ_LENGTH, MSG_WAITALL) != MAX_READ_LENGTH) {
         perror("Couldn't receive string data.");
-        printf("Error receiving data from server. Exiting.\n");
-        exit(0);
+        connection_lost();
     };
+    str[MAX_READ_LENGTH - 1] = '\0';
+}
 
-    return str;
+/*
+ * function connection_lost(): exit after the server connection dropped
+ * algorithm: Tell the player how to resume their session, if they have one,
+ *   and exit.
+ * input: none.
+ * output: none.
+ */
+void connection_lost() {
+    printf("Error receiving data from server. Exiting.\n");
+    if (resume_token[0] != '\0') {
+        printf("Resume your session by passing %s as the last argument.\n",
+               resume_token);
+    }
+    exit(0);
 }
 
 /*
@@ -1,19 +1,29 @@
 int setup_client_connection(char *host_arg, char *port_arg);
 void wait_for_thread(int sockfd);
 int login(int sockfd);
+int resume(int sockfd, char *token);
 void print_login_page();
 void read_login_input(char *buffer);
 void core_loop(int sockfd);
 int select_client_action(int sockfd);
 void play_minesweeper(int sockfd);
+void watch_game(int sockfd);
+void play_coop(int sockfd);
+void send_coop_command(int sockfd, char option, int row, int column);
+void recv_coop_tiles(int sockfd, GameState *game, int *indices, int count);
+void print_coop_event(char *username, int response);
 void update_game_state(GameState *game, int sockfd);
 char select_game_action();
-void get_and_send_tile_coordinates(int sockfd);
+void get_and_send_tile_coordinates(int sockfd, char option);
+int get_and_send_batch(int sockfd);
+void print_hint(int sockfd);
+void print_probabilities(GameState *game, int sockfd);
 void print_response_output(int response, int sockfd);
 void show_leaderboard();
 void print_leaderboard_contents(int response, int sockfd);
 int recv_int(int fd);
-char *recv_string(int fd);
+void recv_string(int fd, char *str);
+void connection_lost();
 void recv_tile(int fd, Tile *tile);
 void send_string(int fd, char *str);
 void clear_buffer();
\ No newline at end of file
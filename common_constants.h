@@ -1,5 +1,17 @@
 #define MAX_READ_LENGTH 20
 #define BACKLOG 50
+// Most moves a client may send in one batch
+#define MAX_BATCH_MOVES 64
+
+// Username a client sends, with its token as password, to resume a session
+#define RESUME_USERNAME "#resume"
+#define AUTH_RESUMED 2
+
+// Sent to a client waiting for a handler thread, followed by its place in the
+// queue and an estimate of the wait in seconds (-1 when unknown), or in place
+// of the queue when it is full
+#define QUEUE_POSITION 28
+#define SERVER_BUSY 29
 
 #define NORMAL 1
 #define GAME_LOST 2
@@ -7,6 +19,31 @@
 #define NO_MINE_AT_FLAG 4
 #define TILE_ALREADY_REVEALED 5
 #define INVALID_COORDINATES 6
+#define CHORD_UNAVAILABLE 27
+// A move, batch or multiplexed request sent faster than the server's limit,
+// it was not played. Multiplexed replies carry it as their type
+#define RATE_LIMITED 32
+#define HINT_SAFE_TILE 7
+#define HINT_NONE 8
+#define PROBABILITIES_EXACT 9
+#define PROBABILITIES_APPROXIMATE 10
+#define PROBABILITIES_UNAVAILABLE 14
+#define SPECTATE_BOARD 15
+#define SPECTATE_END 16
+#define SPECTATE_UNAVAILABLE 17
+#define COOP_SNAPSHOT 18
+#define COOP_DELTA 19
+#define COOP_END 20
+#define COOP_UNAVAILABLE 21
+#define MUX_BOARD 22
+#define MUX_HINT 23
+#define MUX_CLOSED 24
+#define MUX_ERROR 25
+#define MUX_EXIT 26
+// Answers to a request for the shared memory transport, the name of the
+// segment follows SHM_READY
+#define SHM_READY 30
+#define SHM_UNAVAILABLE 31
 
 #define HIGHSCORES_EMPTY 11
 #define HIGHSCORES_PRESENT 12
@@ -0,0 +1,110 @@
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "logger.h"
+#include "config.h"
+
+// Keys a configuration file may set. The port has no option letter on the
+// command line, where it is the last argument, so it is given 'p'
+ConfigKey config_keys[] = {
+    {"port", 'p', false},           {"listen", 'l', false},
+    {"backlog", 'b', false},        {"credentials", 'a', false},
+    {"seed", 'r', false},           {"no_guess", 'g', false},
+    {"io_uring", 'i', false},       {"shards", 's', false},
+    {"coop_board", 'c', false},     {"upgrade_socket", 'u', false},
+    {"events", 'e', false},         {"trace", 'T', false},
+    {"handler_threads", 'n', true}, {"queue_limit", 'q', true},
+    {"timeouts", 't', true},        {"log_level", 'L', true},
+    {"rate_limits", 'R', true},
+};
+
+/*
+ * function trim(): strip white space from both ends of a string in place
+ * input:     string.
+ * output:    pointer to the first character that is not white space.
+ */
+char *trim(char *text) {
+    while (isspace((unsigned char)*text)) {
+        text++;
+    }
+    size_t len = strlen(text);
+    while (len > 0 && isspace((unsigned char)text[len - 1])) {
+        text[--len] = '\0';
+    }
+    return text;
+}
+
+/*
+ * function find_config_key(): look a key up by name
+ * input:     name of the key.
+ * output:    pointer to the key, NULL if there is none of that name.
+ */
+ConfigKey *find_config_key(char *name) {
+    for (size_t i = 0; i < sizeof(config_keys) / sizeof(config_keys[0]);
+         i++) {
+        if (strcmp(config_keys[i].name, name) == 0) {
+            return &config_keys[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * function config_read(): apply the settings of a configuration file
+ * algorithm: every line is "key = value", blank or a comment starting with
+ *   '#'. Each setting is handed to apply() as the option it stands for,
+ *   unless that option was given on the command line, which takes
+ *   precedence. When reloading only keys that can change live are applied,
+ *   the rest take effect on the next start. Bad lines are reported and
+ *   skipped.
+ * input:     path of the file, whether only live keys are applied, options
+ *   given on the command line, function applying an option and its value.
+ * output:    number of bad lines, -1 if the file could not be read.
+ */
+int config_read(char *path, bool live_only, bool *on_command_line,
+                int (*apply)(int option, char *value)) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        log_message(LOG_LEVEL_ERROR, "%s: %m", path);
+        return -1;
+    }
+
+    char line[CONFIG_LINE_BYTES];
+    int line_no = 0, errors = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_no++;
+        char *comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        char *text = trim(line);
+        if (*text == '\0') {
+            continue;
+        }
+
+        char *equals = strchr(text, '=');
+        ConfigKey *key = NULL;
+        if (equals != NULL) {
+            *equals = '\0';
+            key = find_config_key(trim(text));
+        }
+        if (key == NULL) {
+            log_message(LOG_LEVEL_ERROR, "%s:%d: unknown setting", path,
+                        line_no);
+            errors++;
+            continue;
+        }
+        if (on_command_line[key->option] || (live_only && !key->live)) {
+            continue;
+        }
+        if (!apply(key->option, trim(equals + 1))) {
+            log_message(LOG_LEVEL_ERROR, "%s:%d: invalid value for %s", path,
+                        line_no, key->name);
+            errors++;
+        }
+    }
+    fclose(file);
+    return errors;
+}
@@ -0,0 +1,15 @@
+// Longest line of a configuration file
+#define CONFIG_LINE_BYTES 4096
+// Options are letters, so a flag per ASCII character covers them all
+#define CONFIG_OPTIONS 128
+
+// A key of the configuration file, the command line option it stands for
+// and whether it can be changed while the server runs
+typedef struct config_key_t {
+    const char *name;
+    int option;
+    bool live;
+} ConfigKey;
+
+int config_read(char *path, bool live_only, bool *on_command_line,
+                int (*apply)(int option, char *value));
@@ -0,0 +1,429 @@
+#include <arpa/inet.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "common_constants.h"
+#include "minesweeper_logic.h"
+#include "server.h"
+#include "server_io.h"
+#include "spectate.h"
+#include "logger.h"
+#include "coop.h"
+#include "timer_wheel.h"
+#include "reaper.h"
+
+// Shared games still being played or with players left in them
+CoopGame *coop_head = NULL;
+pthread_mutex_t coop_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Board used for new co-op games
+int coop_width = COOP_TILES_X;
+int coop_height = COOP_TILES_Y;
+int coop_mines = COOP_MINES;
+
+/*
+ * function coop_configure(): set the board used by new co-op games
+ * input:     width, height and number of mines.
+ * output:    1 if the board is valid, 0 otherwise.
+ */
+int coop_configure(int width, int height, int num_mines) {
+    if (width <= 0 || height <= 0 || width > COOP_MAX_SIDE ||
+        height > COOP_MAX_SIDE || num_mines <= 0 ||
+        num_mines >= width * height) {
+        return 0;
+    }
+    coop_width = width;
+    coop_height = height;
+    coop_mines = num_mines;
+    return 1;
+}
+
+/*
+ * function join_coop_game(): take a seat in a shared game
+ * algorithm: pick the first game with a free seat that is not over, or start
+ *   a new one with a change log so moves can be sent as deltas.
+ * input:     none.
+ * output:    pointer to the game, or NULL on allocation failure.
+ */
+CoopGame *join_coop_game() {
+    pthread_mutex_lock(&coop_list_mutex);
+    for (CoopGame *node = coop_head; node != NULL; node = node->next) {
+        if (node->seats < COOP_MAX_PLAYERS &&
+            !__atomic_load_n(&node->over, __ATOMIC_ACQUIRE)) {
+            node->seats++;
+            pthread_mutex_unlock(&coop_list_mutex);
+            return node;
+        }
+    }
+
+    CoopGame *coop = malloc(sizeof(CoopGame));
+    if (coop == NULL ||
+        !create_game(&coop->game, coop_width, coop_height, coop_mines)) {
+        free(coop);
+        pthread_mutex_unlock(&coop_list_mutex);
+        return NULL;
+    }
+    if (!enable_change_log(&coop->game)) {
+        destroy_game(&coop->game);
+        free(coop);
+        pthread_mutex_unlock(&coop_list_mutex);
+        return NULL;
+    }
+    coop->over = false;
+    coop->result = NORMAL;
+    coop->seats = 1;
+    coop->players = NULL;
+    pthread_mutex_init(&coop->mutex, NULL);
+    pthread_cond_init(&coop->applied, NULL);
+    coop->pending_head = NULL;
+    coop->pending_tail = NULL;
+    coop->combining = false;
+    pthread_mutex_init(&coop->frames_mutex, NULL);
+    coop->next = coop_head;
+    coop_head = coop;
+    pthread_mutex_unlock(&coop_list_mutex);
+    return coop;
+}
+
+/*
+ * function leave_coop_game(): give up a seat, freeing the game with the last
+ * input:     pointer to the game.
+ * output:    none.
+ */
+void leave_coop_game(CoopGame *coop) {
+    pthread_mutex_lock(&coop_list_mutex);
+    bool empty = --coop->seats == 0;
+    if (empty) {
+        CoopGame **link = &coop_head;
+        while (*link != coop) {
+            link = &(*link)->next;
+        }
+        *link = coop->next;
+    }
+    pthread_mutex_unlock(&coop_list_mutex);
+
+    if (empty) {
+        destroy_game(&coop->game);
+        pthread_mutex_destroy(&coop->mutex);
+        pthread_cond_destroy(&coop->applied);
+        pthread_mutex_destroy(&coop->frames_mutex);
+        free(coop);
+    }
+}
+
+/*
+ * function create_coop_frame(): allocate a frame and fill in its header
+ * input:     pointer to the game, frame type, response to the move, the two
+ *   sizes, name of the player who moved, and number of bytes after the
+ *   header.
+ * output:    pointer to frame, or NULL on failure.
+ */
+Frame *create_coop_frame(CoopGame *coop, int type, int response, int first,
+                         int second, char *name, size_t body_len) {
+    Frame *frame = create_frame(COOP_HEADER_BYTES + body_len);
+    if (frame == NULL) {
+        return NULL;
+    }
+    frame->data[0] = htonl(type);
+    frame->data[1] = htonl(response);
+    frame->data[2] = htonl(coop->game.mines_left);
+    frame->data[3] = htonl(first);
+    frame->data[4] = htonl(second);
+    strncpy((char *)&frame->data[5], name, MAX_READ_LENGTH);
+    return frame;
+}
+
+/*
+ * function snapshot_frame(): encode the whole board, one byte per tile
+ * input:     pointer to the game, response to the move, name of the player
+ *   who moved.
+ * output:    pointer to frame, or NULL on failure.
+ */
+Frame *snapshot_frame(CoopGame *coop, int response, char *name) {
+    GameState *game = &coop->game;
+    int tiles = game->width * game->height;
+    Frame *frame = create_coop_frame(coop, COOP_SNAPSHOT, response,
+                                     game->width, game->height, name, tiles);
+    if (frame != NULL) {
+        unsigned char *bytes = (unsigned char *)frame->data + COOP_HEADER_BYTES;
+        for (int index = 0; index < tiles; index++) {
+            bytes[index] = pack_tile(&game->tiles[index]);
+        }
+    }
+    return frame;
+}
+
+/*
+ * function delta_frame(): encode the tiles changed by the last move
+ * algorithm: write the changed tile indices as network ints followed by the
+ *   new tiles one byte each. Falls back to a snapshot when that is smaller,
+ *   as it is for moves that end the game on a large board.
+ * input:     pointer to the game, response to the move, name of the player
+ *   who moved.
+ * output:    pointer to frame, or NULL on failure.
+ */
+Frame *delta_frame(CoopGame *coop, int response, char *name) {
+    GameState *game = &coop->game;
+    int count = game->num_changes;
+    size_t body_len = (size_t)count * (sizeof(int) + 1);
+    if (body_len > (size_t)game->width * game->height) {
+        return snapshot_frame(coop, response, name);
+    }
+
+    Frame *frame = create_coop_frame(coop, COOP_DELTA, response, count, 0,
+                                     name, body_len);
+    if (frame != NULL) {
+        int *indices =
+            (int *)((unsigned char *)frame->data + COOP_HEADER_BYTES);
+        unsigned char *bytes = (unsigned char *)&indices[count];
+        for (int i = 0; i < count; i++) {
+            int index = game->change_log[i];
+            indices[i] = htonl(index);
+            bytes[i] = pack_tile(&game->tiles[index]);
+        }
+    }
+    return frame;
+}
+
+/*
+ * function apply_command(): apply one move to the board, only ever called by
+ *   the thread currently combining
+ * algorithm: joins register the player and queue it a snapshot, leaves
+ *   unregister it. Reveals and flags run against the board with its change
+ *   log cleared, then the changes are queued as one shared delta to every
+ *   player. A player whose queue is full is resynchronised with a snapshot
+ *   instead. A move that changed nothing, or was over the rate limit and
+ *   not played, is only answered to its player.
+ * input:     pointer to the game and command.
+ * output:    none.
+ */
+void apply_command(CoopGame *coop, CoopCommand *command) {
+    GameState *game = &coop->game;
+    CoopPlayer *player = command->player;
+    char *name = player->login->username;
+
+    if (command->option == 'J') {
+        Frame *frame = snapshot_frame(coop, coop->result, name);
+        pthread_mutex_lock(&coop->frames_mutex);
+        player->next = coop->players;
+        coop->players = player;
+        if (frame != NULL) {
+            queue_frame(&player->queue, frame);
+        }
+        pthread_mutex_unlock(&coop->frames_mutex);
+        if (frame != NULL) {
+            release_frame(frame);
+        }
+        return;
+    }
+
+    if (command->option == 'L') {
+        pthread_mutex_lock(&coop->frames_mutex);
+        CoopPlayer **link = &coop->players;
+        while (*link != player) {
+            link = &(*link)->next;
+        }
+        *link = player->next;
+        release_queued_frames(&player->queue);
+        pthread_mutex_unlock(&coop->frames_mutex);
+        return;
+    }
+
+    if (coop->over) {
+        return;
+    }
+
+    game->num_changes = 0;
+    int response =
+        command->limited
+            ? RATE_LIMITED
+            : play_move(game, command->option, command->row, command->column);
+    bool over = response == GAME_WON || response == GAME_LOST;
+
+    Frame *delta = delta_frame(coop, response, name);
+    if (delta == NULL) {
+        return;
+    }
+    Frame *snapshot = NULL;
+
+    pthread_mutex_lock(&coop->frames_mutex);
+    if (game->num_changes == 0 && !over) {
+        // Nothing changed, only the player who moved needs to hear why
+        queue_frame(&player->queue, delta);
+    } else {
+        if (over) {
+            coop->result = response;
+            __atomic_store_n(&coop->over, true, __ATOMIC_RELEASE);
+        }
+        for (CoopPlayer *node = coop->players; node != NULL;
+             node = node->next) {
+            if (node->queue.count < SPECTATOR_QUEUE_FRAMES) {
+                queue_frame(&node->queue, delta);
+                continue;
+            }
+            // Deltas cannot be skipped, replace the backlog with the board
+            if (snapshot == NULL) {
+                snapshot = snapshot_frame(coop, response, name);
+            }
+            if (snapshot != NULL) {
+                queue_frame(&node->queue, snapshot);
+            }
+        }
+    }
+    pthread_mutex_unlock(&coop->frames_mutex);
+
+    release_frame(delta);
+    if (snapshot != NULL) {
+        release_frame(snapshot);
+    }
+}
+
+/*
+ * function submit_command(): apply a command through flat combining
+ * algorithm: queue the command. If no thread is combining, become the
+ *   combiner and apply queued commands in batches, outside the queue mutex,
+ *   until the queue is empty. Otherwise wait for the combiner to apply it.
+ *   Only the combiner touches the board, so moves are applied one at a time
+ *   without a lock being held over the board.
+ * input:     pointer to the game and command.
+ * output:    none.
+ */
+void submit_command(CoopGame *coop, CoopCommand *command) {
+    command->done = false;
+    command->next = NULL;
+
+    pthread_mutex_lock(&coop->mutex);
+    if (coop->pending_tail == NULL) {
+        coop->pending_head = command;
+    } else {
+        coop->pending_tail->next = command;
+    }
+    coop->pending_tail = command;
+
+    while (!command->done) {
+        if (coop->combining) {
+            pthread_cond_wait(&coop->applied, &coop->mutex);
+            continue;
+        }
+
+        coop->combining = true;
+        while (coop->pending_head != NULL) {
+            CoopCommand *batch = coop->pending_head;
+            coop->pending_head = NULL;
+            coop->pending_tail = NULL;
+            pthread_mutex_unlock(&coop->mutex);
+
+            for (CoopCommand *node = batch; node != NULL; node = node->next) {
+                apply_command(coop, node);
+            }
+
+            pthread_mutex_lock(&coop->mutex);
+            while (batch != NULL) {
+                CoopCommand *next = batch->next;
+                batch->done = true;
+                batch = next;
+            }
+            pthread_cond_broadcast(&coop->applied);
+        }
+        coop->combining = false;
+    }
+    pthread_mutex_unlock(&coop->mutex);
+}
+
+/*
+ * function play_coop(): play a shared game over a connection
+ * algorithm: take a seat and join, which queues a snapshot of the board.
+ *   Then wait on the player's eventfd and the socket: moves read from the
+ *   socket are submitted to the game, frames queued by whichever thread
+ *   applied a move are sent from here. Every move is checked against the
+ *   rate limits first. Leaves when the client sends 'Q', which it also does
+ *   once it sees the game end, then sends COOP_END.
+ * input:     socket file descriptor, login of the player, connected flag,
+ *   the server's shutdown flag and the check of moves against the limits.
+ * output:    1 if a game was played, 0 if no game could be joined.
+ */
+int play_coop(int fd, Login *login, int *connected,
+              volatile int *shutdown_active, bool (*allow_moves)(int count)) {
+    CoopGame *coop = join_coop_game();
+    if (coop == NULL) {
+        return 0;
+    }
+
+    CoopPlayer player;
+    player.login = login;
+    player.queue.first = 0;
+    player.queue.count = 0;
+    player.queue.skipped = 0;
+    player.queue.event_fd = eventfd(0, EFD_NONBLOCK);
+    if (player.queue.event_fd == -1) {
+        log_message(LOG_LEVEL_ERROR, "eventfd: %m");
+        leave_coop_game(coop);
+        return 0;
+    }
+
+    CoopCommand command;
+    command.player = &player;
+    command.limited = false;
+    command.option = 'J';
+    submit_command(coop, &command);
+
+    struct timeval timeout = {SPECTATOR_SEND_TIMEOUT_SECONDS, 0};
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    bool playing = true;
+    while (playing && *connected && !*shutdown_active) {
+        struct pollfd fds[2] = {{player.queue.event_fd, POLLIN, 0},
+                                {fd, POLLIN, 0}};
+        if (poll(fds, 2, WATCH_POLL_MS) <= 0) {
+            continue;
+        }
+
+        if (fds[1].revents != 0) {
+            unsigned char message[COOP_COMMAND_BYTES];
+            if (recv(fd, message, sizeof(message), MSG_WAITALL) !=
+                sizeof(message)) {
+                *connected = 0;
+                break;
+            }
+            reaper_touch();
+            command.option = message[0];
+            memcpy(&command.row, &message[1], sizeof(int));
+            memcpy(&command.column, &message[1 + sizeof(int)], sizeof(int));
+            command.row = ntohl(command.row);
+            command.column = ntohl(command.column);
+
+            if (command.option == 'Q') {
+                playing = false;
+            } else {
+                command.limited = !allow_moves(1);
+                submit_command(coop, &command);
+                command.limited = false;
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            send_queued_frames(fd, &player.queue, &coop->frames_mutex,
+                               connected);
+        }
+    }
+
+    command.option = 'L';
+    submit_command(coop, &command);
+    close(player.queue.event_fd);
+    leave_coop_game(coop);
+
+    timeout.tv_sec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (*connected) {
+        send_int(fd, COOP_END);
+    }
+    return 1;
+}
@@ -0,0 +1,59 @@
+// Players that can share one board
+#define COOP_MAX_PLAYERS 8
+// Default board of a co-op game, the expert layout
+#define COOP_TILES_X 30
+#define COOP_TILES_Y 16
+#define COOP_MINES 99
+// Longest side of a co-op board
+#define COOP_MAX_SIDE 4096
+// A move from a client: option, then row and column as network ints
+#define COOP_COMMAND_BYTES 9
+// Bytes before the tiles of a frame: type, response, mines left, two sizes
+// and the name of the player who moved
+#define COOP_HEADER_BYTES (sizeof(int) * 5 + MAX_READ_LENGTH)
+
+// A move waiting to be applied to a shared board
+typedef struct coop_command_t {
+    char option;
+    int row;
+    int column;
+    struct coop_player_t *player;
+    // Over the rate limit, answered RATE_LIMITED instead of being played
+    bool limited;
+    bool done;
+    struct coop_command_t *next;
+} CoopCommand;
+
+// A connection playing a shared game, frames are queued to it like they are
+// to a spectator
+typedef struct coop_player_t {
+    Login *login;
+    Spectator queue;
+    struct coop_player_t *next;
+} CoopPlayer;
+
+// A board shared by up to COOP_MAX_PLAYERS players. Moves are applied by
+// whichever thread holds the combiner role, so the board itself needs no
+// lock and no thread ever waits on another's move being half done.
+typedef struct coop_game_t {
+    GameState game;
+    bool over;
+    // NORMAL while playing, then how the game ended
+    int result;
+    // Seats taken, guarded by the list of co-op games
+    int seats;
+    CoopPlayer *players;
+    // Guards the command queue and the combining flag
+    pthread_mutex_t mutex;
+    pthread_cond_t applied;
+    CoopCommand *pending_head;
+    CoopCommand *pending_tail;
+    bool combining;
+    // Guards the frame queues of the players
+    pthread_mutex_t frames_mutex;
+    struct coop_game_t *next;
+} CoopGame;
+
+int coop_configure(int width, int height, int num_mines);
+int play_coop(int fd, Login *login, int *connected,
+              volatile int *shutdown_active, bool (*allow_moves)(int count));
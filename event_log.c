@@ -0,0 +1,340 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "event_log.h"
+#include "thread_buffer.h"
+
+// Records of one thread, appended at the tail and written from the head
+typedef struct event_buffer_t {
+    ThreadBuffer link;
+    EventRecord records[EVENT_BUFFER_RECORDS];
+    unsigned int head;
+    unsigned int tail;
+    unsigned long dropped;
+} EventBuffer;
+
+// Whether events are recorded, set before any thread logs
+bool event_log_running = false;
+// Buffers of every thread that logged
+ThreadBufferList event_buffers;
+static __thread EventBuffer *thread_events = NULL;
+// Game ids: the run's start time in the high half, a count in the low one
+unsigned long long event_run_id;
+unsigned int event_games = 0;
+
+// Writer thread, its segment file and settings
+BufferWriter event_writer;
+// Scratch space the writer gathers a block of records in
+EventRecord event_block[EVENT_BLOCK_RECORDS];
+char *event_directory;
+int event_flush_ms;
+int event_segment_fd = -1;
+size_t event_segment_bytes = 0;
+int event_segments = 0;
+// Number in the name of the next segment, ahead of event_segments when
+// names were already taken
+int event_segment_number = 0;
+long event_records = 0;
+
+// CRC-32 (IEEE) lookup table, filled in on first use
+unsigned int event_crc_table[256];
+bool event_crc_ready = false;
+
+/*
+ * function event_crc32(): checksum bytes the way zlib's crc32() does
+ * algorithm: table driven CRC-32 with the reflected IEEE polynomial.
+ * input:     bytes and their number.
+ * output:    checksum.
+ */
+unsigned int event_crc32(void *bytes, size_t len) {
+    if (!event_crc_ready) {
+        for (unsigned int i = 0; i < 256; i++) {
+            unsigned int crc = i;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = crc & 1 ? 0xedb88320 ^ (crc >> 1) : crc >> 1;
+            }
+            event_crc_table[i] = crc;
+        }
+        event_crc_ready = true;
+    }
+    unsigned int crc = 0xffffffff;
+    unsigned char *at = bytes;
+    for (size_t i = 0; i < len; i++) {
+        crc = event_crc_table[(crc ^ at[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffff;
+}
+
+/*
+ * function event_clock_ns(): wall clock time in nanoseconds
+ * input:     none.
+ * output:    nanoseconds since the epoch.
+ */
+unsigned long long event_clock_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*
+ * function open_event_segment(): start a new segment file
+ * algorithm: segments are named after the run and their number within it,
+ *   so they sort in the order they were written. A name already taken, by
+ *   a run restarted within the same second, is never overwritten: the
+ *   number is bumped past it instead. The header is written straight away.
+ * input:     none.
+ * output:    1 on success, 0 on failure.
+ */
+int open_event_segment() {
+    char path[4096];
+    for (;;) {
+        snprintf(path, sizeof(path), "%s/events-%010llu-%06d.seg",
+                 event_directory, event_run_id >> 32, event_segment_number);
+        event_segment_fd =
+            open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644);
+        if (event_segment_fd != -1 || errno != EEXIST) {
+            break;
+        }
+        event_segment_number++;
+    }
+    if (event_segment_fd == -1) {
+        log_message(LOG_LEVEL_ERROR, "%s: %m", path);
+        return 0;
+    }
+    EventSegmentHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, EVENT_SEGMENT_MAGIC, sizeof(header.magic));
+    header.version = EVENT_VERSION;
+    header.record_bytes = sizeof(EventRecord);
+    header.created_ns = event_clock_ns();
+    if (write(event_segment_fd, &header, sizeof(header)) != sizeof(header)) {
+        log_message(LOG_LEVEL_ERROR, "%s: %m", path);
+        close(event_segment_fd);
+        event_segment_fd = -1;
+        return 0;
+    }
+    event_segment_bytes = sizeof(header);
+    event_segments++;
+    event_segment_number++;
+    return 1;
+}
+
+/*
+ * function close_event_segment(): finish the current segment file
+ * algorithm: sync it so a completed segment is on disk before the next one
+ *   is started.
+ * input:     none.
+ * output:    none.
+ */
+void close_event_segment() {
+    if (event_segment_fd != -1) {
+        fdatasync(event_segment_fd);
+        close(event_segment_fd);
+        event_segment_fd = -1;
+    }
+}
+
+/*
+ * function write_event_block(): append a checksummed block of records
+ * algorithm: rotate to a new segment first if the block would not fit in
+ *   the current one, then write the header and records with one writev.
+ * input:     records and their number.
+ * output:    none; a block that cannot be written is lost and reported.
+ */
+void write_event_block(EventRecord *records, int count) {
+    size_t bytes = sizeof(EventBlockHeader) + sizeof(EventRecord) * count;
+    if (event_segment_fd != -1 &&
+        event_segment_bytes + bytes > EVENT_SEGMENT_BYTES) {
+        close_event_segment();
+    }
+    if (event_segment_fd == -1 && !open_event_segment()) {
+        return;
+    }
+
+    EventBlockHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = EVENT_BLOCK_MAGIC;
+    header.count = count;
+    header.crc = event_crc32(records, sizeof(EventRecord) * count);
+    header.first_ns = records[0].time_ns;
+    header.last_ns = records[count - 1].time_ns;
+    struct iovec parts[2] = {{&header, sizeof(header)},
+                             {records, sizeof(EventRecord) * count}};
+    if (writev(event_segment_fd, parts, 2) != (ssize_t)bytes) {
+        log_message(LOG_LEVEL_ERROR, "Couldn't write events: %m");
+        close_event_segment();
+        return;
+    }
+    event_segment_bytes += bytes;
+    event_records += count;
+}
+
+/*
+ * function drain_event_buffers(): write out every record buffered so far
+ * algorithm: copy each thread's records into blocks of up to
+ *   EVENT_BLOCK_RECORDS, freeing the space as each buffer is read, then
+ *   sync the segment if the flush interval ran out. A thread filling its
+ *   buffer wakes the writer early to drain without syncing.
+ * input:     whether to sync.
+ * output:    none.
+ */
+void drain_event_buffers(bool sync) {
+    EventRecord *block = event_block;
+    int count = 0;
+    ThreadBuffer *link = thread_buffers(&event_buffers);
+    for (; link != NULL; link = link->next) {
+        EventBuffer *buffer = (EventBuffer *)link;
+        unsigned int head = buffer->head;
+        unsigned int tail = __atomic_load_n(&buffer->tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            block[count++] =
+                buffer->records[head & (EVENT_BUFFER_RECORDS - 1)];
+            head++;
+            if (count == EVENT_BLOCK_RECORDS) {
+                __atomic_store_n(&buffer->head, head, __ATOMIC_RELEASE);
+                write_event_block(block, count);
+                count = 0;
+            }
+        }
+        __atomic_store_n(&buffer->head, head, __ATOMIC_RELEASE);
+    }
+    if (count > 0) {
+        write_event_block(block, count);
+    }
+    if (sync && event_segment_fd != -1) {
+        fdatasync(event_segment_fd);
+    }
+}
+
+/*
+ * function event_log_start(): start recording game events
+ * algorithm: create the directory if needed and start the writer thread.
+ *   Segment files are only created once there is something to write.
+ * input:     directory for segment files, flush interval in milliseconds.
+ * output:    1 on success, 0 on failure.
+ */
+int event_log_start(char *directory, int flush_ms) {
+    if (mkdir(directory, 0755) == -1 && errno != EEXIST) {
+        log_message(LOG_LEVEL_ERROR, "%s: %m", directory);
+        return 0;
+    }
+    event_directory = directory;
+    event_flush_ms = flush_ms > 0 ? flush_ms : EVENT_FLUSH_MS;
+    event_run_id = (unsigned long long)time(NULL) << 32;
+    if (!buffer_writer_start(&event_writer, event_flush_ms,
+                             drain_event_buffers)) {
+        log_message(LOG_LEVEL_ERROR, "Couldn't start event writer: %m");
+        return 0;
+    }
+    event_log_running = true;
+    return 1;
+}
+
+/*
+ * function event_log_stop(): write out what is buffered and stop
+ * algorithm: wake the writer for its last drain and wait for it. Threads
+ *   should have stopped logging.
+ * input:     none.
+ * output:    none.
+ */
+void event_log_stop() {
+    if (!event_log_running) {
+        return;
+    }
+    buffer_writer_stop(&event_writer);
+    close_event_segment();
+    event_log_running = false;
+
+    unsigned long dropped = 0;
+    ThreadBuffer *link = thread_buffers(&event_buffers);
+    while (link != NULL) {
+        ThreadBuffer *next = link->next;
+        dropped += ((EventBuffer *)link)->dropped;
+        free(link);
+        link = next;
+    }
+    event_buffers.head = NULL;
+    log_message(LOG_LEVEL_INFO,
+                "Events: %ld records in %d segments, %lu dropped",
+                event_records, event_segments, dropped);
+}
+
+/*
+ * function event_log_game_id(): id for a new game
+ * input:     none.
+ * output:    game id, 0 when events are not recorded.
+ */
+unsigned long long event_log_game_id() {
+    if (!event_log_running) {
+        return 0;
+    }
+    return event_run_id |
+           __atomic_add_fetch(&event_games, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * function thread_event_buffer(): buffer of the calling thread
+ * algorithm: registered on the thread's first event. Buffers stay until
+ *   the log is stopped.
+ * input:     none.
+ * output:    pointer to the buffer, NULL if memory ran out.
+ */
+EventBuffer *thread_event_buffer() {
+    if (thread_events == NULL) {
+        thread_events =
+            thread_buffer_register(&event_buffers, sizeof(EventBuffer));
+    }
+    return thread_events;
+}
+
+/*
+ * function log_event(): record an event of a game
+ * algorithm: append the record to the calling thread's buffer without
+ *   blocking; it is dropped and counted if the writer has fallen behind.
+ *   The writer is woken once the buffer reaches half full. Nothing is
+ *   recorded for games without an id.
+ * input:     game id, event type, player's username and the event's values.
+ * output:    none.
+ */
+void log_event(unsigned long long game, int type, char *username, int value0,
+               int value1, int value2, int value3) {
+    if (!event_log_running || game == 0) {
+        return;
+    }
+    EventBuffer *buffer = thread_event_buffer();
+    if (buffer == NULL) {
+        return;
+    }
+    unsigned int tail = buffer->tail;
+    unsigned int used =
+        tail - __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+    if (used == EVENT_BUFFER_RECORDS) {
+        buffer->dropped++;
+        return;
+    }
+    if (used == EVENT_BUFFER_RECORDS / 2) {
+        buffer_writer_wake(&event_writer);
+    }
+    EventRecord *record = &buffer->records[tail & (EVENT_BUFFER_RECORDS - 1)];
+    memset(record, 0, sizeof(*record));
+    record->time_ns = event_clock_ns();
+    record->game = game;
+    record->type = type;
+    record->thread = buffer->link.thread;
+    record->values[0] = value0;
+    record->values[1] = value1;
+    record->values[2] = value2;
+    record->values[3] = value3;
+    strncpy(record->username, username, EVENT_USERNAME_BYTES - 1);
+    __atomic_store_n(&buffer->tail, tail + 1, __ATOMIC_RELEASE);
+}
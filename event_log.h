@@ -0,0 +1,71 @@
+// Records each thread can buffer, a power of two; a game's records are
+// dropped rather than holding up its player when the disk falls behind
+#define EVENT_BUFFER_RECORDS 4096
+// Segment files are rotated once they would grow past this size
+#define EVENT_SEGMENT_BYTES (16 * 1024 * 1024)
+// Most records the writer puts in one checksummed block
+#define EVENT_BLOCK_RECORDS 1024
+// Default interval between the writer's flushes
+#define EVENT_FLUSH_MS 1000
+// Identify segment files and the blocks in them
+#define EVENT_SEGMENT_MAGIC "MSEVENTS"
+#define EVENT_BLOCK_MAGIC 0x4b4c4245
+#define EVENT_VERSION 1
+// Bytes of a username kept in a record
+#define EVENT_USERNAME_BYTES 24
+
+// Types of record. Values of each:
+//   EVENT_GAME_START  width, height, mines, mode (EVENT_MODE_*)
+//   EVENT_MINES       seed, row and column of the first reveal, 0; the seed
+//                     reproduces the mines with place_mines_around()
+//   EVENT_MOVE        option, row, column, response
+//   EVENT_GAME_END    result (GAME_WON, GAME_LOST, -1 quit), duration in
+//                     seconds, moves, 0
+#define EVENT_GAME_START 1
+#define EVENT_MINES 2
+#define EVENT_MOVE 3
+#define EVENT_GAME_END 4
+// How a game was played
+#define EVENT_MODE_SESSION 0
+#define EVENT_MODE_NO_GUESS 1
+#define EVENT_MODE_MULTIPLEXED 2
+
+// One event, 64 bytes so blocks of records stay aligned in a mapped file.
+// Game ids are unique across server runs: the start time of the run the
+// game was played in, then a count of games in that run
+typedef struct event_record_t {
+    unsigned long long time_ns;
+    unsigned long long game;
+    unsigned short type;
+    unsigned short thread;
+    int values[4];
+    char username[EVENT_USERNAME_BYTES];
+    unsigned int reserved;
+} EventRecord;
+
+// Start of every segment file
+typedef struct event_segment_header_t {
+    char magic[8];
+    unsigned int version;
+    unsigned int record_bytes;
+    unsigned long long created_ns;
+    unsigned char reserved[40];
+} EventSegmentHeader;
+
+// Start of every block of records, the checksum covers the records
+typedef struct event_block_header_t {
+    unsigned int magic;
+    unsigned int count;
+    unsigned int crc;
+    unsigned int reserved;
+    unsigned long long first_ns;
+    unsigned long long last_ns;
+    unsigned char padding[32];
+} EventBlockHeader;
+
+int event_log_start(char *directory, int flush_ms);
+void event_log_stop();
+unsigned long long event_log_game_id();
+void log_event(unsigned long long game, int type, char *username, int value0,
+               int value1, int value2, int value3);
+unsigned int event_crc32(void *bytes, size_t len);
@@ -0,0 +1,178 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "event_log.h"
+
+// Filters given on the command line, unset when 0 or NULL
+unsigned long long game_filter = 0;
+char *username_filter = NULL;
+// Totals over every segment read
+long records_read = 0;
+long records_printed = 0;
+long bad_blocks = 0;
+
+int read_segment(char *path);
+void print_record(EventRecord *record);
+
+/*
+ * function main(): entry point for the event log reader
+ * algorithm: read each segment file given in turn, printing the records
+ *   that pass the filters, then a summary of what was read.
+ * input:     command line arguments.
+ * output:    0 if every segment was read without damage, 1 otherwise.
+ */
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "g:u:")) != -1) {
+        if (opt == 'g') {
+            game_filter = strtoull(optarg, NULL, 0);
+        } else if (opt == 'u') {
+            username_filter = optarg;
+        } else {
+            argc = -1;
+            break;
+        }
+    }
+    if (argc < 0 || optind >= argc) {
+        fprintf(stderr, "usage: eventlog [-g game_id] [-u username] "
+                        "segment_file...\n");
+        exit(1);
+    }
+
+    int damaged = 0;
+    for (int i = optind; i < argc; i++) {
+        damaged |= !read_segment(argv[i]);
+    }
+    fprintf(stderr, "%ld records read, %ld printed, %ld bad blocks\n",
+            records_read, records_printed, bad_blocks);
+    return damaged || bad_blocks > 0;
+}
+
+/*
+ * function read_segment(): print the records of one segment file
+ * algorithm: map the file and walk its blocks. A block whose checksum does
+ *   not match is skipped. A block cut short, as left by a crash in the
+ *   middle of a write, ends the segment.
+ * input:     path of the segment file.
+ * output:    1 if the segment was read to its end, 0 otherwise.
+ */
+int read_segment(char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        perror(path);
+        return 0;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == -1 ||
+        (size_t)info.st_size < sizeof(EventSegmentHeader)) {
+        fprintf(stderr, "%s: not an event segment\n", path);
+        close(fd);
+        return 0;
+    }
+    size_t size = info.st_size;
+    unsigned char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror(path);
+        return 0;
+    }
+
+    EventSegmentHeader *header = (EventSegmentHeader *)data;
+    if (memcmp(header->magic, EVENT_SEGMENT_MAGIC, sizeof(header->magic)) !=
+            0 ||
+        header->version != EVENT_VERSION ||
+        header->record_bytes != sizeof(EventRecord)) {
+        fprintf(stderr, "%s: not an event segment of this version\n", path);
+        munmap(data, size);
+        return 0;
+    }
+    // Blocks are read sequentially
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    int complete = 1;
+    size_t offset = sizeof(EventSegmentHeader);
+    while (offset < size) {
+        EventBlockHeader *block = (EventBlockHeader *)(data + offset);
+        size_t records_bytes =
+            offset + sizeof(EventBlockHeader) <= size &&
+                    block->magic == EVENT_BLOCK_MAGIC &&
+                    block->count <= EVENT_BLOCK_RECORDS
+                ? sizeof(EventRecord) * block->count
+                : 0;
+        if (records_bytes == 0 ||
+            offset + sizeof(EventBlockHeader) + records_bytes > size) {
+            fprintf(stderr, "%s: incomplete block at offset %zu\n", path,
+                    offset);
+            complete = 0;
+            break;
+        }
+
+        EventRecord *records =
+            (EventRecord *)(data + offset + sizeof(EventBlockHeader));
+        if (event_crc32(records, records_bytes) != block->crc) {
+            fprintf(stderr, "%s: bad checksum in block at offset %zu\n", path,
+                    offset);
+            bad_blocks++;
+        } else {
+            for (unsigned int i = 0; i < block->count; i++) {
+                print_record(&records[i]);
+            }
+            records_read += block->count;
+        }
+        offset += sizeof(EventBlockHeader) + records_bytes;
+    }
+    munmap(data, size);
+    return complete;
+}
+
+/*
+ * function print_record(): print one record if it passes the filters
+ * algorithm: one line per record: UTC time, game id, player, thread, the
+ *   event and its values by name.
+ * input:     pointer to record.
+ * output:    none.
+ */
+void print_record(EventRecord *record) {
+    char username[EVENT_USERNAME_BYTES + 1] = {0};
+    memcpy(username, record->username, EVENT_USERNAME_BYTES);
+    if ((game_filter != 0 && record->game != game_filter) ||
+        (username_filter != NULL && strcmp(username, username_filter) != 0)) {
+        return;
+    }
+    records_printed++;
+
+    time_t seconds = record->time_ns / 1000000000ULL;
+    struct tm utc;
+    gmtime_r(&seconds, &utc);
+    char when[32];
+    strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &utc);
+    printf("%s.%06lluZ game %#llx %s thread %u ", when,
+           (record->time_ns % 1000000000ULL) / 1000, record->game, username,
+           record->thread);
+
+    int *values = record->values;
+    if (record->type == EVENT_GAME_START) {
+        const char *modes[] = {"session", "no-guess", "multiplexed"};
+        printf("start %dx%d mines %d %s\n", values[0], values[1], values[2],
+               values[3] >= 0 && values[3] <= 2 ? modes[values[3]] : "?");
+    } else if (record->type == EVENT_MINES) {
+        printf("mines seed %u around %c%d\n", (unsigned int)values[0],
+               'A' + values[1], values[2] + 1);
+    } else if (record->type == EVENT_MOVE) {
+        printf("move %c %c%d response %d\n", values[0], 'A' + values[1],
+               values[2] + 1, values[3]);
+    } else if (record->type == EVENT_GAME_END) {
+        printf("end result %d duration %d moves %d\n", values[0], values[1],
+               values[2]);
+    } else {
+        printf("type %u %d %d %d %d\n", record->type, values[0], values[1],
+               values[2], values[3]);
+    }
+}
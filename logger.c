@@ -0,0 +1,386 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "thread_buffer.h"
+
+// One message, formatted by the thread that logged it
+typedef struct log_entry_t {
+    unsigned long long time_ns;
+    unsigned short len;
+    unsigned char level;
+    // Set once a signal handler has filled the entry in
+    unsigned char ready;
+    char text[LOGGER_MESSAGE_BYTES];
+} LogEntry;
+
+// Messages of one thread, appended at the tail and written from the head
+typedef struct log_buffer_t {
+    ThreadBuffer link;
+    LogEntry entries[LOGGER_BUFFER_MESSAGES];
+    unsigned int head;
+    unsigned int tail;
+    unsigned long dropped;
+} LogBuffer;
+
+// Messages below this level are discarded before they are formatted
+int logger_level = LOG_LEVEL_INFO;
+const char *logger_level_names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+// Whether messages go through the writer, otherwise they are written
+// straight away by the thread that logs them
+bool logger_running = false;
+// Buffers of every thread that logged
+ThreadBufferList logger_buffers;
+static __thread LogBuffer *thread_log = NULL;
+// Messages from signal handlers. Entries are claimed by advancing
+// logger_signal_claimed and handed to the writer through their ready flag,
+// the writer frees them by advancing logger_signal_written
+LogEntry logger_signal_entries[LOGGER_SIGNAL_MESSAGES];
+unsigned int logger_signal_claimed = 0;
+unsigned int logger_signal_written = 0;
+unsigned long logger_signal_dropped = 0;
+
+// Writer thread and what it has gathered for the next write
+BufferWriter logger_writer;
+char logger_batch[LOGGER_BATCH_BYTES];
+size_t logger_batch_len = 0;
+int logger_batch_fd = -1;
+
+/*
+ * function logger_clock_ns(): wall clock time in nanoseconds
+ * input:     none.
+ * output:    nanoseconds since the epoch.
+ */
+unsigned long long logger_clock_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*
+ * function logger_fd(): where messages of a level are written
+ * input:     level.
+ * output:    standard error for warnings and errors, standard output
+ *   otherwise.
+ */
+int logger_fd(int level) {
+    return level >= LOG_LEVEL_WARN ? STDERR_FILENO : STDOUT_FILENO;
+}
+
+/*
+ * function write_all(): write bytes out, carrying on after partial writes
+ * input:     file descriptor, bytes and their number.
+ * output:    none; bytes that cannot be written are lost.
+ */
+void write_all(int fd, char *bytes, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, bytes, len);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return;
+        }
+        bytes += written;
+        len -= written;
+    }
+}
+
+/*
+ * function format_log_line(): turn an entry into a line of output
+ * algorithm: "HH:MM:SS.mmm LEVEL message" in UTC, worked out digit by digit
+ *   rather than with the stdio and time functions so that it is safe to use
+ *   from a signal handler.
+ * input:     entry, buffer of at least LOGGER_MESSAGE_BYTES + 32 bytes.
+ * output:    length of the line, which ends in a newline.
+ */
+size_t format_log_line(LogEntry *entry, char *line) {
+    unsigned long long ms = entry->time_ns / 1000000ULL;
+    unsigned int day_ms = ms % (24 * 3600 * 1000ULL);
+    unsigned int fields[4] = {day_ms / 3600000, day_ms / 60000 % 60,
+                              day_ms / 1000 % 60, day_ms % 1000};
+    size_t len = 0;
+    for (int i = 0; i < 4; i++) {
+        if (i == 3) {
+            line[len++] = '.';
+            line[len++] = '0' + fields[i] / 100;
+        } else if (i > 0) {
+            line[len++] = ':';
+        }
+        line[len++] = '0' + fields[i] / 10 % 10;
+        line[len++] = '0' + fields[i] % 10;
+    }
+    line[len++] = ' ';
+    const char *name = logger_level_names[entry->level];
+    size_t name_len = strlen(name);
+    memcpy(line + len, name, name_len);
+    len += name_len;
+    line[len++] = ' ';
+    memcpy(line + len, entry->text, entry->len);
+    len += entry->len;
+    line[len++] = '\n';
+    return len;
+}
+
+/*
+ * function write_log_entry(): write an entry out straight away
+ * algorithm: used while the writer is not running. Only async-signal-safe
+ *   calls are made.
+ * input:     entry.
+ * output:    none.
+ */
+void write_log_entry(LogEntry *entry) {
+    char line[LOGGER_MESSAGE_BYTES + 32];
+    size_t len = format_log_line(entry, line);
+    write_all(logger_fd(entry->level), line, len);
+}
+
+/*
+ * function flush_log_batch(): write out what the writer has gathered
+ * input:     none.
+ * output:    none.
+ */
+void flush_log_batch() {
+    if (logger_batch_len > 0) {
+        write_all(logger_batch_fd, logger_batch, logger_batch_len);
+        logger_batch_len = 0;
+    }
+}
+
+/*
+ * function batch_log_entry(): add an entry to the writer's next write
+ * algorithm: entries for the same stream are gathered, the batch is written
+ *   once it is full or an entry for the other stream comes along.
+ * input:     entry.
+ * output:    none.
+ */
+void batch_log_entry(LogEntry *entry) {
+    int fd = logger_fd(entry->level);
+    if (fd != logger_batch_fd ||
+        logger_batch_len + LOGGER_MESSAGE_BYTES + 32 > LOGGER_BATCH_BYTES) {
+        flush_log_batch();
+        logger_batch_fd = fd;
+    }
+    logger_batch_len +=
+        format_log_line(entry, logger_batch + logger_batch_len);
+}
+
+/*
+ * function drain_log_buffers(): write out every message buffered so far
+ * algorithm: messages from signal handlers first, then each thread's in the
+ *   order it logged them, freeing the space as each buffer is read. Threads
+ *   are drained one after another, so lines of different threads logged
+ *   within one flush interval may be out of time order.
+ * input:     whether the flush interval ran out, not needed.
+ * output:    none.
+ */
+void drain_log_buffers(bool timed_out) {
+    (void)timed_out;
+    for (;;) {
+        LogEntry *entry =
+            &logger_signal_entries[logger_signal_written &
+                                   (LOGGER_SIGNAL_MESSAGES - 1)];
+        if (!__atomic_load_n(&entry->ready, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        batch_log_entry(entry);
+        entry->ready = 0;
+        __atomic_store_n(&logger_signal_written, logger_signal_written + 1,
+                         __ATOMIC_RELEASE);
+    }
+
+    ThreadBuffer *link = thread_buffers(&logger_buffers);
+    for (; link != NULL; link = link->next) {
+        LogBuffer *buffer = (LogBuffer *)link;
+        unsigned int head = buffer->head;
+        unsigned int tail = __atomic_load_n(&buffer->tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            batch_log_entry(
+                &buffer->entries[head & (LOGGER_BUFFER_MESSAGES - 1)]);
+        }
+        __atomic_store_n(&buffer->head, head, __ATOMIC_RELEASE);
+    }
+    flush_log_batch();
+}
+
+/*
+ * function logger_set_level(): set the lowest level that is logged
+ * input:     name of the level, in any case.
+ * output:    1 on success, 0 if there is no level of that name.
+ */
+int logger_set_level(char *name) {
+    for (int level = LOG_LEVEL_DEBUG; level <= LOG_LEVEL_ERROR; level++) {
+        if (strcasecmp(name, logger_level_names[level]) == 0) {
+            __atomic_store_n(&logger_level, level, __ATOMIC_RELAXED);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * function logger_start(): hand messages to a writer thread from now on
+ * algorithm: start the writer and make sure what is buffered is written out
+ *   even if the process exits without stopping the logger.
+ * input:     none.
+ * output:    1 on success, 0 on failure, after which messages are still
+ *   written straight away.
+ */
+int logger_start() {
+    if (!buffer_writer_start(&logger_writer, LOGGER_FLUSH_MS,
+                             drain_log_buffers)) {
+        log_message(LOG_LEVEL_ERROR, "Couldn't start log writer");
+        return 0;
+    }
+    atexit(logger_stop);
+    __atomic_store_n(&logger_running, true, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/*
+ * function logger_stop(): write out what is buffered and stop the writer
+ * algorithm: later messages are written straight away by the threads that
+ *   log them. Buffers are kept, as threads may still hold them.
+ * input:     none.
+ * output:    none.
+ */
+void logger_stop() {
+    if (!__atomic_exchange_n(&logger_running, false, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    buffer_writer_stop(&logger_writer);
+
+    unsigned long dropped =
+        __atomic_load_n(&logger_signal_dropped, __ATOMIC_RELAXED);
+    ThreadBuffer *link = thread_buffers(&logger_buffers);
+    for (; link != NULL; link = link->next) {
+        dropped += ((LogBuffer *)link)->dropped;
+    }
+    if (dropped > 0) {
+        log_message(LOG_LEVEL_WARN, "Logger: %lu messages dropped", dropped);
+    }
+}
+
+/*
+ * function thread_log_buffer(): buffer of the calling thread
+ * algorithm: registered on the thread's first message.
+ * input:     none.
+ * output:    pointer to the buffer, NULL if memory ran out.
+ */
+LogBuffer *thread_log_buffer() {
+    if (thread_log == NULL) {
+        thread_log = thread_buffer_register(&logger_buffers, sizeof(LogBuffer));
+    }
+    return thread_log;
+}
+
+/*
+ * function log_message(): log a message, formatted as printf() does
+ * algorithm: format the message into the next entry of the calling thread's
+ *   buffer without blocking; it is dropped and counted if the writer has
+ *   fallen behind. The writer is woken once the buffer reaches half full.
+ *   errno is kept, so %m gives the error of the call that failed. Not for
+ *   use from signal handlers, see log_signal_safe().
+ * input:     level, format and its arguments.
+ * output:    none.
+ */
+void log_message(int level, const char *format, ...) {
+    if (level < __atomic_load_n(&logger_level, __ATOMIC_RELAXED)) {
+        return;
+    }
+    int error = errno;
+    LogEntry direct;
+    LogEntry *entry = &direct;
+    LogBuffer *buffer = NULL;
+    unsigned int tail = 0;
+    if (__atomic_load_n(&logger_running, __ATOMIC_ACQUIRE) &&
+        (buffer = thread_log_buffer()) != NULL) {
+        tail = buffer->tail;
+        unsigned int used =
+            tail - __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+        if (used == LOGGER_BUFFER_MESSAGES) {
+            buffer->dropped++;
+            errno = error;
+            return;
+        }
+        if (used == LOGGER_BUFFER_MESSAGES / 2) {
+            buffer_writer_wake(&logger_writer);
+        }
+        entry = &buffer->entries[tail & (LOGGER_BUFFER_MESSAGES - 1)];
+    }
+
+    entry->time_ns = logger_clock_ns();
+    entry->level = level;
+    va_list arguments;
+    va_start(arguments, format);
+    errno = error;
+    int len = vsnprintf(entry->text, LOGGER_MESSAGE_BYTES, format, arguments);
+    va_end(arguments);
+    if (len < 0) {
+        len = 0;
+    }
+    entry->len = len < LOGGER_MESSAGE_BYTES ? len : LOGGER_MESSAGE_BYTES - 1;
+    if (entry == &direct) {
+        write_log_entry(entry);
+    } else {
+        __atomic_store_n(&buffer->tail, tail + 1, __ATOMIC_RELEASE);
+    }
+    errno = error;
+}
+
+/*
+ * function log_signal_safe(): log a fixed message from a signal handler
+ * algorithm: claim an entry of the signal buffer with a compare and swap,
+ *   which may interrupt any thread, fill it in and mark it ready for the
+ *   writer. Nothing is formatted and nothing waits; the message is dropped
+ *   and counted if the buffer is full, and written straight away while the
+ *   writer is not running.
+ * input:     level, message.
+ * output:    none.
+ */
+void log_signal_safe(int level, const char *message) {
+    if (level < __atomic_load_n(&logger_level, __ATOMIC_RELAXED)) {
+        return;
+    }
+    int error = errno;
+    LogEntry direct;
+    LogEntry *entry = &direct;
+    if (__atomic_load_n(&logger_running, __ATOMIC_ACQUIRE)) {
+        unsigned int claimed =
+            __atomic_load_n(&logger_signal_claimed, __ATOMIC_RELAXED);
+        do {
+            if (claimed - __atomic_load_n(&logger_signal_written,
+                                          __ATOMIC_ACQUIRE) >=
+                LOGGER_SIGNAL_MESSAGES) {
+                __atomic_add_fetch(&logger_signal_dropped, 1,
+                                   __ATOMIC_RELAXED);
+                errno = error;
+                return;
+            }
+        } while (!__atomic_compare_exchange_n(&logger_signal_claimed, &claimed,
+                                              claimed + 1, true,
+                                              __ATOMIC_ACQUIRE,
+                                              __ATOMIC_RELAXED));
+        entry = &logger_signal_entries[claimed & (LOGGER_SIGNAL_MESSAGES - 1)];
+    }
+
+    size_t len = strlen(message);
+    entry->len = len < LOGGER_MESSAGE_BYTES ? len : LOGGER_MESSAGE_BYTES - 1;
+    memcpy(entry->text, message, entry->len);
+    entry->time_ns = logger_clock_ns();
+    entry->level = level;
+    if (entry == &direct) {
+        write_log_entry(entry);
+    } else {
+        __atomic_store_n(&entry->ready, 1, __ATOMIC_RELEASE);
+    }
+    errno = error;
+}
@@ -0,0 +1,23 @@
+// Levels of a message; messages below the logger's level are discarded
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+// Messages each thread can buffer, a power of two. A message that does not
+// fit is dropped and counted rather than making the thread wait
+#define LOGGER_BUFFER_MESSAGES 256
+// Messages from signal handlers waiting for the writer, a power of two
+#define LOGGER_SIGNAL_MESSAGES 16
+// Longest message kept, longer ones are cut short
+#define LOGGER_MESSAGE_BYTES 240
+// Interval between the writer's flushes
+#define LOGGER_FLUSH_MS 100
+// Bytes the writer gathers before writing them out at once
+#define LOGGER_BATCH_BYTES 65536
+
+int logger_start();
+void logger_stop();
+int logger_set_level(char *name);
+void log_message(int level, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+void log_signal_safe(int level, const char *message);
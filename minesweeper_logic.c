@@ -5,36 +5,155 @@
 // Mutex used to control synchronise use of the rand() function
 pthread_mutex_t rand_mutex;
 
-// Resets game field for a new gamew
-void initialise_game(GameState *game) {
-    game->mines_left = NUM_MINES;
-    for (int row = 0; row < NUM_TILES_Y; row++) {
-        for (int column = 0; column < NUM_TILES_X; column++) {
-            Tile *tile = &game->tiles[row][column];
+// Sets up the fields of a board of the given size, returns 0 if the size is
+// invalid
+static int set_up_game(GameState *game, int width, int height,
+                       int num_mines) {
+    if (width <= 0 || height <= 0 || num_mines < 0 ||
+        num_mines >= width * height) {
+        return 0;
+    }
+
+    game->width = width;
+    game->height = height;
+    game->num_mines = num_mines;
+    game->mines_left = num_mines;
+    game->mines_placed = false;
+    game->change_log = NULL;
+    game->num_changes = 0;
+    return 1;
+}
+
+// Allocates the tiles for a board of the given size, returns 0 if the size is
+// invalid or the allocation failed
+int create_game(GameState *game, int width, int height, int num_mines) {
+    if (!set_up_game(game, width, height, num_mines)) {
+        return 0;
+    }
+    game->owns_memory = true;
+    game->tiles = calloc((size_t)width * height, sizeof(Tile));
+    game->reveal_stack = malloc(sizeof(int) * width * height);
+    if (game->tiles == NULL || game->reveal_stack == NULL) {
+        destroy_game(game);
+        return 0;
+    }
+    return 1;
+}
+
+// Bytes of memory create_game_in() lays a board of the given size out in
+size_t game_memory_size(int width, int height) {
+    return (size_t)width * height * (sizeof(Tile) + sizeof(int));
+}
+
+// Sets up a board in memory of game_memory_size() bytes owned by the caller,
+// destroy_game() leaves that memory alone. Returns 0 if the size is invalid
+int create_game_in(GameState *game, int width, int height, int num_mines,
+                   void *memory) {
+    if (memory == NULL || !set_up_game(game, width, height, num_mines)) {
+        return 0;
+    }
+    game->owns_memory = false;
+    game->tiles = memory;
+    game->reveal_stack = (int *)&game->tiles[width * height];
+    clear_board(game);
+    return 1;
+}
+
+// Frees the tiles of a board created with create_game()
+void destroy_game(GameState *game) {
+    if (game->owns_memory) {
+        free(game->tiles);
+        free(game->reveal_stack);
+    }
+    free(game->change_log);
+    game->tiles = NULL;
+    game->reveal_stack = NULL;
+    game->change_log = NULL;
+}
+
+// Starts recording which tiles change, a single move changes each tile at
+// most once apart from the flag that ends it. Returns 0 on allocation failure
+int enable_change_log(GameState *game) {
+    game->num_changes = 0;
+    game->change_log = malloc(sizeof(int) * (game->width * game->height + 1));
+    return game->change_log != NULL;
+}
+
+// Resets game field for a new gamew, mines are placed by the first reveal so
+// a game that is quit straight away never pays for generation
+void initialise_game(GameState *game) { clear_board(game); }
+
+// Clears every tile of the board without placing any mines
+void clear_board(GameState *game) {
+    game->mines_left = game->num_mines;
+    game->mines_placed = false;
+    for (int row = 0; row < game->height; row++) {
+        for (int column = 0; column < game->width; column++) {
+            Tile *tile = GAME_TILE(game, row, column);
             tile->adjacent_mines = 0;
             tile->revealed = false;
             tile->is_mine = false;
             tile->flagged = false;
         }
     }
-
-    // lock mutex to only allow one thread to use the rand() function at a time
-    pthread_mutex_lock(&rand_mutex);
-    place_mines(game);
-    pthread_mutex_unlock(&rand_mutex);
 }
 
 // Place mines in random spots on the game board
 void place_mines(GameState *game) {
-    for (int i = 0; i < NUM_MINES; i++) {
+    for (int i = 0; i < game->num_mines; i++) {
         int row, column;
         do {
-            row = rand() % NUM_TILES_X;
-            column = rand() % NUM_TILES_Y;
-        } while (game->tiles[row][column].is_mine);
-        game->tiles[row][column].is_mine = true;
+            row = rand() % game->height;
+            column = rand() % game->width;
+        } while (GAME_TILE(game, row, column)->is_mine);
+        GAME_TILE(game, row, column)->is_mine = true;
         increase_number_of_adjacent_mines(game, row, column);
     }
+    game->mines_placed = true;
+}
+
+// Place mines in random spots using a caller owned random state, keeping the
+// tiles around a given tile free so revealing it opens a region. Only the tile
+// itself is kept free when the board is too dense to spare its neighbours.
+void place_mines_around(GameState *game, unsigned int *seed, int safe_row,
+                        int safe_column) {
+    int spared = 0;
+    for (int row = safe_row - 1; row <= safe_row + 1; row++) {
+        for (int column = safe_column - 1; column <= safe_column + 1;
+             column++) {
+            if (row >= 0 && column >= 0 && row < game->height &&
+                column < game->width) {
+                spared++;
+            }
+        }
+    }
+    int radius = game->num_mines <= game->width * game->height - spared ? 1 : 0;
+    game->seed = *seed;
+
+    for (int i = 0; i < game->num_mines; i++) {
+        int row, column;
+        do {
+            row = rand_r(seed) % game->height;
+            column = rand_r(seed) % game->width;
+        } while (GAME_TILE(game, row, column)->is_mine ||
+                 (abs(row - safe_row) <= radius &&
+                  abs(column - safe_column) <= radius));
+        GAME_TILE(game, row, column)->is_mine = true;
+        increase_number_of_adjacent_mines(game, row, column);
+    }
+    game->mines_placed = true;
+}
+
+// Places the mines of a game when its first tile is revealed, keeping that
+// tile and its neighbours clear so the first reveal can never lose
+void place_first_click_mines(GameState *game, int row, int column) {
+    // lock mutex to only allow one thread to use the rand() function at a
+    // time, the placement itself runs on a seed drawn from it
+    pthread_mutex_lock(&rand_mutex);
+    unsigned int seed = rand();
+    pthread_mutex_unlock(&rand_mutex);
+
+    place_mines_around(game, &seed, row, column);
 }
 
 // Increases the count of adjacent mines on all tiles surrounding a tile
@@ -44,32 +163,55 @@ void increase_number_of_adjacent_mines(GameState *game, int row, int column) {
     for (int i = -1; i <= 1; i++) {
         for (int j = -1; j <= 1; j++) {
             // ensure the given coordinate is valid (i.e. not off the playfield)
-            if (row + i >= 0 && column + j >= 0 && row + i < NUM_TILES_Y &&
-                column + j < NUM_TILES_X) {
+            if (row + i >= 0 && column + j >= 0 && row + i < game->height &&
+                column + j < game->width) {
                 // increment mine count of surrounding tiles
-                game->tiles[row + i][column + j].adjacent_mines++;
+                GAME_TILE(game, row + i, column + j)->adjacent_mines++;
             }
         }
     }
 }
 
-// change a tile's game state to be revealed
+// change a tile's game state to be revealed, along with the surrounding
+// region while tiles without adjacent mines are found. Tiles still to be
+// expanded are kept on the game's stack so huge empty regions cannot overflow
+// the call stack.
 void reveal_tile(GameState *game, int row, int column) {
     // ensure the specified tile is a valid coordinate (on the game board)
-    if (row >= 0 && column >= 0 && row < NUM_TILES_Y && column < NUM_TILES_X) {
-        // reveal the tile if not already revealed
-        Tile *tile = &game->tiles[row][column];
-        if (tile->revealed) {
-            return;
+    if (row < 0 || column < 0 || row >= game->height ||
+        column >= game->width) {
+        return;
+    }
+    // reveal the tile if not already revealed
+    Tile *tile = GAME_TILE(game, row, column);
+    if (tile->revealed) {
+        return;
+    }
+    tile->revealed = true;
+    LOG_CHANGE(game, row * game->width + column);
+
+    // every tile is pushed at most once as it is revealed when pushed
+    int *stack = game->reveal_stack;
+    int top = 0;
+    stack[top++] = row * game->width + column;
+    while (top > 0) {
+        int index = stack[--top];
+        if (game->tiles[index].adjacent_mines != 0) {
+            continue;
         }
-        tile->revealed = true;
-
-        // if the tile has no adjacent mines, recursively call the function on
-        // all surrounding tiles
-        if (tile->adjacent_mines == 0) {
-            for (int i = -1; i <= 1; i++) {
-                for (int j = -1; j <= 1; j++) {
-                    reveal_tile(game, row + i, column + j);
+
+        // reveal all surrounding tiles of a tile with no adjacent mines
+        int center_row = index / game->width;
+        int center_column = index % game->width;
+        for (int i = center_row - 1; i <= center_row + 1; i++) {
+            for (int j = center_column - 1; j <= center_column + 1; j++) {
+                if (i >= 0 && j >= 0 && i < game->height && j < game->width) {
+                    int neighbour = i * game->width + j;
+                    if (!game->tiles[neighbour].revealed) {
+                        game->tiles[neighbour].revealed = true;
+                        LOG_CHANGE(game, neighbour);
+                        stack[top++] = neighbour;
+                    }
                 }
             }
         }
@@ -79,13 +221,23 @@ void reveal_tile(GameState *game, int row, int column) {
 // Places a flag on a specified tile
 int place_flag(GameState *game, int row, int column) {
     // ensure the coordinate is valid (on the board)
-    if (row >= 0 && column >= 0 && row < NUM_TILES_Y && column < NUM_TILES_X) {
-        Tile *tile = &game->tiles[row][column];
+    if (row >= 0 && column >= 0 && row < game->height &&
+        column < game->width) {
+        Tile *tile = GAME_TILE(game, row, column);
+
+        // a tile can only be flagged once, so the same mine is never counted
+        // twice
+        if (tile->revealed) {
+            return TILE_ALREADY_REVEALED;
+        } else if (tile->flagged) {
+            return NORMAL;
+        }
 
         // flag the tile if it is a mine and decrement the number of remaining
         // mines
         if (tile->is_mine) {
             tile->flagged = true;
+            LOG_CHANGE(game, row * game->width + column);
             game->mines_left--;
 
             if (game->mines_left == 0) {
@@ -104,9 +256,10 @@ int place_flag(GameState *game, int row, int column) {
 }
 
 void update_end_board(GameState *game, int state) {
-    for (int row = 0; row < NUM_TILES_Y; row++) {
-        for (int column = 0; column < NUM_TILES_X; column++) {
-            Tile *tile = &game->tiles[row][column];
+    for (int row = 0; row < game->height; row++) {
+        for (int column = 0; column < game->width; column++) {
+            Tile *tile = GAME_TILE(game, row, column);
+            bool was_revealed = tile->revealed;
 
             if (tile->is_mine) {
                 tile->revealed = true;
@@ -115,6 +268,9 @@ void update_end_board(GameState *game, int state) {
             } else if (state == GAME_LOST) {
                 tile->revealed = false;
             }
+            if (tile->revealed != was_revealed) {
+                LOG_CHANGE(game, row * game->width + column);
+            }
         }
     }
 }
@@ -122,14 +278,21 @@ void update_end_board(GameState *game, int state) {
 // Handles logic of revealing a specified tile
 int search_tiles(GameState *game, int row, int column) {
     // check that the coordinate is valid
-    if (row >= 0 && column >= 0 && row < NUM_TILES_Y && column < NUM_TILES_X) {
-        Tile *tile = &game->tiles[row][column];
+    if (row >= 0 && column >= 0 && row < game->height &&
+        column < game->width) {
+        Tile *tile = GAME_TILE(game, row, column);
+
+        // mines only exist once the first tile has been chosen
+        if (!game->mines_placed) {
+            place_first_click_mines(game, row, column);
+        }
 
         // check state of mine and take appropriate action
         if (tile->revealed) {
             return TILE_ALREADY_REVEALED;
         } else if (tile->is_mine) {
             tile->revealed = true;
+            LOG_CHANGE(game, row * game->width + column);
             update_end_board(game, GAME_LOST);
             return GAME_LOST;
         } else {
@@ -140,24 +303,114 @@ int search_tiles(GameState *game, int row, int column) {
     return INVALID_COORDINATES;
 }
 
+// Reveals every unflagged neighbour of a revealed number whose flagged
+// neighbours already account for all of its adjacent mines
+int chord(GameState *game, int row, int column) {
+    if (row < 0 || column < 0 || row >= game->height ||
+        column >= game->width) {
+        return INVALID_COORDINATES;
+    }
+    Tile *tile = GAME_TILE(game, row, column);
+    if (!tile->revealed || tile->adjacent_mines == 0) {
+        return CHORD_UNAVAILABLE;
+    }
+
+    int flags = 0;
+    for (int r = row - 1; r <= row + 1; r++) {
+        for (int c = column - 1; c <= column + 1; c++) {
+            if (r >= 0 && c >= 0 && r < game->height && c < game->width &&
+                GAME_TILE(game, r, c)->flagged) {
+                flags++;
+            }
+        }
+    }
+    if (flags != tile->adjacent_mines) {
+        return CHORD_UNAVAILABLE;
+    }
+
+    for (int r = row - 1; r <= row + 1; r++) {
+        for (int c = column - 1; c <= column + 1; c++) {
+            if (r < 0 || c < 0 || r >= game->height || c >= game->width) {
+                continue;
+            }
+            Tile *neighbour = GAME_TILE(game, r, c);
+            if (neighbour->flagged || neighbour->revealed) {
+                continue;
+            }
+            if (neighbour->is_mine) {
+                neighbour->revealed = true;
+                LOG_CHANGE(game, r * game->width + c);
+                update_end_board(game, GAME_LOST);
+                return GAME_LOST;
+            }
+            reveal_tile(game, r, c);
+        }
+    }
+    return NORMAL;
+}
+
+// Applies a move given by its menu option: 'R' reveals, 'P' flags and 'C'
+// chords the tile
+int play_move(GameState *game, char option, int row, int column) {
+    if (option == 'R') {
+        return search_tiles(game, row, column);
+    } else if (option == 'P') {
+        return place_flag(game, row, column);
+    } else if (option == 'C') {
+        return chord(game, row, column);
+    }
+    return INVALID_COORDINATES;
+}
+
+// Packs a tile into one byte, only revealed tiles carry their mine data
+unsigned char pack_tile(Tile *tile) {
+    unsigned char byte = tile->flagged ? TILE_BYTE_FLAGGED : 0;
+    if (tile->revealed) {
+        byte |= TILE_BYTE_REVEALED;
+        byte |= tile->adjacent_mines & TILE_BYTE_ADJACENT;
+        if (tile->is_mine) {
+            byte |= TILE_BYTE_MINE;
+        }
+    }
+    return byte;
+}
+
+// Packs every bit of a tile into one byte, for keeping a game rather than
+// showing it to a client
+unsigned char save_tile(Tile *tile) {
+    unsigned char byte = tile->adjacent_mines & TILE_BYTE_ADJACENT;
+    byte |= tile->revealed ? TILE_BYTE_REVEALED : 0;
+    byte |= tile->is_mine ? TILE_BYTE_MINE : 0;
+    byte |= tile->flagged ? TILE_BYTE_FLAGGED : 0;
+    return byte;
+}
+
+// Unpacks a tile from the byte made by pack_tile() or save_tile()
+void unpack_tile(Tile *tile, unsigned char byte) {
+    tile->adjacent_mines = byte & TILE_BYTE_ADJACENT;
+    tile->revealed = (byte & TILE_BYTE_REVEALED) != 0;
+    tile->is_mine = (byte & TILE_BYTE_MINE) != 0;
+    tile->flagged = (byte & TILE_BYTE_FLAGGED) != 0;
+}
+
 void print_game_state(GameState *game) {
     printf("\nRemaining mines: %d\n", game->mines_left);
 
     printf("\n    ");
-    for (int column = 1; column <= NUM_TILES_X; column++) {
+    for (int column = 1; column <= game->width; column++) {
         printf("%d ", column);
     }
 
     printf("\n----");
-    for (int column = 0; column < NUM_TILES_X; column++) {
+    for (int column = 0; column < game->width; column++) {
         printf("--");
     }
 
-    for (int row = 0; row < NUM_TILES_Y; row++) {
+    for (int row = 0; row < game->height; row++) {
         printf("\n%c | ", row + 'A');
 
-        for (int column = 0; column < NUM_TILES_X; column++) {
-            Tile *tile = &game->tiles[row][column];
+        for (int column = 0; column < game->width; column++) {
+            Tile *tile = GAME_TILE(game, row, column);
 
             if (tile->revealed) {
                 if (tile->is_mine) {
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+// Default board used for a standard game
 #define NUM_TILES_X 9
 #define NUM_TILES_Y 9
 #define NUM_MINES 10
@@ -14,17 +15,67 @@ typedef struct tile_struct {
     bool flagged;
 } Tile;
 
-//structure representing the state of a particular game
+//structure representing the state of a particular game, tiles are stored
+//row by row in a single allocation of width * height entries. Mines are only
+//placed once the first tile is revealed.
 typedef struct game_struct {
+    int width;
+    int height;
+    int num_mines;
     int mines_left;
-    Tile tiles[NUM_TILES_X][NUM_TILES_Y];
+    bool mines_placed;
+    Tile *tiles;
+    // Work space for revealing regions without recursion
+    int *reveal_stack;
+    // Indices of tiles changed since the log was cleared, NULL when unused
+    int *change_log;
+    int num_changes;
+    // Random state the mines were placed from, place_mines_around() with it
+    // and the first revealed tile places them again
+    unsigned int seed;
+    // Whether tiles and reveal_stack were allocated by create_game(), rather
+    // than laid out in memory the caller owns
+    bool owns_memory;
 } GameState;
 
+// Bits of a tile packed into one byte as the client sees it
+#define TILE_BYTE_ADJACENT 0x0f
+#define TILE_BYTE_REVEALED 0x10
+#define TILE_BYTE_MINE 0x20
+#define TILE_BYTE_FLAGGED 0x40
+
+// Access the tile at a given row and column of a game
+#define GAME_TILE(game, row, column) \
+    (&(game)->tiles[(row) * (game)->width + (column)])
+
+// Record that the tile at an index changed, if the game keeps a change log
+#define LOG_CHANGE(game, index)                                  \
+    do {                                                         \
+        if ((game)->change_log != NULL) {                        \
+            (game)->change_log[(game)->num_changes++] = (index); \
+        }                                                        \
+    } while (0)
+
+int create_game(GameState *game, int width, int height, int num_mines);
+size_t game_memory_size(int width, int height);
+int create_game_in(GameState *game, int width, int height, int num_mines,
+                   void *memory);
+void destroy_game(GameState *game);
+int enable_change_log(GameState *game);
 void initialise_game(GameState *game);
+void clear_board(GameState *game);
 void place_mines(GameState *game);
+void place_mines_around(GameState *game, unsigned int *seed, int safe_row,
+                        int safe_column);
+void place_first_click_mines(GameState *game, int row, int column);
 void increase_number_of_adjacent_mines(GameState *game, int row, int column);
 void reveal_tile(GameState *game, int row, int column);
 int place_flag(GameState *game, int row, int column);
 int search_tiles(GameState *game, int row, int column);
+int chord(GameState *game, int row, int column);
+int play_move(GameState *game, char option, int row, int column);
 void print_game_state(GameState *game);
-void update_end_board(GameState *game, int state);
\ No newline at end of file
+unsigned char pack_tile(Tile *tile);
+unsigned char save_tile(Tile *tile);
+void unpack_tile(Tile *tile, unsigned char byte);
+void update_end_board(GameState *game, int state);
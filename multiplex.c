@@ -0,0 +1,197 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "multiplex.h"
+
+/*
+ * function mux_slot(): home slot of a game id
+ * algorithm: multiplicative hash so sequential ids spread over the table.
+ * input:     game id.
+ * output:    slot index.
+ */
+static unsigned int mux_slot(int id) {
+    return ((unsigned int)id * 2654435761u) & (MUX_TABLE_SLOTS - 1);
+}
+
+/*
+ * function mux_table_create(): allocate an empty game table
+ * input:     none.
+ * output:    pointer to table, or NULL on failure.
+ */
+MuxTable *mux_table_create() { return calloc(1, sizeof(MuxTable)); }
+
+/*
+ * function mux_find(): look up the value of a game id
+ * input:     pointer to table, game id.
+ * output:    value, or NULL if the id is not in the table.
+ */
+void *mux_find(MuxTable *table, int id) {
+    for (unsigned int slot = mux_slot(id); table->slots[slot].value != NULL;
+         slot = (slot + 1) & (MUX_TABLE_SLOTS - 1)) {
+        if (table->slots[slot].id == id) {
+            return table->slots[slot].value;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * function mux_insert(): add a game id to the table
+ * input:     pointer to table, game id and its non NULL value.
+ * output:    1 on success, 0 if the id is taken or the table is full.
+ */
+int mux_insert(MuxTable *table, int id, void *value) {
+    if (table->count >= MUX_MAX_GAMES || mux_find(table, id) != NULL) {
+        return 0;
+    }
+    unsigned int slot = mux_slot(id);
+    while (table->slots[slot].value != NULL) {
+        slot = (slot + 1) & (MUX_TABLE_SLOTS - 1);
+    }
+    table->slots[slot].id = id;
+    table->slots[slot].value = value;
+    table->count++;
+    return 1;
+}
+
+/*
+ * function mux_remove(): remove a game id from the table
+ * algorithm: empty its slot, then move later entries of the same probe run
+ *   back so lookups never stop early at the hole.
+ * input:     pointer to table, game id.
+ * output:    the removed value, or NULL if the id was not in the table.
+ */
+void *mux_remove(MuxTable *table, int id) {
+    unsigned int slot = mux_slot(id);
+    while (table->slots[slot].value != NULL && table->slots[slot].id != id) {
+        slot = (slot + 1) & (MUX_TABLE_SLOTS - 1);
+    }
+    void *value = table->slots[slot].value;
+    if (value == NULL) {
+        return NULL;
+    }
+    table->slots[slot].value = NULL;
+    table->count--;
+
+    unsigned int hole = slot;
+    for (slot = (slot + 1) & (MUX_TABLE_SLOTS - 1);
+         table->slots[slot].value != NULL;
+         slot = (slot + 1) & (MUX_TABLE_SLOTS - 1)) {
+        unsigned int home = mux_slot(table->slots[slot].id);
+        // Move the entry unless its home lies after the hole in the run
+        if (((slot - home) & (MUX_TABLE_SLOTS - 1)) >=
+            ((slot - hole) & (MUX_TABLE_SLOTS - 1))) {
+            table->slots[hole] = table->slots[slot];
+            table->slots[slot].value = NULL;
+            hole = slot;
+        }
+    }
+    return value;
+}
+
+/*
+ * function mux_append(): make room for more bytes at the end of a buffer
+ * algorithm: double the capacity until the bytes fit.
+ * input:     pointer to buffer, number of bytes.
+ * output:    pointer to the new bytes, or NULL on allocation failure.
+ */
+unsigned char *mux_append(MuxBuffer *buffer, size_t len) {
+    if (buffer->len + len > buffer->capacity) {
+        size_t capacity = buffer->capacity > 0 ? buffer->capacity : 4096;
+        while (capacity < buffer->len + len) {
+            capacity *= 2;
+        }
+        unsigned char *data = realloc(buffer->data, capacity);
+        if (data == NULL) {
+            return NULL;
+        }
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+    unsigned char *at = buffer->data + buffer->len;
+    buffer->len += len;
+    return at;
+}
+
+/*
+ * function mux_append_message(): append a reply with a header and ints
+ * algorithm: write the header, the given ints and leave room for extra bytes
+ *   of payload, which the caller fills in at the end of the buffer.
+ * input:     pointer to buffer, game id, message type, ints of the payload,
+ *   their count and number of extra payload bytes.
+ * output:    1 on success, 0 on allocation failure.
+ */
+int mux_append_message(MuxBuffer *buffer, int id, int type, int *values,
+                       int count, size_t extra) {
+    size_t payload = sizeof(int) * count + extra;
+    unsigned char *at = mux_append(buffer, MUX_HEADER_BYTES + payload);
+    if (at == NULL) {
+        return 0;
+    }
+    mux_put_int(at, id);
+    mux_put_int(at + sizeof(int), type);
+    mux_put_int(at + 2 * sizeof(int), (int)payload);
+    for (int i = 0; i < count; i++) {
+        mux_put_int(at + MUX_HEADER_BYTES + sizeof(int) * i, values[i]);
+    }
+    return 1;
+}
+
+/*
+ * function mux_put_int(): write an int in network byte order
+ * input:     destination, value.
+ * output:    none.
+ */
+void mux_put_int(unsigned char *at, int value) {
+    value = htonl(value);
+    memcpy(at, &value, sizeof(value));
+}
+
+/*
+ * function mux_get_int(): read an int in network byte order
+ * input:     source.
+ * output:    value.
+ */
+int mux_get_int(unsigned char *at) {
+    int value;
+    memcpy(&value, at, sizeof(value));
+    return ntohl(value);
+}
+
+/*
+ * function mux_flush(): send and empty a buffer
+ * algorithm: keep calling send until every byte was written.
+ * input:     socket file descriptor, pointer to buffer.
+ * output:    1 on success, 0 on error with errno set.
+ */
+int mux_flush(int fd, MuxBuffer *buffer) {
+    size_t sent = 0;
+    while (sent < buffer->len) {
+        ssize_t result =
+            send(fd, buffer->data + sent, buffer->len - sent, MSG_NOSIGNAL);
+        if (result == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        sent += result;
+    }
+    buffer->len = 0;
+    return 1;
+}
+
+/*
+ * function mux_buffer_free(): free the memory of a buffer
+ * input:     pointer to buffer.
+ * output:    none.
+ */
+void mux_buffer_free(MuxBuffer *buffer) {
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->len = 0;
+    buffer->capacity = 0;
+}
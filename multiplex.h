@@ -0,0 +1,43 @@
+// Most games one connection may have open at once
+#define MUX_MAX_GAMES 4096
+// Slots in a game table, a power of two at least twice MUX_MAX_GAMES
+#define MUX_TABLE_SLOTS 8192
+// A request: game id, operation, row and column as network ints
+#define MUX_REQUEST_BYTES 16
+// A reply header: game id, message type and payload length as network ints
+#define MUX_HEADER_BYTES 12
+// Replies are sent once this much is buffered or every request read so far
+// has been answered
+#define MUX_FLUSH_BYTES 65536
+// How often a multiplexed connection checks for shutdown while idle
+#define MUX_POLL_MS 100
+
+// Game id to value mapping, open addressing with linear probing
+typedef struct mux_slot_t {
+    int id;
+    void *value;
+} MuxSlot;
+
+typedef struct mux_table_t {
+    MuxSlot slots[MUX_TABLE_SLOTS];
+    int count;
+} MuxTable;
+
+// Growable byte buffer for framed messages
+typedef struct mux_buffer_t {
+    unsigned char *data;
+    size_t len;
+    size_t capacity;
+} MuxBuffer;
+
+MuxTable *mux_table_create();
+void *mux_find(MuxTable *table, int id);
+int mux_insert(MuxTable *table, int id, void *value);
+void *mux_remove(MuxTable *table, int id);
+unsigned char *mux_append(MuxBuffer *buffer, size_t len);
+int mux_append_message(MuxBuffer *buffer, int id, int type, int *values,
+                       int count, size_t extra);
+void mux_put_int(unsigned char *at, int value);
+int mux_get_int(unsigned char *at);
+int mux_flush(int fd, MuxBuffer *buffer);
+void mux_buffer_free(MuxBuffer *buffer);
@@ -0,0 +1,202 @@
+#include <pthread.h>
+#include <string.h>
+
+#include "common_constants.h"
+#include "minesweeper_logic.h"
+#include "solver.h"
+#include "logger.h"
+#include "no_guess.h"
+#include "worker_pool.h"
+
+// Ring buffer of verified boards, all of the configured size
+NoGuessBoard cache[NO_GUESS_CACHE_SIZE];
+int cache_head = 0;
+int cache_count = 0;
+pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t cache_needs_boards = PTHREAD_COND_INITIALIZER;
+
+// Generation settings and the thread keeping the cache topped up
+int board_width, board_height, board_mines;
+unsigned int next_seed;
+bool generator_running = false;
+pthread_t generator_thread;
+
+// Statistics on how many candidates are accepted
+long candidates_tried = 0;
+long candidates_accepted = 0;
+
+// Scratch board and solver of each pool thread that verifies candidates
+static __thread GameState candidate;
+static __thread bool candidate_ready = false;
+static __thread Solver candidate_solver;
+
+// Plays a board from the given tile using only deductions from the visible
+// board and the mine counter, returns whether every mine gets flagged. The
+// board is left in the state the play reached.
+bool clears_without_guessing(GameState *game, int row, int column,
+                             Solver *solver) {
+    if (search_tiles(game, row, column) != NORMAL) {
+        return false;
+    }
+
+    int tiles = game->width * game->height;
+    while (1) {
+        int found = solve_board(solver, game);
+        if (found <= 0) {
+            // Stuck, unless every hidden tile must be one of the mines left
+            int hidden = 0;
+            for (int index = 0; index < tiles; index++) {
+                Tile *tile = &game->tiles[index];
+                hidden += !tile->revealed && !tile->flagged;
+            }
+            return hidden > 0 && hidden == game->mines_left;
+        }
+
+        for (int i = 0; i < solver->num_mines; i++) {
+            int index = solver->mine_tiles[i];
+            if (place_flag(game, index / game->width, index % game->width) ==
+                GAME_WON) {
+                return true;
+            }
+        }
+        for (int i = 0; i < solver->num_safe; i++) {
+            int index = solver->safe_tiles[i];
+            search_tiles(game, index / game->width, index % game->width);
+        }
+    }
+}
+
+// Pool job: generate candidates until one passes verification, storing it in
+// the cache. Each job draws its own seed so candidates differ across jobs.
+static void generate_candidates(void *arg, int index) {
+    (void)arg;
+    (void)index;
+    if (!candidate_ready) {
+        if (!create_game(&candidate, board_width, board_height, board_mines)) {
+            return;
+        }
+        solver_init(&candidate_solver);
+        candidate_ready = true;
+    }
+    unsigned int seed = __atomic_fetch_add(&next_seed, 1, __ATOMIC_RELAXED);
+
+    for (int attempt = 0; attempt < NO_GUESS_ATTEMPTS_PER_JOB; attempt++) {
+        int row = rand_r(&seed) % board_height;
+        int column = rand_r(&seed) % board_width;
+        clear_board(&candidate);
+        place_mines_around(&candidate, &seed, row, column);
+        __atomic_fetch_add(&candidates_tried, 1, __ATOMIC_RELAXED);
+        if (!clears_without_guessing(&candidate, row, column,
+                                     &candidate_solver)) {
+            continue;
+        }
+        __atomic_fetch_add(&candidates_accepted, 1, __ATOMIC_RELAXED);
+
+        pthread_mutex_lock(&cache_mutex);
+        if (cache_count < NO_GUESS_CACHE_SIZE) {
+            NoGuessBoard *board =
+                &cache[(cache_head + cache_count) % NO_GUESS_CACHE_SIZE];
+            board->start_row = row;
+            board->start_column = column;
+            board->seed = candidate.seed;
+            int mine = 0;
+            for (int i = 0; i < board_width * board_height; i++) {
+                if (candidate.tiles[i].is_mine) {
+                    board->mines[mine++] = i;
+                }
+            }
+            cache_count++;
+        }
+        pthread_mutex_unlock(&cache_mutex);
+        return;
+    }
+}
+
+// Body of the generator thread: whenever the cache is below capacity, hand
+// one job per core to the worker pool
+static void *generator_loop(void *data) {
+    (void)data;
+    int jobs = worker_pool_size() > 0 ? worker_pool_size() : 1;
+
+    pthread_mutex_lock(&cache_mutex);
+    while (generator_running) {
+        if (cache_count == NO_GUESS_CACHE_SIZE) {
+            pthread_cond_wait(&cache_needs_boards, &cache_mutex);
+            continue;
+        }
+        pthread_mutex_unlock(&cache_mutex);
+        worker_pool_run(generate_candidates, NULL, jobs);
+        pthread_mutex_lock(&cache_mutex);
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    return NULL;
+}
+
+// Starts filling the cache with no-guess boards of the given size in the
+// background. The worker pool should be started first.
+void no_guess_start(int width, int height, int num_mines, unsigned int seed) {
+    board_width = width;
+    board_height = height;
+    board_mines = num_mines;
+    next_seed = seed;
+    for (int i = 0; i < NO_GUESS_CACHE_SIZE; i++) {
+        cache[i].mines = malloc(sizeof(int) * num_mines);
+    }
+    generator_running = true;
+    pthread_create(&generator_thread, NULL, generator_loop, NULL);
+}
+
+// Stops the generator thread and frees the cache
+void no_guess_stop() {
+    if (!generator_running) {
+        return;
+    }
+    pthread_mutex_lock(&cache_mutex);
+    generator_running = false;
+    pthread_cond_signal(&cache_needs_boards);
+    pthread_mutex_unlock(&cache_mutex);
+    pthread_join(generator_thread, NULL);
+
+    for (int i = 0; i < NO_GUESS_CACHE_SIZE; i++) {
+        free(cache[i].mines);
+        cache[i].mines = NULL;
+    }
+    cache_count = 0;
+    log_message(LOG_LEVEL_INFO,
+                "No-guess generator: accepted %ld of %ld candidates.",
+                candidates_accepted, candidates_tried);
+}
+
+// Loads a cached no-guess board into a game of the configured size and gives
+// its start tile. Never waits for generation: returns 0 if the cache is empty
+// or the game has a different size, and the caller should fall back to a
+// random board.
+int take_no_guess_board(GameState *game, int *row, int *column) {
+    if (game->width != board_width || game->height != board_height ||
+        game->num_mines != board_mines) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&cache_mutex);
+    if (!generator_running || cache_count == 0) {
+        pthread_mutex_unlock(&cache_mutex);
+        return 0;
+    }
+    NoGuessBoard *board = &cache[cache_head];
+    clear_board(game);
+    for (int i = 0; i < board_mines; i++) {
+        int index = board->mines[i];
+        game->tiles[index].is_mine = true;
+        increase_number_of_adjacent_mines(game, index / game->width,
+                                          index % game->width);
+    }
+    game->mines_placed = true;
+    game->seed = board->seed;
+    *row = board->start_row;
+    *column = board->start_column;
+    cache_head = (cache_head + 1) % NO_GUESS_CACHE_SIZE;
+    cache_count--;
+    pthread_cond_signal(&cache_needs_boards);
+    pthread_mutex_unlock(&cache_mutex);
+    return 1;
+}
@@ -0,0 +1,18 @@
+// Number of verified boards kept ready for new games
+#define NO_GUESS_CACHE_SIZE 64
+// Candidates each pool job tries before giving up its turn
+#define NO_GUESS_ATTEMPTS_PER_JOB 64
+
+// A board the solver can clear without guessing from its start tile
+typedef struct no_guess_board_t {
+    int start_row;
+    int start_column;
+    unsigned int seed;
+    int *mines;
+} NoGuessBoard;
+
+void no_guess_start(int width, int height, int num_mines, unsigned int seed);
+void no_guess_stop();
+int take_no_guess_board(GameState *game, int *row, int *column);
+bool clears_without_guessing(GameState *game, int row, int column,
+                             Solver *solver);
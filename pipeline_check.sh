@@ -0,0 +1,27 @@
+#!/bin/sh
+# Checks that multiplexed requests sent in the same write as the selection
+# are answered when connections are served through io_uring, where the ring
+# may have received them before the switch. The bot always sends its first
+# requests along with the selection. Run from the build directory after make.
+port=${1:-12398}
+dir=$(mktemp -d)
+
+./server -i -R 50,20,0,0 "$port" > "$dir/server.log" 2>&1 &
+server=$!
+sleep 0.5
+
+failed=0
+for games in 1 64 500; do
+    if ! timeout 10 ./bot -n $games -c 64 127.0.0.1 "$port" Maolin 111111 \
+        > /dev/null; then
+        echo "pipelined requests for $games games were not answered"
+        failed=1
+        break
+    fi
+done
+
+kill -INT $server
+wait $server
+rm -r "$dir"
+[ $failed -eq 0 ] && echo "pipeline check passed"
+exit $failed
@@ -0,0 +1,647 @@
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#include "common_constants.h"
+#include "minesweeper_logic.h"
+#include "probability.h"
+#include "solver.h"
+#include "worker_pool.h"
+
+#define BIT_SET(bits, i) ((bits)[(i) >> 6] & (1ull << ((i)&63)))
+
+// Most prefix bits a component is split on when handing it to the pool
+#define MAX_SPLIT_BITS 6
+// How many enumeration steps run between checks of the time budget
+#define DEADLINE_CHECK_MASK 4095
+
+// A revealed number restricted to the tiles of one component
+typedef struct local_constraint_t {
+    int remaining;
+    int num_tiles;
+    int tiles[8];
+} LocalConstraint;
+
+// An independent group of frontier tiles linked through shared constraints.
+// counts[k] is the (scaled) number of configurations with k mines and
+// tile_counts[k * num_tiles + i] how many of those have a mine on tile i.
+typedef struct component_t {
+    int num_tiles;
+    int tiles[MAX_COMPONENT_TILES];
+    int num_constraints;
+    int constraint_capacity;
+    LocalConstraint *constraints;
+    int tile_num_constraints[MAX_COMPONENT_TILES];
+    int tile_constraints[MAX_COMPONENT_TILES][8];
+    double *counts;
+    double *tile_counts;
+} Component;
+
+// One slice of a component's search space, fixed by its first prefix_bits
+// tiles taking the values in prefix
+typedef struct enumeration_job_t {
+    Component *component;
+    int prefix_bits;
+    int prefix;
+    double *counts;
+    double *tile_counts;
+} EnumerationJob;
+
+// Everything shared by the jobs of one probability calculation
+typedef struct probability_context_t {
+    EnumerationJob *jobs;
+    int mines_left;
+    long long deadline_ns;
+    int timed_out;
+} ProbabilityContext;
+
+// Search state of a single job
+typedef struct enumeration_state_t {
+    ProbabilityContext *context;
+    EnumerationJob *job;
+    Component *component;
+    int *mines;
+    int *left;
+    bool assignment[MAX_COMPONENT_TILES];
+    long nodes;
+} EnumerationState;
+
+// Solver reused to remove tiles that can be deduced before enumerating
+static __thread Solver probability_solver;
+static __thread bool probability_solver_ready = false;
+
+static long long monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+// Board index of the tile a constraint's mask bit refers to
+static int constraint_tile(GameState *game, Constraint *constraint, int bit) {
+    return (constraint->row + bit / 3 - 1) * game->width + constraint->column +
+           bit % 3 - 1;
+}
+
+static int find_root(int *parent, int tile) {
+    while (parent[tile] != tile) {
+        parent[tile] = parent[parent[tile]];
+        tile = parent[tile];
+    }
+    return tile;
+}
+
+// Assigns a value to a tile and updates the constraints it is part of,
+// returns whether every one of those constraints can still be satisfied
+static bool assign_tile(EnumerationState *state, int tile, bool is_mine) {
+    Component *component = state->component;
+    bool feasible = true;
+
+    state->assignment[tile] = is_mine;
+    for (int i = 0; i < component->tile_num_constraints[tile]; i++) {
+        int id = component->tile_constraints[tile][i];
+        int remaining = component->constraints[id].remaining;
+        state->left[id]--;
+        state->mines[id] += is_mine;
+        if (state->mines[id] > remaining ||
+            state->mines[id] + state->left[id] < remaining) {
+            feasible = false;
+        }
+    }
+    return feasible;
+}
+
+// Reverts assign_tile()
+static void unassign_tile(EnumerationState *state, int tile) {
+    Component *component = state->component;
+    for (int i = 0; i < component->tile_num_constraints[tile]; i++) {
+        int id = component->tile_constraints[tile][i];
+        state->left[id]++;
+        state->mines[id] -= state->assignment[tile];
+    }
+    state->assignment[tile] = false;
+}
+
+// Depth first enumeration of every mine layout consistent with the
+// component's constraints, tallying finished layouts by mine count
+static void enumerate(EnumerationState *state, int depth, int mines) {
+    ProbabilityContext *context = state->context;
+    if ((++state->nodes & DEADLINE_CHECK_MASK) == 0 &&
+        monotonic_ns() > context->deadline_ns) {
+        __atomic_store_n(&context->timed_out, 1, __ATOMIC_RELAXED);
+    }
+    if (__atomic_load_n(&context->timed_out, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    Component *component = state->component;
+    if (depth == component->num_tiles) {
+        EnumerationJob *job = state->job;
+        job->counts[mines] += 1;
+        double *row = &job->tile_counts[mines * component->num_tiles];
+        for (int i = 0; i < component->num_tiles; i++) {
+            row[i] += state->assignment[i];
+        }
+        return;
+    }
+
+    if (assign_tile(state, depth, false)) {
+        enumerate(state, depth + 1, mines);
+    }
+    unassign_tile(state, depth);
+
+    if (mines < context->mines_left) {
+        if (assign_tile(state, depth, true)) {
+            enumerate(state, depth + 1, mines + 1);
+        }
+        unassign_tile(state, depth);
+    }
+}
+
+// Pool job: enumerate the slice of a component selected by the job's prefix
+static void enumerate_job(void *arg, int index) {
+    ProbabilityContext *context = arg;
+    EnumerationJob *job = &context->jobs[index];
+    Component *component = job->component;
+
+    EnumerationState state;
+    memset(&state, 0, sizeof(state));
+    state.context = context;
+    state.job = job;
+    state.component = component;
+    state.mines = calloc(component->num_constraints, sizeof(int));
+    state.left = malloc(sizeof(int) * component->num_constraints);
+    for (int id = 0; id < component->num_constraints; id++) {
+        state.left[id] = component->constraints[id].num_tiles;
+    }
+
+    bool feasible = true;
+    int mines = 0;
+    for (int i = 0; i < job->prefix_bits; i++) {
+        bool is_mine = (job->prefix >> i) & 1;
+        feasible = assign_tile(&state, i, is_mine) && feasible;
+        mines += is_mine;
+    }
+    if (feasible && mines <= context->mines_left) {
+        enumerate(&state, job->prefix_bits, mines);
+    }
+
+    free(state.mines);
+    free(state.left);
+}
+
+// Reorders a component's tiles breadth first through shared constraints so
+// constraints are closed early in the enumeration and prune sooner
+static void order_component(Component *component, int *local_index) {
+    int order[MAX_COMPONENT_TILES];
+    bool seen[MAX_COMPONENT_TILES] = {false};
+    int head = 0, tail = 0;
+
+    for (int start = 0; start < component->num_tiles; start++) {
+        if (seen[start]) {
+            continue;
+        }
+        seen[start] = true;
+        order[tail++] = start;
+        while (head < tail) {
+            int tile = order[head++];
+            for (int i = 0; i < component->tile_num_constraints[tile]; i++) {
+                int id = component->tile_constraints[tile][i];
+                LocalConstraint *constraint = &component->constraints[id];
+                for (int j = 0; j < constraint->num_tiles; j++) {
+                    int other = constraint->tiles[j];
+                    if (!seen[other]) {
+                        seen[other] = true;
+                        order[tail++] = other;
+                    }
+                }
+            }
+        }
+    }
+
+    // Apply the permutation to tiles, constraints and the tile lookup
+    int position[MAX_COMPONENT_TILES];
+    int tiles[MAX_COMPONENT_TILES];
+    int num_constraints[MAX_COMPONENT_TILES];
+    int constraints[MAX_COMPONENT_TILES][8];
+    for (int i = 0; i < component->num_tiles; i++) {
+        position[order[i]] = i;
+        tiles[i] = component->tiles[order[i]];
+        num_constraints[i] = component->tile_num_constraints[order[i]];
+        memcpy(constraints[i], component->tile_constraints[order[i]],
+               sizeof(constraints[i]));
+    }
+    for (int i = 0; i < component->num_tiles; i++) {
+        component->tiles[i] = tiles[i];
+        component->tile_num_constraints[i] = num_constraints[i];
+        memcpy(component->tile_constraints[i], constraints[i],
+               sizeof(constraints[i]));
+        local_index[tiles[i]] = i;
+    }
+    for (int id = 0; id < component->num_constraints; id++) {
+        LocalConstraint *constraint = &component->constraints[id];
+        for (int j = 0; j < constraint->num_tiles; j++) {
+            constraint->tiles[j] = position[constraint->tiles[j]];
+        }
+    }
+}
+
+// Convolves dist with counts, keeping at most max_len entries
+static int convolve(double *dist, int len, double *counts, int num_counts,
+                    int max_len, double *scratch) {
+    int new_len = len + num_counts - 1;
+    if (new_len > max_len) {
+        new_len = max_len;
+    }
+    memset(scratch, 0, sizeof(double) * new_len);
+    for (int i = 0; i < len; i++) {
+        if (dist[i] == 0) {
+            continue;
+        }
+        for (int k = 0; k < num_counts && i + k < new_len; k++) {
+            scratch[i + k] += dist[i] * counts[k];
+        }
+    }
+    memcpy(dist, scratch, sizeof(double) * new_len);
+    return new_len;
+}
+
+// Fills every undetermined tile with the overall density of remaining mines
+static void fill_density(double *probabilities, int tiles, double density) {
+    for (int index = 0; index < tiles; index++) {
+        if (probabilities[index] == -2) {
+            probabilities[index] = density;
+        }
+    }
+}
+
+// Works out the exact chance of each tile being a mine given only what the
+// client can see. Revealed tiles get -1. Tiles the solver can deduce are
+// settled first, the remaining frontier is split into independent components
+// whose layouts are enumerated in parallel on the worker pool, and the
+// interior tiles are weighted by the number of ways to place the leftover
+// mines among them. Before the first reveal every tile is safe to click.
+// Returns PROBABILITY_EXACT, or PROBABILITY_APPROXIMATE if the time budget ran
+// out or a component was too large, in which case undetermined tiles get the
+// average density of the remaining mines.
+int mine_probabilities(GameState *game, double *probabilities,
+                       long budget_us) {
+    int tiles = game->width * game->height;
+    long long deadline = monotonic_ns() + budget_us * 1000ll;
+
+    // Mines are placed around the first reveal, so it can never hit one
+    if (!any_tile_revealed(game)) {
+        for (int index = 0; index < tiles; index++) {
+            probabilities[index] = game->tiles[index].flagged ? 1 : 0;
+        }
+        return PROBABILITY_EXACT;
+    }
+
+    if (!probability_solver_ready) {
+        solver_init(&probability_solver);
+        probability_solver_ready = true;
+    }
+    Solver *solver = &probability_solver;
+    if (solve_board(solver, game) < 0) {
+        return PROBABILITY_FAILED;
+    }
+
+    // Settle revealed, flagged and deduced tiles; -2 marks undetermined
+    int known_mines = 0;
+    int undetermined = 0;
+    for (int index = 0; index < tiles; index++) {
+        if (game->tiles[index].revealed) {
+            probabilities[index] = -1;
+        } else if (BIT_SET(solver->mine, index)) {
+            probabilities[index] = 1;
+            known_mines++;
+        } else if (BIT_SET(solver->known, index)) {
+            probabilities[index] = 0;
+        } else {
+            probabilities[index] = -2;
+            undetermined++;
+        }
+    }
+    int mines_left = game->num_mines - known_mines;
+    if (undetermined == 0) {
+        return PROBABILITY_EXACT;
+    }
+    double density = mines_left > 0 ? (double)mines_left / undetermined : 0;
+
+    int *parent = malloc(sizeof(int) * tiles);
+    int *local_index = malloc(sizeof(int) * tiles);
+    int *component_of = malloc(sizeof(int) * tiles);
+    Component *components = NULL;
+    EnumerationJob *jobs = NULL;
+    int num_components = 0;
+    int num_jobs = 0;
+    int status = PROBABILITY_EXACT;
+    if (!parent || !local_index || !component_of) {
+        status = PROBABILITY_FAILED;
+        goto cleanup;
+    }
+
+    // Join the unknown neighbours of each constraint into components
+    for (int index = 0; index < tiles; index++) {
+        parent[index] = index;
+        local_index[index] = -1;
+        component_of[index] = -1;
+    }
+    for (int id = 0; id < solver->num_constraints; id++) {
+        Constraint *constraint = &solver->constraints[id];
+        int first = -1;
+        for (int bit = 0; bit < 9; bit++) {
+            if (!(constraint->vars & (1 << bit))) {
+                continue;
+            }
+            int index = constraint_tile(game, constraint, bit);
+            int root = find_root(parent, index);
+            if (first == -1) {
+                first = root;
+            } else if (root != first) {
+                parent[root] = first;
+            }
+        }
+    }
+
+    // Gather the tiles and constraints of each component
+    int component_capacity = 0;
+    for (int id = 0; id < solver->num_constraints; id++) {
+        Constraint *constraint = &solver->constraints[id];
+        if (constraint->vars == 0) {
+            continue;
+        }
+
+        int root = find_root(parent, constraint_tile(
+                                         game, constraint,
+                                         __builtin_ctz(constraint->vars)));
+        if (component_of[root] == -1) {
+            if (num_components == component_capacity) {
+                component_capacity = component_capacity ? component_capacity * 2
+                                                        : 4;
+                Component *grown = realloc(
+                    components, sizeof(Component) * component_capacity);
+                if (!grown) {
+                    status = PROBABILITY_FAILED;
+                    goto cleanup;
+                }
+                components = grown;
+            }
+            memset(&components[num_components], 0, sizeof(Component));
+            component_of[root] = num_components++;
+        }
+        Component *component = &components[component_of[root]];
+        if (component->num_constraints == component->constraint_capacity) {
+            component->constraint_capacity =
+                component->constraint_capacity
+                    ? component->constraint_capacity * 2
+                    : 8;
+            LocalConstraint *grown =
+                realloc(component->constraints,
+                        sizeof(LocalConstraint) *
+                            component->constraint_capacity);
+            if (!grown) {
+                status = PROBABILITY_FAILED;
+                goto cleanup;
+            }
+            component->constraints = grown;
+        }
+        int local_id = component->num_constraints++;
+        LocalConstraint *local = &component->constraints[local_id];
+        local->remaining = constraint->remaining;
+        local->num_tiles = 0;
+
+        for (int bit = 0; bit < 9; bit++) {
+            if (!(constraint->vars & (1 << bit))) {
+                continue;
+            }
+            int index = constraint_tile(game, constraint, bit);
+            if (local_index[index] == -1) {
+                if (component->num_tiles == MAX_COMPONENT_TILES) {
+                    status = PROBABILITY_APPROXIMATE;
+                    goto cleanup;
+                }
+                local_index[index] = component->num_tiles;
+                component->tiles[component->num_tiles++] = index;
+            }
+            int tile = local_index[index];
+            int slot = component->tile_num_constraints[tile]++;
+            local->tiles[local->num_tiles++] = tile;
+            component->tile_constraints[tile][slot] = local_id;
+        }
+    }
+
+    // Split each component on its first few tiles so the pool has enough
+    // jobs to keep every thread busy
+    int target_jobs = 4 * (worker_pool_size() + 1);
+    int split_bits = 0;
+    while (split_bits < MAX_SPLIT_BITS &&
+           (num_components << split_bits) < target_jobs) {
+        split_bits++;
+    }
+    if (worker_pool_size() == 0) {
+        split_bits = 0;
+    }
+    for (int c = 0; c < num_components; c++) {
+        Component *component = &components[c];
+        order_component(component, local_index);
+        int bits = split_bits < component->num_tiles ? split_bits
+                                                     : component->num_tiles;
+        num_jobs += 1 << bits;
+    }
+
+    jobs = calloc(num_jobs, sizeof(EnumerationJob));
+    if (!jobs) {
+        status = PROBABILITY_FAILED;
+        goto cleanup;
+    }
+    int job = 0;
+    for (int c = 0; c < num_components; c++) {
+        Component *component = &components[c];
+        int size = component->num_tiles + 1;
+        int bits = split_bits < component->num_tiles ? split_bits
+                                                     : component->num_tiles;
+        component->counts = calloc(size, sizeof(double));
+        component->tile_counts =
+            calloc((size_t)size * component->num_tiles, sizeof(double));
+        if (!component->counts || !component->tile_counts) {
+            status = PROBABILITY_FAILED;
+            goto cleanup;
+        }
+        for (int prefix = 0; prefix < (1 << bits); prefix++) {
+            jobs[job].component = component;
+            jobs[job].prefix_bits = bits;
+            jobs[job].prefix = prefix;
+            jobs[job].counts = calloc(size, sizeof(double));
+            jobs[job].tile_counts =
+                calloc((size_t)size * component->num_tiles, sizeof(double));
+            if (!jobs[job].counts || !jobs[job].tile_counts) {
+                status = PROBABILITY_FAILED;
+                goto cleanup;
+            }
+            job++;
+        }
+    }
+
+    // Enumerate every slice of every component across the pool
+    ProbabilityContext context;
+    context.jobs = jobs;
+    context.mines_left = mines_left;
+    context.deadline_ns = deadline;
+    context.timed_out = 0;
+    worker_pool_run(enumerate_job, &context, num_jobs);
+    if (context.timed_out) {
+        status = PROBABILITY_APPROXIMATE;
+        goto cleanup;
+    }
+
+    // Merge the slices, scaling each component so its largest count is 1
+    // (a constant factor per component cancels out of every probability)
+    int max_len = 1;
+    for (int j = 0; j < num_jobs; j++) {
+        Component *component = jobs[j].component;
+        int size = component->num_tiles + 1;
+        for (int k = 0; k < size; k++) {
+            component->counts[k] += jobs[j].counts[k];
+        }
+        for (int k = 0; k < size * component->num_tiles; k++) {
+            component->tile_counts[k] += jobs[j].tile_counts[k];
+        }
+    }
+    for (int c = 0; c < num_components; c++) {
+        Component *component = &components[c];
+        int size = component->num_tiles + 1;
+        double largest = 0;
+        for (int k = 0; k < size; k++) {
+            largest = fmax(largest, component->counts[k]);
+        }
+        if (largest == 0) {
+            // The visible board is contradictory (e.g. the game is over)
+            status = PROBABILITY_APPROXIMATE;
+            goto cleanup;
+        }
+        for (int k = 0; k < size; k++) {
+            component->counts[k] /= largest;
+        }
+        for (int k = 0; k < size * component->num_tiles; k++) {
+            component->tile_counts[k] /= largest;
+        }
+        max_len += component->num_tiles;
+    }
+    if (max_len > mines_left + 1) {
+        max_len = mines_left + 1;
+    }
+
+    // Ways to place m mines among the interior tiles, C(interior, m), memoized
+    // in log space for every m reachable from the frontier and scaled by the
+    // largest one to stay in range
+    int interior = undetermined;
+    for (int c = 0; c < num_components; c++) {
+        interior -= components[c].num_tiles;
+    }
+    double *weight = malloc(sizeof(double) * (mines_left + 1));
+    double *dist = malloc(sizeof(double) * max_len);
+    double *other = malloc(sizeof(double) * max_len);
+    double *scratch = malloc(sizeof(double) * max_len);
+    if (!weight || !dist || !other || !scratch) {
+        free(weight);
+        free(dist);
+        free(other);
+        free(scratch);
+        status = PROBABILITY_FAILED;
+        goto cleanup;
+    }
+    double log_choose = 0;
+    double log_largest = -INFINITY;
+    for (int m = 0; m <= mines_left; m++) {
+        if (m > interior) {
+            weight[m] = -INFINITY;
+            continue;
+        }
+        if (m > 0) {
+            log_choose += log((double)(interior - m + 1)) - log((double)m);
+        }
+        weight[m] = log_choose;
+        if (m >= mines_left - max_len + 1) {
+            log_largest = fmax(log_largest, weight[m]);
+        }
+    }
+    for (int m = 0; m <= mines_left; m++) {
+        weight[m] = isinf(log_largest) ? 0 : exp(weight[m] - log_largest);
+    }
+
+    // Total weight over every combination of component mine counts
+    int dist_len = 1;
+    dist[0] = 1;
+    for (int c = 0; c < num_components; c++) {
+        dist_len = convolve(dist, dist_len, components[c].counts,
+                            components[c].num_tiles + 1, max_len, scratch);
+    }
+    double total = 0;
+    double interior_mines = 0;
+    for (int k = 0; k < dist_len; k++) {
+        double w = dist[k] * weight[mines_left - k];
+        total += w;
+        interior_mines += w * (mines_left - k);
+    }
+
+    if (total > 0) {
+        for (int c = 0; c < num_components; c++) {
+            Component *component = &components[c];
+
+            // Distribution of mines over every other component
+            int other_len = 1;
+            other[0] = 1;
+            for (int o = 0; o < num_components; o++) {
+                if (o != c) {
+                    other_len = convolve(other, other_len,
+                                         components[o].counts,
+                                         components[o].num_tiles + 1, max_len,
+                                         scratch);
+                }
+            }
+
+            for (int i = 0; i < component->num_tiles; i++) {
+                probabilities[component->tiles[i]] = 0;
+            }
+            for (int k = 0; k <= component->num_tiles && k <= mines_left;
+                 k++) {
+                double rest = 0;
+                for (int j = 0; j < other_len && k + j <= mines_left; j++) {
+                    rest += other[j] * weight[mines_left - k - j];
+                }
+                double *row = &component->tile_counts[k * component->num_tiles];
+                for (int i = 0; i < component->num_tiles; i++) {
+                    probabilities[component->tiles[i]] += row[i] * rest / total;
+                }
+            }
+        }
+        density = interior > 0 ? interior_mines / total / interior : 0;
+    } else {
+        status = PROBABILITY_APPROXIMATE;
+    }
+    free(weight);
+    free(dist);
+    free(other);
+    free(scratch);
+
+cleanup:
+    // Interior tiles, or every undetermined tile if the exact calculation
+    // could not finish
+    fill_density(probabilities, tiles, density);
+    for (int j = 0; j < num_jobs; j++) {
+        free(jobs[j].counts);
+        free(jobs[j].tile_counts);
+    }
+    free(jobs);
+    for (int c = 0; c < num_components; c++) {
+        free(components[c].constraints);
+        free(components[c].counts);
+        free(components[c].tile_counts);
+    }
+    free(components);
+    free(parent);
+    free(local_index);
+    free(component_of);
+    return status;
+}
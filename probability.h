@@ -0,0 +1,10 @@
+// Outcome of a probability calculation
+#define PROBABILITY_EXACT 0
+#define PROBABILITY_APPROXIMATE 1
+#define PROBABILITY_FAILED -1
+
+// Largest frontier component that is enumerated exactly
+#define MAX_COMPONENT_TILES 128
+
+int mine_probabilities(GameState *game, double *probabilities,
+                       long budget_us);
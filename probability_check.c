@@ -0,0 +1,259 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "common_constants.h"
+#include "minesweeper_logic.h"
+#include "probability.h"
+#include "worker_pool.h"
+
+#define RANDOM_NUMBER_SEED 42
+// Random boards compared against brute force, each small enough to
+// enumerate every placement of its mines
+#define CHECK_BOARDS 300
+#define CHECK_MAX_WIDTH 6
+#define CHECK_MAX_HEIGHT 5
+// Columns of the board whose single frontier component is too large to
+// enumerate, more than MAX_COMPONENT_TILES / 2
+#define FALLBACK_COLUMNS 140
+// Time budget of every calculation, far more than any board here needs
+#define CHECK_BUDGET_US 10000000
+// Largest difference tolerated between a probability and brute force
+#define CHECK_TOLERANCE 1e-9
+
+// Placements of the mines seen while enumerating one board
+typedef struct enumeration_t {
+    GameState *game;
+    int *hidden;
+    int num_hidden;
+    double layouts;
+    double *mine_layouts;
+} Enumeration;
+
+/*
+ * function consistent(): check a placement against every revealed number
+ * input:     game whose is_mine flags hold the placement.
+ * output:    true if every revealed tile shows its number of mines.
+ */
+bool consistent(GameState *game) {
+    for (int row = 0; row < game->height; row++) {
+        for (int column = 0; column < game->width; column++) {
+            Tile *tile = GAME_TILE(game, row, column);
+            if (!tile->revealed) {
+                continue;
+            }
+            int mines = 0;
+            for (int i = row - 1; i <= row + 1; i++) {
+                for (int j = column - 1; j <= column + 1; j++) {
+                    if (i >= 0 && j >= 0 && i < game->height &&
+                        j < game->width && GAME_TILE(game, i, j)->is_mine) {
+                        mines++;
+                    }
+                }
+            }
+            if (tile->is_mine || mines != tile->adjacent_mines) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * function enumerate_placements(): count every placement of the mines left
+ * algorithm: decide each hidden tile in turn, mine or not, and count the
+ *   placements with every mine placed that fit the revealed numbers, and
+ *   how many of them put a mine on each hidden tile.
+ * input:     enumeration, next hidden tile to decide, mines still to place.
+ * output:    none.
+ */
+void enumerate_placements(Enumeration *state, int next, int mines) {
+    if (mines > state->num_hidden - next) {
+        return;
+    }
+    if (next == state->num_hidden) {
+        if (consistent(state->game)) {
+            state->layouts++;
+            for (int i = 0; i < state->num_hidden; i++) {
+                if (state->game->tiles[state->hidden[i]].is_mine) {
+                    state->mine_layouts[i]++;
+                }
+            }
+        }
+        return;
+    }
+    Tile *tile = &state->game->tiles[state->hidden[next]];
+    enumerate_placements(state, next + 1, mines);
+    if (mines > 0) {
+        tile->is_mine = true;
+        enumerate_placements(state, next + 1, mines - 1);
+        tile->is_mine = false;
+    }
+}
+
+/*
+ * function check_settled(): check tiles given certain odds against the
+ *   actual mines
+ * input:     game, probabilities of its tiles, name of the board.
+ * output:    number of tiles that disagree.
+ */
+int check_settled(GameState *game, double *probabilities, int board) {
+    int errors = 0;
+    for (int index = 0; index < game->width * game->height; index++) {
+        Tile *tile = &game->tiles[index];
+        if ((tile->revealed && probabilities[index] != -1) ||
+            (!tile->revealed && probabilities[index] == 1 && !tile->is_mine) ||
+            (!tile->revealed && probabilities[index] == 0 && tile->is_mine)) {
+            printf("board %d: tile %d has probability %f\n", board, index,
+                   probabilities[index]);
+            errors++;
+        }
+    }
+    return errors;
+}
+
+/*
+ * function check_random_board(): compare one random board with brute force
+ * algorithm: place the mines around a first reveal and reveal a few more
+ *   safe tiles, then count every placement of the hidden mines that fits
+ *   the revealed numbers. A tile's chance of being a mine is the share of
+ *   those placements with a mine on it, which mine_probabilities() must
+ *   match exactly.
+ * input:     number of the board, random state.
+ * output:    number of tiles that disagree.
+ */
+int check_random_board(int board, unsigned int *seed) {
+    int width = 3 + rand_r(seed) % (CHECK_MAX_WIDTH - 2);
+    int height = 3 + rand_r(seed) % (CHECK_MAX_HEIGHT - 2);
+    int num_mines = 1 + rand_r(seed) % (width * height / 4);
+    GameState game;
+    if (!create_game(&game, width, height, num_mines)) {
+        return 1;
+    }
+    int row = rand_r(seed) % height;
+    int column = rand_r(seed) % width;
+    place_mines_around(&game, seed, row, column);
+    reveal_tile(&game, row, column);
+    for (int extra = rand_r(seed) % 4; extra > 0; extra--) {
+        int index = rand_r(seed) % (width * height);
+        if (!game.tiles[index].is_mine) {
+            reveal_tile(&game, index / width, index % width);
+        }
+    }
+
+    int tiles = width * height;
+    int *hidden = malloc(sizeof(int) * tiles);
+    double *mine_layouts = calloc(tiles, sizeof(double));
+    double *probabilities = malloc(sizeof(double) * tiles);
+    bool *mines = malloc(sizeof(bool) * tiles);
+    int num_hidden = 0;
+    for (int index = 0; index < tiles; index++) {
+        mines[index] = game.tiles[index].is_mine;
+        if (!game.tiles[index].revealed) {
+            hidden[num_hidden++] = index;
+        }
+    }
+    int status = mine_probabilities(&game, probabilities, CHECK_BUDGET_US);
+    int errors = check_settled(&game, probabilities, board);
+
+    for (int i = 0; i < num_hidden; i++) {
+        game.tiles[hidden[i]].is_mine = false;
+    }
+    Enumeration state = {&game, hidden, num_hidden, 0, mine_layouts};
+    enumerate_placements(&state, 0, num_mines);
+    for (int i = 0; i < num_hidden; i++) {
+        double expected = mine_layouts[i] / state.layouts;
+        if (status != PROBABILITY_EXACT ||
+            fabs(probabilities[hidden[i]] - expected) > CHECK_TOLERANCE) {
+            printf("board %d: tile %d has probability %f (status %d), brute "
+                   "force gives %f\n",
+                   board, hidden[i], probabilities[hidden[i]], status,
+                   expected);
+            errors++;
+        }
+    }
+    for (int index = 0; index < tiles; index++) {
+        game.tiles[index].is_mine = mines[index];
+    }
+
+    free(hidden);
+    free(mine_layouts);
+    free(probabilities);
+    free(mines);
+    destroy_game(&game);
+    return errors;
+}
+
+/*
+ * function check_fallback(): check the answer for a component too large to
+ *   enumerate
+ * algorithm: reveal the middle row of a three row board and put one mine in
+ *   each column above or below it. Every revealed number then only says how
+ *   many mines are in three columns, which settles no tile and joins every
+ *   hidden tile into one component. The calculation must give up on it as
+ *   approximate, with every hidden tile at the average density.
+ * input:     random state.
+ * output:    number of tiles that disagree.
+ */
+int check_fallback(unsigned int *seed) {
+    GameState game;
+    if (!create_game(&game, FALLBACK_COLUMNS, 3, FALLBACK_COLUMNS)) {
+        return 1;
+    }
+    for (int column = 0; column < FALLBACK_COLUMNS; column++) {
+        int row = rand_r(seed) % 2 ? 2 : 0;
+        GAME_TILE(&game, row, column)->is_mine = true;
+        increase_number_of_adjacent_mines(&game, row, column);
+        GAME_TILE(&game, 1, column)->revealed = true;
+    }
+    game.mines_placed = true;
+
+    double *probabilities = malloc(sizeof(double) * 3 * FALLBACK_COLUMNS);
+    int status = mine_probabilities(&game, probabilities, CHECK_BUDGET_US);
+    int errors = 0;
+    if (status != PROBABILITY_APPROXIMATE) {
+        printf("fallback board: status %d, expected approximate\n", status);
+        errors++;
+    }
+    errors += check_settled(&game, probabilities, -1);
+    for (int index = 0; index < 3 * FALLBACK_COLUMNS; index++) {
+        if (!game.tiles[index].revealed &&
+            fabs(probabilities[index] - 0.5) > CHECK_TOLERANCE) {
+            printf("fallback board: tile %d has probability %f, expected "
+                   "the density 0.5\n",
+                   index, probabilities[index]);
+            errors++;
+        }
+    }
+    free(probabilities);
+    destroy_game(&game);
+    return errors;
+}
+
+/*
+ * function main(): entry point for the probability check
+ * algorithm: compare mine_probabilities() with brute force enumeration on
+ *   random small boards, on the worker pool as the server runs it, then
+ *   check its fallback for a component too large to enumerate.
+ * input:     none.
+ * output:    0 if every tile agreed, 1 otherwise.
+ */
+int main() {
+    unsigned int seed = RANDOM_NUMBER_SEED;
+    worker_pool_start(sysconf(_SC_NPROCESSORS_ONLN));
+    int errors = 0;
+    for (int board = 0; board < CHECK_BOARDS; board++) {
+        errors += check_random_board(board, &seed);
+    }
+    errors += check_fallback(&seed);
+    worker_pool_stop();
+
+    if (errors > 0) {
+        printf("probability check failed: %d tiles disagree\n", errors);
+        return 1;
+    }
+    printf("probability check passed: %d boards\n", CHECK_BOARDS + 1);
+    return 0;
+}
@@ -0,0 +1,186 @@
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include "logger.h"
+#include "rate_limit.h"
+
+// Limit of each kind per second, 0 for none; changed while running
+int rate_limits[RATE_KINDS] = {RATE_CONNECTIONS_DEFAULT, RATE_LOGINS_DEFAULT,
+                               RATE_MOVES_DEFAULT, RATE_ADDRESS_MOVES_DEFAULT};
+// Requests turned away, per kind
+long rate_rejected[RATE_KINDS] = {0};
+// Source addresses seen, locks set up on first use
+RateShard rate_shards[RATE_SHARDS];
+pthread_once_t rate_shards_ready = PTHREAD_ONCE_INIT;
+
+/*
+ * function rate_configure(): set the limit of each kind
+ * algorithm: buckets refill at the new rates from their next use.
+ * input:     connections and logins per second per address, moves per
+ *   second per connection and per address; 0 for no limit.
+ * output:    1 if the limits were valid and set, 0 otherwise.
+ */
+int rate_configure(int connections, int logins, int moves, int address_moves) {
+    int limits[RATE_KINDS] = {connections, logins, moves, address_moves};
+    for (int kind = 0; kind < RATE_KINDS; kind++) {
+        if (limits[kind] < 0) {
+            return 0;
+        }
+    }
+    for (int kind = 0; kind < RATE_KINDS; kind++) {
+        __atomic_store_n(&rate_limits[kind], limits[kind], __ATOMIC_RELAXED);
+    }
+    return 1;
+}
+
+/*
+ * function rate_clock_ns(): monotonic time in nanoseconds
+ * input:     none.
+ * output:    nanoseconds.
+ */
+unsigned long long rate_clock_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*
+ * function rate_bucket_init(): fill a bucket, as for a new client
+ * input:     pointer to bucket, its kind.
+ * output:    none.
+ */
+void rate_bucket_init(RateBucket *bucket, int kind) {
+    bucket->tokens = (double)__atomic_load_n(&rate_limits[kind],
+                                             __ATOMIC_RELAXED) *
+                     RATE_BURST_SECONDS;
+    bucket->updated_ns = rate_clock_ns();
+}
+
+/*
+ * function rate_take(): take tokens from a bucket if it has them
+ * algorithm: add the tokens earned since the bucket was last used, up to
+ *   RATE_BURST_SECONDS of the rate, then take count of them. A request the
+ *   bucket cannot cover takes nothing and is counted as rejected. The caller
+ *   owns the bucket or holds its lock.
+ * input:     pointer to bucket, its kind, tokens wanted.
+ * output:    true if the tokens were taken, false if over the limit.
+ */
+bool rate_take(RateBucket *bucket, int kind, int count) {
+    int rate = __atomic_load_n(&rate_limits[kind], __ATOMIC_RELAXED);
+    if (rate == 0) {
+        return true;
+    }
+    unsigned long long now = rate_clock_ns();
+    double burst = (double)rate * RATE_BURST_SECONDS;
+    double tokens =
+        bucket->tokens + (now - bucket->updated_ns) * 1e-9 * rate;
+    bucket->tokens = tokens < burst ? tokens : burst;
+    bucket->updated_ns = now;
+    if (bucket->tokens < count) {
+        __atomic_add_fetch(&rate_rejected[kind], 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    bucket->tokens -= count;
+    return true;
+}
+
+/*
+ * function init_rate_shards(): set up the lock of every shard
+ * input:     none.
+ * output:    none.
+ */
+void init_rate_shards() {
+    for (int i = 0; i < RATE_SHARDS; i++) {
+        pthread_mutex_init(&rate_shards[i].mutex, NULL);
+    }
+}
+
+/*
+ * function find_rate_entry(): entry of an address, added if it is new
+ * algorithm: probe up to RATE_PROBE entries from the address's home slot.
+ *   A new address takes the first free entry, or the least recently seen
+ *   one, whose buckets start full. The caller holds the shard's lock.
+ * input:     shard, 16 byte address, its hash, current time.
+ * output:    pointer to the entry.
+ */
+RateEntry *find_rate_entry(RateShard *shard, unsigned char *address,
+                           unsigned int hash, unsigned long long now) {
+    RateEntry *victim = NULL;
+    for (int i = 0; i < RATE_PROBE; i++) {
+        RateEntry *entry =
+            &shard->entries[(hash + i) & (RATE_SHARD_ENTRIES - 1)];
+        if (entry->used && memcmp(entry->address, address, 16) == 0) {
+            entry->seen_ns = now;
+            return entry;
+        }
+        if (victim == NULL || !entry->used ||
+            (victim->used && entry->seen_ns < victim->seen_ns)) {
+            victim = entry;
+        }
+    }
+    memcpy(victim->address, address, 16);
+    victim->used = true;
+    victim->seen_ns = now;
+    for (int kind = 0; kind < RATE_KINDS; kind++) {
+        rate_bucket_init(&victim->buckets[kind], kind);
+    }
+    return victim;
+}
+
+/*
+ * function rate_allow(): take tokens from a source address's bucket
+ * algorithm: IPv4 addresses are keyed as IPv4-mapped IPv6 ones. An FNV-1a
+ *   hash of the address picks the shard and the entry within it, only that
+ *   shard is locked. Unix domain socket peers are local and not limited.
+ * input:     address of the peer, kind of limit, tokens wanted.
+ * output:    true if allowed, false if over the limit.
+ */
+bool rate_allow(struct sockaddr_storage *peer, int kind, int count) {
+    if (__atomic_load_n(&rate_limits[kind], __ATOMIC_RELAXED) == 0) {
+        return true;
+    }
+    unsigned char address[16] = {0};
+    if (peer->ss_family == AF_INET) {
+        address[10] = address[11] = 0xff;
+        memcpy(address + 12, &((struct sockaddr_in *)peer)->sin_addr, 4);
+    } else if (peer->ss_family == AF_INET6) {
+        memcpy(address, &((struct sockaddr_in6 *)peer)->sin6_addr, 16);
+    } else {
+        return true;
+    }
+
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < 16; i++) {
+        hash = (hash ^ address[i]) * 16777619u;
+    }
+    pthread_once(&rate_shards_ready, init_rate_shards);
+    RateShard *shard = &rate_shards[hash & (RATE_SHARDS - 1)];
+    pthread_mutex_lock(&shard->mutex);
+    RateEntry *entry =
+        find_rate_entry(shard, address, hash / RATE_SHARDS, rate_clock_ns());
+    bool allowed = rate_take(&entry->buckets[kind], kind, count);
+    pthread_mutex_unlock(&shard->mutex);
+    return allowed;
+}
+
+/*
+ * function print_rate_limit_stats(): print how much was turned away
+ * input:     none.
+ * output:    none.
+ */
+void print_rate_limit_stats() {
+    log_message(LOG_LEVEL_INFO,
+                "Rate limits: rejected %ld connections, %ld logins, %ld "
+                "moves per connection, %ld moves per address",
+                __atomic_load_n(&rate_rejected[RATE_CONNECTIONS],
+                                __ATOMIC_RELAXED),
+                __atomic_load_n(&rate_rejected[RATE_LOGINS],
+                                __ATOMIC_RELAXED),
+                __atomic_load_n(&rate_rejected[RATE_MOVES], __ATOMIC_RELAXED),
+                __atomic_load_n(&rate_rejected[RATE_ADDRESS_MOVES],
+                                __ATOMIC_RELAXED));
+}
@@ -0,0 +1,46 @@
+// What is limited: connections and login attempts per source address, moves
+// per connection and per source address
+#define RATE_CONNECTIONS 0
+#define RATE_LOGINS 1
+#define RATE_MOVES 2
+#define RATE_ADDRESS_MOVES 3
+#define RATE_KINDS 4
+// Default limits per second of each kind, 0 for no limit
+#define RATE_CONNECTIONS_DEFAULT 50
+#define RATE_LOGINS_DEFAULT 20
+#define RATE_MOVES_DEFAULT 1000
+#define RATE_ADDRESS_MOVES_DEFAULT 10000
+// A bucket holds this many seconds of its rate, the most a client can burst
+#define RATE_BURST_SECONDS 4
+// Source addresses are spread over shards each with its own lock, and kept
+// in an open addressed table of RATE_SHARD_ENTRIES per shard, probing at
+// most RATE_PROBE entries. A full probe window replaces its least recently
+// seen address. Both sizes are powers of two
+#define RATE_SHARDS 64
+#define RATE_SHARD_ENTRIES 256
+#define RATE_PROBE 8
+
+// Tokens of one limit, refilled continuously at its rate up to its burst
+typedef struct rate_bucket_t {
+    double tokens;
+    unsigned long long updated_ns;
+} RateBucket;
+
+// Limits of one source address, only IPv4 and IPv6 peers are tracked
+typedef struct rate_entry_t {
+    unsigned char address[16];
+    bool used;
+    unsigned long long seen_ns;
+    RateBucket buckets[RATE_KINDS];
+} RateEntry;
+
+typedef struct rate_shard_t {
+    pthread_mutex_t mutex;
+    RateEntry entries[RATE_SHARD_ENTRIES];
+} RateShard;
+
+int rate_configure(int connections, int logins, int moves, int address_moves);
+void rate_bucket_init(RateBucket *bucket, int kind);
+bool rate_take(RateBucket *bucket, int kind, int count);
+bool rate_allow(struct sockaddr_storage *peer, int kind, int count);
+void print_rate_limit_stats();
@@ -0,0 +1,174 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include "timer_wheel.h"
+#include "reaper.h"
+
+// Idle timeout of each phase in ticks, 0 when the phase never times out.
+// Guarded by reaper_mutex once connections are served
+unsigned long idle_ticks[IDLE_PHASES] = {
+    IDLE_LOGIN_SECONDS * 1000 / REAPER_TICK_MS,
+    IDLE_MENU_SECONDS * 1000 / REAPER_TICK_MS,
+    IDLE_GAME_SECONDS * 1000 / REAPER_TICK_MS};
+
+// Timers of every connection being served, guarded by reaper_mutex
+TimerWheel reaper_wheel;
+pthread_mutex_t reaper_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// The connection the calling handler thread is serving
+__thread IdleConnection *current_connection = NULL;
+
+/*
+ * function reaper_configure(): set the idle timeout of each phase
+ * algorithm: connections being served pick up the new timeouts the next
+ *   time their timer is set.
+ * input:     timeouts in seconds for login, menu and game, 0 to disable one.
+ * output:    1 if the timeouts were valid and set, 0 otherwise.
+ */
+int reaper_configure(int login, int menu, int game) {
+    int seconds[IDLE_PHASES] = {login, menu, game};
+    for (int phase = 0; phase < IDLE_PHASES; phase++) {
+        if (seconds[phase] < 0 || (unsigned long)seconds[phase] * 1000 /
+                                          REAPER_TICK_MS > WHEEL_MAX_TICKS) {
+            return 0;
+        }
+    }
+    pthread_mutex_lock(&reaper_mutex);
+    for (int phase = 0; phase < IDLE_PHASES; phase++) {
+        idle_ticks[phase] = (unsigned long)seconds[phase] * 1000 /
+                            REAPER_TICK_MS;
+    }
+    pthread_mutex_unlock(&reaper_mutex);
+    return 1;
+}
+
+/*
+ * function current_tick(): ticks of the monotonic clock
+ * input:     none.
+ * output:    current tick.
+ */
+unsigned long current_tick() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * (1000 / REAPER_TICK_MS) +
+           now.tv_nsec / (REAPER_TICK_MS * 1000000L);
+}
+
+/*
+ * function reaper_start(): start the wheel at the current time
+ * algorithm: must be called before any connection is watched.
+ * input:     none.
+ * output:    none.
+ */
+void reaper_start() { timer_wheel_init(&reaper_wheel, current_tick()); }
+
+/*
+ * function arm(): schedule the timer of a connection for its phase
+ * algorithm: caller holds reaper_mutex.
+ * input:     pointer to connection.
+ * output:    none.
+ */
+void arm(IdleConnection *connection) {
+    if (connection->phase == IDLE_NONE || idle_ticks[connection->phase] == 0) {
+        cancel_timer(&reaper_wheel, &connection->timer);
+    } else {
+        schedule_timer(&reaper_wheel, &connection->timer,
+                       idle_ticks[connection->phase]);
+    }
+}
+
+/*
+ * function reaper_watch(): start timing out the calling thread's connection
+ * algorithm: the connection starts in the login phase.
+ * input:     pointer to connection, owned by the caller until
+ *   reaper_release(), and its socket file descriptor.
+ * output:    none.
+ */
+void reaper_watch(IdleConnection *connection, int fd) {
+    connection->timer.armed = false;
+    connection->fd = fd;
+    connection->phase = IDLE_LOGIN;
+    current_connection = connection;
+
+    pthread_mutex_lock(&reaper_mutex);
+    arm(connection);
+    pthread_mutex_unlock(&reaper_mutex);
+}
+
+/*
+ * function reaper_phase(): move the calling thread's connection to a phase
+ * algorithm: the connection's idle time starts again from now.
+ * input:     phase.
+ * output:    none.
+ */
+void reaper_phase(int phase) {
+    if (current_connection == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&reaper_mutex);
+    current_connection->phase = phase;
+    arm(current_connection);
+    pthread_mutex_unlock(&reaper_mutex);
+}
+
+/*
+ * function reaper_touch(): note that the calling thread's client sent data
+ * algorithm: restart the idle time of the current phase.
+ * input:     none.
+ * output:    none.
+ */
+void reaper_touch() {
+    if (current_connection == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&reaper_mutex);
+    arm(current_connection);
+    pthread_mutex_unlock(&reaper_mutex);
+}
+
+/*
+ * function reaper_release(): stop timing out the calling thread's connection
+ * algorithm: must be called before the socket is closed, so the reaper can
+ *   never shut down a descriptor that was reused for another connection.
+ * input:     none.
+ * output:    none.
+ */
+void reaper_release() {
+    if (current_connection == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&reaper_mutex);
+    cancel_timer(&reaper_wheel, &current_connection->timer);
+    pthread_mutex_unlock(&reaper_mutex);
+    current_connection = NULL;
+}
+
+/*
+ * function reap(): close an idle connection whose timer expired
+ * algorithm: shut the socket down, the thread serving it sees the client
+ *   leave and cleans up as on any disconnect.
+ * input:     pointer to the expired timer, the first member of its
+ *   connection.
+ * output:    none.
+ */
+void reap(WheelTimer *timer) {
+    IdleConnection *connection = (IdleConnection *)timer;
+    shutdown(connection->fd, SHUT_RDWR);
+}
+
+/*
+ * function reap_idle_connections(): close connections idle for too long
+ * algorithm: turn the wheel up to the current tick.
+ * input:     none.
+ * output:    number of connections closed.
+ */
+int reap_idle_connections() {
+    unsigned long now = current_tick();
+    pthread_mutex_lock(&reaper_mutex);
+    int reaped = advance_timer_wheel(&reaper_wheel, now, reap);
+    pthread_mutex_unlock(&reaper_mutex);
+    return reaped;
+}
@@ -0,0 +1,28 @@
+// Phases of a connection, each with its own idle timeout. A connection in
+// IDLE_NONE is never reaped.
+#define IDLE_NONE -1
+#define IDLE_LOGIN 0
+#define IDLE_MENU 1
+#define IDLE_GAME 2
+#define IDLE_PHASES 3
+// Default idle timeouts in seconds
+#define IDLE_LOGIN_SECONDS 30
+#define IDLE_MENU_SECONDS 300
+#define IDLE_GAME_SECONDS 900
+// Length of one tick of the reaper's timer wheel
+#define REAPER_TICK_MS 100
+
+// A connection being served, closed by the reaper when idle for too long
+typedef struct idle_connection_t {
+    WheelTimer timer;
+    int fd;
+    int phase;
+} IdleConnection;
+
+int reaper_configure(int login, int menu, int game);
+void reaper_start();
+void reaper_watch(IdleConnection *connection, int fd);
+void reaper_phase(int phase);
+void reaper_touch();
+void reaper_release();
+int reap_idle_connections();
@@ -0,0 +1,44 @@
+#!/bin/sh
+# Checks that a server whose idle handler pool is shrunk by a configuration
+# reload still serves every client, one after another and while some wait in
+# the admission queue. Run from the build directory after make.
+port=${1:-12399}
+dir=$(mktemp -d)
+config=$dir/server.conf
+
+echo "handler_threads = 10" > "$config"
+./server -f "$config" "$port" > "$dir/server.log" 2>&1 &
+server=$!
+sleep 0.5
+
+echo "handler_threads = 2" > "$config"
+kill -HUP $server
+sleep 0.5
+
+failed=0
+for i in 1 2 3 4 5 6; do
+    if ! timeout 10 ./bot -n 1 127.0.0.1 "$port" Maolin 111111 \
+        > /dev/null; then
+        echo "client $i was not served after the pool shrank"
+        failed=1
+        break
+    fi
+done
+if [ $failed -eq 0 ]; then
+    for i in 1 2 3 4; do
+        timeout 10 ./bot -n 20 127.0.0.1 "$port" Maolin 111111 \
+            > /dev/null &
+    done
+    for job in $(jobs -p); do
+        if [ "$job" != "$server" ] && ! wait "$job"; then
+            echo "a queued client was not served after the pool shrank"
+            failed=1
+        fi
+    done
+fi
+
+kill -INT $server
+wait $server
+rm -r "$dir"
+[ $failed -eq 0 ] && echo "reload check passed"
+exit $failed
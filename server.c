@@ -1,7 +1,10 @@
 #define _GNU_SOURCE
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <pthread.h>
 
 #include <stdio.h>
@@ -16,18 +19,68 @@
 
 #include "common_constants.h"
 #include "minesweeper_logic.h"
+#include "address.h"
+#include "arena.h"
+#include "slab.h"
 #include "server.h"
+#include "server_io.h"
+#include "spectate.h"
+#include "coop.h"
+#include "multiplex.h"
+#include "session.h"
+#include "probability.h"
+#include "solver.h"
+#include "no_guess.h"
+#include "worker_pool.h"
+#include "shard.h"
+#include "timer_wheel.h"
+#include "reaper.h"
+#include "upgrade.h"
+#include "uring.h"
+#include "shm_ring.h"
+#include "event_log.h"
+#include "logger.h"
+#include "trace.h"
+#include "config.h"
+#include "rate_limit.h"
 
 #define RANDOM_NUMBER_SEED 42
-
-// Allocate memory for threads
-#define NUM_HANDLER_THREADS 10
-int thr_id[NUM_HANDLER_THREADS];
-pthread_t p_threads[NUM_HANDLER_THREADS];
+// Port for addresses without one unless set, and where logins are read from
+#define DEFAULT_PORT 12345
+#define CREDENTIALS_FILE "Authentication.txt"
+// Longest a worker may spend computing mine probabilities for a client
+#define PROBABILITY_BUDGET_US 20000
+// Seconds between sweeps of the session table for idle sessions
+#define SESSION_SWEEP_SECONDS 1
+// Longest a read waits before checking for shutdown again
+#define READ_POLL_MS 100
+// Connections that may wait for a handler thread unless set with -q
+#define ADMISSION_QUEUE_DEFAULT 50
+// Seconds between queue position updates to waiting clients
+#define QUEUE_UPDATE_SECONDS 2
+// Connections accepted per tick while they keep up, and once they queue
+#define ADMISSION_ACCEPT_BURST 64
+#define ADMISSION_THROTTLED_ACCEPTS 4
+// Weight of the latest connection in the average time a connection is served
+#define SERVICE_TIME_WEIGHT 0.2
+
+// Allocate memory for threads. The pool can be resized while running up to
+// MAX_HANDLER_THREADS: threads numbered from handler_threads on take no new
+// connections, and started_threads are joined on shutdown. handler_threads
+// is guarded by request_mutex
+#define HANDLER_THREADS_DEFAULT 10
+#define MAX_HANDLER_THREADS 64
+int thr_id[MAX_HANDLER_THREADS];
+pthread_t p_threads[MAX_HANDLER_THREADS];
+int handler_threads = HANDLER_THREADS_DEFAULT;
+int started_threads = 0;
 
 // Synchronisation for client requests
 pthread_mutex_t request_mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
 pthread_cond_t got_request = PTHREAD_COND_INITIALIZER;
+// Threads beyond the size of the pool wait here instead, so they never take
+// a wakeup meant for a thread that would serve the request
+pthread_cond_t pool_resized = PTHREAD_COND_INITIALIZER;
 
 // Synchronisation for scoreboard
 pthread_mutex_t read_mutex, write_mutex;
@@ -38,12 +91,66 @@ Score *score_head = NULL;
 Login *login_head = NULL;
 Request *request_head = NULL;
 
-// Time struct for polling select function
-struct timeval tv;
+// Fixed size objects come from per-type slabs rather than malloc. A
+// multiplexed game's slab object holds its board straight after the MuxGame
+Slab request_slab, score_slab, login_slab, mux_game_slab;
+
+// Admission queue: the tail of request_head, how many connections are in it,
+// how many handler threads are serving one and how long that takes on
+// average. All guarded by request_mutex.
+Request *request_tail = NULL;
+int queued_requests = 0;
+int max_queued_requests = ADMISSION_QUEUE_DEFAULT;
+int busy_handlers = 0;
+double average_service_seconds = -1;
+
+// Live upgrade: set once a new server has asked to take over, so handler
+// threads hand their connections over at the next command. Handed over
+// connections wait in parked_head, guarded by request_mutex.
+volatile int upgrade_requested = 0;
+Request *parked_head = NULL;
+// Whether the calling handler thread's connection was handed over
+__thread int handed_off = 0;
 
 // Flag to start program cleanup
 volatile int shutdown_active = 0;
 
+// Settings that take effect at startup, from the command line or the
+// configuration file
+int listen_port = DEFAULT_PORT;
+char *listen_addresses[MAX_LISTENERS] = {DEFAULT_LISTEN_ADDRESS};
+int num_listen_addresses = 0;
+int listen_backlog = BACKLOG;
+char *credentials_path = CREDENTIALS_FILE;
+unsigned int random_seed = RANDOM_NUMBER_SEED;
+int sharded = 0, shard_count = 0;
+char *upgrade_path = NULL;
+char *event_log_path = NULL;
+int event_log_flush_ms = EVENT_FLUSH_MS;
+char *trace_path = NULL;
+
+// Configuration file and the options given on the command line, which it
+// does not override. The file is read again on SIGHUP, applying the
+// settings that can change while the server runs
+char *config_path = NULL;
+bool on_command_line[CONFIG_OPTIONS];
+volatile sig_atomic_t reload_requested = 0;
+
+// Whether new games use boards that can be cleared without guessing
+int no_guess_mode = 0;
+
+// Whether connections are served through io_uring, set with -i when the
+// kernel supports it. Each handler thread sets its ring up on its first
+// connection and keeps it until it exits
+bool uring_backend = false;
+__thread Uring handler_ring;
+__thread bool handler_ring_ready = false;
+
+// Source address of the connection the calling handler thread serves, and
+// the connection's own bucket of moves
+__thread struct sockaddr_storage connection_peer;
+__thread RateBucket connection_moves;
+
 /*
  * function main(): entry point for server
  * algorithm: checks whether sufficient command line arguments have
@@ -52,79 +159,300 @@ volatile int shutdown_active = 0;
  * output:    none.
  */
 int main(int argc, char *argv[]) {
-    // Check if correct usage of program
-    if (argc > 2) {
-        fprintf(stderr, "usage: server port_number\n");
+    // Check if correct usage of program, options come before the port. The
+    // configuration file only sets what the command line leaves out
+    int opt;
+    while ((opt = getopt(argc, argv, "f:gia:b:l:c:e:n:r:s:t:q:u:L:R:T:")) !=
+           -1) {
+        if (opt == 'f') {
+            config_path = optarg;
+        } else if (opt == '?' || !apply_option(opt, optarg)) {
+            argc = -1;
+            break;
+        }
+        on_command_line[opt] = true;
+    }
+    if (argc - optind == 1) {
+        on_command_line['p'] = true;
+        if (!apply_option('p', argv[optind])) {
+            argc = -1;
+        }
+    }
+    if (argc >= 0 && config_path != NULL &&
+        config_read(config_path, false, on_command_line, apply_option) != 0) {
+        exit(1);
+    }
+    if (argc - optind > 1 || argc < 0 || (sharded && upgrade_path != NULL)) {
+        fprintf(stderr,
+                "usage: server [-f config_file] [-g] [-i] [-l address]... "
+                "[-b backlog]\n"
+                "              [-a credentials_file] [-r seed] "
+                "[-c width,height,mines] [-s shards]\n"
+                "              [-n handler_threads] [-t login,menu,game] "
+                "[-q max_queued]\n"
+                "              [-u upgrade_socket] "
+                "[-e event_directory[,flush_ms]]\n"
+                "              [-L debug|info|warn|error] "
+                "[-T trace_directory]\n"
+                "              [-R connections,logins,moves,address_moves] "
+                "[port_number]\n"
+                "       addresses are host[:port], [ipv6][:port] or "
+                "unix:path, up to %d\n"
+                "       -s and -u cannot be used together, and -q does not "
+                "apply with -s\n",
+                MAX_LISTENERS);
         exit(1);
     }
 
-    // If port number is not provided use a default value
-    int port_no;
-    if (argc == 2) {
-        port_no = atoi(argv[1]);
-    } else {
-        port_no = 12345;
+    // Without -l listen on every IPv4 address
+    if (num_listen_addresses == 0) {
+        num_listen_addresses = 1;
+    }
+
+    // Handler threads hand their messages to the log writer from now on
+    logger_start();
+
+    // Fall back to plain socket calls if io_uring can't be used here
+    if (uring_backend) {
+        Uring probe;
+        if (uring_init(&probe)) {
+            uring_exit(&probe);
+            log_message(LOG_LEVEL_INFO,
+                        "Serving connections through io_uring.");
+        } else {
+            log_message(LOG_LEVEL_WARN,
+                        "io_uring unavailable, using sockets: %m");
+            uring_backend = false;
+        }
+    }
+
+    // Game events are written in the background from the start
+    if (event_log_path != NULL &&
+        !event_log_start(event_log_path, event_log_flush_ms)) {
+        exit(1);
+    }
+
+    // Spans are recorded from the start, and dumped on SIGUSR1
+    if (trace_path != NULL) {
+        if (!trace_start(trace_path)) {
+            exit(1);
+        }
+        signal(SIGUSR1, trace_request_dump);
     }
 
     // Seed the random number generator with set value
-    srand(RANDOM_NUMBER_SEED);
+    srand(random_seed);
     // Set handler for interrupt signal (Ctrl + C)
     signal(SIGINT, initiate_shutdown);
-    // Create socket connection
-    int sockfd = setup_server_connection(port_no);
+    // Settings that can change live are read again on SIGHUP
+    if (config_path != NULL) {
+        signal(SIGHUP, request_reload);
+    }
+    // Clients may drop mid-send, report that as an error instead of dying
+    signal(SIGPIPE, SIG_IGN);
+    // Allocators must be ready before any thread uses them
+    init_allocators();
     // Set up details from .txt file into linked list for login
     setup_login_information();
-    // Execute threads in thread pool
-    initialise_thread_pool();
-
-    // Set timeval struct values to 0 for select to be polling continuously
-    tv.tv_sec = 0;
-    tv.tv_usec = 0;
+    // Start timing idle connections before any can be accepted
+    reaper_start();
+    // Initialise scoreboard mutexes
+    pthread_mutex_init(&read_mutex, NULL);
+    pthread_mutex_init(&write_mutex, NULL);
+    // Either serve every connection from the listeners through the request
+    // queue, or let each shard accept and serve its own
+    int listeners[MAX_LISTENERS];
+    int num_listeners = 0;
+    if (sharded) {
+        shard_count =
+            start_shards(listen_addresses, num_listen_addresses, listen_port,
+                         shard_count, &shutdown_active);
+        log_message(LOG_LEVEL_INFO, "Server serving from %d shards ...",
+                    shard_count);
+    } else {
+        // Take over from a running server if there is one, otherwise create
+        // socket connections
+        if (upgrade_path != NULL) {
+            num_listeners = take_over_server(upgrade_path, listeners);
+        }
+        for (int i = 0; num_listeners == 0 && i < num_listen_addresses;
+             i++) {
+            listeners[i] =
+                setup_server_connection(listen_addresses[i], listen_port, 0);
+        }
+        if (num_listeners == 0) {
+            num_listeners = num_listen_addresses;
+        }
+        // Execute threads in thread pool
+        initialise_thread_pool();
+    }
+    // Let the next version of the server take over from this one
+    int upgrade_fd = -1;
+    if (upgrade_path != NULL) {
+        upgrade_fd = upgrade_listen(upgrade_path);
+    }
+    int upgrade_client = -1;
+    // Start the pool used to spread analysis work over every core
+    worker_pool_start(sysconf(_SC_NPROCESSORS_ONLN));
+    // Keep a cache of boards that never force a guess topped up
+    if (no_guess_mode) {
+        no_guess_start(NUM_TILES_X, NUM_TILES_Y, NUM_MINES, random_seed);
+    }
 
     // Loop continously while flag to shutdown hasnt been set
+    long total_reaped = 0;
+    time_t last_sweep = time(NULL);
+    time_t last_queue_update = last_sweep;
     while (!shutdown_active) {
-        // Create file descriptor set with sockfd
-        fd_set master;
-        FD_ZERO(&master);
-        FD_SET(sockfd, &master);
+        // Drop games of clients that never came back, and pack the games
+        // of those gone for a while
+        time_t now = time(NULL);
+        if (now - last_sweep >= SESSION_SWEEP_SECONDS) {
+            int evicted = evict_idle_sessions(now);
+            if (evicted > 0) {
+                log_message(LOG_LEVEL_INFO,
+                            "Main thread: Evicted %d idle sessions.",
+                            evicted);
+            }
+            int hibernated = hibernate_idle_sessions(now);
+            if (hibernated > 0) {
+                log_message(LOG_LEVEL_INFO,
+                            "Main thread: Hibernated %d idle games.",
+                            hibernated);
+                print_hibernation_stats();
+            }
+            last_sweep = now;
+        }
+
+        // Close connections that stayed idle for too long
+        int reaped = reap_idle_connections();
+        if (reaped > 0) {
+            total_reaped += reaped;
+            log_message(LOG_LEVEL_INFO,
+                        "Main thread: Reaped %d idle connections.", reaped);
+        }
+
+        // Write out the trace if it was asked for
+        trace_dump_if_requested();
+
+        // Apply changed settings if the configuration file was edited
+        if (reload_requested) {
+            reload_requested = 0;
+            reload_configuration();
+        }
 
-        if (select(sockfd + 1, &master, NULL, NULL, &tv) <= 0) {
+        // Tell waiting clients how far they have come
+        if (now - last_queue_update >= QUEUE_UPDATE_SECONDS) {
+            send_queue_positions();
+            last_queue_update = now;
+        }
+
+        // Shards accept for themselves, there is only the waiting to do here
+        if (sharded) {
+            poll(NULL, 0, REAPER_TICK_MS);
             continue;
-        };
+        }
 
-        // If connection is ready to accept on sockfd
-        if (FD_ISSET(sockfd, &master)) {
-            // Variables to store new connection information
-            int new_fd;
-            struct sockaddr_in their_addr;
-            socklen_t sin_size = sizeof(struct sockaddr_in);
+        // While connections are left waiting the handler threads have fallen
+        // behind, then only a few are taken each tick and the rest wait in
+        // the listen backlog. Otherwise wait up to one tick for connections.
+        pthread_mutex_lock(&request_mutex);
+        bool throttled = queued_requests > 0;
+        pthread_mutex_unlock(&request_mutex);
+        struct pollfd ready[1 + MAX_LISTENERS] = {{upgrade_fd, POLLIN, 0}};
+        for (int i = 0; i < num_listeners; i++) {
+            ready[1 + i] = (struct pollfd){listeners[i], POLLIN, 0};
+        }
+        if (poll(ready, throttled ? 1 : 1 + num_listeners, REAPER_TICK_MS) <=
+                0 &&
+            !throttled) {
+            continue;
+        }
 
+        // A new server wants to take over, stop once connections are ready
+        if (ready[0].revents & POLLIN) {
+            upgrade_client = accept(upgrade_fd, NULL, NULL);
+            if (upgrade_client != -1 && begin_upgrade(upgrade_client)) {
+                break;
+            }
+            if (upgrade_client != -1) {
+                close(upgrade_client);
+                upgrade_client = -1;
+            }
+        }
+        // Every listener gets its share of the accepts, those that have
+        // nothing waiting stop straight away
+        int accepts =
+            throttled ? ADMISSION_THROTTLED_ACCEPTS : ADMISSION_ACCEPT_BURST;
+        bool drained[MAX_LISTENERS] = {false};
+        for (int i = 0; i < accepts * num_listeners; i++) {
+            int listener = i % num_listeners;
+            if (drained[listener] ||
+                (!throttled && !(ready[1 + listener].revents & POLLIN))) {
+                continue;
+            }
             // Accept new connection and store details in new_fd
-            if ((new_fd = accept(sockfd, (struct sockaddr *)&their_addr,
-                                 &sin_size)) == -1) {
-                perror("accept");
+            int new_fd = accept_client(listeners[listener]);
+            if (new_fd == -1) {
+                drained[listener] = true;
                 continue;
             }
 
-            // Add the new connection to the request_head linked list
-            add_request(new_fd, &request_mutex, &got_request);
+            // Add the new connection to the request_head linked list, or
+            // turn it away straight away if the queue is full
+            if (!add_request(new_fd, &request_mutex, &got_request)) {
+                send_int(new_fd, SERVER_BUSY);
+                close(new_fd);
+            }
         }
     }
 
-    // Once loop is exited (i.e. shutdown_active) clear stored data
-    printf("Main thread: Clearing shared data.\n");
-    clear_allocated_memory();
+    // Shard threads use the shared data until they exit
+    if (sharded) {
+        stop_shards();
+    }
 
     // Signal all threads waiting on 'got_request' cond variable to unblock
-    printf("Main thread: Unblocking all threads waiting on request.\n");
+    log_message(LOG_LEVEL_INFO,
+                "Main thread: Unblocking all threads waiting on request.");
     pthread_cond_broadcast(&got_request);
+    pthread_cond_broadcast(&pool_resized);
 
-    // Clean up handler threads after they exit
-    for (int i = 0; i < NUM_HANDLER_THREADS; i++) {
+    // Clean up handler threads after they exit, before the data they use
+    for (int i = 0; i < started_threads; i++) {
         pthread_join(p_threads[i], NULL);
     }
 
-    printf("Main thread: Cleared data, exiting.\n");
+    // Pass everything still open on to the new server, otherwise the
+    // listeners are done with
+    if (upgrade_client != -1) {
+        hand_off_server(upgrade_client, listeners, num_listeners);
+        close(upgrade_client);
+    } else {
+        for (int i = 0; i < num_listeners; i++) {
+            close_listener(listeners[i]);
+        }
+    }
+    if (upgrade_fd != -1) {
+        close(upgrade_fd);
+    }
+    // Every thread that logs events has exited
+    event_log_stop();
+
+    // Once loop is exited (i.e. shutdown_active) clear stored data
+    log_message(LOG_LEVEL_INFO, "Main thread: Clearing shared data.");
+    clear_allocated_memory();
+    clear_sessions();
+    no_guess_stop();
+    worker_pool_stop();
+
+    log_message(LOG_LEVEL_INFO,
+                "Main thread: Reaped %ld idle connections in total.",
+                total_reaped);
+    print_rate_limit_stats();
+    print_allocation_stats();
+    log_message(LOG_LEVEL_INFO, "Main thread: Cleared data, exiting.");
+    logger_stop();
     pthread_exit(0);
 
     // Execution will not reach this point as main thread is exited
@@ -134,75 +462,467 @@ int main(int argc, char *argv[]) {
 /*
  * function initiate_shutdown(): function handling interrupt signal
  * algorithm: set shutdown_active to true, allowing threads to exit gracefully.
+ *   Runs as a signal handler, so it logs without formatting or locking.
  * input:     none.
  * output:    none.
  */
 void initiate_shutdown() {
-    printf("Ctrl+C pressed, initiating clean shutdown.\n");
+    log_signal_safe(LOG_LEVEL_INFO,
+                    "Ctrl+C pressed, initiating clean shutdown.");
     shutdown_active = 1;
 }
 
 /*
- * function setup_server_connection(): create listening socket to connect on
- * algorithm: create the socket, bind it to an address based on port input,
- *   and start listening on it.
- * input:     port number.
- * output:    socket file descriptor.
+ * function apply_option(): apply one setting from the command line or the
+ *   configuration file
+ * algorithm: settings used at startup are stored until then. Those that
+ *   can change live are applied straight away, under the locks of what they
+ *   change. Strings are copied, as file values live in a line buffer.
+ * input:     option letter, its value; NULL for a flag on the command line,
+ *   which is 1 or 0 in the file.
+ * output:    1 if the value was valid and applied, 0 otherwise.
  */
-int setup_server_connection(int port_no) {
-    // Variables to store connection information
-    int sockfd;
-    struct sockaddr_in my_addr;
+int apply_option(int opt, char *value) {
+    int number, width, height, mines, login, menu, game;
+    int connections, logins, moves, address_moves;
+    char extra;
+    if (opt == 'g' || opt == 'i') {
+        if (value != NULL && strcmp(value, "0") != 0 &&
+            strcmp(value, "1") != 0) {
+            return 0;
+        }
+        bool set = value == NULL || strcmp(value, "1") == 0;
+        if (opt == 'g') {
+            no_guess_mode = set;
+        } else {
+            uring_backend = set;
+        }
+        return 1;
+    }
+    if (opt == 'l') {
+        if (num_listen_addresses == MAX_LISTENERS) {
+            return 0;
+        }
+        listen_addresses[num_listen_addresses++] = strdup(value);
+        return 1;
+    }
+    if (opt == 'a' || opt == 'u' || opt == 'T') {
+        char **path = opt == 'a'   ? &credentials_path
+                      : opt == 'u' ? &upgrade_path
+                                   : &trace_path;
+        *path = strdup(value);
+        return 1;
+    }
+    if (opt == 'e') {
+        // The flush interval follows the last comma, if there is one
+        event_log_path = strdup(value);
+        char *comma = strrchr(event_log_path, ',');
+        if (comma != NULL) {
+            *comma = '\0';
+            return sscanf(comma + 1, "%d%c", &event_log_flush_ms, &extra) ==
+                       1 &&
+                   event_log_flush_ms > 0;
+        }
+        return 1;
+    }
+    if (opt == 'c') {
+        return sscanf(value, "%d,%d,%d%c", &width, &height, &mines,
+                      &extra) == 3 &&
+               coop_configure(width, height, mines);
+    }
+    if (opt == 't') {
+        return sscanf(value, "%d,%d,%d%c", &login, &menu, &game, &extra) ==
+                   3 &&
+               reaper_configure(login, menu, game);
+    }
+    if (opt == 'L') {
+        return logger_set_level(value);
+    }
+    if (opt == 'R') {
+        return sscanf(value, "%d,%d,%d,%d%c", &connections, &logins, &moves,
+                      &address_moves, &extra) == 4 &&
+               rate_configure(connections, logins, moves, address_moves);
+    }
+    if (opt == 'r') {
+        return sscanf(value, "%u%c", &random_seed, &extra) == 1;
+    }
 
-    // Generate the socket
-    if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-        perror("socket");
-        exit(1);
+    // The rest are whole numbers
+    if (sscanf(value, "%d%c", &number, &extra) != 1) {
+        return 0;
+    }
+    if (opt == 'p' && number > 0 && number <= 65535) {
+        listen_port = number;
+    } else if (opt == 'b' && number > 0) {
+        listen_backlog = number;
+    } else if (opt == 's' && number >= 0) {
+        sharded = 1;
+        shard_count = number;
+    } else if (opt == 'n' && number > 0 && number <= MAX_HANDLER_THREADS) {
+        // Before the pool is started this only sets its size
+        if (started_threads > 0) {
+            resize_thread_pool(number);
+        } else {
+            handler_threads = number;
+        }
+    } else if (opt == 'q' && number >= 0) {
+        pthread_mutex_lock(&request_mutex);
+        max_queued_requests = number;
+        pthread_mutex_unlock(&request_mutex);
+    } else {
+        return 0;
     }
+    return 1;
+}
 
-    // Allow port to be reused
-    int yes = 1;
-    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int)) == -1) {
-        perror("reuse addr");
-        exit(1);
+/*
+ * function request_reload(): function handling the hang up signal
+ * algorithm: only sets a flag, the main thread reloads on its next tick.
+ * input:     none.
+ * output:    none.
+ */
+void request_reload() { reload_requested = 1; }
+
+/*
+ * function reload_configuration(): apply the configuration file again
+ * algorithm: only settings that can change while the server runs are
+ *   applied, and none given on the command line. Bad lines are reported and
+ *   the rest still applied.
+ * input:     none.
+ * output:    none.
+ */
+void reload_configuration() {
+    int errors = config_read(config_path, true, on_command_line, apply_option);
+    if (errors >= 0) {
+        pthread_mutex_lock(&request_mutex);
+        int threads = handler_threads, queued = max_queued_requests;
+        pthread_mutex_unlock(&request_mutex);
+        log_message(LOG_LEVEL_INFO,
+                    "Main thread: Reloaded %s with %d errors: %d handler "
+                    "threads, queue limit %d.",
+                    config_path, errors, threads, queued);
     }
+}
 
-    // Set IPv4 addresses as type
-    my_addr.sin_family = AF_INET;
-    // Set host byte order from host short to network
-    my_addr.sin_port = htons(port_no);
-    // Autofill with IP
-    my_addr.sin_addr.s_addr = INADDR_ANY;
+/*
+ * function take_over_server(): carry on from a server being upgraded
+ * algorithm: connect to the old server's upgrade socket and receive its
+ *   state: players' statistics, the scoreboard, sessions and the connections
+ *   it was serving, along with its listening sockets. Connections that were
+ *   in the middle of being served carry on where they left off, those that
+ *   were waiting are queued again.
+ * input:     path of the old server's upgrade socket, array of MAX_LISTENERS
+ *   for the listening sockets.
+ * output:    number of listening sockets, 0 if there was no server to take
+ *   over from.
+ */
+int take_over_server(char *path, int *listeners) {
+    int upgrade_fd = upgrade_connect(path);
+    if (upgrade_fd == -1) {
+        return 0;
+    }
 
-    // Bind socket to the connection information set up
-    if (bind(sockfd, (struct sockaddr *)&my_addr, sizeof(struct sockaddr)) ==
-        -1) {
-        perror("bind");
+    MuxBuffer state = {NULL, 0, 0};
+    int *fds = NULL;
+    int count = 0;
+    int ok = recv_upgrade_state(upgrade_fd, &state, &fds, &count);
+    close(upgrade_fd);
+    UpgradeReader reader = {state.data, state.len, 0, ok && count > 0};
+
+    int sessions = restore_scoreboard(&reader) ? restore_sessions(&reader,
+                                                                  login_head)
+                                               : -1;
+    int parked = get_upgrade_int(&reader);
+    int queued = get_upgrade_int(&reader);
+    int num_listeners = get_upgrade_int(&reader);
+    if (sessions < 0 || !reader.ok || parked < 0 || queued < 0 ||
+        num_listeners < 1 || num_listeners > MAX_LISTENERS ||
+        num_listeners + parked + queued != count) {
+        log_message(LOG_LEVEL_ERROR, "Couldn't take over from the old server.");
         exit(1);
     }
+    memcpy(listeners, fds, sizeof(int) * num_listeners);
+    // Connections follow the listeners
+    int *connections = fds + num_listeners;
+
+    for (int i = 0; i < parked; i++) {
+        Request *a_request = slab_zalloc(&request_slab);
+        if (a_request == NULL) {
+            close(connections[i]);
+            continue;
+        }
+        a_request->new_fd = connections[i];
+        a_request->admitted = true;
+        get_upgrade_bytes(&reader, a_request->token, MAX_READ_LENGTH);
+        a_request->token[MAX_READ_LENGTH - 1] = '\0';
+        pthread_mutex_lock(&request_mutex);
+        append_request(a_request);
+        pthread_mutex_unlock(&request_mutex);
+    }
+    for (int i = 0; i < queued; i++) {
+        int new_fd = connections[parked + i];
+        if (!add_request(new_fd, &request_mutex, &got_request)) {
+            send_int(new_fd, SERVER_BUSY);
+            close(new_fd);
+        }
+    }
+
+    log_message(LOG_LEVEL_INFO,
+                "Took over %d sessions, %d connections and %d queued clients.",
+                sessions, parked, queued);
+    free(fds);
+    mux_buffer_free(&state);
+    return num_listeners;
+}
+
+/*
+ * function begin_upgrade(): get ready to hand over to a new server
+ * algorithm: check the new server speaks the same version, then stop handing
+ *   out queued connections and let each handler thread park its connection
+ *   at the next command it waits for. Wait up to UPGRADE_PARK_MS for every
+ *   thread, then shut down. Connections in the middle of something else,
+ *   such as a co-op game, are closed but their sessions can be resumed.
+ * input:     socket of the new server.
+ * output:    1 if the server is shutting down to hand over, 0 if the new
+ *   server was refused.
+ */
+int begin_upgrade(int upgrade_fd) {
+    int version;
+    if (recv(upgrade_fd, &version, sizeof(version), MSG_WAITALL) !=
+            sizeof(version) ||
+        ntohl(version) != UPGRADE_VERSION) {
+        log_message(LOG_LEVEL_WARN,
+                    "Main thread: Refused upgrade from another version.");
+        return 0;
+    }
+
+    log_message(LOG_LEVEL_INFO, "Main thread: Handing over to a new server.");
+    upgrade_requested = 1;
+    for (int waited = 0; waited < UPGRADE_PARK_MS; waited += 10) {
+        pthread_mutex_lock(&request_mutex);
+        int busy = busy_handlers;
+        pthread_mutex_unlock(&request_mutex);
+        if (busy == 0) {
+            break;
+        }
+        poll(NULL, 0, 10);
+    }
+    shutdown_active = 1;
+    return 1;
+}
+
+/*
+ * function hand_off_server(): send everything to the new server
+ * algorithm: every handler thread has exited. Write the scoreboard,
+ *   sessions, parked connections with their session tokens and queued
+ *   connections, and send them with the listening sockets and every
+ *   connection's descriptor.
+ * input:     socket of the new server, listening sockets and their number.
+ * output:    none.
+ */
+void hand_off_server(int upgrade_fd, int *listeners, int num_listeners) {
+    MuxBuffer state = {NULL, 0, 0};
+    int parked = 0, queued = 0;
+    for (Request *node = parked_head; node != NULL; node = node->next) {
+        parked++;
+    }
+    for (Request *node = request_head; node != NULL; node = node->next) {
+        queued++;
+    }
+
+    int *fds = malloc(sizeof(int) * (num_listeners + parked + queued));
+    int ok = fds != NULL && save_scoreboard(&state) && save_sessions(&state) &&
+             put_upgrade_int(&state, parked) &&
+             put_upgrade_int(&state, queued) &&
+             put_upgrade_int(&state, num_listeners);
+    int count = 0;
+    if (ok) {
+        for (int i = 0; i < num_listeners; i++) {
+            fds[count++] = listeners[i];
+        }
+        for (Request *node = parked_head; node != NULL; node = node->next) {
+            ok &= put_upgrade_bytes(&state, node->token, MAX_READ_LENGTH);
+            fds[count++] = node->new_fd;
+        }
+        for (Request *node = request_head; node != NULL; node = node->next) {
+            fds[count++] = node->new_fd;
+        }
+    }
+
+    if (ok && send_upgrade_state(upgrade_fd, &state, fds, count)) {
+        log_message(LOG_LEVEL_INFO,
+                    "Main thread: Handed over %d connections and %d queued "
+                    "clients.",
+                    parked, queued);
+    } else {
+        log_message(LOG_LEVEL_ERROR,
+                    "Main thread: Hand over failed, connections lost.");
+    }
+    free(fds);
+    mux_buffer_free(&state);
+}
+
+/*
+ * function save_scoreboard(): write out players' statistics and the scores
+ * input:     state to append to.
+ * output:    1 on success, 0 if out of memory.
+ */
+int save_scoreboard(MuxBuffer *state) {
+    int logins = 0, scores = 0;
+    for (Login *node = login_head; node != NULL; node = node->next) {
+        logins++;
+    }
+    for (Score *node = score_head; node != NULL; node = node->next) {
+        scores++;
+    }
+
+    int ok = put_upgrade_int(state, logins);
+    for (Login *node = login_head; node != NULL; node = node->next) {
+        ok &= put_upgrade_bytes(state, node->username, MAX_READ_LENGTH);
+        ok &= put_upgrade_int(state, node->games_played);
+        ok &= put_upgrade_int(state, node->games_won);
+    }
+    ok &= put_upgrade_int(state, scores);
+    for (Score *node = score_head; node != NULL; node = node->next) {
+        ok &= put_upgrade_bytes(state, node->user->username, MAX_READ_LENGTH);
+        ok &= put_upgrade_int(state, node->duration);
+    }
+    return ok;
+}
+
+/*
+ * function find_login(): look up a player by name
+ * input:     username.
+ * output:    pointer to the login, NULL if there is none.
+ */
+Login *find_login(char *username) {
+    Login *node = login_head;
+    while (node != NULL && strcmp(node->username, username) != 0) {
+        node = node->next;
+    }
+    return node;
+}
+
+/*
+ * function restore_scoreboard(): read back what save_scoreboard() wrote
+ * algorithm: players are matched by name, entries for players no longer in
+ *   the login file are dropped. Scores arrive in order and are appended.
+ * input:     reader positioned at the scoreboard.
+ * output:    1 on success, 0 if the state was cut short.
+ */
+int restore_scoreboard(UpgradeReader *reader) {
+    char username[MAX_READ_LENGTH];
+    int logins = get_upgrade_int(reader);
+    for (int i = 0; i < logins && reader->ok; i++) {
+        get_upgrade_bytes(reader, username, MAX_READ_LENGTH);
+        username[MAX_READ_LENGTH - 1] = '\0';
+        int played = get_upgrade_int(reader);
+        int won = get_upgrade_int(reader);
+        Login *login = find_login(username);
+        if (login != NULL) {
+            login->games_played = played;
+            login->games_won = won;
+        }
+    }
+
+    Score **tail = &score_head;
+    int scores = get_upgrade_int(reader);
+    for (int i = 0; i < scores && reader->ok; i++) {
+        get_upgrade_bytes(reader, username, MAX_READ_LENGTH);
+        username[MAX_READ_LENGTH - 1] = '\0';
+        int duration = get_upgrade_int(reader);
+        Login *login = find_login(username);
+        Score *score = login != NULL ? slab_alloc(&score_slab) : NULL;
+        if (score != NULL) {
+            score->user = login;
+            score->duration = duration;
+            score->next = NULL;
+            *tail = score;
+            tail = &score->next;
+        }
+    }
+    return reader->ok;
+}
 
-    // Start listnening on the socket
-    if (listen(sockfd, BACKLOG) == -1) {
-        perror("listen");
+/*
+ * function setup_server_connection(): create listening socket to connect on
+ * algorithm: create the socket, bind it to the address (an IPv4 or IPv6
+ *   host, or a Unix socket path) and start listening on it. The socket does
+ *   not block, so accepting until no connection is left is safe. With
+ *   reuse_port several sockets may listen on the same port and the kernel
+ *   balances connections between them.
+ * input:     address, port used if the address has none, whether to set
+ *   SO_REUSEPORT.
+ * output:    socket file descriptor.
+ */
+int setup_server_connection(char *address, int port_no, int reuse_port) {
+    int sockfd =
+        listen_on_address(address, port_no, reuse_port, listen_backlog);
+    if (sockfd == -1) {
         exit(1);
     }
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
 
-    printf("Server starts listening ...\n");
+    log_message(LOG_LEVEL_INFO, "Server starts listening on %s ...", address);
     return sockfd;
 }
 
+/*
+ * function accept_client(): accept a connection waiting on a listener
+ * algorithm: accept the connection and turn off Nagle's algorithm on it.
+ *   A source address connecting faster than its limit is told the server
+ *   is busy and closed straight away, and the next connection accepted. The
+ *   calling thread's trace spans are recorded under the new connection.
+ * input:     listening socket file descriptor.
+ * output:    file descriptor of the connection, or -1 if none was accepted.
+ */
+int accept_client(int sockfd) {
+    unsigned long long start;
+    struct sockaddr_storage their_addr;
+    int new_fd;
+    do {
+        start = trace_now();
+        socklen_t sin_size = sizeof(their_addr);
+        new_fd = accept(sockfd, (struct sockaddr *)&their_addr, &sin_size);
+        if (new_fd == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                log_message(LOG_LEVEL_ERROR, "accept: %m");
+            }
+            return -1;
+        }
+        if (!rate_allow(&their_addr, RATE_CONNECTIONS, 1)) {
+            int busy = htonl(SERVER_BUSY);
+            send(new_fd, &busy, sizeof(busy), MSG_DONTWAIT | MSG_NOSIGNAL);
+            close(new_fd);
+            new_fd = -1;
+        }
+    } while (new_fd == -1);
+
+    // Replies are written in one send each, so there is nothing for Nagle's
+    // algorithm to coalesce and it would only delay them. Unix domain
+    // sockets have no such delay
+    if (their_addr.ss_family == AF_INET || their_addr.ss_family == AF_INET6) {
+        int yes = 1;
+        setsockopt(new_fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    }
+    trace_new_connection();
+    trace_span(TRACE_ACCEPT, start, 0, 0);
+    return new_fd;
+}
+
 /*
  * function setup_login_information(): read txt file into global linked list
- * algorithm: Open the Authentication.txt file for reading. Create a login node
+ * algorithm: Open the credentials file for reading. Create a login node
  *   for each entry in the file, and add it to the linked list.
  * input:     pointer to login_head of login linked list.
  * output:    none.
  */
 void setup_login_information() {
     // Open file for reading
-    FILE *login_file = fopen("Authentication.txt", "r");
+    FILE *login_file = fopen(credentials_path, "r");
     // Exit on file read error (file not found, etc)
     if (!login_file) {
+        log_message(LOG_LEVEL_ERROR, "%s: %m", credentials_path);
         exit(1);
     }
 
@@ -210,18 +930,19 @@ void setup_login_information() {
     Login *prev = login_head;
     while (1) {
         // Create login node
-        Login *curr_node = malloc(sizeof(Login));
+        Login *curr_node = slab_alloc(&login_slab);
         // Read username and password from file to node
         if (fscanf(login_file, "%s %s", curr_node->username,
                    curr_node->password) != 2) {
             // If it was the last entry, free node and leave loop
-            free(curr_node);
+            slab_free(&login_slab, curr_node);
             break;
         };
 
         // Initialise each login with 0 games played or won
         curr_node->games_played = 0;
         curr_node->games_won = 0;
+        curr_node->next = NULL;
 
         // Add node to linked list
         if (login_head == NULL) {
@@ -236,56 +957,79 @@ void setup_login_information() {
     fclose(login_file);
     // Throwing away the first entry that contains column headers from file
     Login *temp = login_head->next;
-    free(login_head);
+    slab_free(&login_slab, login_head);
     login_head = temp;
 }
 
 /*
  * function initialise_thread_pool(): execute all handler threads for
  * request_head algorithm: loop through number of handler threads and execute
- * them. Initialise the read and write mutexes as well. input:     none. output:
- * none.
+ * them. input:     none. output: none.
  */
-void initialise_thread_pool() {
-    // Loop through number of threads, and execute them in start routine
-    for (int i = 0; i < NUM_HANDLER_THREADS; i++) {
-        thr_id[i] = i;
-        pthread_create(&p_threads[i], NULL, handle_requests_loop,
-                       (void *)&thr_id[i]);
-    }
+void initialise_thread_pool() { resize_thread_pool(handler_threads); }
 
-    // Initialise mutexes
-    pthread_mutex_init(&read_mutex, NULL);
-    pthread_mutex_init(&write_mutex, NULL);
+/*
+ * function resize_thread_pool(): change how many handler threads serve the
+ *   request queue
+ * algorithm: start threads up to the new size if fewer were ever started.
+ *   Threads beyond it finish the connection they serve and then stay idle
+ *   until the pool grows again, so shrinking drops nobody. When it shrinks
+ *   every idle thread is woken, so those now outside it move off got_request
+ *   and its signals only reach threads that serve. Threads back in the pool
+ *   are woken to pick up queued requests. Only the main thread calls this.
+ * input:     number of threads, 1 to MAX_HANDLER_THREADS.
+ * output:    none.
+ */
+void resize_thread_pool(int count) {
+    pthread_mutex_lock(&request_mutex);
+    if (count < handler_threads) {
+        pthread_cond_broadcast(&got_request);
+    }
+    handler_threads = count;
+    pthread_mutex_unlock(&request_mutex);
+    for (; started_threads < count; started_threads++) {
+        thr_id[started_threads] = started_threads;
+        pthread_create(&p_threads[started_threads], NULL,
+                       handle_requests_loop, (void *)&thr_id[started_threads]);
+    }
+    pthread_cond_broadcast(&pool_resized);
 }
 
 /*
  * function add_request(): add a request to the request_head linked list
  * algorithm: creates a Request, adds to the list, and increases number
  *   of pending request_head by one, and signal that there is a new request.
+ *   The request is refused if every handler thread is busy and
+ *   max_queued_requests connections are already waiting. If it has to wait
+ *   the client is sent its place in the queue straight away.
  * input:     request file descriptor, linked list mutex and cond variable.
- * output:    none.
+ * output:    1 if the request was queued, 0 if the queue was full.
  */
-void add_request(int new_fd, pthread_mutex_t *p_mutex,
-                 pthread_cond_t *p_cond_var) {
-    // Initialise new request
-    Request *a_request = malloc(sizeof(Request));
-    a_request->new_fd = new_fd;
-    a_request->next = NULL;
-
+int add_request(int new_fd, pthread_mutex_t *p_mutex,
+                pthread_cond_t *p_cond_var) {
     // Lock the mutex, to assure exclusive access to the list
     pthread_mutex_lock(p_mutex);
+    if (queued_requests + busy_handlers >=
+        handler_threads + max_queued_requests) {
+        pthread_mutex_unlock(p_mutex);
+        return 0;
+    }
 
-    // Add Request to the end of the linked list
-    if (request_head == NULL) {
-        // Set new request as login_head if list is empty
-        request_head = a_request;
-    } else {
-        Request *last_request = request_head;
-        while (last_request->next != NULL) {
-            last_request = last_request->next;
-        }
-        last_request->next = a_request;
+    // Initialise new request
+    Request *a_request = slab_zalloc(&request_slab);
+    if (a_request == NULL) {
+        pthread_mutex_unlock(p_mutex);
+        return 0;
+    }
+    a_request->new_fd = new_fd;
+    a_request->trace_connection = trace_connection();
+    a_request->queued_ns = trace_now();
+    append_request(a_request);
+
+    // Threads that are free will take the request before it could wait
+    int position = queued_requests - (handler_threads - busy_handlers);
+    if (position > 0) {
+        send_queue_position(new_fd, position);
     }
 
     // Unlock mutex
@@ -293,6 +1037,93 @@ void add_request(int new_fd, pthread_mutex_t *p_mutex,
 
     // Signal the condition variable that a new request is available
     pthread_cond_signal(p_cond_var);
+    return 1;
+}
+
+/*
+ * function append_request(): add a request to the end of the queue
+ * algorithm: request_mutex must be held.
+ * input:     pointer to request.
+ * output:    none.
+ */
+void append_request(Request *a_request) {
+    a_request->next = NULL;
+    if (request_tail == NULL) {
+        // Set new request as login_head if list is empty
+        request_head = a_request;
+    } else {
+        request_tail->next = a_request;
+    }
+    request_tail = a_request;
+    queued_requests++;
+}
+
+/*
+ * function send_queue_position(): tell a waiting client where it is queued
+ * algorithm: estimate the wait from the average time a connection is served,
+ *   spread over every handler thread. Never blocks, as the caller holds
+ *   request_mutex. Clients send nothing until they are served, so a socket
+ *   that reads as closed belongs to a client that gave up.
+ * input:     socket file descriptor, place in the queue counting from 1.
+ * output:    1 if the update was sent or the socket was full, 0 if the client
+ *   has gone or only part of the update could be sent.
+ */
+int send_queue_position(int new_fd, int position) {
+    int wait = -1;
+    if (average_service_seconds >= 0) {
+        wait =
+            (int)(position * average_service_seconds / handler_threads + 0.5);
+    }
+    char byte;
+    if (recv(new_fd, &byte, sizeof(byte), MSG_PEEK | MSG_DONTWAIT) == 0) {
+        return 0;
+    }
+
+    int message[3] = {htonl(QUEUE_POSITION), htonl(position), htonl(wait)};
+    ssize_t sent =
+        send(new_fd, message, sizeof(message), MSG_DONTWAIT | MSG_NOSIGNAL);
+    // Part of a message would leave the client reading the rest as the
+    // start of the next one, so it counts as failure and the client is
+    // dropped. A full socket takes none of it and the update is skipped
+    if (sent == -1) {
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    return sent == sizeof(message);
+}
+
+/*
+ * function send_queue_positions(): update every client waiting in the queue
+ * algorithm: walk the queue sending each waiting request its position.
+ *   Clients that have gone while waiting are taken out and closed.
+ * input:     none.
+ * output:    none.
+ */
+void send_queue_positions() {
+    pthread_mutex_lock(&request_mutex);
+    int position = 1 - (handler_threads - busy_handlers);
+    Request *prev = NULL;
+    Request *a_request = request_head;
+    while (a_request != NULL) {
+        Request *next = a_request->next;
+        if (position < 1 || send_queue_position(a_request->new_fd, position)) {
+            position++;
+            prev = a_request;
+        } else {
+            if (prev == NULL) {
+                request_head = next;
+            } else {
+                prev->next = next;
+            }
+            if (request_tail == a_request) {
+                request_tail = prev;
+            }
+            queued_requests--;
+            close(a_request->new_fd);
+            slab_free(&request_slab, a_request);
+        }
+        a_request = next;
+    }
+    pthread_mutex_unlock(&request_mutex);
 }
 
 /*
@@ -312,22 +1143,54 @@ void *handle_requests_loop(void *data) {
 
     // Loop forever as long as shutdown hasnt been activated
     while (!shutdown_active) {
-        // Get a request from the list
-        a_request = get_request();
-
-        // If a request was pending
-        if (a_request) {
+        // Get a request from the list, leaving them for the new server once
+        // an upgrade has begun, or for other threads while the pool is
+        // smaller than this thread's number
+        a_request = upgrade_requested || thread_id >= handler_threads
+                        ? NULL
+                        : get_request();
+
+        // Wait for the pool to grow back if this thread is outside it,
+        // otherwise handle the request if one was pending. A thread outside
+        // the pool may have taken a wakeup meant for a queued request, which
+        // it passes on to the threads that serve
+        if (thread_id >= handler_threads) {
+            if (request_head != NULL) {
+                pthread_cond_signal(&got_request);
+            }
+            pthread_cond_wait(&pool_resized, &request_mutex);
+        } else if (a_request) {
             // Unlock mutex so other threads can handle other request_head
+            busy_handlers++;
             pthread_mutex_unlock(&request_mutex);
 
-            // Handle the request, and free once handled
+            // Handle the request, and free once handled unless it was kept
+            // to be handed over
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
             handle_request(a_request, thread_id);
-            free(a_request);
+            clock_gettime(CLOCK_MONOTONIC, &end);
 
             // Lock the mutex again as it will try to get a request again
             pthread_mutex_lock(&request_mutex);
+            if (handed_off) {
+                a_request->next = parked_head;
+                parked_head = a_request;
+            } else {
+                slab_free(&request_slab, a_request);
+            }
+            busy_handlers--;
+            double seconds = (end.tv_sec - start.tv_sec) +
+                             (end.tv_nsec - start.tv_nsec) / 1e9;
+            average_service_seconds =
+                average_service_seconds < 0
+                    ? seconds
+                    : average_service_seconds +
+                          SERVICE_TIME_WEIGHT *
+                              (seconds - average_service_seconds);
         } else {
-            printf("Thread %d: Waiting for request...\n", thread_id);
+            log_message(LOG_LEVEL_DEBUG, "Thread %d: Waiting for request...",
+                        thread_id);
             // Block on the condition variable, unlocking the mutex.
             pthread_cond_wait(&got_request, &request_mutex);
             // Will unblock on signal/broadcast and lock the mutex.
@@ -336,7 +1199,8 @@ void *handle_requests_loop(void *data) {
 
     // Leaves loop on shutdown, unlocks mutex allowing other blocked threads to
     // continue. Exits after.
-    printf("Thread %d: Exiting\n", thread_id);
+    close_handler_ring();
+    log_message(LOG_LEVEL_INFO, "Thread %d: Exiting", thread_id);
     pthread_mutex_unlock(&request_mutex);
     pthread_exit(0);
 }
@@ -356,6 +1220,10 @@ Request *get_request() {
     // If the list was not empty, progress the list down one link
     if (request_head != NULL) {
         request_head = a_request->next;
+        if (request_head == NULL) {
+            request_tail = NULL;
+        }
+        queued_requests--;
     }
 
     return a_request;
@@ -372,111 +1240,257 @@ void handle_request(Request *a_request, int thread_id) {
     // File descriptor for the request
     int new_fd = a_request->new_fd;
 
-    // Unblock client that is waiting to be handled
-    int connected = 1;
-    send_int(new_fd, connected);
-    printf("Thread %d: Handling new game.\n", thread_id);
+    // Record spans under the connection from here on, connections handed
+    // over by the server this one replaced get a new id
+    if (a_request->trace_connection != 0) {
+        trace_set_connection(a_request->trace_connection);
+    } else {
+        trace_new_connection();
+    }
+    trace_span(TRACE_QUEUE, a_request->queued_ns, 0, 0);
+
+    // Logins and moves are limited by where the connection comes from, and
+    // moves by the connection as well
+    socklen_t peer_len = sizeof(connection_peer);
+    if (getpeername(new_fd, (struct sockaddr *)&connection_peer, &peer_len) ==
+        -1) {
+        connection_peer.ss_family = AF_UNSPEC;
+    }
+    rate_bucket_init(&connection_moves, RATE_MOVES);
 
-    // Get user login information or NULL if not authenticated,
-    Login *curr_login = auth_access(new_fd, thread_id, &connected);
+    // Close the connection if the client goes quiet for too long
+    IdleConnection idle;
+    reaper_watch(&idle, new_fd);
+    handed_off = 0;
+    attach_connection(new_fd);
+
+    // Unblock client that is waiting to be handled, unless the server this
+    // one took over from had already done so
+    int connected = 1;
+    if (!a_request->admitted) {
+        send_int(new_fd, connected);
+    }
+    log_message(LOG_LEVEL_INFO, "Thread %d: Handling new game.", thread_id);
+
+    // Get the player's session or NULL if not authenticated. A connection
+    // handed over with a session carries on from the menu, or its game.
+    Session *session = NULL;
+    if (a_request->token[0] != '\0') {
+        session = resume_session(a_request->token, new_fd);
+        reaper_phase(IDLE_MENU);
+    } else {
+        unsigned long long auth_start = trace_now();
+        session = auth_access(new_fd, thread_id, &connected);
+        trace_span(TRACE_AUTH, auth_start, session != NULL, 0);
+    }
 
-    if (curr_login != NULL) {
+    if (session != NULL) {
         char selection;
 
+        // A resumed game carries on straight away
+        if (session->in_game) {
+            minesweeper_selection(new_fd, thread_id, &connected, session);
+        }
+
         // Loop until shutdown or client disconnect
         while (!shutdown_active && connected) {
-            if (read_helper(new_fd, &selection, sizeof(selection),
-                            &connected)) {
+            reaper_phase(IDLE_MENU);
+            if (read_command(new_fd, &selection, sizeof(selection),
+                             &connected)) {
                 // Call appropriate function from client selection
                 if (selection == '1') {
                     minesweeper_selection(new_fd, thread_id, &connected,
-                                          curr_login);
+                                          session);
                 } else if (selection == '2') {
                     score_selection(new_fd);
+                } else if (selection == '4') {
+                    watch_selection(new_fd, thread_id, &connected);
+                } else if (selection == '5') {
+                    coop_selection(new_fd, thread_id, &connected, session);
+                } else if (selection == '6') {
+                    multiplex_selection(new_fd, thread_id, &connected,
+                                        session);
+                } else if (selection == '7') {
+                    shared_memory_selection(new_fd, thread_id, &connected,
+                                            session);
                 } else if (selection == '3') {
-                    // Leave loop on client quit
+                    // Leave loop on client quit, the session is not needed
+                    end_session(session);
+                    session = NULL;
                     break;
                 }
             }
         }
+
+        // Keep the session for a reconnect on disconnect or shutdown. Once
+        // detached, the TTL sweep may free it, so its token is copied first.
+        if (session != NULL) {
+            strcpy(a_request->token, session->token);
+            detach_session(session);
+        }
     }
 
-    // Quitting game: failed login, shutdown or client disconnect
+    // Replies still staged go out before the socket is closed or handed over
+    detach_connection(NULL, 0);
+
+    // Quitting game: failed login, shutdown or client disconnect. A
+    // connection kept for a new server stays open, along with its session's
+    // token so the new server can attach it.
+    reaper_release();
+    if (handed_off) {
+        if (session == NULL) {
+            a_request->token[0] = '\0';
+        }
+        log_message(LOG_LEVEL_INFO,
+                    "Thread %d: Keeping client connection for the new server.",
+                    thread_id);
+        return;
+    }
     close(new_fd);
-    printf("Thread %d: Closing client connection and returning back to pool.\n",
-           thread_id);
+    log_message(
+        LOG_LEVEL_INFO,
+        "Thread %d: Closing client connection and returning back to pool.",
+        thread_id);
 }
 
 /*
  * function auth_access(): authenticate the client
- * algorithm: get the username and password strings from client,
- *   and compare the values to the verified Login list
+ * algorithm: get the username and password strings from client. A client
+ *   resuming a session sends RESUME_USERNAME and its token as the password
+ *   and gets AUTH_RESUMED followed by a snapshot of its session. Otherwise
+ *   compare the values to the verified Login list, start a session on success
+ *   and send its resume token.
  * input: socked file descriptor, thread id for logging, and connected flag
- * output: pointer to client's Login or NULL if not authenticated.
+ * output: pointer to client's Session or NULL if not authenticated.
  */
-Login *auth_access(int new_fd, int thread_id, int *connected) {
+Session *auth_access(int new_fd, int thread_id, int *connected) {
     char usr[MAX_READ_LENGTH];
     char pwd[MAX_READ_LENGTH];
 
     // Get user input for username and password without blocking
-    if (read_helper(new_fd, &usr, MAX_READ_LENGTH, connected)) {
+    if (read_command(new_fd, &usr, MAX_READ_LENGTH, connected)) {
         if (read_helper(new_fd, &pwd, MAX_READ_LENGTH, connected)) {
+            usr[MAX_READ_LENGTH - 1] = '\0';
+            pwd[MAX_READ_LENGTH - 1] = '\0';
+
+            // Too many attempts from the address fail without checking
+            if (!rate_allow(&connection_peer, RATE_LOGINS, 1)) {
+                send_int(new_fd, 0);
+                return NULL;
+            }
+
+            if (strcmp(usr, RESUME_USERNAME) == 0) {
+                Session *session = resume_session(pwd, new_fd);
+                if (session == NULL) {
+                    send_int(new_fd, 0);
+                    return NULL;
+                }
+                log_message(LOG_LEVEL_INFO, "Thread %d: Resumed session of %s.",
+                            thread_id, session->login->username);
+                send_session_snapshot(session, new_fd);
+                return session;
+            }
+
             // Default the authentication variables to 'unauthenticated'
             int auth_val = 0;
-            Login *auth_login = NULL;
+            Session *session = NULL;
 
             // Loop through the linked list
             Login *curr_node = login_head;
-            while (curr_node->next != NULL) {
+            while (curr_node != NULL) {
                 if (strcmp(curr_node->username, usr) == 0 &&
                     strcmp(curr_node->password, pwd) == 0) {
-                    // If correct details, set variables to login values
-                    auth_val = 1;
-                    auth_login = curr_node;
+                    // If correct details, start a session for the login
+                    session = create_session(curr_node, new_fd);
+                    auth_val = session != NULL;
                     break;
                 }
                 curr_node = curr_node->next;
             }
             // Send whether authentication was successful to client
             send_int(new_fd, auth_val);
+            if (session != NULL) {
+                send_string(new_fd, session->token);
+            }
 
-            return auth_login;
+            return session;
         }
     }
 
     // Control only reaches here if unable to read values or server shutdown
-    printf("Thread %d: Left login due to shutdown or disconnect.\n", thread_id);
+    log_message(LOG_LEVEL_INFO,
+                "Thread %d: Left login due to shutdown or disconnect.",
+                thread_id);
     return NULL;
 }
 
 /*
- * function minesweeper_selection(): process a minesweeper game selection
- * algorithm: store start time for a game, play the game, compute the play time
- *   , and if the game was won add the score to the scoreboard.
+ * function send_session_snapshot(): send a resumed client its session state
+ * algorithm: encode AUTH_RESUMED, whether a game is in progress and, if so,
+ *   the board as the client sees it into one buffer and send it as a single
+ *   frame.
+ * input: pointer to Session, socked file descriptor.
+ * output: none.
+ */
+void send_session_snapshot(Session *session, int new_fd) {
+    int header[2] = {AUTH_RESUMED, (int)session->in_game};
+    if (session->in_game) {
+        send_game_update(&session->game, new_fd, header, 2,
+                         session->update_buffer);
+    } else {
+        header[0] = htonl(header[0]);
+        header[1] = htonl(header[1]);
+        send_buffer(new_fd, header, sizeof(header));
+    }
+}
+
+/*
+ * function minesweeper_selection(): process a minesweeper game selection
+ * algorithm: play the game, compute the play time from the game's start, and
+ *   if the game was won add the score to the scoreboard. A game left by a
+ *   dropped connection stays in the session and is not counted as played.
  * input: socked file descriptor, thread id for logging, connected flag, and
- *   login of current user
+ *   session of current user
  * output: none.
  */
 void minesweeper_selection(int new_fd, int thread_id, int *connected,
-                           Login *login) {
-    // Track the time before, and after the game to compute duration
-    long int start, end;
-    time(&start);
-    int game_result = play_minesweeper(new_fd, thread_id, connected);
+                           Session *session) {
+    reaper_phase(IDLE_GAME);
+    int game_result = play_minesweeper(new_fd, thread_id, connected, session);
+    if (session->in_game) {
+        return;
+    }
+    long int end;
     time(&end);
 
+    int duration = (int)(end - session->game_start);
+    record_game(session->login, game_result, duration);
+    if (game_result == GAME_WON) {
+        // Send duration to client so player can view
+        send_int(new_fd, duration);
+    }
+}
+
+/*
+ * function record_game(): update a player's statistics after a game
+ * algorithm: count the game as played, and if it was won count the win and
+ *   add the score to the scoreboard.
+ * input: login of the player, result of the game and its duration.
+ * output: none.
+ */
+void record_game(Login *login, int result, int duration) {
     // Update user details about games played/won
     login->games_played++;
-    if (game_result == GAME_WON) {
+    if (result == GAME_WON) {
         login->games_won++;
 
         // Create a score struct with user and duration data
-        Score *score = malloc(sizeof(Score));
+        Score *score = slab_alloc(&score_slab);
+        if (score == NULL) {
+            return;
+        }
         score->user = login;
-        score->duration = (int)(end - start);
-
-        // Send duration to client so player can view
-        send_int(new_fd, score->duration);
+        score->duration = duration;
 
         // Mutexes to exclusively add a score to the list
         pthread_mutex_lock(&write_mutex);
@@ -485,47 +1499,199 @@ void minesweeper_selection(int new_fd, int thread_id, int *connected,
     }
 }
 
+/*
+ * function start_game(): set up a new game in a session
+ * algorithm: allocate the session's board on its first game, then lay out a
+ *   verified no-guess board with its start region opened if one is ready in
+ *   no-guess mode, otherwise a blank board that gets its mines on the first
+ *   reveal. Records the start time of the game.
+ * input: pointer to Session.
+ * output: 1 on success, 0 if the board could not be allocated.
+ */
+int start_game(Session *session) {
+    GameState *game = &session->game;
+    if (game->tiles == NULL &&
+        !create_session_game(session, NUM_TILES_X, NUM_TILES_Y, NUM_MINES)) {
+        return 0;
+    }
+
+    int start_row = 0, start_column = 0;
+    int mode = EVENT_MODE_SESSION;
+    if (no_guess_mode &&
+        take_no_guess_board(game, &start_row, &start_column)) {
+        search_tiles(game, start_row, start_column);
+        mode = EVENT_MODE_NO_GUESS;
+    } else {
+        initialise_game(game);
+    }
+    session->in_game = true;
+    time(&session->game_start);
+    session->game_id = event_log_game_id();
+    session->moves = 0;
+    log_game_start(session->game_id, session->login, game, mode, start_row,
+                   start_column);
+
+    // Let other players watch the game from its first board
+    session->broadcast = open_broadcast(session->login);
+    if (session->broadcast != NULL) {
+        publish_game(session->broadcast, game);
+    }
+    return 1;
+}
+
+/*
+ * function end_game(): mark the session's game as over
+ * algorithm: clear the in game flag, record the end in the event log and end
+ *   the game's broadcast with the result so spectators can show it.
+ * input: pointer to Session, GAME_WON, GAME_LOST or -1 if the game was quit.
+ * output: none.
+ */
+void end_game(Session *session, int result) {
+    session->in_game = false;
+    log_event(session->game_id, EVENT_GAME_END, session->login->username,
+              result, (int)(time(NULL) - session->game_start), session->moves,
+              0);
+    if (session->broadcast != NULL) {
+        close_broadcast(session->broadcast, result);
+        session->broadcast = NULL;
+    }
+}
+
+/*
+ * function log_game_start(): record the start of a game in the event log
+ * algorithm: a board dealt with its mines already placed also records the
+ *   seed they came from, other boards do so on their first reveal.
+ * input: game id, player's login, the game, EVENT_MODE_* and the start tile
+ *   of a dealt board.
+ * output: none.
+ */
+void log_game_start(unsigned long long game_id, Login *login, GameState *game,
+                    int mode, int start_row, int start_column) {
+    log_event(game_id, EVENT_GAME_START, login->username, game->width,
+              game->height, game->num_mines, mode);
+    if (game->mines_placed) {
+        log_event(game_id, EVENT_MINES, login->username, (int)game->seed,
+                  start_row, start_column, 0);
+    }
+}
+
+/*
+ * function play_logged_move(): play a move and record it in the event log
+ * algorithm: the move that places the mines also records their seed and
+ *   the tile they were placed around.
+ * input: the game, its id, player's login, its move count, option, row and
+ *   column.
+ * output: response to the move, as from play_move().
+ */
+int play_logged_move(GameState *game, unsigned long long game_id,
+                     Login *login, int *moves, int option, int row,
+                     int column) {
+    bool placed = game->mines_placed;
+    int response = play_move(game, option, row, column);
+    if (!placed && game->mines_placed) {
+        log_event(game_id, EVENT_MINES, login->username, (int)game->seed, row,
+                  column, 0);
+    }
+    log_event(game_id, EVENT_MOVE, login->username, option, row, column,
+              response);
+    (*moves)++;
+    return response;
+}
+
 /*
  * function play_minesweeper(): communicate with client to play game
- * algorithm: Loop and get client input for game option. If game isnt quit,
- *   get coordinates and place or reveal tile. Send server response code for
- *   the processing, and send updated game state. Leave loop on game end or quit
- * input: socked file descriptor, thread id for logging, connected flag.
+ * algorithm: Start a new game unless the session already holds one, which
+ *   the client received with its resume snapshot. Loop and get client input
+ *   for game option. Hints and mine probabilities are answered straight away.
+ *   If game isnt quit, get coordinates and place or reveal tile. Send server
+ *   response code for the processing, and send updated game state. Leave loop
+ *   on game end or quit, which also ends the session's game.
+ * input: socked file descriptor, thread id for logging, connected flag,
+ *   session of current user.
  * output: exit code of game (GAME_WON or GAME_LOST or -1).
  */
-int play_minesweeper(int new_fd, int thread_id, int *connected) {
-    // Setup intial game state
-    GameState game;
-    initialise_game(&game);
-    send_revealed_game(&game, new_fd);
+int play_minesweeper(int new_fd, int thread_id, int *connected,
+                     Session *session) {
+    GameState *game = &session->game;
+    if (!session->in_game) {
+        if (!start_game(session)) {
+            *connected = 0;
+            return -1;
+        }
+        send_game_update(game, new_fd, NULL, 0, session->update_buffer);
+    }
 
     char option;
     char row, column;
     // Loop till shutdown or disconnect
     while (!shutdown_active && *connected) {
         // Reads are nested to ensure data is received in order
-        if (read_helper(new_fd, &option, sizeof(option), connected)) {
+        if (read_command(new_fd, &option, sizeof(option), connected)) {
             // Leave loop on quit
             if (option == 'Q') {
+                end_game(session, -1);
                 break;
             }
 
+            // Every other command is traced from its arrival to its reply.
+            // Hints and the probability map need no coordinates
+            unsigned long long move_start = trace_now();
+            if (option == 'H') {
+                if (allow_moves(1)) {
+                    send_hint(game, new_fd);
+                } else {
+                    send_int(new_fd, HINT_NONE);
+                }
+                trace_span(TRACE_MOVE, move_start, option, 0);
+                continue;
+            }
+            if (option == 'M') {
+                if (allow_moves(1)) {
+                    send_probabilities(game, new_fd, session->probabilities);
+                } else {
+                    send_int(new_fd, PROBABILITIES_UNAVAILABLE);
+                }
+                trace_span(TRACE_MOVE, move_start, option, 0);
+                continue;
+            }
+            if (option == 'B') {
+                int response = play_batch(session, new_fd, connected);
+                trace_span(TRACE_MOVE, move_start, option, response);
+                if (response == GAME_WON || response == GAME_LOST) {
+                    end_game(session, response);
+                    return response;
+                }
+                continue;
+            }
+
             if (read_helper(new_fd, &row, sizeof(row), connected)) {
                 if (read_helper(new_fd, &column, sizeof(column), connected)) {
-                    int response;
-                    if (option == 'R') {
-                        response = search_tiles(&game, row - 'A', column - '1');
-                    } else if (option == 'P') {
-                        response = place_flag(&game, row - 'A', column - '1');
+                    // A move over the limit is not played
+                    int response =
+                        allow_moves(1)
+                            ? play_logged_move(game, session->game_id,
+                                               session->login,
+                                               &session->moves, option,
+                                               row - 'A', column - '1')
+                            : RATE_LIMITED;
+
+                    // Send the server response so client can display a
+                    // message, with the game state showing only revealed
+                    // tiles
+                    send_game_update(game, new_fd, &response, 1,
+                                     session->update_buffer);
+                    if (session->broadcast != NULL &&
+                        response != INVALID_COORDINATES &&
+                        response != TILE_ALREADY_REVEALED &&
+                        response != CHORD_UNAVAILABLE &&
+                        response != RATE_LIMITED) {
+                        publish_game(session->broadcast, game);
                     }
-
-                    // Send the server response so client can display a message
-                    send_int(new_fd, response);
-                    // Send game state with data only on revealed tiles
-                    send_revealed_game(&game, new_fd);
+                    trace_span(TRACE_MOVE, move_start, option, response);
 
                     // Return from function on game end
                     if (response == GAME_WON || response == GAME_LOST) {
+                        end_game(session, response);
                         return response;
                     }
                 }
@@ -533,44 +1699,563 @@ int play_minesweeper(int new_fd, int thread_id, int *connected) {
         }
     }
 
-    printf("Thread %d: Leaving mid-game due to shutdown or quit.\n", thread_id);
+    log_message(LOG_LEVEL_INFO,
+                "Thread %d: Leaving game due to shutdown, disconnect or quit.",
+                thread_id);
     return -1;
 }
 
 /*
- * function send_revealed_game(): send game state with dataless unrevealed tiles
- * algorithm: Loop through game state and if tile is revealed, send it. Send
- *   a 'dummy' tile with no mine information for unrevealed tiles.
- * input: pointer to GameState, socked file descriptor.
+ * function allow_moves(): check moves against the rate limits
+ * algorithm: the connection's own bucket is checked first, as it needs no
+ *   lock, then the bucket of its source address.
+ * input: number of moves.
+ * output: true if the moves may be played, false if over a limit.
+ */
+bool allow_moves(int count) {
+    return rate_take(&connection_moves, RATE_MOVES, count) &&
+           rate_allow(&connection_peer, RATE_ADDRESS_MOVES, count);
+}
+
+/*
+ * function play_batch(): apply a batch of moves sent in one message
+ * algorithm: read the number of moves and then each move as option, row and
+ *   column characters. Apply them in order, stopping at the end of the game.
+ *   Reply with one aggregated response, the number of moves applied and the
+ *   board, and publish the board to spectators once.
+ * input: pointer to Session, socked file descriptor, connected flag.
+ * output: aggregated response: GAME_WON or GAME_LOST if the game ended, else
+ *   the response of the last move that was not NORMAL, else NORMAL. -1 if the
+ *   batch could not be read.
+ */
+int play_batch(Session *session, int new_fd, int *connected) {
+    unsigned char count;
+    char moves[MAX_BATCH_MOVES * 3];
+    if (!read_helper(new_fd, &count, sizeof(count), connected) ||
+        count > MAX_BATCH_MOVES ||
+        !read_helper(new_fd, moves, count * 3, connected)) {
+        *connected = 0;
+        return -1;
+    }
+
+    // A batch over the limit is turned away whole
+    GameState *game = &session->game;
+    int reply[2] = {NORMAL, 0};
+    bool changed = false;
+    if (!allow_moves(count)) {
+        reply[0] = RATE_LIMITED;
+        count = 0;
+    }
+    for (int i = 0; i < count; i++) {
+        int response = play_logged_move(
+            game, session->game_id, session->login, &session->moves,
+            moves[i * 3], moves[i * 3 + 1] - 'A', moves[i * 3 + 2] - '1');
+        reply[1]++;
+
+        changed |= response == NORMAL || response == GAME_WON ||
+                   response == GAME_LOST;
+        if (response != NORMAL) {
+            reply[0] = response;
+        }
+        if (response == GAME_WON || response == GAME_LOST) {
+            break;
+        }
+    }
+
+    send_game_update(game, new_fd, reply, 2, session->update_buffer);
+    if (session->broadcast != NULL && changed) {
+        publish_game(session->broadcast, game);
+    }
+    return reply[0];
+}
+
+/*
+ * function watch_selection(): let the client watch a game in progress
+ * algorithm: send up to MAX_LISTED_GAMES games in progress, best players
+ *   first, as the player's name and games won. If any were listed read the
+ *   client's pick ('0' to go back) and stream that game until it ends or the
+ *   client stops watching. SPECTATE_UNAVAILABLE is sent if the game ended in
+ *   the meantime.
+ * input: socked file descriptor, thread id for logging, connected flag.
  * output: none.
  */
-void send_revealed_game(GameState *game, int new_fd) {
-    // Set up dummy tile
-    Tile dummy;
-    dummy.revealed = 0;
+void watch_selection(int new_fd, int thread_id, int *connected) {
+    int ids[MAX_LISTED_GAMES];
+    Login *players[MAX_LISTED_GAMES];
+    int count = list_broadcasts(ids, players, MAX_LISTED_GAMES);
+
+    send_int(new_fd, count);
+    for (int i = 0; i < count; i++) {
+        send_string(new_fd, players[i]->username);
+        send_int(new_fd, players[i]->games_won);
+    }
+    if (count == 0) {
+        return;
+    }
+
+    char pick;
+    if (!read_helper(new_fd, &pick, sizeof(pick), connected)) {
+        return;
+    }
+    int index = pick - '1';
+    if (index < 0 || index >= count) {
+        return;
+    }
 
-    // Loop through all tiles in gamestate
-    for (int row = 0; row < NUM_TILES_Y; row++) {
-        for (int column = 0; column < NUM_TILES_X; column++) {
-            Tile *tile = &game->tiles[row][column];
+    // Spectators only listen, they stay for as long as the game does
+    reaper_phase(IDLE_NONE);
+    log_message(LOG_LEVEL_INFO, "Thread %d: Watching the game of %s.",
+                thread_id, players[index]->username);
+    detach_connection(NULL, 0);
+    if (!watch_broadcast(new_fd, ids[index], connected, &shutdown_active)) {
+        send_int(new_fd, SPECTATE_UNAVAILABLE);
+    }
+    attach_connection(new_fd);
+}
 
-            if (tile->revealed) {
-                // Send proper tile as it has already been revealed
-                send_tile(new_fd, tile);
-            } else {
-                // Set flag status of dummy tile then send it
-                if (tile->flagged) {
-                    dummy.flagged = 1;
-                } else {
-                    dummy.flagged = 0;
-                }
-                send_tile(new_fd, &dummy);
+/*
+ * function coop_selection(): process a co-op game selection
+ * algorithm: join a shared board and play on it until the game ends or the
+ *   client leaves. COOP_UNAVAILABLE is sent if no game could be joined.
+ * input: socked file descriptor, thread id for logging, connected flag, and
+ *   session of current user.
+ * output: none.
+ */
+void coop_selection(int new_fd, int thread_id, int *connected,
+                    Session *session) {
+    log_message(LOG_LEVEL_INFO, "Thread %d: %s joined a co-op game.",
+                thread_id, session->login->username);
+    reaper_phase(IDLE_GAME);
+    detach_connection(NULL, 0);
+    if (!play_coop(new_fd, session->login, connected, &shutdown_active,
+                   allow_moves)) {
+        send_int(new_fd, COOP_UNAVAILABLE);
+    }
+    attach_connection(new_fd);
+}
+
+/*
+ * function multiplex_selection(): drive many games over one connection
+ * algorithm: read requests in bulk and answer every complete one in order,
+ *   each reply tagged with its game id. Replies are collected in a buffer
+ *   and sent together once all requests read so far were handled, so a
+ *   client pipelining moves across games gets them back in few sends.
+ *   Requests sent along with the selection are answered first. Open games
+ *   are freed when the client leaves with 'X' or disconnects.
+ * input: socked file descriptor, thread id for logging, connected flag, and
+ *   session of current user.
+ * output: none.
+ */
+void multiplex_selection(int new_fd, int thread_id, int *connected,
+                         Session *session) {
+    log_message(LOG_LEVEL_INFO, "Thread %d: %s started multiplexed games.",
+                thread_id, session->login->username);
+    reaper_phase(IDLE_GAME);
+    MuxTable *games = mux_table_create();
+    MuxBuffer input = {NULL, 0, 0};
+    MuxBuffer output = {NULL, 0, 0};
+    if (games == NULL || mux_append(&input, MUX_FLUSH_BYTES) == NULL) {
+        *connected = 0;
+    }
+    // Requests sent right behind the selection may have been received
+    // through the ring already
+    input.len =
+        detach_connection(input.data, input.data != NULL ? input.capacity : 0);
+
+    int running = 1;
+    while (running && *connected && !shutdown_active) {
+        // Answer what is buffered before waiting for more, as requests the
+        // ring received may already be complete with nothing left to arrive
+        size_t offset = 0;
+        while (running && *connected &&
+               input.len - offset >= MUX_REQUEST_BYTES) {
+            running = handle_mux_request(games, &output, input.data + offset,
+                                         session->login, NULL);
+            offset += MUX_REQUEST_BYTES;
+            if (output.len >= MUX_FLUSH_BYTES &&
+                !mux_flush(new_fd, &output)) {
+                log_message(LOG_LEVEL_WARN,
+                            "Couldn't send buffered messages: %m");
+                *connected = 0;
+            }
+        }
+        // Keep a partly received request for the next read. Less than one
+        // request is left, so the buffer always has room to receive into
+        memmove(input.data, input.data + offset, input.len - offset);
+        input.len -= offset;
+
+        if (*connected && !mux_flush(new_fd, &output)) {
+            log_message(LOG_LEVEL_WARN, "Couldn't send buffered messages: %m");
+            *connected = 0;
+        }
+        if (!running || !*connected) {
+            break;
+        }
+
+        struct pollfd ready = {new_fd, POLLIN, 0};
+        if (poll(&ready, 1, MUX_POLL_MS) <= 0) {
+            continue;
+        }
+        ssize_t received = recv(new_fd, input.data + input.len,
+                                input.capacity - input.len, 0);
+        if (received <= 0) {
+            log_message(LOG_LEVEL_WARN, "Client ended connection: %m");
+            *connected = 0;
+            break;
+        }
+        reaper_touch();
+        input.len += received;
+    }
+
+    free_mux_games(games);
+    mux_buffer_free(&input);
+    mux_buffer_free(&output);
+    attach_connection(new_fd);
+}
+
+/*
+ * function shared_memory_selection(): drive many games through shared memory
+ * algorithm: create a segment and send its name, or SHM_UNAVAILABLE. The
+ *   client then sends multiplexed requests through the request ring and
+ *   gets replies through the reply ring, with boards packed into the
+ *   segment instead of the replies. Every request published so far is
+ *   handled before the replies are written, and the rings only sleep on a
+ *   futex when one side has nothing to do. The connection itself is only
+ *   watched for the client going away. The name is unlinked once the client
+ *   has sent a request, so it has mapped the segment.
+ * input: socked file descriptor, thread id for logging, connected flag, and
+ *   session of current user.
+ * output: none.
+ */
+void shared_memory_selection(int new_fd, int thread_id, int *connected,
+                             Session *session) {
+    detach_connection(NULL, 0);
+    char name[MAX_READ_LENGTH] = {0};
+    ShmSegment *segment = shm_segment_create(name, sizeof(name));
+    if (segment == NULL) {
+        log_message(LOG_LEVEL_WARN,
+                    "Thread %d: Couldn't create shared memory segment: %m",
+                    thread_id);
+    }
+    MuxTable *games = segment != NULL ? mux_table_create() : NULL;
+    MuxBuffer input = {NULL, 0, 0};
+    MuxBuffer output = {NULL, 0, 0};
+    if (games == NULL || mux_append(&input, MUX_FLUSH_BYTES) == NULL) {
+        send_int(new_fd, SHM_UNAVAILABLE);
+        if (segment != NULL) {
+            shm_segment_unlink(name);
+            shm_segment_close(segment);
+        }
+        free_mux_games(games);
+        mux_buffer_free(&input);
+        attach_connection(new_fd);
+        return;
+    }
+    input.len = 0;
+    send_int(new_fd, SHM_READY);
+    send_string(new_fd, name);
+    log_message(LOG_LEVEL_INFO,
+                "Thread %d: %s started games through shared memory %s.",
+                thread_id, session->login->username, name);
+    reaper_phase(IDLE_GAME);
+
+    bool linked = true;
+    int running = 1;
+    while (running && *connected && !shutdown_active) {
+        size_t received =
+            shm_ring_read(&segment->requests, input.data + input.len,
+                          input.capacity - input.len);
+        if (received == 0) {
+            if (!shm_ring_wait_readable(&segment->requests, MUX_POLL_MS) &&
+                !shm_peer_connected(new_fd)) {
+                *connected = 0;
             }
+            continue;
+        }
+        if (linked) {
+            shm_segment_unlink(name);
+            linked = false;
+        }
+        reaper_touch();
+        input.len += received;
+
+        size_t offset = 0;
+        while (running && input.len - offset >= MUX_REQUEST_BYTES) {
+            running = handle_mux_request(games, &output, input.data + offset,
+                                         session->login, segment);
+            offset += MUX_REQUEST_BYTES;
+        }
+        memmove(input.data, input.data + offset, input.len - offset);
+        input.len -= offset;
+        flush_shared_replies(segment, &output, new_fd, connected);
+    }
+
+    if (linked) {
+        shm_segment_unlink(name);
+    }
+    shm_segment_close(segment);
+    free_mux_games(games);
+    mux_buffer_free(&input);
+    mux_buffer_free(&output);
+    attach_connection(new_fd);
+}
+
+/*
+ * function flush_shared_replies(): write buffered replies to the reply ring
+ * algorithm: write what fits, and while the ring is full wait for the client
+ *   to read, giving up if it goes away or the server shuts down.
+ * input: segment, reply buffer, socket file descriptor and connected flag.
+ * output: 1 once every reply was written, 0 otherwise.
+ */
+int flush_shared_replies(ShmSegment *segment, MuxBuffer *output, int new_fd,
+                         int *connected) {
+    size_t sent = 0;
+    while (sent < output->len && *connected && !shutdown_active) {
+        size_t written = shm_ring_write(&segment->replies, output->data + sent,
+                                        output->len - sent);
+        sent += written;
+        if (written == 0 &&
+            !shm_ring_wait_writable(&segment->replies, MUX_POLL_MS) &&
+            !shm_peer_connected(new_fd)) {
+            *connected = 0;
         }
     }
+    int flushed = sent == output->len;
+    output->len = 0;
+    return flushed;
+}
+
+/*
+ * function handle_mux_request(): apply one multiplexed request
+ * algorithm: 'O' opens a game under the given id and replies with its board,
+ *   'R', 'P' and 'C' reveal, flag or chord and reply with the response and
+ *   board, 'H'
+ *   replies with a hint and 'Q' closes the game. Finished games are recorded
+ *   and closed straight away so their id can be reused. Requests for unknown
+ *   games get MUX_ERROR. 'X' replies MUX_EXIT and leaves multiplexed mode.
+ *   Through shared memory ids index the segment's boards, so ids outside
+ *   them get MUX_ERROR too. Every other request counts as a move against
+ *   the rate limits, and one over them is answered RATE_LIMITED without
+ *   being applied.
+ * input: table of open games, reply buffer, request, the player's login and
+ *   the shared memory segment, NULL over a socket.
+ * output: 0 if the client left multiplexed mode, 1 otherwise.
+ */
+int handle_mux_request(MuxTable *games, MuxBuffer *output,
+                       unsigned char *request, Login *login,
+                       ShmSegment *segment) {
+    int id = mux_get_int(request);
+    int option = mux_get_int(request + sizeof(int));
+    int row = mux_get_int(request + 2 * sizeof(int));
+    int column = mux_get_int(request + 3 * sizeof(int));
+
+    if (option == 'X') {
+        mux_append_message(output, 0, MUX_EXIT, NULL, 0, 0);
+        return 0;
+    }
+    if (!allow_moves(1)) {
+        mux_append_message(output, id, RATE_LIMITED, NULL, 0, 0);
+        return 1;
+    }
+
+    if (segment != NULL && (id < 0 || id >= SHM_MAX_GAMES)) {
+        mux_append_message(output, id, MUX_ERROR, NULL, 0, 0);
+        return 1;
+    }
+
+    MuxGame *mux_game = mux_find(games, id);
+    if (option == 'O' && mux_game == NULL) {
+        mux_game = new_mux_game();
+        if (mux_game != NULL && !mux_insert(games, id, mux_game)) {
+            free_mux_game(mux_game);
+            mux_game = NULL;
+        }
+        if (mux_game == NULL) {
+            mux_append_message(output, id, MUX_ERROR, NULL, 0, 0);
+            return 1;
+        }
 
-    // Send number of remaining mines in the game state to the client
-    send_int(new_fd, game->mines_left);
+        int start_row = 0, start_column = 0;
+        int mode = EVENT_MODE_MULTIPLEXED;
+        if (no_guess_mode && take_no_guess_board(&mux_game->game, &start_row,
+                                                 &start_column)) {
+            search_tiles(&mux_game->game, start_row, start_column);
+            mode = EVENT_MODE_NO_GUESS;
+        } else {
+            initialise_game(&mux_game->game);
+        }
+        time(&mux_game->start);
+        mux_game->game_id = event_log_game_id();
+        mux_game->moves = 0;
+        log_game_start(mux_game->game_id, login, &mux_game->game, mode,
+                       start_row, start_column);
+        append_mux_board(output, id, mux_game, NORMAL, 0, segment);
+        return 1;
+    }
+    if (mux_game == NULL || option == 'O') {
+        mux_append_message(output, id, MUX_ERROR, NULL, 0, 0);
+        return 1;
+    }
+
+    GameState *game = &mux_game->game;
+    int response = INVALID_COORDINATES;
+    if (option == 'H') {
+        int hint[3] = {HINT_NONE, 0, 0};
+        if (find_safe_tile(game, &hint[1], &hint[2])) {
+            hint[0] = HINT_SAFE_TILE;
+        }
+        mux_append_message(output, id, MUX_HINT, hint, 3, 0);
+        return 1;
+    } else if (option == 'Q') {
+        record_game(login, -1, 0);
+        log_event(mux_game->game_id, EVENT_GAME_END, login->username, -1,
+                  (int)(time(NULL) - mux_game->start), mux_game->moves, 0);
+        mux_append_message(output, id, MUX_CLOSED, NULL, 0, 0);
+    } else {
+        response = play_logged_move(game, mux_game->game_id, login,
+                                    &mux_game->moves, option, row, column);
+        int duration = 0;
+        if (response == GAME_WON || response == GAME_LOST) {
+            duration = (int)(time(NULL) - mux_game->start);
+            record_game(login, response, duration);
+            log_event(mux_game->game_id, EVENT_GAME_END, login->username,
+                      response, duration, mux_game->moves, 0);
+        }
+        append_mux_board(output, id, mux_game, response, duration, segment);
+        if (response != GAME_WON && response != GAME_LOST) {
+            return 1;
+        }
+    }
+
+    mux_remove(games, id);
+    free_mux_game(mux_game);
+    return 1;
+}
+
+/*
+ * function new_mux_game(): allocate a multiplexed game and its board
+ * algorithm: take one object from the multiplexed game slab and lay the
+ *   standard board out in the memory after the MuxGame.
+ * input: none.
+ * output: pointer to the game, NULL if memory ran out.
+ */
+MuxGame *new_mux_game() {
+    MuxGame *mux_game = slab_alloc(&mux_game_slab);
+    if (mux_game != NULL &&
+        !create_game_in(&mux_game->game, NUM_TILES_X, NUM_TILES_Y, NUM_MINES,
+                        mux_game + 1)) {
+        slab_free(&mux_game_slab, mux_game);
+        return NULL;
+    }
+    return mux_game;
+}
+
+/*
+ * function free_mux_game(): free a game from new_mux_game()
+ * input: pointer to the game.
+ * output: none.
+ */
+void free_mux_game(MuxGame *mux_game) {
+    destroy_game(&mux_game->game);
+    slab_free(&mux_game_slab, mux_game);
+}
+
+/*
+ * function free_mux_games(): free a table and the games left open in it
+ * algorithm: games left open are dropped without counting them.
+ * input: table of games, may be NULL.
+ * output: none.
+ */
+void free_mux_games(MuxTable *games) {
+    if (games == NULL) {
+        return;
+    }
+    for (int slot = 0; slot < MUX_TABLE_SLOTS; slot++) {
+        MuxGame *mux_game = games->slots[slot].value;
+        if (mux_game != NULL) {
+            free_mux_game(mux_game);
+        }
+    }
+    free(games);
+}
+
+/*
+ * function append_mux_board(): append a board reply for a multiplexed game
+ * algorithm: write the response, mines left, dimensions and duration of a
+ *   won game, followed by every tile packed into one byte. Through shared
+ *   memory the tiles go to the game's board in the segment instead, and
+ *   the sequence they were written under follows the duration.
+ * input: reply buffer, game id, the game, response to the move, the
+ *   duration of a won game and the shared memory segment or NULL.
+ * output: 1 on success, 0 on allocation failure.
+ */
+int append_mux_board(MuxBuffer *output, int id, MuxGame *mux_game,
+                     int response, int duration, ShmSegment *segment) {
+    GameState *game = &mux_game->game;
+    int tiles = game->width * game->height;
+    int values[6] = {response, game->mines_left, game->width, game->height,
+                     duration, 0};
+    if (segment != NULL) {
+        unsigned char packed[SHM_BOARD_BYTES];
+        for (int index = 0; index < tiles; index++) {
+            packed[index] = pack_tile(&game->tiles[index]);
+        }
+        values[5] = (int)shm_board_write(&segment->boards[id], packed, tiles);
+        return mux_append_message(output, id, MUX_BOARD, values, 6, 0);
+    }
+    if (!mux_append_message(output, id, MUX_BOARD, values, 5, tiles)) {
+        return 0;
+    }
+    unsigned char *bytes = output->data + output->len - tiles;
+    for (int index = 0; index < tiles; index++) {
+        bytes[index] = pack_tile(&game->tiles[index]);
+    }
+    return 1;
+}
+
+/*
+ * function send_hint(): send the client a tile that is guaranteed safe
+ * algorithm: run the solver over the revealed board, send HINT_SAFE_TILE and
+ *   the tile's row and column if one was found, otherwise HINT_NONE.
+ * input: pointer to GameState, socked file descriptor.
+ * output: none.
+ */
+void send_hint(GameState *game, int new_fd) {
+    int row, column;
+    if (find_safe_tile(game, &row, &column)) {
+        send_int(new_fd, HINT_SAFE_TILE);
+        send_int(new_fd, row);
+        send_int(new_fd, column);
+    } else {
+        send_int(new_fd, HINT_NONE);
+    }
+}
+
+/*
+ * function send_probabilities(): send the chance of each tile being a mine
+ * algorithm: compute the probabilities within the time budget, send whether
+ *   they are exact or approximate followed by one value per tile in tenths of
+ *   a percent (-1 for revealed tiles), row by row.
+ * input: pointer to GameState, socked file descriptor, buffer of one double
+ *   per tile.
+ * output: none.
+ */
+void send_probabilities(GameState *game, int new_fd, double *probabilities) {
+    int tiles = game->width * game->height;
+    int status =
+        mine_probabilities(game, probabilities, PROBABILITY_BUDGET_US);
+
+    if (status == PROBABILITY_FAILED) {
+        send_int(new_fd, PROBABILITIES_UNAVAILABLE);
+    } else {
+        send_int(new_fd, status == PROBABILITY_EXACT
+                             ? PROBABILITIES_EXACT
+                             : PROBABILITIES_APPROXIMATE);
+        for (int index = 0; index < tiles; index++) {
+            double value = probabilities[index];
+            send_int(new_fd, value < 0 ? -1 : (int)(value * 1000 + 0.5));
+        }
+    }
 }
 
 /*
@@ -581,6 +2266,7 @@ void send_revealed_game(GameState *game, int new_fd) {
  * output: none.
  */
 void score_selection(int new_fd) {
+    unsigned long long start = trace_now();
     // Lock writing if atleast one reader is present
     pthread_mutex_lock(&read_mutex);
     reader_count++;
@@ -598,6 +2284,7 @@ void score_selection(int new_fd) {
         pthread_mutex_unlock(&write_mutex);
     }
     pthread_mutex_unlock(&read_mutex);
+    trace_span(TRACE_SCORES, start, 0, 0);
 }
 
 /*
@@ -681,81 +2368,160 @@ void insert_score(Score *new) {
     }
 }
 
+/*
+ * function read_command(): read the start of a client's next command
+ * algorithm: as read_helper(), except that while the server is handing over
+ *   to a new one it gives up before reading anything, marking the
+ *   connection as handed off. The command is then read by the new server.
+ * input: socked file descriptor, pointer to buffer, length of buffer,
+ *   connected flag.
+ * output: 1 once the buffer was filled, 0 on shutdown, disconnect or hand
+ *   off.
+ */
+int read_command(int fd, void *buff, size_t len, int *connected) {
+    return read_bytes(fd, buff, len, connected, true);
+}
+
 /*
  * function read_helper(): provide non-blocking recv ability
- * algorithm: Continously poll the file descriptor with select to see if there
- *   is anything available to read, with a flag on shutdown and connection.
- *   If data is available to read, read it into the provided buffer.
- *   Note: as only character values are read, no requirement to convert byte
- *   order.
+ * algorithm: read_bytes() for reads that must not be handed off.
  * input: socked file descriptor, pointer to buffer, length of buffer,
  *   connected flag.
- * output: none.
+ * output: 1 once the buffer was filled, 0 on shutdown or disconnect.
  */
 int read_helper(int fd, void *buff, size_t len, int *connected) {
-    while (!shutdown_active && *connected) {
-        // Reset the file descriptor set to read from fd
-        fd_set init_select;
-        FD_ZERO(&init_select);
-        FD_SET(fd, &init_select);
+    return read_bytes(fd, buff, len, connected, false);
+}
 
-        // Set init_select with whether fd has data
-        if (select(fd + 1, &init_select, NULL, NULL, &tv) <= 0) {
-            continue;
-        };
-        // If fd was set, and data is available read it in
-        if (FD_ISSET(fd, &init_select)) {
-            if (recv(fd, buff, len, 0) <= 0) {
-                // On receive error, set flag that client is not connected
-                perror("Client ended connection");
-                *connected = 0;
-                continue;
-            }
-            return 1;
+/*
+ * function attach_connection(): serve a connection through io_uring
+ * algorithm: with the io_uring backend, set up the calling thread's ring on
+ *   its first connection and attach the connection to it, so reads and
+ *   sends on it go through the ring. Without it connections use plain
+ *   socket calls.
+ * input: socket file descriptor.
+ * output: none.
+ */
+void attach_connection(int fd) {
+    if (!uring_backend) {
+        return;
+    }
+    if (!handler_ring_ready) {
+        if (!uring_init(&handler_ring)) {
+            log_message(LOG_LEVEL_ERROR, "Couldn't set up io_uring: %m");
+            return;
         }
+        handler_ring_ready = true;
     }
-    return 0;
+    uring_attach(&handler_ring, fd);
+    set_connection_ring(&handler_ring);
 }
 
 /*
- * function send_int(): helper function to send int data to client
- * algorithm: convert byte order to network long and then send the data
- *   to file descriptor, checking for errors
- * input: none.
- * output: none.
+ * function detach_connection(): go back to plain socket calls
+ * algorithm: send whatever replies are staged, stop receiving through the
+ *   ring and hand back what it received but was not read yet. Must be done
+ *   before the connection is closed, handed over, or read by code that
+ *   calls recv itself.
+ * input: buffer for unread bytes and its size (any beyond it are dropped).
+ * output: number of unread bytes copied.
  */
-void send_int(int fd, int val) {
-    val = htonl(val);
-    if (send(fd, &val, sizeof(val), 0) == -1) {
-        perror("Couldn't send int data.");
+size_t detach_connection(void *leftover, size_t max) {
+    Uring *ring = get_connection_ring();
+    if (ring == NULL) {
+        return 0;
     }
+    size_t copied = uring_detach(ring, leftover, max);
+    set_connection_ring(NULL);
+    return copied;
 }
 
 /*
- * function send_string(): helper function to send string data to client
- * algorithm: send the length of the string to file descriptor, followed by the
- *   actual character information.
+ * function close_handler_ring(): close the calling thread's ring on exit
  * input: none.
  * output: none.
  */
-void send_string(int fd, char *str) {
-    if (send(fd, str, MAX_READ_LENGTH, 0) == -1) {
-        perror("Couldn't send string data.");
-    };
+void close_handler_ring() {
+    if (handler_ring_ready) {
+        uring_exit(&handler_ring);
+        handler_ring_ready = false;
+    }
 }
 
 /*
- * function send_tile(): helper function to send tiles to client
- * algorithm: send all individual components of the tile, as integers,
- *   to be received by the client.
- * input: none.
- * output: none.
+ * function read_bytes(): provide non-blocking recv ability
+ * algorithm: Poll the file descriptor to see if there is anything available
+ *   to read, waking every READ_POLL_MS to check the flags on shutdown and
+ *   connection. Each read restarts the connection's idle timeout.
+ *   If data is available to read, read it into the provided buffer until the
+ *   whole length has arrived, as a client may send a message in parts.
+ *   Connections attached to an io_uring are read from what its multishot
+ *   recv delivered, so commands that already arrived need no system call.
+ *   Note: as only character values are read, no requirement to convert byte
+ *   order.
+ *   Reads of the start of a command may be cut short for an upgrade.
+ * input: socked file descriptor, pointer to buffer, length of buffer,
+ *   connected flag, whether the connection may be handed off here.
+ * output: 1 once the buffer was filled, 0 on shutdown, disconnect or hand
+ *   off.
  */
-void send_tile(int fd, Tile *tile) {
-    send_int(fd, tile->adjacent_mines);
-    send_int(fd, (int)tile->revealed);
-    send_int(fd, (int)tile->is_mine);
-    send_int(fd, (int)tile->flagged);
+int read_bytes(int fd, void *buff, size_t len, int *connected,
+               bool can_hand_off) {
+    Uring *ring = get_connection_ring();
+    if (ring != NULL && ring->fd != fd) {
+        ring = NULL;
+    }
+    size_t filled = 0;
+    while (!shutdown_active && *connected) {
+        if (ring != NULL) {
+            filled += uring_read(ring, (char *)buff + filled, len - filled);
+        }
+        if (filled == len) {
+            return 1;
+        }
+        if (can_hand_off && upgrade_requested && filled == 0) {
+            // A command the ring already received is served first
+            if (ring != NULL) {
+                uring_stop_receiving(ring);
+                if (uring_pending(ring) > 0) {
+                    continue;
+                }
+            }
+            handed_off = 1;
+            *connected = 0;
+            return 0;
+        }
+        // With io_uring, wait for the multishot recv to deliver more, which
+        // also sends the replies staged since the last wait
+        if (ring != NULL) {
+            int status = uring_wait(ring, READ_POLL_MS);
+            if (status == -1) {
+                log_message(LOG_LEVEL_WARN, "Client ended connection");
+                *connected = 0;
+            } else if (status == 1) {
+                reaper_touch();
+            }
+            continue;
+        }
+        // Wait for fd to have data, or for the client to go away
+        struct pollfd ready = {fd, POLLIN, 0};
+        if (poll(&ready, 1, READ_POLL_MS) <= 0) {
+            continue;
+        }
+        // If data is available read it in
+        if (ready.revents != 0) {
+            ssize_t received = recv(fd, (char *)buff + filled, len - filled, 0);
+            if (received <= 0) {
+                // On receive error, set flag that client is not connected
+                log_message(LOG_LEVEL_WARN, "Client ended connection: %m");
+                *connected = 0;
+                continue;
+            }
+            filled += received;
+            reaper_touch();
+        }
+    }
+    return 0;
 }
 
 /*
@@ -768,20 +2534,61 @@ void clear_allocated_memory() {
     // Free scoreboard elements
     while (score_head != NULL) {
         Score *next = score_head->next;
-        free(score_head);
+        slab_free(&score_slab, score_head);
         score_head = next;
     }
     // Free read in verified login details
     while (login_head != NULL) {
         Login *next = login_head->next;
-        free(login_head);
+        slab_free(&login_slab, login_head);
         login_head = next;
     }
-    // Free any requests from clients still pending
+    // Free any requests from clients still pending, or kept for a new server
+    while (parked_head != NULL) {
+        Request *next = parked_head->next;
+        close(parked_head->new_fd);
+        slab_free(&request_slab, parked_head);
+        parked_head = next;
+    }
     while (request_head != NULL) {
         Request *next = request_head->next;
         close(request_head->new_fd);
-        free(request_head);
+        slab_free(&request_slab, request_head);
         request_head = next;
     }
+    request_tail = NULL;
+    queued_requests = 0;
+}
+
+/*
+ * function init_allocators(): set up the slabs of the server's objects
+ * algorithm: one slab per fixed size type, must run before any thread
+ *   starts.
+ * input: none.
+ * output: none.
+ */
+void init_allocators() {
+    slab_init(&request_slab, "request", sizeof(Request));
+    slab_init(&score_slab, "score", sizeof(Score));
+    slab_init(&login_slab, "login", sizeof(Login));
+    slab_init(&mux_game_slab, "mux game",
+              sizeof(MuxGame) + game_memory_size(NUM_TILES_X, NUM_TILES_Y));
+    init_sessions();
+}
+
+/*
+ * function print_allocation_stats(): print the allocator counters
+ * algorithm: once every object has been freed at shutdown, print each slab
+ *   and the arena totals, then free the slabs' blocks.
+ * input: none.
+ * output: none.
+ */
+void print_allocation_stats() {
+    Slab *slabs[] = {&request_slab, &score_slab, &login_slab, &mux_game_slab};
+    for (size_t i = 0; i < sizeof(slabs) / sizeof(slabs[0]); i++) {
+        print_slab_stats(slabs[i]);
+        slab_destroy(slabs[i]);
+    }
+    print_session_stats();
+    print_arena_stats();
 }
\ No newline at end of file
@@ -12,30 +12,106 @@ typedef struct score_entry_t {
     struct score_entry_t *next;
 } Score;
 
+// A game driven over a multiplexed connection
+typedef struct mux_game_t {
+    GameState game;
+    long int start;
+    // Id of the game in the event log and the moves made in it
+    unsigned long long game_id;
+    int moves;
+} MuxGame;
+
 typedef struct request_t {
     int new_fd;
+    // Set for a connection handed over by the server this one replaced: it
+    // was already let in, and is logged in if it has a session token
+    bool admitted;
+    char token[MAX_READ_LENGTH];
+    // Id the connection's trace spans are recorded under, and when it was
+    // queued for a handler thread
+    unsigned int trace_connection;
+    unsigned long long queued_ns;
     struct request_t *next;
 } Request;
 
+// Defined in session.h and multiplex.h, which depend on this header
+struct session_t;
+struct mux_table_t;
+struct mux_buffer_t;
+struct upgrade_reader_t;
+struct shm_segment_t;
+
 void initiate_shutdown();
-int setup_server_connection(int port_no);
+int apply_option(int opt, char *value);
+void request_reload();
+void reload_configuration();
+int take_over_server(char *path, int *listeners);
+int begin_upgrade(int upgrade_fd);
+void hand_off_server(int upgrade_fd, int *listeners, int num_listeners);
+int save_scoreboard(struct mux_buffer_t *state);
+Login *find_login(char *username);
+int restore_scoreboard(struct upgrade_reader_t *reader);
+int setup_server_connection(char *address, int port_no, int reuse_port);
+int accept_client(int sockfd);
 void setup_login_information();
 void initialise_thread_pool();
-void add_request(int new_fd, pthread_mutex_t *p_mutex,
-                 pthread_cond_t *p_cond_var);
+void resize_thread_pool(int count);
+int add_request(int new_fd, pthread_mutex_t *p_mutex,
+                pthread_cond_t *p_cond_var);
+void append_request(Request *a_request);
+int send_queue_position(int new_fd, int position);
+void send_queue_positions();
 void *handle_requests_loop(void *data);
 Request *get_request();
 void handle_request(struct request_t *a_request, int thread_id);
-Login *auth_access(int new_fd, int thread_id, int *client_connected);
+struct session_t *auth_access(int new_fd, int thread_id,
+                              int *client_connected);
+void send_session_snapshot(struct session_t *session, int new_fd);
 void minesweeper_selection(int new_fd, int thread_id, int *connected,
-                           Login *curr_login);
-int play_minesweeper(int new_fd, int thread_id, int *client_connected);
-void send_revealed_game(GameState *game, int new_fd);
+                           struct session_t *session);
+int start_game(struct session_t *session);
+void end_game(struct session_t *session, int result);
+void log_game_start(unsigned long long game_id, Login *login, GameState *game,
+                    int mode, int start_row, int start_column);
+int play_logged_move(GameState *game, unsigned long long game_id,
+                     Login *login, int *moves, int option, int row,
+                     int column);
+int play_minesweeper(int new_fd, int thread_id, int *client_connected,
+                     struct session_t *session);
+bool allow_moves(int count);
+int play_batch(struct session_t *session, int new_fd, int *connected);
+void watch_selection(int new_fd, int thread_id, int *connected);
+void coop_selection(int new_fd, int thread_id, int *connected,
+                    struct session_t *session);
+void multiplex_selection(int new_fd, int thread_id, int *connected,
+                         struct session_t *session);
+void shared_memory_selection(int new_fd, int thread_id, int *connected,
+                             struct session_t *session);
+int flush_shared_replies(struct shm_segment_t *segment,
+                         struct mux_buffer_t *output, int new_fd,
+                         int *connected);
+int handle_mux_request(struct mux_table_t *games, struct mux_buffer_t *output,
+                       unsigned char *request, Login *login,
+                       struct shm_segment_t *segment);
+MuxGame *new_mux_game();
+void free_mux_game(MuxGame *mux_game);
+void free_mux_games(struct mux_table_t *games);
+int append_mux_board(struct mux_buffer_t *output, int id, MuxGame *mux_game,
+                     int response, int duration,
+                     struct shm_segment_t *segment);
+void record_game(Login *login, int result, int duration);
+void send_hint(GameState *game, int new_fd);
+void send_probabilities(GameState *game, int new_fd, double *probabilities);
 void score_selection(int new_fd);
 void send_highscore_data(int new_fd);
 void insert_score(Score *new);
+int read_command(int fd, void *buff, size_t len, int *connected);
+int read_bytes(int fd, void *buff, size_t len, int *connected,
+               bool can_hand_off);
 int read_helper(int fd, void *buff, size_t len, int *client_connected);
-void send_int(int fd, int val);
-void send_string(int fd, char *str);
-void send_tile(int fd, Tile *tile);
-void clear_allocated_memory();
\ No newline at end of file
+void attach_connection(int fd);
+size_t detach_connection(void *leftover, size_t max);
+void close_handler_ring();
+void clear_allocated_memory();
+void init_allocators();
+void print_allocation_stats();
\ No newline at end of file
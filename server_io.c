@@ -0,0 +1,147 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+#include "common_constants.h"
+#include "minesweeper_logic.h"
+#include "uring.h"
+#include "logger.h"
+#include "server_io.h"
+
+// Ring the calling thread serves its connection through, NULL when it uses
+// plain socket calls
+__thread Uring *connection_ring = NULL;
+
+/*
+ * function set_connection_ring(): choose how the calling thread does I/O
+ * input: ring its connection is attached to, NULL for plain socket calls.
+ * output: none.
+ */
+void set_connection_ring(Uring *ring) { connection_ring = ring; }
+
+/*
+ * function get_connection_ring(): ring the calling thread does I/O through
+ * input: none.
+ * output: the ring, NULL if the thread uses plain socket calls.
+ */
+Uring *get_connection_ring() { return connection_ring; }
+
+/*
+ * function encode_revealed_game(): write the client's view of a game to memory
+ * algorithm: Loop through game state writing the four fields of each tile in
+ *   network byte order. Unrevealed tiles are written as a 'dummy' tile that
+ *   only carries the flag status. The number of remaining mines comes last.
+ * input: pointer to GameState, buffer of at least REVEALED_GAME_INTS ints.
+ * output: number of ints written.
+ */
+int encode_revealed_game(GameState *game, int *buffer) {
+    int count = 0;
+    for (int row = 0; row < game->height; row++) {
+        for (int column = 0; column < game->width; column++) {
+            Tile *tile = GAME_TILE(game, row, column);
+
+            if (tile->revealed) {
+                buffer[count++] = htonl(tile->adjacent_mines);
+                buffer[count++] = htonl(1);
+                buffer[count++] = htonl((int)tile->is_mine);
+            } else {
+                buffer[count++] = htonl(0);
+                buffer[count++] = htonl(0);
+                buffer[count++] = htonl(0);
+            }
+            buffer[count++] = htonl((int)tile->flagged);
+        }
+    }
+    buffer[count++] = htonl(game->mines_left);
+    return count;
+}
+
+/*
+ * function send_revealed_game(): send game state with dataless unrevealed tiles
+ * algorithm: Encode the whole board into one buffer and send it with a single
+ *   call instead of four sends per tile.
+ * input: pointer to GameState, socked file descriptor.
+ * output: none.
+ */
+void send_revealed_game(GameState *game, int new_fd) {
+    int *buffer = malloc(sizeof(int) * REVEALED_GAME_INTS(game));
+    if (buffer == NULL) {
+        log_message(LOG_LEVEL_ERROR, "Couldn't allocate game state buffer: %m");
+        return;
+    }
+    int count = encode_revealed_game(game, buffer);
+    send_buffer(new_fd, buffer, sizeof(int) * count);
+    free(buffer);
+}
+
+/*
+ * function send_game_update(): send a move's result and the new board at once
+ * algorithm: encode the given header ints followed by the board as the client
+ *   sees it into the caller's buffer, so the reply goes out in a single send
+ *   without allocating per move.
+ * input: pointer to GameState, socked file descriptor, header ints and their
+ *   count, buffer of at least count + REVEALED_GAME_INTS(game) ints.
+ * output: none.
+ */
+void send_game_update(GameState *game, int new_fd, int *header, int count,
+                      int *buffer) {
+    for (int i = 0; i < count; i++) {
+        buffer[i] = htonl(header[i]);
+    }
+    int total = count + encode_revealed_game(game, &buffer[count]);
+    send_buffer(new_fd, buffer, sizeof(int) * total);
+}
+
+/*
+ * function send_buffer(): send a whole buffer to the client
+ * algorithm: keep calling send until every byte was written, as large
+ *   buffers may be accepted by the socket in several parts. On a connection
+ *   attached to an io_uring the data is staged instead and sent with
+ *   everything else staged when the thread next waits for input.
+ * input: socket file descriptor, pointer to data and its length in bytes.
+ * output: 1 on success, 0 on error.
+ */
+int send_buffer(int fd, void *buffer, size_t len) {
+    if (connection_ring != NULL && connection_ring->fd == fd) {
+        return uring_send(connection_ring, buffer, len);
+    }
+    char *data = buffer;
+    while (len > 0) {
+        ssize_t sent = send(fd, data, len, MSG_NOSIGNAL);
+        if (sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_message(LOG_LEVEL_WARN, "Couldn't send buffer: %m");
+            return 0;
+        }
+        data += sent;
+        len -= sent;
+    }
+    return 1;
+}
+
+/*
+ * function send_int(): helper function to send int data to client
+ * algorithm: convert byte order to network long and then send the data
+ *   to file descriptor, checking for errors
+ * input: none.
+ * output: none.
+ */
+void send_int(int fd, int val) {
+    val = htonl(val);
+    send_buffer(fd, &val, sizeof(val));
+}
+
+/*
+ * function send_string(): helper function to send string data to client
+ * algorithm: send the length of the string to file descriptor, followed by the
+ *   actual character information.
+ * input: none.
+ * output: none.
+ */
+void send_string(int fd, char *str) {
+    send_buffer(fd, str, MAX_READ_LENGTH);
+}
@@ -0,0 +1,15 @@
+// Ints needed to encode a game as seen by the client
+#define REVEALED_GAME_INTS(game) ((game)->width * (game)->height * 4 + 1)
+
+// Defined in uring.h
+struct uring_t;
+
+int encode_revealed_game(GameState *game, int *buffer);
+void send_revealed_game(GameState *game, int new_fd);
+void send_game_update(GameState *game, int new_fd, int *header, int count,
+                      int *buffer);
+int send_buffer(int fd, void *buffer, size_t len);
+void send_int(int fd, int val);
+void send_string(int fd, char *str);
+void set_connection_ring(struct uring_t *ring);
+struct uring_t *get_connection_ring();
@@ -0,0 +1,623 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include "common_constants.h"
+#include "minesweeper_logic.h"
+#include "arena.h"
+#include "slab.h"
+#include "server.h"
+#include "spectate.h"
+#include "multiplex.h"
+#include "upgrade.h"
+#include "server_io.h"
+#include "logger.h"
+#include "session.h"
+
+// Hash table of sessions keyed by resume token
+Session *session_buckets[SESSION_BUCKETS];
+pthread_mutex_t session_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Signalled whenever a session loses its connection
+pthread_cond_t session_detached = PTHREAD_COND_INITIALIZER;
+// Sessions are allocated from their own slab
+Slab session_slab;
+// Hibernation totals: games packed and unpacked, boards of idle sessions
+// in the menu released, and the games packed now with the memory they take
+// and the memory their boards took. Guarded by session_mutex
+long hibernations = 0, wakes = 0, boards_released = 0;
+long hibernated_games = 0;
+size_t hibernated_bytes = 0, hibernated_board_bytes = 0;
+
+/*
+ * function init_sessions(): set up the allocator for sessions
+ * algorithm: must be called before any handler thread starts.
+ * input:     none.
+ * output:    none.
+ */
+void init_sessions() { slab_init(&session_slab, "session", sizeof(Session)); }
+
+/*
+ * function new_session(): allocate a session with no game and no connection
+ * input:     login of the player.
+ * output:    pointer to the session, or NULL if memory ran out.
+ */
+Session *new_session(Login *login) {
+    Session *session = slab_alloc(&session_slab);
+    if (session == NULL) {
+        return NULL;
+    }
+    session->login = login;
+    session->game.tiles = NULL;
+    session->arena.blocks = NULL;
+    session->hibernated = NULL;
+    session->update_buffer = NULL;
+    session->probabilities = NULL;
+    session->in_game = false;
+    session->game_id = 0;
+    session->moves = 0;
+    session->broadcast = NULL;
+    session->fd = -1;
+    return session;
+}
+
+/*
+ * function session_bucket(): bucket of the session table for a token
+ * algorithm: FNV-1a hash of the token, masked to the table size.
+ * input:     token string.
+ * output:    pointer to the head of the bucket's chain.
+ */
+Session **session_bucket(char *token) {
+    unsigned int hash = 2166136261u;
+    for (char *c = token; *c != '\0'; c++) {
+        hash = (hash ^ (unsigned char)*c) * 16777619u;
+    }
+    return &session_buckets[hash & (SESSION_BUCKETS - 1)];
+}
+
+/*
+ * function find_session(): look up a session, session_mutex must be held
+ * input:     token string.
+ * output:    pointer to the session, or NULL if there is none.
+ */
+Session *find_session(char *token) {
+    for (Session *node = *session_bucket(token); node != NULL;
+         node = node->next) {
+        if (strcmp(node->token, token) == 0) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * function generate_token(): fill in a random, unused resume token
+ * algorithm: read random bytes from the kernel and write them out as hex,
+ *   retrying on the unlikely event of a clash. session_mutex must be held.
+ * input:     buffer of at least RESUME_TOKEN_LENGTH + 1 characters.
+ * output:    1 on success, 0 if no randomness was available.
+ */
+int generate_token(char *token) {
+    unsigned char bytes[RESUME_TOKEN_LENGTH / 2];
+    do {
+        if (getrandom(bytes, sizeof(bytes), 0) != sizeof(bytes)) {
+            log_message(LOG_LEVEL_ERROR, "getrandom: %m");
+            return 0;
+        }
+        for (size_t i = 0; i < sizeof(bytes); i++) {
+            sprintf(&token[i * 2], "%02x", bytes[i]);
+        }
+    } while (find_session(token) != NULL);
+    return 1;
+}
+
+/*
+ * function create_session(): start a session for a freshly logged in player
+ * algorithm: allocate the session with no game yet, give it a token and add
+ *   it to the table attached to the login connection.
+ * input:     login of the player, connection file descriptor.
+ * output:    pointer to the session, or NULL on failure.
+ */
+Session *create_session(Login *login, int fd) {
+    Session *session = new_session(login);
+    if (session == NULL) {
+        return NULL;
+    }
+    session->fd = fd;
+    time(&session->last_active);
+
+    pthread_mutex_lock(&session_mutex);
+    if (!generate_token(session->token)) {
+        pthread_mutex_unlock(&session_mutex);
+        slab_free(&session_slab, session);
+        return NULL;
+    }
+    Session **bucket = session_bucket(session->token);
+    session->next = *bucket;
+    *bucket = session;
+    pthread_mutex_unlock(&session_mutex);
+    return session;
+}
+
+/*
+ * function create_session_game(): allocate the board of a session's games
+ * algorithm: take the board, the update buffer and the probability buffer
+ *   from the session's arena, so playing never allocates. The board is kept
+ *   for every later game of the session.
+ * input:     pointer to session, board width, height and number of mines.
+ * output:    1 on success, 0 if the size is invalid or memory ran out.
+ */
+int create_session_game(Session *session, int width, int height,
+                        int num_mines) {
+    GameState *game = &session->game;
+    if (width <= 0 || height <= 0 ||
+        !create_game_in(game, width, height, num_mines,
+                        arena_alloc(&session->arena,
+                                    game_memory_size(width, height)))) {
+        game->tiles = NULL;
+        return 0;
+    }
+    session->update_buffer = arena_alloc(
+        &session->arena,
+        sizeof(int) * (SESSION_HEADER_INTS + REVEALED_GAME_INTS(game)));
+    session->probabilities =
+        arena_alloc(&session->arena, sizeof(double) * width * height);
+    if (session->update_buffer == NULL || session->probabilities == NULL) {
+        destroy_game(game);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * function packed_game_size(): bytes of a HibernatedGame
+ * input:     number of tiles on the board.
+ * output:    size of the header and its three bitsets.
+ */
+size_t packed_game_size(int tiles) {
+    return sizeof(HibernatedGame) + 3 * (size_t)((tiles + 7) / 8);
+}
+
+/*
+ * function hibernate_session(): release the board of an idle session
+ * algorithm: pack a game in progress into bitsets, then free the board and
+ *   the buffers along with the arena. A game that cannot be packed keeps its
+ *   board. session_mutex must be held and the session detached.
+ * input:     pointer to session.
+ * output:    1 if the board was released, 0 otherwise.
+ */
+int hibernate_session(Session *session) {
+    GameState *game = &session->game;
+    size_t board_bytes = arena_footprint(&session->arena);
+    if (session->in_game) {
+        int tiles = game->width * game->height;
+        int bitset = (tiles + 7) / 8;
+        HibernatedGame *packed = calloc(1, packed_game_size(tiles));
+        if (packed == NULL) {
+            return 0;
+        }
+        packed->width = game->width;
+        packed->height = game->height;
+        packed->num_mines = game->num_mines;
+        packed->mines_left = game->mines_left;
+        packed->mines_placed = game->mines_placed;
+        packed->seed = game->seed;
+        packed->board_bytes = board_bytes;
+        for (int i = 0; i < tiles; i++) {
+            unsigned char bit = 1 << (i % 8);
+            Tile *tile = &game->tiles[i];
+            packed->bits[i / 8] |= tile->is_mine ? bit : 0;
+            packed->bits[bitset + i / 8] |= tile->revealed ? bit : 0;
+            packed->bits[2 * bitset + i / 8] |= tile->flagged ? bit : 0;
+        }
+        session->hibernated = packed;
+        hibernations++;
+        hibernated_games++;
+        hibernated_bytes += packed_game_size(tiles);
+        hibernated_board_bytes += board_bytes;
+    } else {
+        boards_released++;
+    }
+    destroy_game(game);
+    arena_release(&session->arena);
+    session->update_buffer = NULL;
+    session->probabilities = NULL;
+    return 1;
+}
+
+/*
+ * function discard_hibernated(): free the packed game of a session
+ * algorithm: session_mutex must be held.
+ * input:     pointer to session.
+ * output:    none.
+ */
+void discard_hibernated(Session *session) {
+    HibernatedGame *packed = session->hibernated;
+    hibernated_games--;
+    hibernated_bytes -= packed_game_size(packed->width * packed->height);
+    hibernated_board_bytes -= packed->board_bytes;
+    free(packed);
+    session->hibernated = NULL;
+}
+
+/*
+ * function wake_session(): give a hibernated session its board back
+ * algorithm: allocate the board and buffers again, set each tile from the
+ *   bitsets and count the mines around every tile. session_mutex must be
+ *   held.
+ * input:     pointer to session.
+ * output:    1 if the session can be played, 0 if memory ran out, in which
+ *   case it stays hibernated.
+ */
+int wake_session(Session *session) {
+    HibernatedGame *packed = session->hibernated;
+    if (packed == NULL) {
+        return 1;
+    }
+    GameState *game = &session->game;
+    if (!create_session_game(session, packed->width, packed->height,
+                             packed->num_mines)) {
+        arena_release(&session->arena);
+        return 0;
+    }
+    int tiles = packed->width * packed->height;
+    int bitset = (tiles + 7) / 8;
+    for (int i = 0; i < tiles; i++) {
+        unsigned char bit = 1 << (i % 8);
+        Tile *tile = &game->tiles[i];
+        tile->is_mine = (packed->bits[i / 8] & bit) != 0;
+        tile->revealed = (packed->bits[bitset + i / 8] & bit) != 0;
+        tile->flagged = (packed->bits[2 * bitset + i / 8] & bit) != 0;
+    }
+    for (int i = 0; i < tiles; i++) {
+        if (game->tiles[i].is_mine) {
+            increase_number_of_adjacent_mines(game, i / game->width,
+                                              i % game->width);
+        }
+    }
+    game->mines_left = packed->mines_left;
+    game->mines_placed = packed->mines_placed;
+    game->seed = packed->seed;
+    wakes++;
+    discard_hibernated(session);
+    return 1;
+}
+
+/*
+ * function resume_session(): attach a new connection to an existing session
+ * algorithm: look the token up. If another connection still holds the
+ *   session, shut that socket down so its handler notices and detaches, and
+ *   wait a bounded time for it to do so. A hibernated game is unpacked.
+ * input:     token sent by the client, new connection file descriptor.
+ * output:    pointer to the session, or NULL if unknown or still held.
+ */
+Session *resume_session(char *token, int fd) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += SESSION_TAKEOVER_SECONDS;
+
+    pthread_mutex_lock(&session_mutex);
+    Session *session = find_session(token);
+    while (session != NULL && session->fd != -1) {
+        shutdown(session->fd, SHUT_RDWR);
+        if (pthread_cond_timedwait(&session_detached, &session_mutex,
+                                   &deadline) != 0) {
+            session = NULL;
+            break;
+        }
+        // The old handler may have ended the session while we waited
+        session = find_session(token);
+    }
+    if (session != NULL && !wake_session(session)) {
+        session = NULL;
+    }
+    if (session != NULL) {
+        session->fd = fd;
+        time(&session->last_active);
+    }
+    pthread_mutex_unlock(&session_mutex);
+    return session;
+}
+
+/*
+ * function detach_session(): release a session when its connection goes away
+ * algorithm: mark it unattached and start its idle time, then wake any
+ *   client waiting to take it over. Must be called before the socket closes.
+ * input:     pointer to session.
+ * output:    none.
+ */
+void detach_session(Session *session) {
+    pthread_mutex_lock(&session_mutex);
+    session->fd = -1;
+    time(&session->last_active);
+    pthread_cond_broadcast(&session_detached);
+    pthread_mutex_unlock(&session_mutex);
+}
+
+/*
+ * function free_session(): free a session that is no longer in the table
+ * algorithm: session_mutex must be held if the session is hibernated.
+ * input:     pointer to session.
+ * output:    none.
+ */
+void free_session(Session *session) {
+    if (session->hibernated != NULL) {
+        discard_hibernated(session);
+    }
+    if (session->broadcast != NULL) {
+        close_broadcast(session->broadcast, -1);
+    }
+    if (session->game.tiles != NULL) {
+        destroy_game(&session->game);
+    }
+    arena_release(&session->arena);
+    slab_free(&session_slab, session);
+}
+
+/*
+ * function end_session(): remove a session when the player quits
+ * algorithm: unlink it from its bucket and free it along with its game.
+ * input:     pointer to session.
+ * output:    none.
+ */
+void end_session(Session *session) {
+    pthread_mutex_lock(&session_mutex);
+    Session **link = session_bucket(session->token);
+    while (*link != session) {
+        link = &(*link)->next;
+    }
+    *link = session->next;
+    pthread_cond_broadcast(&session_detached);
+    pthread_mutex_unlock(&session_mutex);
+    free_session(session);
+}
+
+/*
+ * function evict_idle_sessions(): drop sessions nobody came back for
+ * algorithm: walk every bucket and free detached sessions that have been
+ *   idle for at least SESSION_TTL_SECONDS.
+ * input:     current time.
+ * output:    number of sessions evicted.
+ */
+int evict_idle_sessions(time_t now) {
+    int evicted = 0;
+    pthread_mutex_lock(&session_mutex);
+    for (int bucket = 0; bucket < SESSION_BUCKETS; bucket++) {
+        Session **link = &session_buckets[bucket];
+        while (*link != NULL) {
+            Session *session = *link;
+            if (session->fd == -1 &&
+                now - session->last_active >= SESSION_TTL_SECONDS) {
+                *link = session->next;
+                free_session(session);
+                evicted++;
+            } else {
+                link = &session->next;
+            }
+        }
+    }
+    pthread_mutex_unlock(&session_mutex);
+    return evicted;
+}
+
+/*
+ * function hibernate_idle_sessions(): release the boards of idle sessions
+ * algorithm: walk every bucket and hibernate detached sessions that still
+ *   hold a board after SESSION_HIBERNATE_SECONDS idle.
+ * input:     current time.
+ * output:    number of games packed.
+ */
+int hibernate_idle_sessions(time_t now) {
+    int packed = 0;
+    pthread_mutex_lock(&session_mutex);
+    for (int bucket = 0; bucket < SESSION_BUCKETS; bucket++) {
+        for (Session *node = session_buckets[bucket]; node != NULL;
+             node = node->next) {
+            if (node->fd == -1 && node->game.tiles != NULL &&
+                now - node->last_active >= SESSION_HIBERNATE_SECONDS &&
+                hibernate_session(node) && node->in_game) {
+                packed++;
+            }
+        }
+    }
+    pthread_mutex_unlock(&session_mutex);
+    return packed;
+}
+
+/*
+ * function clear_sessions(): free every session on shutdown
+ * input:     none.
+ * output:    none.
+ */
+void clear_sessions() {
+    pthread_mutex_lock(&session_mutex);
+    for (int bucket = 0; bucket < SESSION_BUCKETS; bucket++) {
+        while (session_buckets[bucket] != NULL) {
+            Session *next = session_buckets[bucket]->next;
+            free_session(session_buckets[bucket]);
+            session_buckets[bucket] = next;
+        }
+    }
+    pthread_mutex_unlock(&session_mutex);
+}
+
+/*
+ * function print_hibernation_stats(): print the memory of hibernated games
+ * input:     none.
+ * output:    none.
+ */
+void print_hibernation_stats() {
+    pthread_mutex_lock(&session_mutex);
+    log_message(LOG_LEVEL_INFO,
+                "Hibernation: %ld games packed in %zu bytes, their boards "
+                "took %zu bytes",
+                hibernated_games, hibernated_bytes, hibernated_board_bytes);
+    pthread_mutex_unlock(&session_mutex);
+}
+
+/*
+ * function print_session_stats(): print the allocation counters of sessions
+ * algorithm: print the session slab, then free its blocks. Only called at
+ *   shutdown once clear_sessions() has run.
+ * input:     none.
+ * output:    none.
+ */
+void print_session_stats() {
+    log_message(LOG_LEVEL_INFO,
+                "Hibernation: %ld games packed, %ld unpacked, %ld idle boards "
+                "released in total",
+                hibernations, wakes, boards_released);
+    print_slab_stats(&session_slab);
+    slab_destroy(&session_slab);
+}
+
+/*
+ * function save_sessions(): write out every session for a server taking over
+ * algorithm: for each session its token, player and how long it has been
+ *   idle, and for a game in progress how long it has run, its size and
+ *   every tile in full. Every session is written as detached. No handler may
+ *   be using a session while this runs.
+ * input:     state to append to.
+ * output:    1 on success, 0 if out of memory.
+ */
+int save_sessions(MuxBuffer *state) {
+    time_t now = time(NULL);
+    int ok = 1;
+    pthread_mutex_lock(&session_mutex);
+    int count = 0;
+    for (int bucket = 0; bucket < SESSION_BUCKETS; bucket++) {
+        for (Session *node = session_buckets[bucket]; node != NULL;
+             node = node->next) {
+            count++;
+        }
+    }
+    ok &= put_upgrade_int(state, count);
+
+    for (int bucket = 0; bucket < SESSION_BUCKETS; bucket++) {
+        for (Session *node = session_buckets[bucket]; node != NULL;
+             node = node->next) {
+            ok &= put_upgrade_bytes(state, node->token, MAX_READ_LENGTH);
+            ok &= put_upgrade_bytes(state, node->login->username,
+                                    MAX_READ_LENGTH);
+            ok &= put_upgrade_int(state, (int)(now - node->last_active));
+            ok &= put_upgrade_int(state, node->in_game);
+            if (!node->in_game) {
+                continue;
+            }
+            // Hibernated games are written out in full like any other
+            if (!wake_session(node)) {
+                ok = 0;
+                continue;
+            }
+
+            GameState *game = &node->game;
+            ok &= put_upgrade_int(state, (int)(now - node->game_start));
+            ok &= put_upgrade_int(state, game->width);
+            ok &= put_upgrade_int(state, game->height);
+            ok &= put_upgrade_int(state, game->num_mines);
+            ok &= put_upgrade_int(state, game->mines_left);
+            ok &= put_upgrade_int(state, game->mines_placed);
+            ok &= put_upgrade_bytes(state, &node->game_id,
+                                    sizeof(node->game_id));
+            ok &= put_upgrade_int(state, node->moves);
+            int tiles = game->width * game->height;
+            unsigned char *at = mux_append(state, tiles);
+            if (at == NULL) {
+                ok = 0;
+                continue;
+            }
+            for (int i = 0; i < tiles; i++) {
+                at[i] = save_tile(&game->tiles[i]);
+            }
+        }
+    }
+    pthread_mutex_unlock(&session_mutex);
+    return ok;
+}
+
+/*
+ * function restore_sessions(): add the sessions written by save_sessions()
+ * algorithm: look each player up by name, sessions of players not in the
+ *   login list are skipped. Games in progress get a new broadcast so they
+ *   can be watched again.
+ * input:     reader positioned at the sessions, head of the login list.
+ * output:    number of sessions restored, -1 if the state was cut short.
+ */
+int restore_sessions(UpgradeReader *reader, Login *logins) {
+    time_t now = time(NULL);
+    int restored = 0;
+    int count = get_upgrade_int(reader);
+    for (int i = 0; i < count && reader->ok; i++) {
+        char token[MAX_READ_LENGTH];
+        char username[MAX_READ_LENGTH];
+        get_upgrade_bytes(reader, token, MAX_READ_LENGTH);
+        get_upgrade_bytes(reader, username, MAX_READ_LENGTH);
+        token[MAX_READ_LENGTH - 1] = '\0';
+        username[MAX_READ_LENGTH - 1] = '\0';
+        int idle = get_upgrade_int(reader);
+        bool in_game = get_upgrade_int(reader);
+
+        Login *login = logins;
+        while (login != NULL && strcmp(login->username, username) != 0) {
+            login = login->next;
+        }
+        Session *session = new_session(login);
+        if (session == NULL) {
+            reader->ok = false;
+            break;
+        }
+
+        int elapsed = 0;
+        if (in_game) {
+            elapsed = get_upgrade_int(reader);
+            int width = get_upgrade_int(reader);
+            int height = get_upgrade_int(reader);
+            int num_mines = get_upgrade_int(reader);
+            if (!reader->ok ||
+                !create_session_game(session, width, height, num_mines)) {
+                free_session(session);
+                reader->ok = false;
+                break;
+            }
+            GameState *game = &session->game;
+            game->mines_left = get_upgrade_int(reader);
+            game->mines_placed = get_upgrade_int(reader);
+            get_upgrade_bytes(reader, &session->game_id,
+                              sizeof(session->game_id));
+            session->moves = get_upgrade_int(reader);
+            for (int tile = 0; tile < width * height; tile++) {
+                unsigned char byte = 0;
+                get_upgrade_bytes(reader, &byte, sizeof(byte));
+                unpack_tile(&game->tiles[tile], byte);
+            }
+        }
+
+        // Sessions of players no longer in the login list are dropped
+        if (login == NULL) {
+            free_session(session);
+            continue;
+        }
+        strcpy(session->token, token);
+        session->in_game = in_game;
+        session->game_start = now - elapsed;
+        session->last_active = now - idle;
+        if (in_game) {
+            session->broadcast = open_broadcast(login);
+            if (session->broadcast != NULL) {
+                publish_game(session->broadcast, &session->game);
+            }
+        }
+
+        pthread_mutex_lock(&session_mutex);
+        Session **bucket = session_bucket(session->token);
+        session->next = *bucket;
+        *bucket = session;
+        pthread_mutex_unlock(&session_mutex);
+        restored++;
+    }
+    return reader->ok ? restored : -1;
+}
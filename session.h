@@ -0,0 +1,75 @@
+// Characters in the resume token handed to a client after login
+#define RESUME_TOKEN_LENGTH 16
+// Seconds a detached session keeps its game before it is evicted
+#define SESSION_TTL_SECONDS 300
+// Buckets in the session table, must be a power of two
+#define SESSION_BUCKETS 256
+// Longest a resuming client waits for the old connection to let go
+#define SESSION_TAKEOVER_SECONDS 5
+// Most header ints sent in front of the board from a session's update buffer
+#define SESSION_HEADER_INTS 2
+// Seconds a detached session sits idle before its board is released, a game
+// in progress is packed into a HibernatedGame first
+#define SESSION_HIBERNATE_SECONDS 30
+
+// A game in progress packed while nobody plays it: a bitset of mines, then
+// of revealed tiles, then of flagged tiles, one bit per tile in board order.
+// Adjacent mine counts are worked out again when it is unpacked
+typedef struct hibernated_game_t {
+    int width;
+    int height;
+    int num_mines;
+    int mines_left;
+    bool mines_placed;
+    unsigned int seed;
+    // Memory the board and buffers took before they were released
+    size_t board_bytes;
+    unsigned char bits[];
+} HibernatedGame;
+
+// A logged in player and their game, kept across reconnects
+typedef struct session_t {
+    char token[MAX_READ_LENGTH];
+    Login *login;
+    GameState game;
+    // Holds the board and the buffers below once the first game starts, all
+    // released together with the session
+    Arena arena;
+    // Game in progress while the session is hibernated, its board and the
+    // buffers are released until the player comes back. NULL otherwise
+    HibernatedGame *hibernated;
+    // Header ints and the board as the client sees it, for each reply
+    int *update_buffer;
+    // Chance of each tile being a mine, for probability requests
+    double *probabilities;
+    bool in_game;
+    long int game_start;
+    // Id of the game in the event log and the moves made in it
+    unsigned long long game_id;
+    int moves;
+    time_t last_active;
+    // Spectators' view of the game in progress, NULL if none
+    struct broadcast_t *broadcast;
+    // Connection currently attached to the session, -1 if none
+    int fd;
+    struct session_t *next;
+} Session;
+
+// Defined in multiplex.h and upgrade.h
+struct mux_buffer_t;
+struct upgrade_reader_t;
+
+void init_sessions();
+Session *create_session(Login *login, int fd);
+int create_session_game(Session *session, int width, int height,
+                        int num_mines);
+Session *resume_session(char *token, int fd);
+void detach_session(Session *session);
+void end_session(Session *session);
+int evict_idle_sessions(time_t now);
+int hibernate_idle_sessions(time_t now);
+void clear_sessions();
+int save_sessions(struct mux_buffer_t *state);
+int restore_sessions(struct upgrade_reader_t *reader, Login *logins);
+void print_hibernation_stats();
+void print_session_stats();
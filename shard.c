@@ -0,0 +1,144 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "common_constants.h"
+#include "minesweeper_logic.h"
+#include "address.h"
+#include "server.h"
+#include "logger.h"
+#include "trace.h"
+#include "shard.h"
+
+// Shards serving connections, and the flag their threads stop on
+Shard *shards = NULL;
+int num_shards = 0;
+volatile int *shards_shutdown = NULL;
+
+/*
+ * function shard_loop(): body of each thread of a shard
+ * algorithm: pin the thread to its shard's core, then wait on the shard's
+ *   listeners until shutdown. Accept a connection when one is ready and serve
+ *   it on this thread like a handler thread does, with no queue in between.
+ *   The threads of a shard share its listeners, and the kernel spreads
+ *   connections across the listeners of every shard.
+ * input:     pointer to the shard's thread id; the shard is found from it.
+ * output:    none.
+ */
+void *shard_loop(void *data) {
+    int thread_id = *(int *)data;
+    Shard *shard = &shards[thread_id / SHARD_HANDLER_THREADS];
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(shard->cpu, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+    while (!*shards_shutdown) {
+        struct pollfd listeners[MAX_LISTENERS];
+        for (int i = 0; i < shard->num_sockfds; i++) {
+            listeners[i] = (struct pollfd){shard->sockfds[i], POLLIN, 0};
+        }
+        if (poll(listeners, shard->num_sockfds, SHARD_POLL_MS) <= 0) {
+            continue;
+        }
+
+        // Another thread of the shard may have taken the connection first
+        int new_fd = -1;
+        for (int i = 0; i < shard->num_sockfds && new_fd == -1; i++) {
+            if (listeners[i].revents & POLLIN) {
+                new_fd = accept_client(shard->sockfds[i]);
+            }
+        }
+        if (new_fd == -1) {
+            continue;
+        }
+
+        Request a_request = {.new_fd = new_fd,
+                             .trace_connection = trace_connection()};
+        handle_request(&a_request, thread_id);
+    }
+
+    close_handler_ring();
+    log_message(LOG_LEVEL_INFO, "Thread %d: Exiting", thread_id);
+    return NULL;
+}
+
+/*
+ * function start_shards(): open listeners per shard and start its threads
+ * algorithm: bind every shard's listener for an address to the same port
+ *   with SO_REUSEPORT so the kernel load balances new connections between
+ *   them. The kernel does not balance Unix domain sockets, so each of those
+ *   is opened once and served by the first shard. Shard i is pinned to core
+ *   i modulo the number of online cores.
+ * input:     addresses and their number, port for addresses without one,
+ *   number of shards (0 for one per online core) and the flag that stops
+ *   the shards.
+ * output:    number of shards started.
+ */
+int start_shards(char **addresses, int num_addresses, int port_no, int count,
+                 volatile int *shutdown_active) {
+    int cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (count <= 0) {
+        count = cores;
+    }
+    if (count > MAX_SHARDS) {
+        count = MAX_SHARDS;
+    }
+
+    shards = malloc(sizeof(Shard) * count);
+    if (shards == NULL) {
+        log_message(LOG_LEVEL_ERROR, "Couldn't allocate shards: %m");
+        exit(1);
+    }
+    shards_shutdown = shutdown_active;
+
+    // Open every listener before any thread runs, so none can see a
+    // partially built shard array
+    for (int i = 0; i < count; i++) {
+        shards[i].num_sockfds = 0;
+        for (int j = 0; j < num_addresses; j++) {
+            if (i == 0 || !is_unix_address(addresses[j])) {
+                shards[i].sockfds[shards[i].num_sockfds++] =
+                    setup_server_connection(addresses[j], port_no, 1);
+            }
+        }
+        shards[i].cpu = i % cores;
+    }
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < SHARD_HANDLER_THREADS; j++) {
+            int *thread_id = &shards[i].thread_ids[j];
+            *thread_id = i * SHARD_HANDLER_THREADS + j;
+            pthread_create(&shards[i].threads[j], NULL, shard_loop,
+                           thread_id);
+        }
+    }
+    num_shards = count;
+    return count;
+}
+
+/*
+ * function stop_shards(): join every shard thread and close the listeners
+ * algorithm: the threads notice the shutdown flag within SHARD_POLL_MS, or
+ *   once the connection they are serving ends.
+ * input:     none.
+ * output:    none.
+ */
+void stop_shards() {
+    for (int i = 0; i < num_shards; i++) {
+        for (int j = 0; j < SHARD_HANDLER_THREADS; j++) {
+            pthread_join(shards[i].threads[j], NULL);
+        }
+        for (int j = 0; j < shards[i].num_sockfds; j++) {
+            close_listener(shards[i].sockfds[j]);
+        }
+    }
+    free(shards);
+    shards = NULL;
+    num_shards = 0;
+}
@@ -0,0 +1,20 @@
+// Most listeners that can be opened, one per core by default
+#define MAX_SHARDS 256
+// Connections a shard serves at once, each on its own thread
+#define SHARD_HANDLER_THREADS 4
+// How often an idle shard thread checks for shutdown
+#define SHARD_POLL_MS 100
+
+// Listeners of its own with the threads that accept and serve from them, all
+// pinned to one core
+typedef struct shard_t {
+    int sockfds[MAX_LISTENERS];
+    int num_sockfds;
+    int cpu;
+    pthread_t threads[SHARD_HANDLER_THREADS];
+    int thread_ids[SHARD_HANDLER_THREADS];
+} Shard;
+
+int start_shards(char **addresses, int num_addresses, int port_no, int count,
+                 volatile int *shutdown_active);
+void stop_shards();
@@ -0,0 +1,305 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "minesweeper_logic.h"
+#include "shm_ring.h"
+
+// Segments created by this process, to keep their names apart
+unsigned int segments_created = 0;
+// Checks made before sleeping, none on a single core where the other side
+// cannot run while this one spins; -1 until the cores were counted
+int spin_checks = -1;
+
+/*
+ * function shm_segment_create(): create a segment for a new client
+ * algorithm: create a new object under /dev/shm readable only by this user,
+ *   size it and map it. The name is sent to the client so it can map the
+ *   same object, and should be unlinked once the client has. Fresh memory
+ *   is zeroed, so both rings start out empty.
+ * input:     buffer for the segment's name and its size.
+ * output:    pointer to the mapped segment, NULL on failure with errno set.
+ */
+ShmSegment *shm_segment_create(char *name, size_t name_len) {
+    unsigned int number =
+        __atomic_fetch_add(&segments_created, 1, __ATOMIC_RELAXED);
+    snprintf(name, name_len, "/ms-%x-%x", (unsigned int)getpid(), number);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd == -1) {
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(ShmSegment)) == -1) {
+        int error = errno;
+        close(fd);
+        shm_unlink(name);
+        errno = error;
+        return NULL;
+    }
+    ShmSegment *segment = mmap(NULL, sizeof(ShmSegment),
+                               PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED) {
+        int error = errno;
+        shm_unlink(name);
+        errno = error;
+        return NULL;
+    }
+    segment->max_games = SHM_MAX_GAMES;
+    segment->board_bytes = SHM_BOARD_BYTES;
+    segment->version = SHM_VERSION;
+    __atomic_store_n(&segment->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+    return segment;
+}
+
+/*
+ * function shm_segment_open(): map a segment created by the server
+ * algorithm: check the object is the size of a segment and was laid out by
+ *   the same version of the transport before using it.
+ * input:     name of the segment.
+ * output:    pointer to the mapped segment, NULL on failure with errno set,
+ *   EPROTO for a segment of another size or layout.
+ */
+ShmSegment *shm_segment_open(char *name) {
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd == -1) {
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == -1 || info.st_size != sizeof(ShmSegment)) {
+        close(fd);
+        errno = EPROTO;
+        return NULL;
+    }
+    ShmSegment *segment = mmap(NULL, sizeof(ShmSegment),
+                               PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED) {
+        return NULL;
+    }
+    if (__atomic_load_n(&segment->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC ||
+        segment->version != SHM_VERSION ||
+        segment->max_games != SHM_MAX_GAMES ||
+        segment->board_bytes != SHM_BOARD_BYTES) {
+        munmap(segment, sizeof(ShmSegment));
+        errno = EPROTO;
+        return NULL;
+    }
+    return segment;
+}
+
+/*
+ * function shm_segment_unlink(): remove a segment's name
+ * algorithm: mappings stay valid, the memory is freed once both sides have
+ *   unmapped it.
+ * input:     name of the segment.
+ * output:    none.
+ */
+void shm_segment_unlink(char *name) { shm_unlink(name); }
+
+/*
+ * function shm_segment_close(): unmap a segment
+ * input:     pointer to the segment.
+ * output:    none.
+ */
+void shm_segment_close(ShmSegment *segment) {
+    munmap(segment, sizeof(ShmSegment));
+}
+
+/*
+ * function shm_peer_connected(): check the connection that set up a segment
+ *   is still open
+ * algorithm: the rings cannot tell that the other side went away, so a side
+ *   that timed out waiting peeks at the socket, which reports end of file
+ *   once the peer closed it. Nothing is read from it.
+ * input:     socket file descriptor.
+ * output:    1 if the connection is open, 0 otherwise.
+ */
+int shm_peer_connected(int fd) {
+    char byte;
+    ssize_t peeked = recv(fd, &byte, sizeof(byte), MSG_PEEK | MSG_DONTWAIT);
+    return peeked > 0 ||
+           (peeked == -1 &&
+            (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR));
+}
+
+/*
+ * function futex_wait(): sleep while a shared counter holds a value
+ * input:     counter, value it was seen with, timeout in milliseconds.
+ * output:    none; wakeups, timeouts and a changed value all return.
+ */
+void futex_wait(unsigned int *counter, unsigned int seen, int timeout_ms) {
+    struct timespec timeout = {timeout_ms / 1000,
+                               (timeout_ms % 1000) * 1000000L};
+    syscall(SYS_futex, counter, FUTEX_WAIT, seen, &timeout, NULL, 0);
+}
+
+/*
+ * function futex_wake(): wake the other side if it sleeps on a counter
+ * algorithm: the counter was just advanced with a sequentially consistent
+ *   store, so either the sleeper set its flag before and is woken, or it
+ *   checks the counter after setting it and does not sleep.
+ * input:     counter, the sleeper's waiting flag.
+ * output:    none.
+ */
+void futex_wake(unsigned int *counter, unsigned int *waiting) {
+    if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST)) {
+        syscall(SYS_futex, counter, FUTEX_WAKE, 1, NULL, NULL, 0);
+    }
+}
+
+/*
+ * function shm_ring_write(): append bytes to a ring
+ * algorithm: copy as much as fits into the free space, in two pieces if it
+ *   wraps, then publish it by advancing the tail. Only the ring's producer
+ *   may call this.
+ * input:     pointer to ring, bytes and their number.
+ * output:    number of bytes written, 0 if the ring is full.
+ */
+size_t shm_ring_write(ShmRing *ring, void *bytes, size_t len) {
+    unsigned int tail = ring->tail;
+    unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    size_t space = SHM_RING_BYTES - (tail - head);
+    if (len > space) {
+        len = space;
+    }
+    if (len == 0) {
+        return 0;
+    }
+    size_t at = tail & (SHM_RING_BYTES - 1);
+    size_t first = len < SHM_RING_BYTES - at ? len : SHM_RING_BYTES - at;
+    memcpy(ring->data + at, bytes, first);
+    memcpy(ring->data, (unsigned char *)bytes + first, len - first);
+    __atomic_store_n(&ring->tail, tail + (unsigned int)len, __ATOMIC_SEQ_CST);
+    futex_wake(&ring->tail, &ring->consumer_waiting);
+    return len;
+}
+
+/*
+ * function shm_ring_read(): take bytes from a ring
+ * algorithm: copy what was published, up to max, then free the space by
+ *   advancing the head. Only the ring's consumer may call this.
+ * input:     pointer to ring, buffer and its size.
+ * output:    number of bytes read, 0 if the ring is empty.
+ */
+size_t shm_ring_read(ShmRing *ring, void *bytes, size_t max) {
+    unsigned int head = ring->head;
+    unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    size_t len = tail - head;
+    if (len > max) {
+        len = max;
+    }
+    if (len == 0) {
+        return 0;
+    }
+    size_t at = head & (SHM_RING_BYTES - 1);
+    size_t first = len < SHM_RING_BYTES - at ? len : SHM_RING_BYTES - at;
+    memcpy(bytes, ring->data + at, first);
+    memcpy((unsigned char *)bytes + first, ring->data, len - first);
+    __atomic_store_n(&ring->head, head + (unsigned int)len, __ATOMIC_SEQ_CST);
+    futex_wake(&ring->head, &ring->producer_waiting);
+    return len;
+}
+
+/*
+ * function wait_for_counter(): wait until a ring counter moves
+ * algorithm: spin on the counter for SHM_SPIN_CHECKS checks, as the other
+ *   side usually answers within that time if it runs on another core. Then
+ *   set the waiting flag, check once more so a change made before the flag
+ *   was seen is not missed, and sleep on the futex.
+ * input:     counter, the value it must move away from, the waiting flag,
+ *   timeout in milliseconds.
+ * output:    1 if the counter moved, 0 on timeout.
+ */
+int wait_for_counter(unsigned int *counter, unsigned int seen,
+                     unsigned int *waiting, int timeout_ms) {
+    int checks = __atomic_load_n(&spin_checks, __ATOMIC_RELAXED);
+    if (checks == -1) {
+        checks = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SHM_SPIN_CHECKS : 0;
+        __atomic_store_n(&spin_checks, checks, __ATOMIC_RELAXED);
+    }
+    for (int i = 0; i < checks; i++) {
+        if (__atomic_load_n(counter, __ATOMIC_ACQUIRE) != seen) {
+            return 1;
+        }
+    }
+    __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(counter, __ATOMIC_SEQ_CST) == seen) {
+        futex_wait(counter, seen, timeout_ms);
+    }
+    __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+    return __atomic_load_n(counter, __ATOMIC_ACQUIRE) != seen;
+}
+
+/*
+ * function shm_ring_wait_readable(): wait for bytes to read, as consumer
+ * input:     pointer to ring, timeout in milliseconds.
+ * output:    1 if bytes can be read, 0 on timeout.
+ */
+int shm_ring_wait_readable(ShmRing *ring, int timeout_ms) {
+    return wait_for_counter(&ring->tail, ring->head, &ring->consumer_waiting,
+                            timeout_ms);
+}
+
+/*
+ * function shm_ring_wait_writable(): wait for free space, as producer
+ * input:     pointer to ring, timeout in milliseconds.
+ * output:    1 if bytes can be written, 0 on timeout.
+ */
+int shm_ring_wait_writable(ShmRing *ring, int timeout_ms) {
+    unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (ring->tail - head < SHM_RING_BYTES) {
+        return 1;
+    }
+    return wait_for_counter(&ring->head, head, &ring->producer_waiting,
+                            timeout_ms);
+}
+
+/*
+ * function shm_board_write(): replace the tiles of a game's board
+ * algorithm: make the sequence odd, copy the tiles in and make it even
+ *   again, so a reader can tell a copy it took meanwhile is torn. Only the
+ *   server writes boards.
+ * input:     pointer to board, packed tiles and their number, at most
+ *   SHM_BOARD_BYTES.
+ * output:    sequence of the board now written, to send with its reply.
+ */
+unsigned int shm_board_write(ShmBoard *board, unsigned char *tiles,
+                             size_t len) {
+    unsigned int sequence = board->sequence + 1;
+    __atomic_store_n(&board->sequence, sequence, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(board->tiles, tiles, len);
+    __atomic_store_n(&board->sequence, sequence + 1, __ATOMIC_RELEASE);
+    return sequence + 1;
+}
+
+/*
+ * function shm_board_read(): copy the tiles of a game's board
+ * algorithm: copy the tiles between two reads of the sequence, trying
+ *   again until it was even and unchanged across the copy.
+ * input:     pointer to board, sequence sent with the reply, buffer for the
+ *   tiles and their number, at most SHM_BOARD_BYTES.
+ * output:    1 if the copy is the board of the reply, 0 if a later move
+ *   already replaced it.
+ */
+int shm_board_read(ShmBoard *board, unsigned int sequence,
+                   unsigned char *tiles, size_t len) {
+    unsigned int before, after;
+    do {
+        before = __atomic_load_n(&board->sequence, __ATOMIC_ACQUIRE);
+        memcpy(tiles, board->tiles, len);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&board->sequence, __ATOMIC_RELAXED);
+    } while ((before & 1) != 0 || before != after);
+    return before == sequence;
+}
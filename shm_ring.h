@@ -0,0 +1,68 @@
+// Identifies a segment laid out by this version of the transport
+#define SHM_MAGIC 0x4d534852
+#define SHM_VERSION 2
+// Bytes in each ring, a power of two
+#define SHM_RING_BYTES 131072
+// Games a segment has board slots for; game ids index the slots
+#define SHM_MAX_GAMES 4096
+// Bytes of a board slot, one packed tile per byte of a standard board
+#define SHM_BOARD_BYTES (NUM_TILES_X * NUM_TILES_Y)
+// Times a side checks an empty or full ring before it sleeps on the futex
+#define SHM_SPIN_CHECKS 2000
+// Keeps each side's counter on its own cache line
+#define SHM_CACHE_LINE 64
+
+// A single producer, single consumer byte ring in shared memory. Counters
+// only grow and wrap at 2^32, their difference is the bytes in the ring. A
+// side that finds nothing to do sets its waiting flag and sleeps on the
+// other side's counter, which is woken only while the flag is set
+typedef struct shm_ring_t {
+    // Bytes written so far, advanced by the producer
+    unsigned int tail;
+    unsigned int consumer_waiting;
+    char tail_line[SHM_CACHE_LINE - 2 * sizeof(unsigned int)];
+    // Bytes read so far, advanced by the consumer
+    unsigned int head;
+    unsigned int producer_waiting;
+    char head_line[SHM_CACHE_LINE - 2 * sizeof(unsigned int)];
+    unsigned char data[SHM_RING_BYTES];
+} ShmRing;
+
+// The packed tiles of one game, guarded by a sequence lock. The server makes
+// the sequence odd while it writes the tiles and even again once they are
+// complete. A reader copies the tiles and tries again if the sequence was
+// odd or changed meanwhile
+typedef struct shm_board_t {
+    unsigned int sequence;
+    unsigned char tiles[SHM_BOARD_BYTES];
+} ShmBoard;
+
+// A segment shared by the server and one client: multiplexed requests go one
+// way and replies the other, in the same framing as over a socket, except
+// that board replies carry no tiles. The tiles of game id i are written to
+// boards[i] before its reply is published, and the reply carries the
+// sequence they were written under instead. A reply whose board was since
+// replaced by a later move of the same game has a newer reply on its way
+typedef struct shm_segment_t {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int max_games;
+    unsigned int board_bytes;
+    ShmRing requests;
+    ShmRing replies;
+    ShmBoard boards[SHM_MAX_GAMES];
+} ShmSegment;
+
+ShmSegment *shm_segment_create(char *name, size_t name_len);
+ShmSegment *shm_segment_open(char *name);
+void shm_segment_unlink(char *name);
+void shm_segment_close(ShmSegment *segment);
+int shm_peer_connected(int fd);
+size_t shm_ring_write(ShmRing *ring, void *bytes, size_t len);
+size_t shm_ring_read(ShmRing *ring, void *bytes, size_t max);
+int shm_ring_wait_readable(ShmRing *ring, int timeout_ms);
+int shm_ring_wait_writable(ShmRing *ring, int timeout_ms);
+unsigned int shm_board_write(ShmBoard *board, unsigned char *tiles,
+                             size_t len);
+int shm_board_read(ShmBoard *board, unsigned int sequence,
+                   unsigned char *tiles, size_t len);
@@ -0,0 +1,182 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logger.h"
+#include "slab.h"
+
+// Free objects each thread holds for every slab
+typedef struct slab_cache_t {
+    SlabObject *head;
+    int count;
+} SlabCache;
+
+__thread SlabCache slab_caches[MAX_SLABS];
+int num_slabs = 0;
+
+/*
+ * function slab_init(): set up an empty slab for objects of one size
+ * algorithm: round the size up so a free object can hold the list link and
+ *   stay pointer aligned, then claim the next cache slot. Slabs must be set
+ *   up before the threads that use them are started.
+ * input:     pointer to slab, name used in statistics, object size.
+ * output:    none.
+ */
+void slab_init(Slab *slab, const char *name, size_t size) {
+    size_t align = sizeof(void *);
+    if (size < sizeof(SlabObject)) {
+        size = sizeof(SlabObject);
+    }
+    slab->name = name;
+    slab->size = (size + align - 1) / align * align;
+    slab->id = num_slabs++;
+    slab->free_list = NULL;
+    slab->blocks = NULL;
+    slab->allocations = 0;
+    slab->frees = 0;
+    slab->refills = 0;
+    slab->num_blocks = 0;
+    pthread_mutex_init(&slab->mutex, NULL);
+    if (slab->id >= MAX_SLABS) {
+        log_message(LOG_LEVEL_ERROR, "Too many slabs, raise MAX_SLABS");
+        exit(1);
+    }
+}
+
+/*
+ * function refill_cache(): move a batch of free objects into a thread cache
+ * algorithm: under the mutex, take half a cache worth of objects from the
+ *   shared list, carving a new block out of malloc if the list is empty.
+ * input:     pointer to slab, pointer to the calling thread's cache.
+ * output:    0 if a new block could not be allocated, 1 otherwise.
+ */
+int refill_cache(Slab *slab, SlabCache *cache) {
+    pthread_mutex_lock(&slab->mutex);
+    if (slab->free_list == NULL) {
+        SlabBlock *block =
+            malloc(slab->size * (SLAB_BLOCK_OBJECTS + 1));
+        if (block == NULL) {
+            pthread_mutex_unlock(&slab->mutex);
+            return 0;
+        }
+        // The first object's worth of the block holds the block link
+        block->next = slab->blocks;
+        slab->blocks = block;
+        slab->num_blocks++;
+        unsigned char *objects = (unsigned char *)block + slab->size;
+        for (int i = SLAB_BLOCK_OBJECTS - 1; i >= 0; i--) {
+            SlabObject *object = (SlabObject *)(objects + i * slab->size);
+            object->next = slab->free_list;
+            slab->free_list = object;
+        }
+    }
+
+    while (slab->free_list != NULL && cache->count < SLAB_THREAD_CACHE / 2) {
+        SlabObject *object = slab->free_list;
+        slab->free_list = object->next;
+        object->next = cache->head;
+        cache->head = object;
+        cache->count++;
+    }
+    slab->refills++;
+    pthread_mutex_unlock(&slab->mutex);
+    return 1;
+}
+
+/*
+ * function slab_alloc(): allocate one object from a slab
+ * algorithm: pop the calling thread's cache, refilling it first if empty.
+ * input:     pointer to slab.
+ * output:    uninitialised object, NULL if memory ran out.
+ */
+void *slab_alloc(Slab *slab) {
+    SlabCache *cache = &slab_caches[slab->id];
+    if (cache->head == NULL && !refill_cache(slab, cache)) {
+        return NULL;
+    }
+    SlabObject *object = cache->head;
+    cache->head = object->next;
+    cache->count--;
+    __atomic_fetch_add(&slab->allocations, 1, __ATOMIC_RELAXED);
+    return object;
+}
+
+/*
+ * function slab_zalloc(): allocate one zeroed object from a slab
+ * input:     pointer to slab.
+ * output:    zeroed object, NULL if memory ran out.
+ */
+void *slab_zalloc(Slab *slab) {
+    void *object = slab_alloc(slab);
+    if (object != NULL) {
+        memset(object, 0, slab->size);
+    }
+    return object;
+}
+
+/*
+ * function slab_free(): return an object to its slab
+ * algorithm: push it on the calling thread's cache. When the cache is over
+ *   its limit, hand half of it back to the shared list so objects freed by
+ *   one thread can be reused by the others.
+ * input:     pointer to slab, object from slab_alloc() or NULL.
+ * output:    none.
+ */
+void slab_free(Slab *slab, void *object) {
+    if (object == NULL) {
+        return;
+    }
+    SlabCache *cache = &slab_caches[slab->id];
+    SlabObject *freed = object;
+    freed->next = cache->head;
+    cache->head = freed;
+    cache->count++;
+    __atomic_fetch_add(&slab->frees, 1, __ATOMIC_RELAXED);
+
+    if (cache->count > SLAB_THREAD_CACHE) {
+        pthread_mutex_lock(&slab->mutex);
+        while (cache->count > SLAB_THREAD_CACHE / 2) {
+            SlabObject *spare = cache->head;
+            cache->head = spare->next;
+            cache->count--;
+            spare->next = slab->free_list;
+            slab->free_list = spare;
+        }
+        pthread_mutex_unlock(&slab->mutex);
+    }
+}
+
+/*
+ * function slab_destroy(): free every block of a slab
+ * algorithm: free the block list. Objects still allocated become invalid,
+ *   so this is only called once every user of the slab has stopped.
+ * input:     pointer to slab.
+ * output:    none.
+ */
+void slab_destroy(Slab *slab) {
+    while (slab->blocks != NULL) {
+        SlabBlock *block = slab->blocks;
+        slab->blocks = block->next;
+        free(block);
+    }
+    slab->free_list = NULL;
+    slab_caches[slab->id].head = NULL;
+    slab_caches[slab->id].count = 0;
+    pthread_mutex_destroy(&slab->mutex);
+}
+
+/*
+ * function print_slab_stats(): print the allocation counters of a slab
+ * input:     pointer to slab.
+ * output:    none.
+ */
+void print_slab_stats(Slab *slab) {
+    long allocations = __atomic_load_n(&slab->allocations, __ATOMIC_RELAXED);
+    long frees = __atomic_load_n(&slab->frees, __ATOMIC_RELAXED);
+    log_message(LOG_LEVEL_INFO,
+                "Slab %-8s %ld allocations, %ld frees, %ld refills, %ld "
+                "blocks of %zu bytes",
+                slab->name, allocations, frees, slab->refills,
+                slab->num_blocks, slab->size * (SLAB_BLOCK_OBJECTS + 1));
+}
@@ -0,0 +1,40 @@
+// Objects carved out of each block a slab takes from malloc
+#define SLAB_BLOCK_OBJECTS 64
+// Free objects a thread keeps to itself, half are handed back to the shared
+// list when the cache grows past this
+#define SLAB_THREAD_CACHE 32
+// Most slabs there can be, every thread has a cache slot for each
+#define MAX_SLABS 8
+
+// A free object, linked through its own first bytes
+typedef struct slab_object_t {
+    struct slab_object_t *next;
+} SlabObject;
+
+// A block of objects taken from malloc, kept until the slab is destroyed
+typedef struct slab_block_t {
+    struct slab_block_t *next;
+} SlabBlock;
+
+// Allocator for objects of one fixed size. Each thread allocates and frees
+// through its own cache and only takes the mutex to move a batch of objects
+// between that cache and the shared free list
+typedef struct slab_t {
+    const char *name;
+    size_t size;
+    int id;
+    SlabObject *free_list;
+    SlabBlock *blocks;
+    pthread_mutex_t mutex;
+    long allocations;
+    long frees;
+    long refills;
+    long num_blocks;
+} Slab;
+
+void slab_init(Slab *slab, const char *name, size_t size);
+void *slab_alloc(Slab *slab);
+void *slab_zalloc(Slab *slab);
+void slab_free(Slab *slab, void *object);
+void slab_destroy(Slab *slab);
+void print_slab_stats(Slab *slab);
@@ -0,0 +1,333 @@
+#include <pthread.h>
+#include <string.h>
+
+#include "common_constants.h"
+#include "minesweeper_logic.h"
+#include "solver.h"
+
+#define BIT_SET(bits, i) ((bits)[(i) >> 6] & (1ull << ((i)&63)))
+#define SET_BIT(bits, i) ((bits)[(i) >> 6] |= (1ull << ((i)&63)))
+
+// 3x3 neighbour masks laid out in a 7x7 window, used to compare constraints
+// whose centres are up to two tiles apart
+static uint64_t window_table[512];
+static pthread_once_t window_table_once = PTHREAD_ONCE_INIT;
+
+// Solver reused by find_safe_tile() so hints never allocate on the game thread
+static __thread Solver hint_solver;
+static __thread bool hint_solver_ready = false;
+
+// Builds the table of 3x3 neighbour masks spread out to 7 bit wide rows
+static void build_window_table() {
+    for (int vars = 0; vars < 512; vars++) {
+        uint64_t mask = 0;
+        for (int bit = 0; bit < 9; bit++) {
+            if (vars & (1 << bit)) {
+                mask |= 1ull << ((bit / 3) * 7 + bit % 3);
+            }
+        }
+        window_table[vars] = mask;
+    }
+}
+
+// Sets up an empty solver, storage is allocated on first use
+void solver_init(Solver *solver) {
+    pthread_once(&window_table_once, build_window_table);
+    memset(solver, 0, sizeof(Solver));
+}
+
+// Frees all storage held by a solver
+void solver_free(Solver *solver) {
+    free(solver->known);
+    free(solver->mine);
+    free(solver->constraint_at);
+    free(solver->constraints);
+    free(solver->worklist);
+    free(solver->safe_tiles);
+    free(solver->mine_tiles);
+    solver_init(solver);
+}
+
+// Grows the solver storage to hold a board of the given number of tiles
+static int solver_reserve(Solver *solver, int tiles) {
+    if (tiles <= solver->capacity) {
+        return 1;
+    }
+
+    int words = (tiles + 63) / 64;
+    solver_free(solver);
+    solver->known = malloc(sizeof(uint64_t) * words);
+    solver->mine = malloc(sizeof(uint64_t) * words);
+    solver->constraint_at = malloc(sizeof(int) * tiles);
+    solver->constraints = malloc(sizeof(Constraint) * tiles);
+    solver->worklist = malloc(sizeof(int) * tiles);
+    solver->safe_tiles = malloc(sizeof(int) * tiles);
+    solver->mine_tiles = malloc(sizeof(int) * tiles);
+    if (!solver->known || !solver->mine || !solver->constraint_at ||
+        !solver->constraints || !solver->worklist || !solver->safe_tiles ||
+        !solver->mine_tiles) {
+        solver_free(solver);
+        return 0;
+    }
+    solver->capacity = tiles;
+    return 1;
+}
+
+// Places a 3x3 neighbour mask into a 7x7 window with its top left corner at
+// the given window row and column
+static inline uint64_t window_mask(int vars, int row, int column) {
+    return window_table[vars] << (row * 7 + column);
+}
+
+// Marks a tile as a deduced mine or safe tile and updates every constraint
+// that has it as a variable, queueing those constraints to be re-checked
+static void mark_tile(Solver *solver, GameState *game, int row, int column,
+                      bool is_mine) {
+    int index = row * game->width + column;
+    if (BIT_SET(solver->known, index)) {
+        return;
+    }
+
+    SET_BIT(solver->known, index);
+    if (is_mine) {
+        SET_BIT(solver->mine, index);
+        solver->mine_tiles[solver->num_mines++] = index;
+    } else {
+        solver->safe_tiles[solver->num_safe++] = index;
+    }
+
+    for (int i = -1; i <= 1; i++) {
+        for (int j = -1; j <= 1; j++) {
+            int r = row + i;
+            int c = column + j;
+            if (r < 0 || c < 0 || r >= game->height || c >= game->width) {
+                continue;
+            }
+            int id = solver->constraint_at[r * game->width + c];
+            if (id == -1) {
+                continue;
+            }
+
+            // The tile is at offset -i, -j from the constraint's centre
+            Constraint *constraint = &solver->constraints[id];
+            constraint->vars &= ~(1 << ((1 - i) * 3 + (1 - j)));
+            if (is_mine) {
+                constraint->remaining--;
+            }
+            if (!constraint->queued) {
+                constraint->queued = true;
+                solver->worklist[solver->num_queued++] = id;
+            }
+        }
+    }
+}
+
+// Marks every tile of a 3x3 neighbour mask around a tile
+static void mark_mask(Solver *solver, GameState *game, int row, int column,
+                      int vars, bool is_mine) {
+    while (vars) {
+        int bit = __builtin_ctz(vars);
+        mark_tile(solver, game, row + bit / 3 - 1, column + bit % 3 - 1,
+                  is_mine);
+        vars &= vars - 1;
+    }
+}
+
+// Marks every tile of a 7x7 window mask whose centre is at row, column
+static void mark_window(Solver *solver, GameState *game, int row, int column,
+                        uint64_t mask, bool is_mine) {
+    while (mask) {
+        int bit = __builtin_ctzll(mask);
+        mark_tile(solver, game, row + bit / 7 - 3, column + bit % 7 - 3,
+                  is_mine);
+        mask &= mask - 1;
+    }
+}
+
+// Single point rule: a constraint with no mines left has only safe
+// neighbours, one with as many mines as unknowns has only mines
+static void propagate_single(Solver *solver, GameState *game) {
+    while (solver->num_queued > 0) {
+        Constraint *constraint =
+            &solver->constraints[solver->worklist[--solver->num_queued]];
+        constraint->queued = false;
+
+        int vars = constraint->vars;
+        if (vars == 0) {
+            continue;
+        }
+        if (constraint->remaining == 0) {
+            mark_mask(solver, game, constraint->row, constraint->column, vars,
+                      false);
+        } else if (constraint->remaining == __builtin_popcount(vars)) {
+            mark_mask(solver, game, constraint->row, constraint->column, vars,
+                      true);
+        }
+    }
+}
+
+// Subset rule over every pair of constraints that share unknown tiles. For A
+// and B, if B has exactly |B \ A| more mines than A then B \ A are all mines
+// and A \ B all safe; if A is a subset of B with equal mines, B \ A is safe.
+// Deductions are propagated straight away so later pairs see them. Returns
+// whether anything was deduced.
+static bool propagate_subsets(Solver *solver, GameState *game) {
+    bool changed = false;
+
+    for (int id = 0; id < solver->num_constraints; id++) {
+        Constraint *a = &solver->constraints[id];
+
+        for (int dr = -2; dr <= 2 && a->vars; dr++) {
+            for (int dc = -2; dc <= 2 && a->vars; dc++) {
+                int r = a->row + dr;
+                int c = a->column + dc;
+                if ((dr == 0 && dc == 0) || r < 0 || c < 0 ||
+                    r >= game->height || c >= game->width) {
+                    continue;
+                }
+                int other = solver->constraint_at[r * game->width + c];
+                if (other == -1 || solver->constraints[other].vars == 0) {
+                    continue;
+                }
+
+                Constraint *b = &solver->constraints[other];
+                uint64_t a_mask = window_mask(a->vars, 2, 2);
+                uint64_t b_mask = window_mask(b->vars, 2 + dr, 2 + dc);
+                if ((a_mask & b_mask) == 0) {
+                    continue;
+                }
+
+                uint64_t only_a = a_mask & ~b_mask;
+                uint64_t only_b = b_mask & ~a_mask;
+                int extra = b->remaining - a->remaining;
+
+                if (only_b && extra == __builtin_popcountll(only_b)) {
+                    mark_window(solver, game, a->row, a->column, only_b, true);
+                    mark_window(solver, game, a->row, a->column, only_a,
+                                false);
+                } else if (only_a == 0 && only_b && extra == 0) {
+                    mark_window(solver, game, a->row, a->column, only_b,
+                                false);
+                } else {
+                    continue;
+                }
+                changed = true;
+                propagate_single(solver, game);
+            }
+        }
+    }
+    return changed;
+}
+
+// Whether the player has revealed any tile yet
+bool any_tile_revealed(GameState *game) {
+    int tiles = game->width * game->height;
+    for (int index = 0; index < tiles; index++) {
+        if (game->tiles[index].revealed) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Deduces guaranteed safe tiles and mines using only what a client can see:
+// revealed tiles with their numbers and flags (which are always on mines).
+// Deductions are left in safe_tiles/mine_tiles as row * width + column.
+// Returns the number of deductions, or -1 if storage could not be allocated.
+int solve_board(Solver *solver, GameState *game) {
+    int tiles = game->width * game->height;
+    if (!solver_reserve(solver, tiles)) {
+        return -1;
+    }
+
+    solver->words = (tiles + 63) / 64;
+    memset(solver->known, 0, sizeof(uint64_t) * solver->words);
+    memset(solver->mine, 0, sizeof(uint64_t) * solver->words);
+    solver->num_constraints = 0;
+    solver->num_queued = 0;
+    solver->num_safe = 0;
+    solver->num_mines = 0;
+
+    for (int index = 0; index < tiles; index++) {
+        Tile *tile = &game->tiles[index];
+        solver->constraint_at[index] = -1;
+        if (tile->revealed) {
+            SET_BIT(solver->known, index);
+        } else if (tile->flagged) {
+            SET_BIT(solver->known, index);
+            SET_BIT(solver->mine, index);
+        }
+    }
+
+    // Build a constraint for every revealed number bordering unknown tiles
+    for (int row = 0; row < game->height; row++) {
+        for (int column = 0; column < game->width; column++) {
+            Tile *tile = GAME_TILE(game, row, column);
+            if (!tile->revealed || tile->is_mine ||
+                tile->adjacent_mines == 0) {
+                continue;
+            }
+
+            int vars = 0;
+            int remaining = tile->adjacent_mines;
+            for (int i = -1; i <= 1; i++) {
+                for (int j = -1; j <= 1; j++) {
+                    int r = row + i;
+                    int c = column + j;
+                    if (r < 0 || c < 0 || r >= game->height ||
+                        c >= game->width || (i == 0 && j == 0)) {
+                        continue;
+                    }
+                    int index = r * game->width + c;
+                    if (!BIT_SET(solver->known, index)) {
+                        vars |= 1 << ((i + 1) * 3 + (j + 1));
+                    } else if (BIT_SET(solver->mine, index)) {
+                        remaining--;
+                    }
+                }
+            }
+            if (vars == 0) {
+                continue;
+            }
+
+            int id = solver->num_constraints++;
+            Constraint *constraint = &solver->constraints[id];
+            constraint->row = row;
+            constraint->column = column;
+            constraint->vars = vars;
+            constraint->remaining = remaining;
+            constraint->queued = true;
+            solver->constraint_at[row * game->width + column] = id;
+            solver->worklist[solver->num_queued++] = id;
+        }
+    }
+
+    // Run the cheap rule to a fixed point before trying pairs of constraints
+    propagate_single(solver, game);
+    while (propagate_subsets(solver, game)) {
+    }
+
+    return solver->num_safe + solver->num_mines;
+}
+
+// Finds a tile that is guaranteed not to be a mine, returns 0 if the visible
+// board does not prove any tile safe. Before anything is revealed every tile
+// is safe, as mines are placed around the first reveal.
+int find_safe_tile(GameState *game, int *row, int *column) {
+    if (!any_tile_revealed(game)) {
+        *row = game->height / 2;
+        *column = game->width / 2;
+        return 1;
+    }
+    if (!hint_solver_ready) {
+        solver_init(&hint_solver);
+        hint_solver_ready = true;
+    }
+    if (solve_board(&hint_solver, game) <= 0 || hint_solver.num_safe == 0) {
+        return 0;
+    }
+
+    *row = hint_solver.safe_tiles[0] / game->width;
+    *column = hint_solver.safe_tiles[0] % game->width;
+    return 1;
+}
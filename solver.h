@@ -0,0 +1,36 @@
+#include <stdint.h>
+
+// A revealed number with unknown neighbours. vars is a 3x3 mask of the
+// unknown neighbours (bit (i + 1) * 3 + (j + 1) for offset i, j) and
+// remaining is how many of them are mines.
+typedef struct constraint_t {
+    int row;
+    int column;
+    int vars;
+    int remaining;
+    bool queued;
+} Constraint;
+
+// Reusable solver state, sized for the largest board seen so far so repeated
+// calls do not allocate
+typedef struct solver_t {
+    int capacity;
+    int words;
+    uint64_t *known;    // bitset of tiles that are revealed or deduced
+    uint64_t *mine;     // bitset of tiles that are flagged or deduced mines
+    int *constraint_at; // index into constraints per tile, or -1
+    Constraint *constraints;
+    int num_constraints;
+    int *worklist;
+    int num_queued;
+    int *safe_tiles;
+    int num_safe;
+    int *mine_tiles;
+    int num_mines;
+} Solver;
+
+void solver_init(Solver *solver);
+void solver_free(Solver *solver);
+bool any_tile_revealed(GameState *game);
+int solve_board(Solver *solver, GameState *game);
+int find_safe_tile(GameState *game, int *row, int *column);
@@ -0,0 +1,386 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "common_constants.h"
+#include "minesweeper_logic.h"
+#include "server.h"
+#include "server_io.h"
+#include "logger.h"
+#include "spectate.h"
+
+// Games that can be watched, newest first
+Broadcast *broadcast_head = NULL;
+int next_broadcast_id = 1;
+pthread_mutex_t broadcast_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * function create_frame(): allocate a frame holding one reference
+ * input:     length of the frame in bytes.
+ * output:    pointer to frame, or NULL on failure.
+ */
+Frame *create_frame(size_t len) {
+    Frame *frame = malloc(sizeof(Frame) + len);
+    if (frame != NULL) {
+        frame->refs = 1;
+        frame->len = len;
+    }
+    return frame;
+}
+
+/*
+ * function release_frame(): drop a reference to a frame, freeing it with
+ *   the last one
+ * input:     pointer to frame.
+ * output:    none.
+ */
+void release_frame(Frame *frame) {
+    if (__atomic_sub_fetch(&frame->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(frame);
+    }
+}
+
+/*
+ * function release_broadcast(): drop a reference to a broadcast, freeing it
+ *   with the last one
+ * input:     pointer to broadcast.
+ * output:    none.
+ */
+void release_broadcast(Broadcast *broadcast) {
+    if (__atomic_sub_fetch(&broadcast->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (broadcast->latest != NULL) {
+            release_frame(broadcast->latest);
+        }
+        pthread_mutex_destroy(&broadcast->mutex);
+        free(broadcast);
+    }
+}
+
+/*
+ * function wake_spectator(): wake the thread serving a spectator
+ * algorithm: bump its eventfd, which never blocks the caller.
+ * input:     pointer to spectator.
+ * output:    none.
+ */
+void wake_spectator(Spectator *spectator) {
+    uint64_t one = 1;
+    if (write(spectator->event_fd, &one, sizeof(one)) == -1 &&
+        errno != EAGAIN) {
+        log_message(LOG_LEVEL_ERROR, "Couldn't wake spectator: %m");
+    }
+}
+
+/*
+ * function queue_frame(): queue a frame to a spectator, the broadcast's
+ *   mutex must be held
+ * algorithm: take a reference to the frame and append it. Every frame holds
+ *   the whole board, so a spectator whose queue is full has its backlog
+ *   thrown away and skips ahead to the new frame.
+ * input:     pointer to spectator and frame.
+ * output:    none.
+ */
+void queue_frame(Spectator *spectator, Frame *frame) {
+    if (spectator->count == SPECTATOR_QUEUE_FRAMES) {
+        release_queued_frames(spectator);
+        spectator->skipped++;
+    }
+
+    __atomic_add_fetch(&frame->refs, 1, __ATOMIC_RELAXED);
+    spectator->frames[(spectator->first + spectator->count) %
+                      SPECTATOR_QUEUE_FRAMES] = frame;
+    spectator->count++;
+    wake_spectator(spectator);
+}
+
+/*
+ * function send_queued_frames(): send the frames queued to a spectator
+ * algorithm: take the queued frames under the mutex guarding the queue, then
+ *   send them after releasing it so the publisher is never held up by the
+ *   socket. Clears the connected flag if a send fails or times out.
+ * input:     socket file descriptor, pointer to spectator, mutex guarding its
+ *   queue, connected flag.
+ * output:    none.
+ */
+void send_queued_frames(int fd, Spectator *spectator, pthread_mutex_t *mutex,
+                        int *connected) {
+    uint64_t events;
+    if (read(spectator->event_fd, &events, sizeof(events)) == -1 &&
+        errno != EAGAIN) {
+        log_message(LOG_LEVEL_ERROR, "Couldn't read spectator events: %m");
+    }
+
+    Frame *frames[SPECTATOR_QUEUE_FRAMES];
+    pthread_mutex_lock(mutex);
+    int count = spectator->count;
+    for (int i = 0; i < count; i++) {
+        frames[i] =
+            spectator->frames[(spectator->first + i) % SPECTATOR_QUEUE_FRAMES];
+    }
+    spectator->first = 0;
+    spectator->count = 0;
+    pthread_mutex_unlock(mutex);
+
+    for (int i = 0; i < count; i++) {
+        if (*connected && !send_buffer(fd, frames[i]->data, frames[i]->len)) {
+            *connected = 0;
+        }
+        release_frame(frames[i]);
+    }
+}
+
+/*
+ * function release_queued_frames(): drop every frame still queued to a
+ *   spectator, the mutex guarding its queue must be held
+ * input:     pointer to spectator.
+ * output:    none.
+ */
+void release_queued_frames(Spectator *spectator) {
+    for (int i = 0; i < spectator->count; i++) {
+        release_frame(
+            spectator->frames[(spectator->first + i) % SPECTATOR_QUEUE_FRAMES]);
+    }
+    spectator->first = 0;
+    spectator->count = 0;
+}
+
+/*
+ * function open_broadcast(): make a new game available to watch
+ * algorithm: allocate the broadcast with one reference held by the player
+ *   and add it to the list of watchable games.
+ * input:     login of the player.
+ * output:    pointer to broadcast, or NULL on failure.
+ */
+Broadcast *open_broadcast(Login *player) {
+    Broadcast *broadcast = malloc(sizeof(Broadcast));
+    if (broadcast == NULL) {
+        return NULL;
+    }
+    broadcast->player = player;
+    broadcast->refs = 1;
+    broadcast->live = true;
+    broadcast->result = -1;
+    broadcast->latest = NULL;
+    broadcast->spectators = NULL;
+    pthread_mutex_init(&broadcast->mutex, NULL);
+
+    pthread_mutex_lock(&broadcast_list_mutex);
+    broadcast->id = next_broadcast_id++;
+    broadcast->next = broadcast_head;
+    broadcast_head = broadcast;
+    pthread_mutex_unlock(&broadcast_list_mutex);
+    return broadcast;
+}
+
+/*
+ * function publish_game(): send the current board to every spectator
+ * algorithm: encode the board once into a new frame and queue a reference to
+ *   it on each spectator. The frame also replaces the latest board given to
+ *   new spectators. No socket is written here, so a slow spectator can never
+ *   hold up the player.
+ * input:     pointer to broadcast and game.
+ * output:    none.
+ */
+void publish_game(Broadcast *broadcast, GameState *game) {
+    Frame *frame = create_frame(sizeof(int) * (1 + REVEALED_GAME_INTS(game)));
+    if (frame == NULL) {
+        return;
+    }
+    frame->data[0] = htonl(SPECTATE_BOARD);
+    encode_revealed_game(game, &frame->data[1]);
+
+    pthread_mutex_lock(&broadcast->mutex);
+    Frame *previous = broadcast->latest;
+    broadcast->latest = frame;
+    for (Spectator *node = broadcast->spectators; node != NULL;
+         node = node->next) {
+        queue_frame(node, frame);
+    }
+    pthread_mutex_unlock(&broadcast->mutex);
+
+    if (previous != NULL) {
+        release_frame(previous);
+    }
+}
+
+/*
+ * function close_broadcast(): end a broadcast once its game is over
+ * algorithm: remove it from the list of watchable games, record the result
+ *   and wake every spectator so it can finish. Releases the player's
+ *   reference.
+ * input:     pointer to broadcast, GAME_WON, GAME_LOST or -1 if the game was
+ *   abandoned.
+ * output:    none.
+ */
+void close_broadcast(Broadcast *broadcast, int result) {
+    pthread_mutex_lock(&broadcast_list_mutex);
+    Broadcast **link = &broadcast_head;
+    while (*link != broadcast) {
+        link = &(*link)->next;
+    }
+    *link = broadcast->next;
+    pthread_mutex_unlock(&broadcast_list_mutex);
+
+    pthread_mutex_lock(&broadcast->mutex);
+    broadcast->live = false;
+    broadcast->result = result;
+    for (Spectator *node = broadcast->spectators; node != NULL;
+         node = node->next) {
+        wake_spectator(node);
+    }
+    pthread_mutex_unlock(&broadcast->mutex);
+    release_broadcast(broadcast);
+}
+
+/*
+ * function list_broadcasts(): find the games most worth watching
+ * algorithm: walk the watchable games keeping the ones whose players have
+ *   won the most games, sorted best first by insertion.
+ * input:     arrays to fill with broadcast ids and players, their length.
+ * output:    number of games listed.
+ */
+int list_broadcasts(int *ids, Login **players, int max) {
+    int count = 0;
+    pthread_mutex_lock(&broadcast_list_mutex);
+    for (Broadcast *node = broadcast_head; node != NULL; node = node->next) {
+        int position = count < max ? count++ : max;
+        while (position > 0 &&
+               players[position - 1]->games_won < node->player->games_won) {
+            if (position < max) {
+                ids[position] = ids[position - 1];
+                players[position] = players[position - 1];
+            }
+            position--;
+        }
+        if (position < max) {
+            ids[position] = node->id;
+            players[position] = node->player;
+        }
+    }
+    pthread_mutex_unlock(&broadcast_list_mutex);
+    return count;
+}
+
+/*
+ * function find_broadcast(): look up a watchable game and take a reference
+ * input:     broadcast id.
+ * output:    pointer to broadcast, or NULL if the game is over.
+ */
+Broadcast *find_broadcast(int id) {
+    pthread_mutex_lock(&broadcast_list_mutex);
+    Broadcast *node = broadcast_head;
+    while (node != NULL && node->id != id) {
+        node = node->next;
+    }
+    if (node != NULL) {
+        __atomic_add_fetch(&node->refs, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&broadcast_list_mutex);
+    return node;
+}
+
+/*
+ * function watch_broadcast(): stream a game to a spectator
+ * algorithm: register a spectator starting from the latest board, then wait
+ *   on its eventfd and the socket. Queued frames are taken under the
+ *   broadcast's mutex and sent after releasing it. A send that blocks for
+ *   longer than SPECTATOR_SEND_TIMEOUT_SECONDS drops the spectator. Any
+ *   input from the client stops watching. Finishes with SPECTATE_END and the
+ *   game's result.
+ * input:     socket file descriptor, broadcast id, connected flag and the
+ *   server's shutdown flag.
+ * output:    1 if the game was watched, 0 if it was no longer available.
+ */
+int watch_broadcast(int fd, int id, int *connected,
+                    volatile int *shutdown_active) {
+    Broadcast *broadcast = find_broadcast(id);
+    if (broadcast == NULL) {
+        return 0;
+    }
+
+    Spectator spectator;
+    spectator.first = 0;
+    spectator.count = 0;
+    spectator.skipped = 0;
+    spectator.event_fd = eventfd(0, EFD_NONBLOCK);
+    if (spectator.event_fd == -1) {
+        log_message(LOG_LEVEL_ERROR, "eventfd: %m");
+        release_broadcast(broadcast);
+        return 0;
+    }
+
+    pthread_mutex_lock(&broadcast->mutex);
+    if (broadcast->latest != NULL) {
+        queue_frame(&spectator, broadcast->latest);
+    }
+    spectator.next = broadcast->spectators;
+    broadcast->spectators = &spectator;
+    // Make sure a game that already ended is noticed straight away
+    wake_spectator(&spectator);
+    pthread_mutex_unlock(&broadcast->mutex);
+
+    struct timeval timeout = {SPECTATOR_SEND_TIMEOUT_SECONDS, 0};
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    bool watching = true;
+    while (watching && *connected && !*shutdown_active) {
+        struct pollfd fds[2] = {{spectator.event_fd, POLLIN, 0},
+                                {fd, POLLIN, 0}};
+        if (poll(fds, 2, WATCH_POLL_MS) <= 0) {
+            continue;
+        }
+
+        if (fds[1].revents != 0) {
+            char option;
+            if (recv(fd, &option, sizeof(option), 0) <= 0) {
+                *connected = 0;
+                break;
+            }
+            watching = false;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            // The game ends after its last board was queued, so once it is
+            // seen over every remaining frame is already in the queue
+            pthread_mutex_lock(&broadcast->mutex);
+            if (!broadcast->live) {
+                watching = false;
+            }
+            pthread_mutex_unlock(&broadcast->mutex);
+            send_queued_frames(fd, &spectator, &broadcast->mutex, connected);
+        }
+    }
+
+    // Unhook the spectator before it goes out of scope
+    pthread_mutex_lock(&broadcast->mutex);
+    Spectator **link = &broadcast->spectators;
+    while (*link != &spectator) {
+        link = &(*link)->next;
+    }
+    *link = spectator.next;
+    release_queued_frames(&spectator);
+    int result = broadcast->live ? -1 : broadcast->result;
+    pthread_mutex_unlock(&broadcast->mutex);
+    close(spectator.event_fd);
+    release_broadcast(broadcast);
+
+    timeout.tv_sec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (spectator.skipped > 0) {
+        log_message(LOG_LEVEL_INFO, "Spectator skipped ahead %d times.",
+                    spectator.skipped);
+    }
+    if (*connected) {
+        send_int(fd, SPECTATE_END);
+        send_int(fd, result);
+    }
+    return 1;
+}
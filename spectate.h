@@ -0,0 +1,54 @@
+// Frames a spectator may fall behind by before it is skipped to the latest
+#define SPECTATOR_QUEUE_FRAMES 8
+// Longest a send to a spectator may block before the spectator is dropped
+#define SPECTATOR_SEND_TIMEOUT_SECONDS 5
+// Most games offered to a client choosing what to watch
+#define MAX_LISTED_GAMES 9
+// How often a spectator's thread checks for shutdown while idle
+#define WATCH_POLL_MS 100
+
+// An encoded message shared by every spectator it is queued to
+typedef struct frame_t {
+    int refs;
+    size_t len;
+    int data[];
+} Frame;
+
+// A connection watching a game and the frames it has still to send
+typedef struct spectator_t {
+    int event_fd;
+    Frame *frames[SPECTATOR_QUEUE_FRAMES];
+    int first;
+    int count;
+    int skipped;
+    struct spectator_t *next;
+} Spectator;
+
+// A game in progress that can be watched
+typedef struct broadcast_t {
+    int id;
+    Login *player;
+    int refs;
+    bool live;
+    // How the game ended, sent to spectators once it is no longer live
+    int result;
+    // Last board published, sent first to new spectators
+    Frame *latest;
+    Spectator *spectators;
+    pthread_mutex_t mutex;
+    struct broadcast_t *next;
+} Broadcast;
+
+Frame *create_frame(size_t len);
+void release_frame(Frame *frame);
+void wake_spectator(Spectator *spectator);
+void queue_frame(Spectator *spectator, Frame *frame);
+void send_queued_frames(int fd, Spectator *spectator, pthread_mutex_t *mutex,
+                        int *connected);
+void release_queued_frames(Spectator *spectator);
+Broadcast *open_broadcast(Login *player);
+void publish_game(Broadcast *broadcast, GameState *game);
+void close_broadcast(Broadcast *broadcast, int result);
+int list_broadcasts(int *ids, Login **players, int max);
+int watch_broadcast(int fd, int id, int *connected,
+                    volatile int *shutdown_active);
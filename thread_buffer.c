@@ -0,0 +1,109 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "thread_buffer.h"
+
+/*
+ * function thread_buffer_register(): add a buffer for the calling thread
+ * algorithm: allocate it zeroed, number it and push it onto the list with
+ *   a compare and swap. The caller keeps it in a thread local variable, so
+ *   this is called once per thread.
+ * input:     list, size of the buffer, which starts with a ThreadBuffer.
+ * output:    pointer to the buffer, NULL if memory ran out.
+ */
+void *thread_buffer_register(ThreadBufferList *list, size_t size) {
+    ThreadBuffer *buffer = calloc(1, size);
+    if (buffer == NULL) {
+        return NULL;
+    }
+    buffer->thread = __atomic_fetch_add(&list->threads, 1, __ATOMIC_RELAXED);
+    buffer->next = __atomic_load_n(&list->head, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&list->head, &buffer->next, buffer,
+                                        true, __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED)) {
+    }
+    return buffer;
+}
+
+/*
+ * function thread_buffers(): first buffer of a list, for the reader
+ * input:     list.
+ * output:    newest buffer, NULL if no thread registered one.
+ */
+ThreadBuffer *thread_buffers(ThreadBufferList *list) {
+    return __atomic_load_n(&list->head, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * function buffer_writer_loop(): body of a writer thread
+ * algorithm: wait for the interval or a wakeup and drain without holding
+ *   the mutex, telling the drain whether the interval ran out.
+ * input:     writer.
+ * output:    none.
+ */
+void *buffer_writer_loop(void *data) {
+    BufferWriter *writer = data;
+    pthread_mutex_lock(&writer->mutex);
+    while (!writer->stopping) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += writer->interval_ms / 1000;
+        deadline.tv_nsec += (writer->interval_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        int waited =
+            pthread_cond_timedwait(&writer->wake, &writer->mutex, &deadline);
+        pthread_mutex_unlock(&writer->mutex);
+        writer->drain(waited == ETIMEDOUT);
+        pthread_mutex_lock(&writer->mutex);
+    }
+    pthread_mutex_unlock(&writer->mutex);
+    writer->drain(true);
+    return NULL;
+}
+
+/*
+ * function buffer_writer_start(): start a writer thread
+ * input:     writer, interval between drains in milliseconds, function
+ *   draining the buffers.
+ * output:    1 on success, 0 on failure.
+ */
+int buffer_writer_start(BufferWriter *writer, int interval_ms,
+                        void (*drain)(bool timed_out)) {
+    pthread_mutex_init(&writer->mutex, NULL);
+    pthread_cond_init(&writer->wake, NULL);
+    writer->stopping = false;
+    writer->interval_ms = interval_ms;
+    writer->drain = drain;
+    return pthread_create(&writer->thread, NULL, buffer_writer_loop,
+                          writer) == 0;
+}
+
+/*
+ * function buffer_writer_wake(): have a writer drain before its interval
+ * algorithm: signals without the mutex, so a thread logging never waits
+ *   for the writer.
+ * input:     writer.
+ * output:    none.
+ */
+void buffer_writer_wake(BufferWriter *writer) {
+    pthread_cond_signal(&writer->wake);
+}
+
+/*
+ * function buffer_writer_stop(): drain once more and stop a writer
+ * input:     writer.
+ * output:    none.
+ */
+void buffer_writer_stop(BufferWriter *writer) {
+    pthread_mutex_lock(&writer->mutex);
+    writer->stopping = true;
+    pthread_cond_signal(&writer->wake);
+    pthread_mutex_unlock(&writer->mutex);
+    pthread_join(writer->thread, NULL);
+}
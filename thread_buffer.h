@@ -0,0 +1,33 @@
+// Start of every per-thread buffer. Each thread appends to its own buffer
+// and one reader drains them all, walking the list without taking a lock:
+// buffers are only ever pushed onto its head, and stay on it
+typedef struct thread_buffer_t {
+    struct thread_buffer_t *next;
+    unsigned short thread;
+} ThreadBuffer;
+
+// Buffers of every thread that registered one, newest first. Threads are
+// numbered in the order they registered
+typedef struct thread_buffer_list_t {
+    ThreadBuffer *head;
+    unsigned short threads;
+} ThreadBufferList;
+
+// Thread draining buffers every interval, and early when a thread filling
+// its buffer wakes it; a wakeup missed while it is draining only delays the
+// next drain to the interval. It drains once more when stopped
+typedef struct buffer_writer_t {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    bool stopping;
+    int interval_ms;
+    void (*drain)(bool timed_out);
+} BufferWriter;
+
+void *thread_buffer_register(ThreadBufferList *list, size_t size);
+ThreadBuffer *thread_buffers(ThreadBufferList *list);
+int buffer_writer_start(BufferWriter *writer, int interval_ms,
+                        void (*drain)(bool timed_out));
+void buffer_writer_wake(BufferWriter *writer);
+void buffer_writer_stop(BufferWriter *writer);
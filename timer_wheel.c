@@ -0,0 +1,154 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "timer_wheel.h"
+
+/*
+ * function timer_wheel_init(): start an empty wheel at the given tick
+ * input:     pointer to wheel, current tick.
+ * output:    none.
+ */
+void timer_wheel_init(TimerWheel *wheel, unsigned long now) {
+    wheel->now = now;
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < WHEEL_SLOTS; slot++) {
+            wheel->slots[level][slot] = NULL;
+        }
+    }
+}
+
+/*
+ * function link_timer(): put a timer in the slot its expiry falls in
+ * algorithm: the level is picked by how far ahead the timer expires, and the
+ *   slot by the bits of the expiry tick that level counts in.
+ * input:     pointer to wheel, pointer to timer with expires set.
+ * output:    none.
+ */
+void link_timer(TimerWheel *wheel, WheelTimer *timer) {
+    unsigned long delta = timer->expires - wheel->now;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 &&
+           delta >= 1UL << (WHEEL_SLOT_BITS * (level + 1))) {
+        level++;
+    }
+    int slot = (timer->expires >> (WHEEL_SLOT_BITS * level)) &
+               (WHEEL_SLOTS - 1);
+
+    WheelTimer **head = &wheel->slots[level][slot];
+    timer->slot = head;
+    timer->prev = NULL;
+    timer->next = *head;
+    if (*head != NULL) {
+        (*head)->prev = timer;
+    }
+    *head = timer;
+}
+
+/*
+ * function unlink_timer(): take a timer out of the slot that holds it
+ * input:     pointer to armed timer.
+ * output:    none.
+ */
+void unlink_timer(WheelTimer *timer) {
+    if (timer->prev != NULL) {
+        timer->prev->next = timer->next;
+    } else {
+        *timer->slot = timer->next;
+    }
+    if (timer->next != NULL) {
+        timer->next->prev = timer->prev;
+    }
+}
+
+/*
+ * function schedule_timer(): arm a timer, moving it if it was armed already
+ * input:     pointer to wheel, pointer to timer, ticks from now until it
+ *   expires (at least 1, at most WHEEL_MAX_TICKS).
+ * output:    none.
+ */
+void schedule_timer(TimerWheel *wheel, WheelTimer *timer, unsigned long ticks) {
+    if (timer->armed) {
+        unlink_timer(timer);
+    }
+    if (ticks < 1) {
+        ticks = 1;
+    } else if (ticks > WHEEL_MAX_TICKS) {
+        ticks = WHEEL_MAX_TICKS;
+    }
+    timer->expires = wheel->now + ticks;
+    timer->armed = true;
+    link_timer(wheel, timer);
+}
+
+/*
+ * function cancel_timer(): disarm a timer if it is armed
+ * input:     pointer to wheel, pointer to timer.
+ * output:    none.
+ */
+void cancel_timer(TimerWheel *wheel, WheelTimer *timer) {
+    (void)wheel;
+    if (timer->armed) {
+        unlink_timer(timer);
+        timer->armed = false;
+    }
+}
+
+/*
+ * function cascade(): move the timers of a higher level slot down
+ * algorithm: relink every timer of the slot, now that the wheel has reached
+ *   the span the slot covers each lands in a lower level.
+ * input:     pointer to wheel, level and slot to empty.
+ * output:    none.
+ */
+void cascade(TimerWheel *wheel, int level, int slot) {
+    WheelTimer *timer = wheel->slots[level][slot];
+    wheel->slots[level][slot] = NULL;
+    while (timer != NULL) {
+        WheelTimer *next = timer->next;
+        link_timer(wheel, timer);
+        timer = next;
+    }
+}
+
+/*
+ * function advance_timer_wheel(): turn the wheel up to the given tick
+ * algorithm: one tick at a time, when a level's slot index wraps to 0 the
+ *   next level's current slot is cascaded down first, starting from the
+ *   highest level that wrapped. Then every timer in
+ *   the level 0 slot for the tick has expired, it is disarmed and passed to
+ *   the expire function, which may schedule it again.
+ * input:     pointer to wheel, current tick, function called per expired
+ *   timer.
+ * output:    number of timers that expired.
+ */
+int advance_timer_wheel(TimerWheel *wheel, unsigned long now,
+                        void (*expire)(WheelTimer *timer)) {
+    int expired = 0;
+    while (wheel->now != now) {
+        wheel->now++;
+        int wrapped = 0;
+        while (wrapped < WHEEL_LEVELS - 1 &&
+               ((wheel->now >> (WHEEL_SLOT_BITS * wrapped)) &
+                (WHEEL_SLOTS - 1)) == 0) {
+            wrapped++;
+        }
+        for (int level = wrapped; level > 0; level--) {
+            cascade(wheel, level,
+                    (wheel->now >> (WHEEL_SLOT_BITS * level)) &
+                        (WHEEL_SLOTS - 1));
+        }
+
+        WheelTimer **head = &wheel->slots[0][wheel->now & (WHEEL_SLOTS - 1)];
+        while (*head != NULL) {
+            WheelTimer *timer = *head;
+            *head = timer->next;
+            if (*head != NULL) {
+                (*head)->prev = NULL;
+            }
+            timer->armed = false;
+            expire(timer);
+            expired++;
+        }
+    }
+    return expired;
+}
@@ -0,0 +1,30 @@
+// Slots in each level of the wheel, a power of two
+#define WHEEL_SLOT_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_SLOT_BITS)
+#define WHEEL_LEVELS 3
+// Furthest ahead a timer can be scheduled, in ticks
+#define WHEEL_MAX_TICKS ((1UL << (WHEEL_SLOT_BITS * WHEEL_LEVELS)) - 1)
+
+// A timer linked into one slot of the wheel while it is armed
+typedef struct wheel_timer_t {
+    unsigned long expires;
+    bool armed;
+    // Head of the slot list the timer is linked into
+    struct wheel_timer_t **slot;
+    struct wheel_timer_t *prev;
+    struct wheel_timer_t *next;
+} WheelTimer;
+
+// Hierarchical timer wheel: level 0 holds timers due within WHEEL_SLOTS ticks
+// one tick per slot, each higher level covers WHEEL_SLOTS times as much and
+// its slots are cascaded down as the wheel turns
+typedef struct timer_wheel_t {
+    unsigned long now;
+    WheelTimer *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+} TimerWheel;
+
+void timer_wheel_init(TimerWheel *wheel, unsigned long now);
+void schedule_timer(TimerWheel *wheel, WheelTimer *timer, unsigned long ticks);
+void cancel_timer(TimerWheel *wheel, WheelTimer *timer);
+int advance_timer_wheel(TimerWheel *wheel, unsigned long now,
+                        void (*expire)(WheelTimer *timer));
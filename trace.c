@@ -0,0 +1,258 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "thread_buffer.h"
+#include "trace.h"
+
+// Recent spans of one thread. Only the thread writes to it, overwriting the
+// oldest span once it is full; next counts every span ever written
+typedef struct trace_ring_t {
+    ThreadBuffer link;
+    TraceEvent events[TRACE_RING_EVENTS];
+    unsigned int next;
+} TraceRing;
+
+// Whether spans are recorded, set before any thread records one
+bool trace_enabled = false;
+char *trace_directory;
+// Rings of every thread that recorded a span
+ThreadBufferList trace_rings;
+static __thread TraceRing *thread_trace = NULL;
+// Connection the calling thread is working for, and the last id handed out
+static __thread unsigned int current_connection = 0;
+unsigned int trace_connections = 0;
+// Set from a signal handler, the main thread dumps on its next tick
+volatile sig_atomic_t trace_dump_requested = 0;
+int trace_dumps = 0;
+
+// Names of span types in a dump, and of their values
+const char *trace_names[] = {"?", "accept", "queue", "auth", "move", "scores"};
+const char *trace_value_names[][2] = {{"value0", "value1"},
+                                      {"value0", "value1"},
+                                      {"value0", "value1"},
+                                      {"logged_in", "value1"},
+                                      {"option", "response"},
+                                      {"value0", "value1"}};
+
+/*
+ * function trace_start(): start recording spans
+ * algorithm: create the directory dumps are written to if needed. Rings
+ *   are only allocated once a thread records something.
+ * input:     directory for dumps.
+ * output:    1 on success, 0 on failure.
+ */
+int trace_start(char *directory) {
+    if (mkdir(directory, 0755) == -1 && errno != EEXIST) {
+        log_message(LOG_LEVEL_ERROR, "%s: %m", directory);
+        return 0;
+    }
+    trace_directory = directory;
+    trace_enabled = true;
+    return 1;
+}
+
+/*
+ * function trace_now(): start time of a span
+ * input:     none.
+ * output:    nanoseconds on the monotonic clock, 0 while tracing is off so
+ *   the span is not recorded.
+ */
+unsigned long long trace_now() {
+    if (!trace_enabled) {
+        return 0;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/*
+ * function trace_new_connection(): give a newly accepted connection an id
+ * algorithm: the calling thread works for the connection until told
+ *   otherwise with trace_set_connection().
+ * input:     none.
+ * output:    id of the connection, 0 while tracing is off.
+ */
+unsigned int trace_new_connection() {
+    if (!trace_enabled) {
+        return 0;
+    }
+    current_connection =
+        __atomic_add_fetch(&trace_connections, 1, __ATOMIC_RELAXED);
+    return current_connection;
+}
+
+/*
+ * function trace_set_connection(): set the connection the calling thread
+ *   works for, which its spans are recorded under
+ * input:     id of the connection.
+ * output:    none.
+ */
+void trace_set_connection(unsigned int connection) {
+    current_connection = connection;
+}
+
+/*
+ * function trace_connection(): connection the calling thread works for
+ * input:     none.
+ * output:    id of the connection.
+ */
+unsigned int trace_connection() { return current_connection; }
+
+/*
+ * function thread_trace_ring(): ring of the calling thread
+ * algorithm: registered on the thread's first span. Rings stay for the
+ *   life of the process.
+ * input:     none.
+ * output:    pointer to the ring, NULL if memory ran out.
+ */
+TraceRing *thread_trace_ring() {
+    if (thread_trace == NULL) {
+        thread_trace = thread_buffer_register(&trace_rings, sizeof(TraceRing));
+    }
+    return thread_trace;
+}
+
+/*
+ * function trace_span(): record a span that ends now
+ * algorithm: overwrite the oldest slot of the calling thread's ring and
+ *   publish it by advancing the count. No locks and no system calls beyond
+ *   reading the clock.
+ * input:     span type, start time from trace_now() and the span's values.
+ * output:    none.
+ */
+void trace_span(int type, unsigned long long start_ns, int value0,
+                int value1) {
+    if (start_ns == 0) {
+        return;
+    }
+    TraceRing *ring = thread_trace_ring();
+    if (ring == NULL) {
+        return;
+    }
+    unsigned int next = ring->next;
+    TraceEvent *event = &ring->events[next & (TRACE_RING_EVENTS - 1)];
+    event->start_ns = start_ns;
+    event->duration_ns = trace_now() - start_ns;
+    event->connection = current_connection;
+    event->type = type;
+    event->thread = ring->link.thread;
+    event->values[0] = value0;
+    event->values[1] = value1;
+    __atomic_store_n(&ring->next, next + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * function trace_request_dump(): ask for the rings to be dumped
+ * algorithm: only sets a flag, so it can be called from a signal handler.
+ * input:     none.
+ * output:    none.
+ */
+void trace_request_dump() { trace_dump_requested = 1; }
+
+/*
+ * function trace_dump_if_requested(): dump the rings if asked to
+ * input:     none.
+ * output:    none.
+ */
+void trace_dump_if_requested() {
+    if (trace_dump_requested) {
+        trace_dump_requested = 0;
+        trace_dump();
+    }
+}
+
+/*
+ * function write_trace_ring(): write the spans of one ring to a dump
+ * algorithm: copy what the ring holds while its thread keeps recording,
+ *   then keep only the spans that were not overwritten during the copy: the
+ *   thread may be writing the slot after the last span it published.
+ * input:     dump file, ring, scratch array of TRACE_RING_EVENTS spans,
+ *   whether a span was already written to the file.
+ * output:    number of spans written.
+ */
+int write_trace_ring(FILE *file, TraceRing *ring, TraceEvent *copy,
+                     bool first) {
+    unsigned int end = __atomic_load_n(&ring->next, __ATOMIC_ACQUIRE);
+    unsigned int count = end < TRACE_RING_EVENTS ? end : TRACE_RING_EVENTS;
+    unsigned int oldest = end - count;
+    for (unsigned int i = 0; i < count; i++) {
+        copy[i] = ring->events[(oldest + i) & (TRACE_RING_EVENTS - 1)];
+    }
+    unsigned int after = __atomic_load_n(&ring->next, __ATOMIC_ACQUIRE);
+    unsigned int overwritten = 0;
+    if (after - oldest >= TRACE_RING_EVENTS) {
+        overwritten = after - oldest - TRACE_RING_EVENTS + 1;
+    }
+
+    int written = 0;
+    for (unsigned int i = overwritten; i < count; i++) {
+        TraceEvent *event = &copy[i];
+        int type = event->type < sizeof(trace_names) / sizeof(trace_names[0])
+                       ? event->type
+                       : 0;
+        fprintf(file,
+                "%s\n{\"name\":\"%s\",\"cat\":\"session\",\"ph\":\"X\","
+                "\"ts\":%llu.%03llu,\"dur\":%llu.%03llu,\"pid\":1,\"tid\":%u,"
+                "\"args\":{\"thread\":%u,\"%s\":%d,\"%s\":%d}}",
+                first && written == 0 ? "" : ",", trace_names[type],
+                event->start_ns / 1000, event->start_ns % 1000,
+                event->duration_ns / 1000, event->duration_ns % 1000,
+                event->connection, event->thread,
+                trace_value_names[type][0], event->values[0],
+                trace_value_names[type][1], event->values[1]);
+        written++;
+    }
+    return written;
+}
+
+/*
+ * function trace_dump(): write every ring to a Chrome trace format file
+ * algorithm: one complete event per span, with the connection as its
+ *   thread id so each session gets its own row in a trace viewer. Spans
+ *   keep being recorded while the dump is written. Files are numbered
+ *   within the run.
+ * input:     none.
+ * output:    1 on success, 0 on failure.
+ */
+int trace_dump() {
+    if (!trace_enabled) {
+        return 0;
+    }
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/trace-%d-%d.json", trace_directory,
+             (int)getpid(), trace_dumps++);
+    FILE *file = fopen(path, "w");
+    TraceEvent *copy = malloc(sizeof(TraceEvent) * TRACE_RING_EVENTS);
+    if (file == NULL || copy == NULL) {
+        log_message(LOG_LEVEL_ERROR, "Couldn't dump trace to %s: %m", path);
+        if (file != NULL) {
+            fclose(file);
+        }
+        free(copy);
+        return 0;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    int spans = 0;
+    ThreadBuffer *link = thread_buffers(&trace_rings);
+    for (; link != NULL; link = link->next) {
+        spans += write_trace_ring(file, (TraceRing *)link, copy, spans == 0);
+    }
+    fprintf(file, "\n]}\n");
+    free(copy);
+    if (fclose(file) != 0) {
+        log_message(LOG_LEVEL_ERROR, "Couldn't write trace to %s: %m", path);
+        return 0;
+    }
+    log_message(LOG_LEVEL_INFO, "Wrote %d trace spans to %s.", spans, path);
+    return 1;
+}
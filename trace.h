@@ -0,0 +1,36 @@
+// Spans each thread keeps, a power of two; the oldest are overwritten
+#define TRACE_RING_EVENTS 4096
+
+// Types of span. Values of each:
+//   TRACE_ACCEPT  0, 0
+//   TRACE_QUEUE   0, 0
+//   TRACE_AUTH    1 if the client logged in, 0 otherwise; 0
+//   TRACE_MOVE    option, response (0 for hints and probabilities)
+//   TRACE_SCORES  0, 0
+#define TRACE_ACCEPT 1
+#define TRACE_QUEUE 2
+#define TRACE_AUTH 3
+#define TRACE_MOVE 4
+#define TRACE_SCORES 5
+
+// One span of work done for a connection, on the monotonic clock. Logins
+// and queue waits can last far longer than 32 bits of nanoseconds
+typedef struct trace_event_t {
+    unsigned long long start_ns;
+    unsigned long long duration_ns;
+    unsigned int connection;
+    unsigned short type;
+    unsigned short thread;
+    int values[2];
+} TraceEvent;
+
+int trace_start(char *directory);
+unsigned long long trace_now();
+unsigned int trace_new_connection();
+void trace_set_connection(unsigned int connection);
+unsigned int trace_connection();
+void trace_span(int type, unsigned long long start_ns, int value0,
+                int value1);
+void trace_request_dump();
+void trace_dump_if_requested();
+int trace_dump();
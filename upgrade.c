@@ -0,0 +1,238 @@
+#include <arpa/inet.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "multiplex.h"
+#include "logger.h"
+#include "upgrade.h"
+
+/*
+ * function upgrade_address(): fill in the Unix socket address of a path
+ * input:     pointer to address, path.
+ * output:    1 on success, 0 if the path is too long.
+ */
+int upgrade_address(struct sockaddr_un *address, char *path) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        log_message(LOG_LEVEL_ERROR, "Upgrade socket path is too long.");
+        return 0;
+    }
+    strcpy(address->sun_path, path);
+    return 1;
+}
+
+/*
+ * function upgrade_listen(): listen for a new server taking over
+ * algorithm: remove whatever was left at the path, a socket of a server
+ *   that has handed over already, and listen there.
+ * input:     path of the Unix socket.
+ * output:    listening socket file descriptor, or -1 on failure.
+ */
+int upgrade_listen(char *path) {
+    struct sockaddr_un address;
+    if (!upgrade_address(&address, path)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        log_message(LOG_LEVEL_ERROR, "upgrade socket: %m");
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) == -1 ||
+        listen(fd, 1) == -1) {
+        log_message(LOG_LEVEL_ERROR, "upgrade listen: %m");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * function upgrade_connect(): ask a running server to hand over to us
+ * algorithm: connect to its upgrade socket and send our version.
+ * input:     path of the Unix socket.
+ * output:    connected socket file descriptor, or -1 if no server answered.
+ */
+int upgrade_connect(char *path) {
+    struct sockaddr_un address;
+    if (!upgrade_address(&address, path)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    int version = htonl(UPGRADE_VERSION);
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == -1 ||
+        send(fd, &version, sizeof(version), MSG_NOSIGNAL) != sizeof(version)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * function send_upgrade_state(): hand the server's state to its successor
+ * algorithm: send the length of the state and the number of descriptors,
+ *   then the state, then the descriptors in batches with SCM_RIGHTS. Wait
+ *   for the successor to acknowledge it has everything.
+ * input:     connected upgrade socket, state, descriptors and their count.
+ * output:    1 once the successor has taken over, 0 on failure.
+ */
+int send_upgrade_state(int fd, MuxBuffer *state, int *fds, int count) {
+    int header[2] = {htonl((int)state->len), htonl(count)};
+    if (send(fd, header, sizeof(header), MSG_NOSIGNAL) != sizeof(header) ||
+        mux_flush(fd, state) == 0) {
+        return 0;
+    }
+
+    for (int sent = 0; sent < count; sent += UPGRADE_FDS_PER_MESSAGE) {
+        int batch = count - sent;
+        if (batch > UPGRADE_FDS_PER_MESSAGE) {
+            batch = UPGRADE_FDS_PER_MESSAGE;
+        }
+        char control[CMSG_SPACE(sizeof(int) * UPGRADE_FDS_PER_MESSAGE)];
+        char byte = 0;
+        struct iovec data = {&byte, sizeof(byte)};
+        struct msghdr message = {0};
+        message.msg_iov = &data;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = CMSG_SPACE(sizeof(int) * batch);
+
+        struct cmsghdr *rights = CMSG_FIRSTHDR(&message);
+        rights->cmsg_level = SOL_SOCKET;
+        rights->cmsg_type = SCM_RIGHTS;
+        rights->cmsg_len = CMSG_LEN(sizeof(int) * batch);
+        memcpy(CMSG_DATA(rights), &fds[sent], sizeof(int) * batch);
+        if (sendmsg(fd, &message, MSG_NOSIGNAL) != sizeof(byte)) {
+            log_message(LOG_LEVEL_ERROR, "upgrade sendmsg: %m");
+            return 0;
+        }
+    }
+
+    char ack;
+    return recv(fd, &ack, sizeof(ack), MSG_WAITALL) == sizeof(ack);
+}
+
+/*
+ * function recv_upgrade_state(): take over the state of the old server
+ * algorithm: the counterpart of send_upgrade_state(), acknowledging once
+ *   every descriptor has arrived. The sizes in the header are checked
+ *   before anything is allocated for them.
+ * input:     connected upgrade socket, buffer for the state, where to store
+ *   the allocated descriptor array and its count.
+ * output:    1 on success, 0 on failure.
+ */
+int recv_upgrade_state(int fd, MuxBuffer *state, int **fds, int *count) {
+    int header[2];
+    if (recv(fd, header, sizeof(header), MSG_WAITALL) != sizeof(header)) {
+        return 0;
+    }
+    int len = ntohl(header[0]);
+    *count = ntohl(header[1]);
+    if (len < 0 || len > UPGRADE_MAX_STATE_BYTES || *count < 0 ||
+        *count > UPGRADE_MAX_FDS) {
+        *count = 0;
+        return 0;
+    }
+    *fds = malloc(sizeof(int) * (*count > 0 ? *count : 1));
+    unsigned char *at = mux_append(state, len);
+    if (*fds == NULL || at == NULL || recv(fd, at, len, MSG_WAITALL) != len) {
+        return 0;
+    }
+
+    for (int received = 0; received < *count;) {
+        char control[CMSG_SPACE(sizeof(int) * UPGRADE_FDS_PER_MESSAGE)];
+        char byte;
+        struct iovec data = {&byte, sizeof(byte)};
+        struct msghdr message = {0};
+        message.msg_iov = &data;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &message, MSG_WAITALL) != sizeof(byte)) {
+            return 0;
+        }
+
+        struct cmsghdr *rights = CMSG_FIRSTHDR(&message);
+        if (rights == NULL || rights->cmsg_type != SCM_RIGHTS) {
+            return 0;
+        }
+        int batch = (rights->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        if (batch > *count - received) {
+            return 0;
+        }
+        memcpy(&(*fds)[received], CMSG_DATA(rights), sizeof(int) * batch);
+        received += batch;
+    }
+
+    char ack = 1;
+    return send(fd, &ack, sizeof(ack), MSG_NOSIGNAL) == sizeof(ack);
+}
+
+/*
+ * function put_upgrade_int(): append an int in network byte order
+ * input:     state, value.
+ * output:    1 on success, 0 if out of memory.
+ */
+int put_upgrade_int(MuxBuffer *state, int value) {
+    unsigned char *at = mux_append(state, sizeof(int));
+    if (at == NULL) {
+        return 0;
+    }
+    mux_put_int(at, value);
+    return 1;
+}
+
+/*
+ * function put_upgrade_bytes(): append raw bytes
+ * input:     state, bytes and their length.
+ * output:    1 on success, 0 if out of memory.
+ */
+int put_upgrade_bytes(MuxBuffer *state, void *bytes, size_t len) {
+    unsigned char *at = mux_append(state, len);
+    if (at == NULL) {
+        return 0;
+    }
+    memcpy(at, bytes, len);
+    return 1;
+}
+
+/*
+ * function get_upgrade_int(): read the next int of a state
+ * input:     reader.
+ * output:    value, 0 once the reader has overrun.
+ */
+int get_upgrade_int(UpgradeReader *reader) {
+    if (!reader->ok || reader->len - reader->offset < sizeof(int)) {
+        reader->ok = false;
+        return 0;
+    }
+    int value = mux_get_int(reader->data + reader->offset);
+    reader->offset += sizeof(int);
+    return value;
+}
+
+/*
+ * function get_upgrade_bytes(): read the next raw bytes of a state
+ * algorithm: on overrun the bytes are zeroed and the reader marked bad.
+ * input:     reader, destination and length.
+ * output:    none.
+ */
+void get_upgrade_bytes(UpgradeReader *reader, void *bytes, size_t len) {
+    if (!reader->ok || reader->len - reader->offset < len) {
+        reader->ok = false;
+        memset(bytes, 0, len);
+        return;
+    }
+    memcpy(bytes, reader->data + reader->offset, len);
+    reader->offset += len;
+}
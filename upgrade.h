@@ -0,0 +1,29 @@
+// Sent by a new server on connecting, the old one only hands over to the
+// same version
+#define UPGRADE_VERSION 3
+// Longest the old server waits for its connections to reach a point where
+// they can be handed over
+#define UPGRADE_PARK_MS 500
+// File descriptors passed per message, below the kernel's SCM_MAX_FD
+#define UPGRADE_FDS_PER_MESSAGE 200
+// Largest state and number of descriptors a new server accepts, a header
+// claiming more is taken as corrupt rather than allocated for
+#define UPGRADE_MAX_STATE_BYTES (256 * 1024 * 1024)
+#define UPGRADE_MAX_FDS 65536
+
+// Reads values back out of a received state, ok is cleared on overrun
+typedef struct upgrade_reader_t {
+    unsigned char *data;
+    size_t len;
+    size_t offset;
+    bool ok;
+} UpgradeReader;
+
+int upgrade_listen(char *path);
+int upgrade_connect(char *path);
+int send_upgrade_state(int fd, MuxBuffer *state, int *fds, int count);
+int recv_upgrade_state(int fd, MuxBuffer *state, int **fds, int *count);
+int put_upgrade_int(MuxBuffer *state, int value);
+int put_upgrade_bytes(MuxBuffer *state, void *bytes, size_t len);
+int get_upgrade_int(UpgradeReader *reader);
+void get_upgrade_bytes(UpgradeReader *reader, void *bytes, size_t len);
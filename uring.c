@@ -0,0 +1,487 @@
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "uring.h"
+
+/*
+ * function uring_enter(): submit queued requests and wait for completions
+ * algorithm: io_uring_enter with an optional timeout passed as an extended
+ *   argument. Requests the kernel took are removed from to_submit.
+ * input:     pointer to ring, completions to wait for, timeout in
+ *   milliseconds (-1 to wait without one).
+ * output:    0 on success, -1 with errno set (ETIME on timeout).
+ */
+int uring_enter(Uring *ring, unsigned int min_complete, int timeout_ms) {
+    struct __kernel_timespec timeout = {timeout_ms / 1000,
+                                        (timeout_ms % 1000) * 1000000L};
+    struct io_uring_getevents_arg arg = {0, _NSIG / 8, 0, 0};
+    if (timeout_ms >= 0) {
+        arg.ts = (unsigned long)&timeout;
+    }
+    unsigned int flags = IORING_ENTER_EXT_ARG;
+    if (min_complete > 0) {
+        flags |= IORING_ENTER_GETEVENTS;
+    }
+    int submitted = syscall(__NR_io_uring_enter, ring->ring_fd, ring->to_submit,
+                            min_complete, flags, &arg, sizeof(arg));
+    if (submitted < 0) {
+        return -1;
+    }
+    ring->to_submit -= submitted;
+    return 0;
+}
+
+/*
+ * function get_sqe(): take the next free submission queue entry
+ * algorithm: submit what is queued first if the queue is full. The entry is
+ *   zeroed and only becomes visible to the kernel through push_sqe().
+ * input:     pointer to ring.
+ * output:    entry to fill in.
+ */
+struct io_uring_sqe *get_sqe(Uring *ring) {
+    unsigned int tail = *ring->sq_tail;
+    while (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >=
+           ring->sq_entries) {
+        uring_enter(ring, 0, -1);
+    }
+    struct io_uring_sqe *sqe = &ring->sqes[tail & ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+/*
+ * function push_sqe(): hand the entry from get_sqe() to the kernel
+ * input:     pointer to ring.
+ * output:    none.
+ */
+void push_sqe(Uring *ring) {
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+}
+
+/*
+ * function recycle_buffer(): give a receive buffer back to the kernel
+ * input:     pointer to ring, buffer id.
+ * output:    none.
+ */
+void recycle_buffer(Uring *ring, unsigned short id) {
+    struct io_uring_buf *buf =
+        &ring->buf_ring->bufs[ring->buf_tail & (URING_RECV_BUFFERS - 1)];
+    buf->addr = (unsigned long)&ring->recv_buffers[id * URING_RECV_BUFFER_BYTES];
+    buf->len = URING_RECV_BUFFER_BYTES;
+    buf->bid = id;
+    ring->buf_tail++;
+    __atomic_store_n(&ring->buf_ring->tail, ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+/*
+ * function uring_init(): set up a ring with its receive and send buffers
+ * algorithm: io_uring_setup, map the queues, fill the sqe index array in
+ *   order once, and register the provided receive buffers as a buffer ring.
+ *   Kernels without the extended wait argument or buffer rings are refused.
+ * input:     pointer to ring.
+ * output:    1 on success, 0 if io_uring can't be used (errno is set).
+ */
+int uring_init(Uring *ring) {
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->ring_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (ring->ring_fd < 0) {
+        return 0;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+        !(params.features & IORING_FEAT_EXT_ARG)) {
+        close(ring->ring_fd);
+        errno = ENOSYS;
+        return 0;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes +
+                     params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->ring_size = sq_size > cq_size ? sq_size : cq_size;
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->ring_memory =
+        mmap(NULL, ring->ring_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->ring_fd,
+                      IORING_OFF_SQES);
+    size_t buf_ring_size = URING_RECV_BUFFERS * sizeof(struct io_uring_buf);
+    ring->buf_ring = mmap(NULL, buf_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ring->recv_buffers = malloc(URING_RECV_BUFFERS * URING_RECV_BUFFER_BYTES);
+    ring->send_buffers[0] = malloc(URING_SEND_BYTES);
+    ring->send_buffers[1] = malloc(URING_SEND_BYTES);
+    if (ring->ring_memory == MAP_FAILED || ring->sqes == MAP_FAILED ||
+        ring->buf_ring == MAP_FAILED || ring->recv_buffers == NULL ||
+        ring->send_buffers[0] == NULL || ring->send_buffers[1] == NULL) {
+        uring_exit(ring);
+        errno = ENOMEM;
+        return 0;
+    }
+
+    unsigned char *memory = ring->ring_memory;
+    ring->sq_head = (unsigned int *)(memory + params.sq_off.head);
+    ring->sq_tail = (unsigned int *)(memory + params.sq_off.tail);
+    ring->sq_mask = *(unsigned int *)(memory + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    unsigned int *sq_array = (unsigned int *)(memory + params.sq_off.array);
+    for (unsigned int i = 0; i < params.sq_entries; i++) {
+        sq_array[i] = i;
+    }
+    ring->cq_head = (unsigned int *)(memory + params.cq_off.head);
+    ring->cq_tail = (unsigned int *)(memory + params.cq_off.tail);
+    ring->cq_mask = *(unsigned int *)(memory + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(memory + params.cq_off.cqes);
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)ring->buf_ring;
+    reg.ring_entries = URING_RECV_BUFFERS;
+    reg.bgid = URING_BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, ring->ring_fd,
+                IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        int error = errno;
+        uring_exit(ring);
+        errno = error;
+        return 0;
+    }
+    for (unsigned short id = 0; id < URING_RECV_BUFFERS; id++) {
+        recycle_buffer(ring, id);
+    }
+    return 1;
+}
+
+/*
+ * function uring_exit(): close a ring and free its buffers
+ * algorithm: any connection must have been detached first.
+ * input:     pointer to ring.
+ * output:    none.
+ */
+void uring_exit(Uring *ring) {
+    if (ring->ring_memory != NULL && ring->ring_memory != MAP_FAILED) {
+        munmap(ring->ring_memory, ring->ring_size);
+    }
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->buf_ring != NULL && ring->buf_ring != MAP_FAILED) {
+        munmap(ring->buf_ring,
+               URING_RECV_BUFFERS * sizeof(struct io_uring_buf));
+    }
+    free(ring->recv_buffers);
+    free(ring->send_buffers[0]);
+    free(ring->send_buffers[1]);
+    close(ring->ring_fd);
+    memset(ring, 0, sizeof(*ring));
+    ring->ring_fd = -1;
+    ring->fd = -1;
+}
+
+/*
+ * function finish_send(): account for the completion of a send
+ * algorithm: a send cut short is finished with blocking sends, so bytes
+ *   staged after it can never overtake it. A failed send marks the
+ *   connection closed.
+ * input:     pointer to ring, result of the send.
+ * output:    none.
+ */
+void finish_send(Uring *ring, int result) {
+    unsigned char *data = ring->send_buffers[!ring->staged_buffer];
+    size_t len = ring->in_flight_len;
+    ring->in_flight_len = 0;
+    if (result < 0) {
+        ring->closed = true;
+        return;
+    }
+    for (size_t sent = result; sent < len;) {
+        ssize_t more = send(ring->fd, data + sent, len - sent, MSG_NOSIGNAL);
+        if (more < 0 && errno != EINTR) {
+            ring->closed = true;
+            return;
+        }
+        sent += more > 0 ? more : 0;
+    }
+}
+
+/*
+ * function reap_completions(): handle every completion posted so far
+ * algorithm: received data is queued as a chunk of its provided buffer. A
+ *   recv completion without IORING_CQE_F_MORE means the multishot recv has
+ *   stopped: at the end of the stream or on an error the connection is
+ *   marked closed, when it ran out of buffers or was cancelled it is simply
+ *   armed again later. Needs no system call.
+ * input:     pointer to ring.
+ * output:    none.
+ */
+void reap_completions(Uring *ring) {
+    unsigned int head = *ring->cq_head;
+    unsigned int tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+        if (cqe->user_data == URING_SEND) {
+            finish_send(ring, cqe->res);
+        } else if (cqe->user_data == URING_RECV) {
+            if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+                int slot =
+                    (ring->chunk_head + ring->num_chunks) % URING_RECV_BUFFERS;
+                ring->chunks[slot].id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+                ring->chunks[slot].offset = 0;
+                ring->chunks[slot].len = cqe->res;
+                ring->num_chunks++;
+            } else if (cqe->res != -ENOBUFS && cqe->res != -ECANCELED) {
+                ring->closed = true;
+            }
+            if (!(cqe->flags & IORING_CQE_F_MORE)) {
+                ring->receiving = false;
+            }
+        }
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/*
+ * function queue_send(): queue the staged replies as one send
+ * algorithm: wait for the send in flight to complete first, then swap the
+ *   staging buffers so new replies can be staged while this one is sent.
+ *   The send is only queued, it goes to the kernel with the next enter.
+ * input:     pointer to ring.
+ * output:    none.
+ */
+void queue_send(Uring *ring) {
+    while (ring->in_flight_len > 0) {
+        uring_enter(ring, 1, -1);
+        reap_completions(ring);
+    }
+    if (ring->staged_len == 0 || ring->closed) {
+        ring->staged_len = 0;
+        return;
+    }
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = ring->fd;
+    sqe->addr = (unsigned long)ring->send_buffers[ring->staged_buffer];
+    sqe->len = ring->staged_len;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->user_data = URING_SEND;
+    push_sqe(ring);
+    ring->in_flight_len = ring->staged_len;
+    ring->staged_buffer = !ring->staged_buffer;
+    ring->staged_len = 0;
+}
+
+/*
+ * function queue_recv(): arm the multishot recv of the connection
+ * algorithm: the kernel picks a provided buffer for each segment that
+ *   arrives and posts a completion for it, until it runs out of buffers.
+ * input:     pointer to ring.
+ * output:    none.
+ */
+void queue_recv(Uring *ring) {
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = ring->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = URING_RECV;
+    push_sqe(ring);
+    ring->receiving = true;
+}
+
+/*
+ * function uring_attach(): start serving a connection from a ring
+ * input:     pointer to ring, socket file descriptor.
+ * output:    none.
+ */
+void uring_attach(Uring *ring, int fd) {
+    ring->fd = fd;
+    ring->closed = false;
+}
+
+/*
+ * function uring_stop_receiving(): cancel the multishot recv
+ * algorithm: queue a cancel and wait until the recv has posted its last
+ *   completion. Bytes it received are kept for uring_read().
+ * input:     pointer to ring.
+ * output:    none.
+ */
+void uring_stop_receiving(Uring *ring) {
+    if (!ring->receiving) {
+        return;
+    }
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = URING_RECV;
+    sqe->user_data = URING_CANCEL;
+    push_sqe(ring);
+    while (ring->receiving) {
+        uring_enter(ring, 1, -1);
+        reap_completions(ring);
+    }
+}
+
+/*
+ * function uring_detach(): stop serving a connection from a ring
+ * algorithm: send every staged reply and wait for it, cancel the recv and
+ *   hand back bytes that were received but not read, dropping any that do
+ *   not fit. The connection can be used with plain socket calls afterwards.
+ * input:     pointer to ring, buffer for unread bytes and its size.
+ * output:    number of unread bytes copied.
+ */
+size_t uring_detach(Uring *ring, void *leftover, size_t max) {
+    if (ring->fd == -1) {
+        return 0;
+    }
+    uring_flush(ring);
+    uring_stop_receiving(ring);
+    size_t copied = uring_read(ring, leftover, max);
+    // Whatever did not fit is dropped
+    while (ring->num_chunks > 0) {
+        recycle_buffer(ring, ring->chunks[ring->chunk_head].id);
+        ring->chunk_head = (ring->chunk_head + 1) % URING_RECV_BUFFERS;
+        ring->num_chunks--;
+    }
+    ring->fd = -1;
+    return copied;
+}
+
+/*
+ * function uring_pending(): number of received bytes not read yet
+ * input:     pointer to ring.
+ * output:    byte count.
+ */
+size_t uring_pending(Uring *ring) {
+    reap_completions(ring);
+    size_t pending = 0;
+    for (int i = 0; i < ring->num_chunks; i++) {
+        UringChunk *chunk =
+            &ring->chunks[(ring->chunk_head + i) % URING_RECV_BUFFERS];
+        pending += chunk->len - chunk->offset;
+    }
+    return pending;
+}
+
+/*
+ * function uring_read(): read bytes that have already been received
+ * algorithm: copy from the oldest chunks, giving each provided buffer back
+ *   to the kernel once it has been read. Needs no system call.
+ * input:     pointer to ring, buffer and the most bytes to read.
+ * output:    number of bytes read, 0 if nothing was waiting.
+ */
+size_t uring_read(Uring *ring, void *buffer, size_t len) {
+    reap_completions(ring);
+    size_t copied = 0;
+    while (copied < len && ring->num_chunks > 0) {
+        UringChunk *chunk = &ring->chunks[ring->chunk_head];
+        size_t available = chunk->len - chunk->offset;
+        size_t take = len - copied < available ? len - copied : available;
+        memcpy((char *)buffer + copied,
+               &ring->recv_buffers[chunk->id * URING_RECV_BUFFER_BYTES +
+                                   chunk->offset],
+               take);
+        copied += take;
+        chunk->offset += take;
+        if (chunk->offset == chunk->len) {
+            recycle_buffer(ring, chunk->id);
+            ring->chunk_head = (ring->chunk_head + 1) % URING_RECV_BUFFERS;
+            ring->num_chunks--;
+        }
+    }
+    return copied;
+}
+
+/*
+ * function uring_wait(): wait for input on the attached connection
+ * algorithm: if nothing was received yet, queue the staged replies, arm the
+ *   recv if it stopped and make one io_uring_enter that submits both and
+ *   waits for data or the timeout. Input already received returns at once,
+ *   so pipelined commands cost no system calls and their replies pile up
+ *   into one send.
+ * input:     pointer to ring, timeout in milliseconds.
+ * output:    1 if input is waiting, 0 on timeout, -1 if the connection
+ *   closed.
+ */
+int uring_wait(Uring *ring, int timeout_ms) {
+    reap_completions(ring);
+    if (ring->num_chunks > 0) {
+        return 1;
+    }
+    if (ring->closed) {
+        return -1;
+    }
+    queue_send(ring);
+    if (!ring->receiving) {
+        queue_recv(ring);
+    }
+    unsigned int wait_for = ring->in_flight_len > 0 ? 2 : 1;
+    if (uring_enter(ring, wait_for, timeout_ms) == -1 && errno != ETIME &&
+        errno != EINTR) {
+        log_message(LOG_LEVEL_ERROR, "io_uring_enter: %m");
+        ring->closed = true;
+    }
+    reap_completions(ring);
+    if (ring->num_chunks > 0) {
+        return 1;
+    }
+    return ring->closed ? -1 : 0;
+}
+
+/*
+ * function uring_send(): stage bytes to send on the attached connection
+ * algorithm: copy them after the replies already staged. When the staging
+ *   buffer is full it is sent straight away, and data too large to ever fit
+ *   is sent with blocking sends once everything before it has gone out.
+ * input:     pointer to ring, data and its length.
+ * output:    1 on success, 0 if the connection failed.
+ */
+int uring_send(Uring *ring, void *data, size_t len) {
+    if (ring->staged_len + len > URING_SEND_BYTES) {
+        queue_send(ring);
+        uring_enter(ring, 0, -1);
+    }
+    if (len > URING_SEND_BYTES) {
+        uring_flush(ring);
+        for (size_t sent = 0; sent < len && !ring->closed;) {
+            ssize_t more =
+                send(ring->fd, (char *)data + sent, len - sent, MSG_NOSIGNAL);
+            if (more < 0 && errno != EINTR) {
+                ring->closed = true;
+            }
+            sent += more > 0 ? more : 0;
+        }
+        return !ring->closed;
+    }
+    memcpy(ring->send_buffers[ring->staged_buffer] + ring->staged_len, data,
+           len);
+    ring->staged_len += len;
+    return !ring->closed;
+}
+
+/*
+ * function uring_flush(): send every staged reply and wait until it has gone
+ * input:     pointer to ring.
+ * output:    1 on success, 0 if the connection failed.
+ */
+int uring_flush(Uring *ring) {
+    queue_send(ring);
+    while (ring->in_flight_len > 0) {
+        uring_enter(ring, 1, -1);
+        reap_completions(ring);
+    }
+    return !ring->closed;
+}
@@ -0,0 +1,73 @@
+// Entries in the submission queue of each ring
+#define URING_ENTRIES 32
+// Provided receive buffers per ring, a power of two, and the size of each
+#define URING_RECV_BUFFERS 16
+#define URING_RECV_BUFFER_BYTES 2048
+// Buffer group the receive buffers are registered under
+#define URING_BUFFER_GROUP 0
+// Bytes of replies that can be staged while an earlier send is in flight
+#define URING_SEND_BYTES 16384
+
+// Tags of the requests a ring submits, as user_data
+#define URING_RECV 1
+#define URING_SEND 2
+#define URING_CANCEL 3
+
+// Received bytes held in one provided buffer
+typedef struct uring_chunk_t {
+    unsigned short id;
+    unsigned int offset;
+    unsigned int len;
+} UringChunk;
+
+// An io_uring driving one connection at a time for the thread that owns it.
+// Receives arrive through a multishot recv into the provided buffers, replies
+// are staged and sent together when the thread next waits for input
+typedef struct uring_t {
+    int ring_fd;
+    // Submission queue, shared with the kernel
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int sq_mask;
+    unsigned int sq_entries;
+    struct io_uring_sqe *sqes;
+    unsigned int to_submit;
+    // Completion queue, shared with the kernel
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe *cqes;
+    // Mappings to undo when the ring is closed
+    void *ring_memory;
+    size_t ring_size;
+    size_t sqes_size;
+    // Provided receive buffers and the ring handing them to the kernel
+    struct io_uring_buf_ring *buf_ring;
+    unsigned char *recv_buffers;
+    unsigned short buf_tail;
+    // Connection attached to the ring, -1 if none
+    int fd;
+    // Whether the multishot recv is armed, and whether the connection closed
+    bool receiving;
+    bool closed;
+    // Received bytes not read yet, oldest first
+    UringChunk chunks[URING_RECV_BUFFERS];
+    int chunk_head;
+    int num_chunks;
+    // Replies staged for the next send, and the buffer of the one in flight
+    unsigned char *send_buffers[2];
+    int staged_buffer;
+    size_t staged_len;
+    size_t in_flight_len;
+} Uring;
+
+int uring_init(Uring *ring);
+void uring_exit(Uring *ring);
+void uring_attach(Uring *ring, int fd);
+size_t uring_detach(Uring *ring, void *leftover, size_t max);
+void uring_stop_receiving(Uring *ring);
+size_t uring_pending(Uring *ring);
+size_t uring_read(Uring *ring, void *buffer, size_t len);
+int uring_wait(Uring *ring, int timeout_ms);
+int uring_send(Uring *ring, void *data, size_t len);
+int uring_flush(Uring *ring);
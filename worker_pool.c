@@ -0,0 +1,194 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "worker_pool.h"
+
+// Pool threads and the queue of batches that still have unclaimed jobs
+pthread_t *pool_threads = NULL;
+int pool_size = 0;
+JobBatch *batch_head = NULL;
+JobBatch *batch_tail = NULL;
+pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER;
+bool pool_stopping = false;
+
+/*
+ * function claim_job(): claim the next unstarted job of a batch
+ * algorithm: atomically increment the batch's next index.
+ * input:     pointer to batch.
+ * output:    job index, or -1 if every job has been claimed.
+ */
+int claim_job(JobBatch *batch) {
+    int index = __atomic_fetch_add(&batch->next_index, 1, __ATOMIC_RELAXED);
+    return index < batch->count ? index : -1;
+}
+
+/*
+ * function finish_job(): record that a job of a batch has completed
+ * algorithm: increment the finished count and wake the submitter once every
+ *   job is done.
+ * input:     pointer to batch.
+ * output:    none.
+ */
+void finish_job(JobBatch *batch) {
+    pthread_mutex_lock(&batch->mutex);
+    if (++batch->finished == batch->count) {
+        pthread_cond_signal(&batch->done);
+    }
+    pthread_mutex_unlock(&batch->mutex);
+}
+
+/*
+ * function pool_loop(): body of each pool thread
+ * algorithm: wait for a batch, claim jobs from the head batch and run them.
+ *   A batch is unlinked from the queue once all its jobs are claimed.
+ * input:     none.
+ * output:    none.
+ */
+void *pool_loop(void *data) {
+    (void)data;
+    pthread_mutex_lock(&pool_mutex);
+    while (!pool_stopping) {
+        JobBatch *batch = batch_head;
+        if (batch == NULL) {
+            pthread_cond_wait(&pool_work, &pool_mutex);
+            continue;
+        }
+
+        int index = claim_job(batch);
+        if (index == -1) {
+            // Fully claimed, stop handing it out
+            batch_head = batch->next;
+            if (batch_head == NULL) {
+                batch_tail = NULL;
+            }
+            continue;
+        }
+
+        pthread_mutex_unlock(&pool_mutex);
+        batch->run(batch->arg, index);
+        finish_job(batch);
+        pthread_mutex_lock(&pool_mutex);
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    return NULL;
+}
+
+/*
+ * function worker_pool_start(): start the shared pool of worker threads
+ * algorithm: create the requested number of threads running pool_loop.
+ * input:     number of threads.
+ * output:    none.
+ */
+void worker_pool_start(int num_threads) {
+    pool_threads = malloc(sizeof(pthread_t) * num_threads);
+    pool_stopping = false;
+    for (int i = 0; i < num_threads; i++) {
+        pthread_create(&pool_threads[i], NULL, pool_loop, NULL);
+    }
+    pool_size = num_threads;
+}
+
+/*
+ * function worker_pool_stop(): stop and join all pool threads
+ * algorithm: set the stopping flag, wake every thread and join them.
+ *   Batches still queued are finished by their submitters.
+ * input:     none.
+ * output:    none.
+ */
+void worker_pool_stop() {
+    pthread_mutex_lock(&pool_mutex);
+    pool_stopping = true;
+    pthread_cond_broadcast(&pool_work);
+    pthread_mutex_unlock(&pool_mutex);
+
+    for (int i = 0; i < pool_size; i++) {
+        pthread_join(pool_threads[i], NULL);
+    }
+    free(pool_threads);
+    pool_threads = NULL;
+    pool_size = 0;
+}
+
+/*
+ * function worker_pool_size(): number of threads in the pool
+ * input:     none.
+ * output:    thread count, 0 if the pool was not started.
+ */
+int worker_pool_size() { return pool_size; }
+
+/*
+ * function worker_pool_run(): run a batch of jobs across the pool
+ * algorithm: queue the batch for the pool threads, then claim and run jobs on
+ *   the calling thread as well so the batch completes even when every pool
+ *   thread is busy (or no pool was started). Blocks until all jobs finished.
+ * input:     job function, its argument and the number of jobs.
+ * output:    none.
+ */
+void worker_pool_run(void (*run)(void *arg, int index), void *arg, int count) {
+    if (count <= 0) {
+        return;
+    }
+
+    JobBatch batch;
+    batch.run = run;
+    batch.arg = arg;
+    batch.count = count;
+    batch.next_index = 0;
+    batch.finished = 0;
+    batch.next = NULL;
+    pthread_mutex_init(&batch.mutex, NULL);
+    pthread_cond_init(&batch.done, NULL);
+
+    bool queued = false;
+    if (count > 1) {
+        pthread_mutex_lock(&pool_mutex);
+        if (pool_size > 0 && !pool_stopping) {
+            if (batch_tail == NULL) {
+                batch_head = &batch;
+            } else {
+                batch_tail->next = &batch;
+            }
+            batch_tail = &batch;
+            queued = true;
+            pthread_cond_broadcast(&pool_work);
+        }
+        pthread_mutex_unlock(&pool_mutex);
+    }
+
+    int index;
+    while ((index = claim_job(&batch)) != -1) {
+        run(arg, index);
+        finish_job(&batch);
+    }
+
+    pthread_mutex_lock(&batch.mutex);
+    while (batch.finished < batch.count) {
+        pthread_cond_wait(&batch.done, &batch.mutex);
+    }
+    pthread_mutex_unlock(&batch.mutex);
+
+    // Make sure no pool thread can still reach the batch before it goes away
+    if (queued) {
+        pthread_mutex_lock(&pool_mutex);
+        JobBatch *prev = NULL;
+        for (JobBatch *node = batch_head; node != NULL; node = node->next) {
+            if (node == &batch) {
+                if (prev == NULL) {
+                    batch_head = node->next;
+                } else {
+                    prev->next = node->next;
+                }
+                if (batch_tail == node) {
+                    batch_tail = prev;
+                }
+                break;
+            }
+            prev = node;
+        }
+        pthread_mutex_unlock(&pool_mutex);
+    }
+    pthread_mutex_destroy(&batch.mutex);
+    pthread_cond_destroy(&batch.done);
+}
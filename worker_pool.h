@@ -0,0 +1,16 @@
+// A batch of independent jobs, run(arg, index) is called once per index
+typedef struct job_batch_t {
+    void (*run)(void *arg, int index);
+    void *arg;
+    int count;
+    int next_index;
+    int finished;
+    pthread_mutex_t mutex;
+    pthread_cond_t done;
+    struct job_batch_t *next;
+} JobBatch;
+
+void worker_pool_start(int num_threads);
+void worker_pool_stop();
+int worker_pool_size();
+void worker_pool_run(void (*run)(void *arg, int index), void *arg, int count);